@@ -12,6 +12,9 @@
 #include <functional>
 #include <set>
 #include <memory>
+#include <random>
+#include <algorithm>
+#include <chrono>
 
 #include <boost/optional.hpp>
 #include <boost/lexical_cast.hpp>
@@ -25,6 +28,7 @@
 
 #if !defined(MQTT_NO_TLS)
 #include <boost/asio/ssl.hpp>
+#include <mqtt/tls_session_cache.hpp>
 #endif // !defined(MQTT_NO_TLS)
 
 #if defined(MQTT_USE_WS)
@@ -33,6 +37,8 @@
 
 #include <mqtt/endpoint.hpp>
 #include <mqtt/null_strand.hpp>
+#include <mqtt/resolver_cache.hpp>
+#include <mqtt/socket_options.hpp>
 
 namespace mqtt {
 
@@ -52,6 +58,7 @@ public:
     using pubrec_handler = typename base::pubrec_handler;
     using pubcomp_handler = typename base::pubcomp_handler;
     using publish_handler = typename base::publish_handler;
+    using publish_ref_handler = typename base::publish_ref_handler;
     using suback_handler = typename base::suback_handler;
     using unsuback_handler = typename base::unsuback_handler;
     using pingresp_handler = typename base::pingresp_handler;
@@ -76,6 +83,30 @@ public:
     friend std::shared_ptr<client<as::ip::tcp::socket, null_strand>>
     make_client_no_strand(as::io_service& ios, std::string host, std::string port);
 
+#if defined(MQTT_USE_IO_URING)
+    /**
+     * @breif Create no tls io_uring client with strand.
+     *        boost::system::system_error is thrown if io_uring is not available.
+     * @param ios io_service object.
+     * @param host hostname
+     * @param port port number
+     * @return client object
+     */
+    friend std::shared_ptr<client<io_uring_socket, as::io_service::strand>>
+    make_client_io_uring(as::io_service& ios, std::string host, std::string port);
+
+    /**
+     * @breif Create no tls io_uring client without strand.
+     *        boost::system::system_error is thrown if io_uring is not available.
+     * @param ios io_service object.
+     * @param host hostname
+     * @param port port number
+     * @return client object
+     */
+    friend std::shared_ptr<client<io_uring_socket, null_strand>>
+    make_client_no_strand_io_uring(as::io_service& ios, std::string host, std::string port);
+#endif // defined(MQTT_USE_IO_URING)
+
 #if defined(MQTT_USE_WS)
     /**
      * @breif Create no tls websocket client with strand.
@@ -160,6 +191,32 @@ public:
     void set_client_key_file(std::string file) {
         ctx_.use_private_key_file(std::move(file), as::ssl::context::pem);
     }
+
+    /**
+     * @breif Set the TLS session cache
+     * The session that is established with the broker is stored to the cache, and the
+     * following connects to the same host and port resume it instead of the full handshake.
+     * The cache can be shared with other clients.
+     * @param cache TLS session cache. nullptr disables the resumption. The default is nullptr.
+     */
+    void set_tls_session_cache(std::shared_ptr<tls_session_cache> cache) {
+        if (cache) {
+            tls_session_cache::enable(ctx_);
+            tls_session_ = std::make_shared<tls_session_cache::binding>(std::move(cache), host_ + ':' + port_);
+        }
+        else {
+            tls_session_.reset();
+        }
+    }
+
+    /**
+     * @breif Check whether the TLS session of the current connection has been resumed.
+     * @return If the session has been resumed then true, otherwise false.
+     */
+    bool tls_session_reused() const {
+        auto ssl = native_ssl(base::socket());
+        return ssl && SSL_session_reused(ssl);
+    }
 #endif // !defined(MQTT_NO_TLS)
 
     /**
@@ -198,40 +255,60 @@ public:
         set_keep_alive_sec_ping_ms(keep_alive_sec, keep_alive_sec * 1000 / 2);
     }
 
+    /**
+     * @breif Set the timeout of PINGRESP.
+     * @param timeout_ms If PINGRESP is not received within timeout_ms after sending PINGREQ,
+     *                   the connection is closed and the error handler is called with
+     *                   boost::system::errc::timed_out. 0 means ping_ms. The default is 0.
+     *
+     * The ping timer is reset by any packet that is sent, so PINGREQ is sent only when
+     * nothing has been sent for ping_ms.
+     */
+    void set_pingresp_timeout_ms(std::size_t timeout_ms) {
+        pingresp_timeout_ms_ = timeout_ms;
+    }
+
+    /**
+     * @breif Set automatic reconnect.
+     * @param enable enable automatic reconnect
+     * @param initial_delay_ms the delay before the first reconnect
+     * @param max_delay_ms the maximum delay
+     * @param max_attempts the maximum number of reconnects in a row. 0 means unlimited.
+     * @param jitter the ratio of the delay that is randomly reduced. 0.0 to 1.0.
+     *
+     * When the connection is closed or fails without calling disconnect(), async_disconnect(),
+     * or force_disconnect(), the client connects again after the delay.<BR>
+     * The delay doubles for each failed reconnect up to max_delay_ms, and is reduced by
+     * a random ratio up to jitter so that many clients don't reconnect at the same time.<BR>
+     * The count is reset when CONNACK is accepted.<BR>
+     * The close handler and the error handler are called before reconnecting.
+     * If connect() is called in them, the client doesn't reconnect by itself.<BR>
+     * Set clean session to false to resume the session. Then the stored publishes
+     * are sent again after CONNACK.
+     */
+    void set_auto_reconnect(
+        bool enable,
+        std::size_t initial_delay_ms = 1000,
+        std::size_t max_delay_ms = 60000,
+        std::size_t max_attempts = 0,
+        double jitter = 0.5) {
+        auto_reconnect_ = enable;
+        reconnect_initial_delay_ms_ = initial_delay_ms;
+        reconnect_max_delay_ms_ = std::max(initial_delay_ms, max_delay_ms);
+        reconnect_max_attempts_ = max_attempts;
+        reconnect_jitter_ = std::min(std::max(jitter, 0.0), 1.0);
+        if (!enable) reconnect_tim_->cancel();
+    }
+
     /**
      * @breif Connect to a broker
      * Before calling connect(), call set_xxx member functions to configure the connection.
      * @param func finish handler that is called when the session is finished
      */
     void connect(async_handler_t const& func = async_handler_t()) {
-        as::ip::tcp::resolver r(ios_);
-        as::ip::tcp::resolver::query q(host_, port_);
-        auto it = r.resolve(q);
+        prepare_connect(func);
         setup_socket(base::socket());
-        auto self = this->shared_from_this();
-        as::async_connect(
-            base::socket()->lowest_layer(), it,
-            [this, self, func]
-            (boost::system::error_code const& ec, as::ip::tcp::resolver::iterator) mutable {
-                base::set_close_handler([this](){ handle_close(); });
-                base::set_error_handler([this](boost::system::error_code const& ec){ handle_error(ec); });
-                if (!ec) {
-                    base::set_connect();
-                    if (ping_duration_ms_ != 0) {
-                        tim_->expires_from_now(boost::posix_time::milliseconds(ping_duration_ms_));
-                        std::weak_ptr<this_type> wp(std::static_pointer_cast<this_type>(self));
-                        tim_->async_wait(
-                            [wp](boost::system::error_code const& ec) {
-                                if (auto sp = wp.lock()) {
-                                    sp->handle_timer(ec);
-                                }
-                            }
-                        );
-                    }
-                }
-                if (base::handle_close_or_error(ec)) return;
-                handshake_socket(base::socket(), func);
-            });
+        resolve_and_connect(func);
     }
 
     /**
@@ -242,34 +319,51 @@ public:
      * @param func finish handler that is called when the session is finished
      */
     void connect(std::unique_ptr<Socket>&& socket, async_handler_t const& func = async_handler_t()) {
-        as::ip::tcp::resolver r(ios_);
-        as::ip::tcp::resolver::query q(host_, port_);
-        auto it = r.resolve(q);
+        prepare_connect(func);
         base::socket() = std::move(socket);
-        auto self = this->shared_from_this();
-        as::async_connect(
-            base::socket()->lowest_layer(), it,
-            [this, self, func]
-            (boost::system::error_code const& ec, as::ip::tcp::resolver::iterator) mutable {
-                base::set_close_handler([this](){ handle_close(); });
-                base::set_error_handler([this](boost::system::error_code const& ec){ handle_error(ec); });
-                if (!ec) {
-                    base::set_connect();
-                    if (ping_duration_ms_ != 0) {
-                        tim_->expires_from_now(boost::posix_time::milliseconds(ping_duration_ms_));
-                        std::weak_ptr<this_type> wp(std::static_pointer_cast<this_type>(self));
-                        tim_->async_wait(
-                            [wp](boost::system::error_code const& ec) {
-                                if (auto sp = wp.lock()) {
-                                    sp->handle_timer(ec);
-                                }
-                            }
-                        );
-                    }
-                }
-                if (base::handle_close_or_error(ec)) return;
-                handshake_socket(base::socket(), func);
-            });
+        resolve_and_connect(func);
+    }
+
+#if defined(MQTT_USE_WS)
+    /**
+     * @breif Enable permessage-deflate of the WebSocket transport
+     * The client offers the extension on the WebSocket handshake. If the broker accepts it,
+     * all messages are compressed. It is used by the clients that are created by
+     * make_client_ws() and make_tls_client_ws().
+     * @param opts options. boost::none disables the extension. The default is boost::none.
+     */
+    void set_ws_permessage_deflate(boost::optional<permessage_deflate_options> opts) {
+        ws_deflate_ = std::move(opts);
+    }
+#endif // defined(MQTT_USE_WS)
+
+    /**
+     * @breif Set the socket options
+     * The options are applied to the TCP socket, and the underlying TCP socket of TLS and WebSocket,
+     * each time the socket is opened for connecting. TCP_QUICKACK is applied again after connecting.
+     * If an option can't be applied, the connection fails and the error handler is called.
+     * @param options socket options
+     */
+    void set_socket_options(socket_options options) {
+        socket_options_ = std::move(options);
+    }
+
+    /**
+     * @breif Get the socket options
+     * @return socket options
+     */
+    socket_options const& get_socket_options() const {
+        return socket_options_;
+    }
+
+    /**
+     * @breif Set the resolver cache
+     * connect() resolves the host asynchronously. If the cache is set, the resolved endpoints
+     * are shared with the other clients that use the same cache until the ttl of the cache expires.
+     * @param cache resolver cache. nullptr disables the cache. The default is nullptr.
+     */
+    void set_resolver_cache(std::shared_ptr<resolver_cache> cache) {
+        resolver_cache_ = std::move(cache);
     }
 
     /**
@@ -280,6 +374,7 @@ public:
      * See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718090<BR>
      */
     void disconnect() {
+        user_disconnect();
         if (ping_duration_ms_ != 0) tim_->cancel();
         if (base::connected()) {
             base::disconnect();
@@ -287,6 +382,7 @@ public:
     }
 
     void async_disconnect() {
+        user_disconnect();
         if (ping_duration_ms_ != 0) tim_->cancel();
         if (base::connected()) {
             base::async_disconnect();
@@ -294,6 +390,7 @@ public:
     }
 
     void force_disconnect() {
+        user_disconnect();
         if (ping_duration_ms_ != 0) tim_->cancel();
         base::force_disconnect();
     }
@@ -314,6 +411,22 @@ public:
         h_error_ = std::move(h);
     }
 
+    /**
+     * @brief Set connack handler
+     * @param h handler
+     */
+    void set_connack_handler(connack_handler h = connack_handler()) {
+        h_connack_ = std::move(h);
+    }
+
+    /**
+     * @brief Set pingresp handler
+     * @param h handler
+     */
+    void set_pingresp_handler(pingresp_handler h = pingresp_handler()) {
+        h_pingresp_ = std::move(h);
+    }
+
 private:
     client(as::io_service& ios,
            std::string host,
@@ -336,6 +449,21 @@ private:
          ,
          ctx_(as::ssl::context::tlsv12)
 #endif // !defined(MQTT_NO_TLS)
+         ,
+         pingresp_tim_(new boost::asio::deadline_timer(ios_)),
+         pingresp_timeout_ms_(0),
+         pingresp_waiting_(false),
+         pingresp_timed_out_(false),
+         reconnect_tim_(new boost::asio::deadline_timer(ios_)),
+         auto_reconnect_(false),
+         reconnect_initial_delay_ms_(1000),
+         reconnect_max_delay_ms_(60000),
+         reconnect_max_attempts_(0),
+         reconnect_jitter_(0.5),
+         reconnect_attempts_(0),
+         user_disconnect_(false),
+         connect_count_(0),
+         rng_(std::random_device()())
 #if defined(MQTT_USE_WS)
          ,
          path_(std::move(path))
@@ -349,12 +477,22 @@ private:
         socket.reset(new Socket(ios_));
     }
 
+#if defined(MQTT_USE_IO_URING)
+    template <typename T>
+    typename std::enable_if<
+        std::is_same<T, std::unique_ptr<io_uring_socket>>::value
+    >::type setup_socket(T& socket) {
+        socket.reset(new Socket(ios_));
+    }
+#endif // defined(MQTT_USE_IO_URING)
+
 #if defined(MQTT_USE_WS)
     template <typename T>
     typename std::enable_if<
         std::is_same<T, std::unique_ptr<ws_endpoint<as::ip::tcp::socket>>>::value
     >::type setup_socket(T& socket) {
         socket.reset(new Socket(ios_));
+        if (ws_deflate_) socket->enable_permessage_deflate(*ws_deflate_);
     }
 #endif // defined(MQTT_USE_WS)
 
@@ -379,6 +517,7 @@ private:
         std::is_same<T, std::unique_ptr<ws_endpoint<as::ssl::stream<as::ip::tcp::socket>>>>::value
     >::type setup_socket(T& socket) {
         socket.reset(new Socket(ios_, ctx_));
+        if (ws_deflate_) socket->enable_permessage_deflate(*ws_deflate_);
         socket->next_layer().set_verify_mode(as::ssl::verify_peer);
         socket->next_layer().set_verify_callback([](bool preverified, as::ssl::verify_context& ctx) -> bool {
                 char subject_name[256];
@@ -389,6 +528,27 @@ private:
     }
 #endif // defined(MQTT_USE_WS)
 
+    template <typename T>
+    static SSL* native_ssl(T const&) {
+        return nullptr;
+    }
+
+    static SSL* native_ssl(std::unique_ptr<as::ssl::stream<as::ip::tcp::socket>> const& socket) {
+        return socket ? socket->native_handle() : nullptr;
+    }
+
+#if defined(MQTT_USE_WS)
+    static SSL* native_ssl(std::unique_ptr<ws_endpoint<as::ssl::stream<as::ip::tcp::socket>>> const& socket) {
+        return socket ? socket->next_layer().native_handle() : nullptr;
+    }
+#endif // defined(MQTT_USE_WS)
+
+    void attach_tls_session(SSL* ssl) {
+        // Keep the binding that the SSL object refers to even if the cache is replaced.
+        attached_tls_session_ = tls_session_;
+        if (ssl && attached_tls_session_) tls_session_cache::attach(ssl, *attached_tls_session_);
+    }
+
 #endif // defined(MQTT_NO_TLS)
 
     template <typename T>
@@ -399,6 +559,16 @@ private:
         base::connect(keep_alive_sec_);
     }
 
+#if defined(MQTT_USE_IO_URING)
+    template <typename T>
+    typename std::enable_if<
+        std::is_same<T, std::unique_ptr<io_uring_socket>>::value
+    >::type handshake_socket(T&, async_handler_t const& func) {
+        base::async_read_control_packet_type(func);
+        base::connect(keep_alive_sec_);
+    }
+#endif // defined(MQTT_USE_IO_URING)
+
 #if defined(MQTT_USE_WS)
     template <typename T>
     typename std::enable_if<
@@ -459,29 +629,224 @@ private:
 
 #endif // defined(MQTT_NO_TLS)
 
-    void handle_timer(boost::system::error_code const& ec) {
-        if (!ec) {
-            base::pingreq();
-            tim_->expires_from_now(boost::posix_time::milliseconds(ping_duration_ms_));
-            std::weak_ptr<this_type> wp(std::static_pointer_cast<this_type>(this->shared_from_this()));
-            tim_->async_wait(
-                [wp](boost::system::error_code const& ec) {
-                    if (auto sp = wp.lock()) {
-                        sp->handle_timer(ec);
-                    }
+    void start_ping_timer(std::size_t ms) {
+        tim_->expires_from_now(boost::posix_time::milliseconds(ms));
+        std::weak_ptr<this_type> wp(std::static_pointer_cast<this_type>(this->shared_from_this()));
+        tim_->async_wait(
+            [wp](boost::system::error_code const& ec) {
+                if (auto sp = wp.lock()) {
+                    sp->handle_timer(ec);
                 }
-            );
+            }
+        );
+    }
+
+    void handle_timer(boost::system::error_code const& ec) {
+        if (ec || ping_duration_ms_ == 0) return;
+        // Any packet sent resets the keep alive, so wait for the rest of the period.
+        auto idle = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - base::last_write_time()).count();
+        auto period = static_cast<std::int64_t>(ping_duration_ms_) * 1000;
+        if (idle < period) {
+            start_ping_timer(static_cast<std::size_t>((period - idle + 999) / 1000));
+            return;
         }
+        base::pingreq();
+        start_pingresp_timer();
+        start_ping_timer(ping_duration_ms_);
+    }
+
+    void start_pingresp_timer() {
+        if (pingresp_waiting_) return;
+        pingresp_waiting_ = true;
+        pingresp_tim_->expires_from_now(
+            boost::posix_time::milliseconds(
+                pingresp_timeout_ms_ != 0 ? pingresp_timeout_ms_ : ping_duration_ms_));
+        std::weak_ptr<this_type> wp(std::static_pointer_cast<this_type>(this->shared_from_this()));
+        pingresp_tim_->async_wait(
+            [wp](boost::system::error_code const& ec) {
+                if (ec) return;
+                if (auto sp = wp.lock()) {
+                    sp->handle_pingresp_timeout();
+                }
+            }
+        );
+    }
+
+    void cancel_pingresp_timer() {
+        pingresp_waiting_ = false;
+        pingresp_tim_->cancel();
+    }
+
+    void handle_pingresp_timeout() {
+        if (!pingresp_waiting_) return;
+        pingresp_waiting_ = false;
+        if (!base::connected()) return;
+        // The pending read is aborted and reports the error.
+        pingresp_timed_out_ = true;
+        base::force_disconnect();
+    }
+
+    bool handle_pingresp() {
+        cancel_pingresp_timer();
+        if (h_pingresp_) return h_pingresp_();
+        return true;
     }
 
     void handle_close() {
         if (ping_duration_ms_ != 0) tim_->cancel();
+        cancel_pingresp_timer();
+        auto count = connect_count_;
         if (h_close_) h_close_();
+        if (count == connect_count_) schedule_reconnect();
     }
 
     void handle_error(boost::system::error_code const& ec) {
         if (ping_duration_ms_ != 0) tim_->cancel();
-        if (h_error_) h_error_(ec);
+        cancel_pingresp_timer();
+        auto count = connect_count_;
+        if (pingresp_timed_out_) {
+            pingresp_timed_out_ = false;
+            if (h_error_) h_error_(boost::system::errc::make_error_code(boost::system::errc::timed_out));
+        }
+        else if (h_error_) h_error_(ec);
+        if (count == connect_count_) schedule_reconnect();
+    }
+
+    bool handle_connack(bool session_present, std::uint8_t return_code) {
+        if (return_code == connect_return_code::accepted) reconnect_attempts_ = 0;
+        if (h_connack_) return h_connack_(session_present, return_code);
+        return true;
+    }
+
+    void resolve_and_connect(async_handler_t const& func) {
+#if !defined(MQTT_NO_TLS)
+        attach_tls_session(native_ssl(base::socket()));
+#endif // !defined(MQTT_NO_TLS)
+        auto self = this->shared_from_this();
+        auto count = connect_count_;
+        auto on_resolve =
+            [this, self, func, count]
+            (boost::system::error_code const& ec, std::shared_ptr<resolved_endpoints const> const& eps) {
+                // Another connect() has been called during the resolution.
+                if (count != connect_count_) return;
+                if (ec) {
+                    set_handlers();
+                    base::handle_close_or_error(ec);
+                    return;
+                }
+                connect_endpoint(eps, 0, func);
+            };
+        if (resolver_cache_) resolver_cache_->async_resolve(ios_, host_, port_, on_resolve);
+        else mqtt::async_resolve(ios_, host_, port_, on_resolve);
+    }
+
+    // Try the endpoints in order. The socket is opened for each endpoint
+    // so that the socket options are applied before connecting.
+    void connect_endpoint(
+        std::shared_ptr<resolved_endpoints const> const& eps,
+        std::size_t i,
+        async_handler_t const& func) {
+        if (i == eps->size()) {
+            handle_connect(as::error::not_found, func);
+            return;
+        }
+        auto& s = base::socket()->lowest_layer();
+        boost::system::error_code ec;
+        s.close(ec);
+        s.open((*eps)[i].protocol(), ec);
+        if (!ec) socket_options_.apply(s, ec);
+        if (ec) {
+            connect_next_endpoint(ec, eps, i, func);
+            return;
+        }
+        auto self = this->shared_from_this();
+        s.async_connect(
+            (*eps)[i],
+            [this, self, eps, i, func]
+            (boost::system::error_code const& ec) {
+                connect_next_endpoint(ec, eps, i, func);
+            });
+    }
+
+    void connect_next_endpoint(
+        boost::system::error_code ec,
+        std::shared_ptr<resolved_endpoints const> const& eps,
+        std::size_t i,
+        async_handler_t const& func) {
+        if (ec && i + 1 < eps->size()) {
+            connect_endpoint(eps, i + 1, func);
+            return;
+        }
+        if (!ec) socket_options_.apply_after_connect(base::socket()->lowest_layer(), ec);
+        handle_connect(ec, func);
+    }
+
+    void handle_connect(boost::system::error_code const& ec, async_handler_t const& func) {
+        set_handlers();
+        if (!ec) {
+            base::set_connect();
+            if (ping_duration_ms_ != 0) start_ping_timer(ping_duration_ms_);
+        }
+        if (base::handle_close_or_error(ec)) return;
+        handshake_socket(base::socket(), func);
+    }
+
+    void set_handlers() {
+        base::set_close_handler([this](){ handle_close(); });
+        base::set_error_handler([this](boost::system::error_code const& ec){ handle_error(ec); });
+        base::set_connack_handler(
+            [this](bool session_present, std::uint8_t return_code){
+                return handle_connack(session_present, return_code);
+            });
+        base::set_pingresp_handler([this](){ return handle_pingresp(); });
+    }
+
+    void prepare_connect(async_handler_t const& func) {
+        ++connect_count_;
+        cancel_pingresp_timer();
+        pingresp_timed_out_ = false;
+        reconnect_attempts_ = 0;
+        user_disconnect_ = false;
+        reconnect_func_ = func;
+        reconnect_tim_->cancel();
+    }
+
+    void user_disconnect() {
+        user_disconnect_ = true;
+        cancel_pingresp_timer();
+        reconnect_tim_->cancel();
+    }
+
+    void schedule_reconnect() {
+        if (!auto_reconnect_ || user_disconnect_ || base::connected()) return;
+        if (reconnect_max_attempts_ != 0 && reconnect_attempts_ >= reconnect_max_attempts_) return;
+        std::size_t delay_ms = reconnect_initial_delay_ms_;
+        for (std::size_t i = 0; i != reconnect_attempts_ && delay_ms < reconnect_max_delay_ms_; ++i) {
+            delay_ms *= 2;
+        }
+        delay_ms = std::min(delay_ms, reconnect_max_delay_ms_);
+        std::uniform_real_distribution<double> dist(1.0 - reconnect_jitter_, 1.0);
+        delay_ms = static_cast<std::size_t>(static_cast<double>(delay_ms) * dist(rng_));
+        ++reconnect_attempts_;
+        reconnect_tim_->expires_from_now(boost::posix_time::milliseconds(delay_ms));
+        std::weak_ptr<this_type> wp(std::static_pointer_cast<this_type>(this->shared_from_this()));
+        reconnect_tim_->async_wait(
+            [wp](boost::system::error_code const& ec) {
+                if (ec) return;
+                if (auto sp = wp.lock()) {
+                    sp->reconnect();
+                }
+            }
+        );
+    }
+
+    void reconnect() {
+        if (user_disconnect_ || base::connected()) return;
+        // connect() resets the count for the connection by the user.
+        auto attempts = reconnect_attempts_;
+        connect(reconnect_func_);
+        reconnect_attempts_ = attempts;
     }
 
 
@@ -495,11 +860,33 @@ private:
     std::size_t ping_duration_ms_;
 #if !defined(MQTT_NO_TLS)
     as::ssl::context ctx_;
+    std::shared_ptr<tls_session_cache::binding> tls_session_;
+    std::shared_ptr<tls_session_cache::binding> attached_tls_session_;
 #endif // !defined(MQTT_NO_TLS)
     close_handler h_close_;
     error_handler h_error_;
+    connack_handler h_connack_;
+    pingresp_handler h_pingresp_;
+    std::unique_ptr<as::deadline_timer> pingresp_tim_;
+    std::size_t pingresp_timeout_ms_;
+    bool pingresp_waiting_;
+    bool pingresp_timed_out_;
+    std::unique_ptr<as::deadline_timer> reconnect_tim_;
+    bool auto_reconnect_;
+    std::size_t reconnect_initial_delay_ms_;
+    std::size_t reconnect_max_delay_ms_;
+    std::size_t reconnect_max_attempts_;
+    double reconnect_jitter_;
+    std::size_t reconnect_attempts_;
+    bool user_disconnect_;
+    std::size_t connect_count_;
+    async_handler_t reconnect_func_;
+    std::mt19937 rng_;
+    std::shared_ptr<resolver_cache> resolver_cache_;
+    socket_options socket_options_;
 #if defined(MQTT_USE_WS)
     std::string path_;
+    boost::optional<permessage_deflate_options> ws_deflate_;
 #endif // defined(MQTT_USE_WS)
 };
 
@@ -537,6 +924,47 @@ make_client_no_strand(as::io_service& ios, std::string host, std::uint16_t port)
     return make_client_no_strand(ios, std::move(host), boost::lexical_cast<std::string>(port));
 }
 
+#if defined(MQTT_USE_IO_URING)
+
+inline std::shared_ptr<client<io_uring_socket, as::io_service::strand>>
+make_client_io_uring(as::io_service& ios, std::string host, std::string port) {
+    // Fail here rather than at connect if io_uring is not available.
+    as::use_service<io_uring_ring>(ios);
+    struct impl : client<io_uring_socket, as::io_service::strand> {
+        impl(as::io_service& ios,
+             std::string host,
+             std::string port,
+             bool tls)
+        : client<io_uring_socket, as::io_service::strand>(ios, std::move(host), std::move(port), tls) {}
+    };
+    return std::make_shared<impl>(std::ref(ios), std::move(host), std::move(port), false);
+}
+
+inline std::shared_ptr<client<io_uring_socket, as::io_service::strand>>
+make_client_io_uring(as::io_service& ios, std::string host, std::uint16_t port) {
+    return make_client_io_uring(ios, std::move(host), boost::lexical_cast<std::string>(port));
+}
+
+inline std::shared_ptr<client<io_uring_socket, null_strand>>
+make_client_no_strand_io_uring(as::io_service& ios, std::string host, std::string port) {
+    as::use_service<io_uring_ring>(ios);
+    struct impl : client<io_uring_socket, null_strand> {
+        impl(as::io_service& ios,
+             std::string host,
+             std::string port,
+             bool tls)
+        : client<io_uring_socket, null_strand>(ios, std::move(host), std::move(port), tls) {}
+    };
+    return std::make_shared<impl>(std::ref(ios), std::move(host), std::move(port), false);
+}
+
+inline std::shared_ptr<client<io_uring_socket, null_strand>>
+make_client_no_strand_io_uring(as::io_service& ios, std::string host, std::uint16_t port) {
+    return make_client_no_strand_io_uring(ios, std::move(host), boost::lexical_cast<std::string>(port));
+}
+
+#endif // defined(MQTT_USE_IO_URING)
+
 #if defined(MQTT_USE_WS)
 
 inline std::shared_ptr<client<ws_endpoint<as::ip::tcp::socket>, as::io_service::strand>>
@@ -0,0 +1,630 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_CODEC_HPP)
+#define MQTT_CODEC_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include <boost/optional.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <mqtt/fixed_header.hpp>
+#include <mqtt/control_packet_type.hpp>
+#include <mqtt/connect_flags.hpp>
+#include <mqtt/session_present.hpp>
+#include <mqtt/publish.hpp>
+#include <mqtt/qos.hpp>
+#include <mqtt/exception.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief MQTT packet codec that doesn't do any I/O.
+ * The decoders work on the bytes that the caller received, and the references in the
+ * decoded packets point into them. The encoders write into the buffers of the caller.
+ * endpoint uses them for all packets, and they can be used with any other transport.
+ * See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718018<BR>
+ * 2 MQTT Control Packet format
+ */
+namespace codec {
+
+/**
+ * @brief The maximum size of the fixed header and the remaining length.
+ */
+constexpr std::size_t const max_fixed_header_size = 5;
+
+/**
+ * @brief The maximum value of the remaining length.
+ */
+constexpr std::size_t const max_remaining_length = 0xfffffff;
+
+/**
+ * @brief A packet that is framed by parse_frame.
+ */
+struct frame {
+    std::uint8_t fixed_header;
+    // The variable header and the payload.
+    boost::string_ref body;
+    // The size of the whole packet.
+    std::size_t size;
+};
+
+inline
+std::uint16_t make_uint16_t(char b1, char b2) {
+    return
+        ((static_cast<std::uint16_t>(b1) & 0xff)) << 8 |
+        (static_cast<std::uint16_t>(b2) & 0xff);
+}
+
+/**
+ * @brief Find the packet at the beginning of the bytes.
+ * @param p the received bytes
+ * @param available the number of the received bytes
+ * @param f the found packet. If the packet is not complete, f.size is the size of the
+ *          whole packet, or 0 if the remaining length is not complete either.
+ * @return true if the whole packet is in the bytes.
+ * remaining_length_error is thrown if the remaining length is longer than 4 bytes.
+ */
+inline
+bool parse_frame(char const* p, std::size_t available, frame& f) {
+    f.size = 0;
+    if (available < 2) return false;
+    std::size_t length = 0;
+    std::size_t multiplier = 1;
+    std::size_t i = 1;
+    for (;; ++i) {
+        if (i == available) return false;
+        length += (p[i] & 0b01111111) * multiplier;
+        if (!(p[i] & 0b10000000)) break;
+        multiplier *= 128;
+        if (multiplier > 128 * 128 * 128) throw remaining_length_error();
+    }
+    f.fixed_header = static_cast<std::uint8_t>(p[0]);
+    f.size = i + 1 + length;
+    if (available < f.size) return false;
+    f.body = boost::string_ref(p + i + 1, length);
+    return true;
+}
+
+struct connect_packet {
+    boost::string_ref client_id;
+    boost::optional<boost::string_ref> user_name;
+    boost::optional<boost::string_ref> password;
+    bool clean_session;
+    std::uint16_t keep_alive;
+    bool will_flag;
+    bool will_retain;
+    std::uint8_t will_qos;
+    boost::string_ref will_topic;
+    boost::string_ref will_message;
+};
+
+struct connack_packet {
+    bool session_present;
+    std::uint8_t return_code;
+};
+
+struct publish_packet {
+    std::uint8_t fixed_header;
+    // It has a value if QoS is 1 or 2.
+    boost::optional<std::uint16_t> packet_id;
+    boost::string_ref topic_name;
+    boost::string_ref contents;
+};
+
+struct subscribe_packet {
+    std::uint16_t packet_id;
+    // The list of the topic filters and the requested QoS. It has been validated by decode_subscribe.
+    boost::string_ref entries;
+
+    /**
+     * @brief Call f(boost::string_ref topic_filter, std::uint8_t qos) for each entry.
+     */
+    template <typename F>
+    void for_each(F&& f) const {
+        std::size_t i = 0;
+        while (i < entries.size()) {
+            std::size_t length = make_uint16_t(entries[i], entries[i + 1]);
+            i += 2;
+            auto topic_filter = entries.substr(i, length);
+            i += length;
+            f(topic_filter, static_cast<std::uint8_t>(entries[i] & 0b00000011));
+            ++i;
+        }
+    }
+};
+
+struct suback_packet {
+    std::uint16_t packet_id;
+    boost::string_ref return_codes;
+
+    /**
+     * @brief Call f(boost::optional<std::uint8_t> qos) for each return code.
+     *        The failure is passed as boost::none.
+     */
+    template <typename F>
+    void for_each(F&& f) const {
+        for (auto c : return_codes) {
+            if (c & 0b10000000) f(boost::optional<std::uint8_t>());
+            else f(boost::optional<std::uint8_t>(static_cast<std::uint8_t>(c)));
+        }
+    }
+};
+
+struct unsubscribe_packet {
+    std::uint16_t packet_id;
+    // The list of the topic filters. It has been validated by decode_unsubscribe.
+    boost::string_ref entries;
+
+    /**
+     * @brief Call f(boost::string_ref topic_filter) for each entry.
+     */
+    template <typename F>
+    void for_each(F&& f) const {
+        std::size_t i = 0;
+        while (i < entries.size()) {
+            std::size_t length = make_uint16_t(entries[i], entries[i + 1]);
+            i += 2;
+            f(entries.substr(i, length));
+            i += length;
+        }
+    }
+};
+
+namespace detail {
+
+inline
+boost::system::error_code success() {
+    return boost::system::errc::make_error_code(boost::system::errc::success);
+}
+
+inline
+boost::system::error_code message_size() {
+    return boost::system::errc::make_error_code(boost::system::errc::message_size);
+}
+
+inline
+boost::system::error_code protocol_error() {
+    return boost::system::errc::make_error_code(boost::system::errc::protocol_error);
+}
+
+// Read a length prefixed string at i, and advance i.
+inline
+bool read_string(boost::string_ref body, std::size_t& i, boost::string_ref& s) {
+    if (body.size() < i + 2) return false;
+    std::size_t length = make_uint16_t(body[i], body[i + 1]);
+    i += 2;
+    if (body.size() < i + length) return false;
+    s = body.substr(i, length);
+    i += length;
+    return true;
+}
+
+} // namespace detail
+
+/**
+ * @brief Decode the body of CONNECT.
+ * @return protocol_error if it is not MQTT 3.1.1, message_size if it is too short.
+ */
+inline
+boost::system::error_code decode_connect(boost::string_ref body, connect_packet& p) {
+    std::size_t i = 0;
+    if (body.size() < 10 ||
+        body[i++] != 0x00 ||
+        body[i++] != 0x04 ||
+        body[i++] != 'M' ||
+        body[i++] != 'Q' ||
+        body[i++] != 'T' ||
+        body[i++] != 'T' ||
+        body[i++] != 0x04) {
+        return detail::protocol_error();
+    }
+    char byte8 = body[i++];
+    p.keep_alive = make_uint16_t(body[i], body[i + 1]);
+    i += 2;
+    if (!detail::read_string(body, i, p.client_id)) return detail::message_size();
+    p.clean_session = connect_flags::has_clean_session(byte8);
+    p.will_flag = connect_flags::has_will_flag(byte8);
+    p.will_retain = false;
+    p.will_qos = qos::at_most_once;
+    p.will_topic = boost::string_ref();
+    p.will_message = boost::string_ref();
+    if (p.will_flag) {
+        if (!detail::read_string(body, i, p.will_topic)) return detail::message_size();
+        if (!detail::read_string(body, i, p.will_message)) return detail::message_size();
+        p.will_retain = connect_flags::has_will_retain(byte8);
+        p.will_qos = static_cast<std::uint8_t>(connect_flags::will_qos(byte8));
+    }
+    p.user_name = boost::none;
+    if (connect_flags::has_user_name_flag(byte8)) {
+        boost::string_ref s;
+        if (!detail::read_string(body, i, s)) return detail::message_size();
+        p.user_name = s;
+    }
+    p.password = boost::none;
+    if (connect_flags::has_password_flag(byte8)) {
+        boost::string_ref s;
+        if (!detail::read_string(body, i, s)) return detail::message_size();
+        p.password = s;
+    }
+    return detail::success();
+}
+
+inline
+boost::system::error_code decode_connack(boost::string_ref body, connack_packet& p) {
+    if (body.size() != 2) return detail::message_size();
+    p.session_present = is_session_present(body[0]);
+    p.return_code = static_cast<std::uint8_t>(body[1]);
+    return detail::success();
+}
+
+inline
+boost::system::error_code decode_publish(std::uint8_t fixed_header, boost::string_ref body, publish_packet& p) {
+    std::size_t i = 0;
+    p.fixed_header = fixed_header;
+    if (!detail::read_string(body, i, p.topic_name)) return detail::message_size();
+    p.packet_id = boost::none;
+    auto qos = publish::get_qos(fixed_header);
+    if (qos == qos::at_least_once || qos == qos::exactly_once) {
+        if (body.size() < i + 2) return detail::message_size();
+        p.packet_id = make_uint16_t(body[i], body[i + 1]);
+        i += 2;
+    }
+    p.contents = body.substr(i);
+    return detail::success();
+}
+
+/**
+ * @brief Decode the body of PUBACK, PUBREC, PUBREL, PUBCOMP and UNSUBACK.
+ */
+inline
+boost::system::error_code decode_packet_id(boost::string_ref body, std::uint16_t& packet_id) {
+    if (body.size() != 2) return detail::message_size();
+    packet_id = make_uint16_t(body[0], body[1]);
+    return detail::success();
+}
+
+inline
+boost::system::error_code decode_subscribe(boost::string_ref body, subscribe_packet& p) {
+    if (body.size() < 2) return detail::message_size();
+    p.packet_id = make_uint16_t(body[0], body[1]);
+    std::size_t i = 2;
+    while (i < body.size()) {
+        boost::string_ref topic_filter;
+        if (!detail::read_string(body, i, topic_filter)) return detail::message_size();
+        if (i == body.size()) return detail::message_size();
+        ++i;
+    }
+    p.entries = body.substr(2);
+    return detail::success();
+}
+
+inline
+boost::system::error_code decode_suback(boost::string_ref body, suback_packet& p) {
+    if (body.size() < 2) return detail::message_size();
+    p.packet_id = make_uint16_t(body[0], body[1]);
+    p.return_codes = body.substr(2);
+    return detail::success();
+}
+
+inline
+boost::system::error_code decode_unsubscribe(boost::string_ref body, unsubscribe_packet& p) {
+    if (body.size() < 2) return detail::message_size();
+    p.packet_id = make_uint16_t(body[0], body[1]);
+    std::size_t i = 2;
+    while (i < body.size()) {
+        boost::string_ref topic_filter;
+        if (!detail::read_string(body, i, topic_filter)) return detail::message_size();
+    }
+    p.entries = body.substr(2);
+    return detail::success();
+}
+
+/**
+ * @brief Decode the body of PINGREQ, PINGRESP and DISCONNECT.
+ */
+inline
+boost::system::error_code decode_empty(boost::string_ref body) {
+    return body.empty() ? detail::success() : detail::message_size();
+}
+
+/**
+ * @brief Decode the packet, and call the member function of the visitor for its type:
+ * @code
+ * bool on_connect(connect_packet const&);
+ * bool on_connack(connack_packet const&);
+ * bool on_publish(publish_packet const&);
+ * bool on_puback(std::uint16_t packet_id);   // on_pubrec, on_pubrel, on_pubcomp and on_unsuback too
+ * bool on_subscribe(subscribe_packet const&);
+ * bool on_suback(suback_packet const&);
+ * bool on_unsubscribe(unsubscribe_packet const&);
+ * bool on_pingreq();                         // on_pingresp and on_disconnect too
+ * void on_error(boost::system::error_code const&);
+ * @endcode
+ * @return the return value of the called function, or false after on_error is called
+ *         if the packet is malformed.
+ */
+template <typename Visitor>
+bool decode(std::uint8_t fixed_header, boost::string_ref body, Visitor& v) {
+    boost::system::error_code ec;
+    switch (get_control_packet_type(fixed_header)) {
+    case control_packet_type::connect: {
+        connect_packet p;
+        if (!(ec = decode_connect(body, p))) return v.on_connect(p);
+    } break;
+    case control_packet_type::connack: {
+        connack_packet p;
+        if (!(ec = decode_connack(body, p))) return v.on_connack(p);
+    } break;
+    case control_packet_type::publish: {
+        publish_packet p;
+        if (!(ec = decode_publish(fixed_header, body, p))) return v.on_publish(p);
+    } break;
+    case control_packet_type::puback: {
+        std::uint16_t packet_id;
+        if (!(ec = decode_packet_id(body, packet_id))) return v.on_puback(packet_id);
+    } break;
+    case control_packet_type::pubrec: {
+        std::uint16_t packet_id;
+        if (!(ec = decode_packet_id(body, packet_id))) return v.on_pubrec(packet_id);
+    } break;
+    case control_packet_type::pubrel: {
+        std::uint16_t packet_id;
+        if (!(ec = decode_packet_id(body, packet_id))) return v.on_pubrel(packet_id);
+    } break;
+    case control_packet_type::pubcomp: {
+        std::uint16_t packet_id;
+        if (!(ec = decode_packet_id(body, packet_id))) return v.on_pubcomp(packet_id);
+    } break;
+    case control_packet_type::subscribe: {
+        subscribe_packet p;
+        if (!(ec = decode_subscribe(body, p))) return v.on_subscribe(p);
+    } break;
+    case control_packet_type::suback: {
+        suback_packet p;
+        if (!(ec = decode_suback(body, p))) return v.on_suback(p);
+    } break;
+    case control_packet_type::unsubscribe: {
+        unsubscribe_packet p;
+        if (!(ec = decode_unsubscribe(body, p))) return v.on_unsubscribe(p);
+    } break;
+    case control_packet_type::unsuback: {
+        std::uint16_t packet_id;
+        if (!(ec = decode_packet_id(body, packet_id))) return v.on_unsuback(packet_id);
+    } break;
+    case control_packet_type::pingreq:
+        if (!(ec = decode_empty(body))) return v.on_pingreq();
+        break;
+    case control_packet_type::pingresp:
+        if (!(ec = decode_empty(body))) return v.on_pingresp();
+        break;
+    case control_packet_type::disconnect:
+        if (!(ec = decode_empty(body))) return v.on_disconnect();
+        break;
+    default:
+        ec = detail::protocol_error();
+        break;
+    }
+    v.on_error(ec);
+    return false;
+}
+
+/**
+ * @brief Incremental decoder. Feed the received bytes in any size, and the visitor is
+ * called for each complete packet. See decode() for the visitor.
+ * The packets are decoded in place from the fed bytes. Only a packet that is split
+ * over several feeds is copied into the internal buffer.
+ */
+class decoder {
+public:
+    /**
+     * @brief Constructor.
+     * @param max_packet_size the maximum size of the whole packet. The larger packets are
+     *        reported by on_error(message_size) as soon as their remaining length is read,
+     *        instead of being buffered.
+     */
+    explicit decoder(std::size_t max_packet_size = max_fixed_header_size + max_remaining_length)
+        :max_packet_size_(max_packet_size) {}
+
+    /**
+     * @brief Decode the packets in the bytes.
+     * @param data the received bytes
+     * @param size the number of the received bytes
+     * @param v visitor
+     * @return the number of the consumed bytes. It is less than size if the visitor returned false,
+     *         or if the packet is larger than the maximum packet size.
+     * remaining_length_error is thrown if the remaining length is longer than 4 bytes.
+     */
+    template <typename Visitor>
+    std::size_t feed(char const* data, std::size_t size, Visitor& v) {
+        std::size_t pos = 0;
+        frame f;
+        // Complete the split packet first.
+        while (!buf_.empty() && pos != size) {
+            if (parse_frame(buf_.data(), buf_.size(), f)) break;
+            if (f.size > max_packet_size_) return too_large(pos, v);
+            // Copy only the bytes of the packet. The header is copied byte by byte.
+            // The buffer grows as the bytes arrive, so a remaining length that the peer
+            // doesn't fulfil costs no more than the bytes that are received.
+            std::size_t n = f.size == 0 ? 1 : std::min(f.size - buf_.size(), size - pos);
+            buf_.insert(buf_.end(), data + pos, data + pos + n);
+            pos += n;
+        }
+        if (!buf_.empty()) {
+            if (!parse_frame(buf_.data(), buf_.size(), f)) {
+                if (f.size > max_packet_size_) return too_large(pos, v);
+                return pos;
+            }
+            bool cont = decode(f.fixed_header, f.body, v);
+            buf_.clear();
+            if (!cont) return pos;
+        }
+        while (pos != size) {
+            bool complete = parse_frame(data + pos, size - pos, f);
+            if (f.size > max_packet_size_) return too_large(pos, v);
+            if (!complete) {
+                buf_.assign(data + pos, data + size);
+                return size;
+            }
+            pos += f.size;
+            if (!decode(f.fixed_header, f.body, v)) return pos;
+        }
+        return pos;
+    }
+
+    /**
+     * @brief Get the number of the bytes of the split packet.
+     * @return the number of the buffered bytes
+     */
+    std::size_t buffered() const {
+        return buf_.size();
+    }
+
+    /**
+     * @brief Discard the split packet.
+     */
+    void reset() {
+        buf_.clear();
+    }
+
+private:
+    template <typename Visitor>
+    std::size_t too_large(std::size_t pos, Visitor& v) {
+        buf_.clear();
+        v.on_error(detail::message_size());
+        return pos;
+    }
+
+    std::size_t max_packet_size_;
+    std::vector<char> buf_;
+};
+
+/**
+ * @brief Get the size of the remaining length field.
+ */
+inline
+std::size_t remaining_length_size(std::size_t remaining_length) {
+    std::size_t size = 1;
+    while (remaining_length > 127) {
+        remaining_length >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+/**
+ * @brief Write the fixed header and the remaining length.
+ * @param out buffer that has at least 1 + remaining_length_size(remaining_length) bytes
+ * @return the number of the written bytes
+ * remaining_length_error is thrown if remaining_length is larger than max_remaining_length.
+ */
+inline
+std::size_t encode_fixed_header(char* out, std::uint8_t fixed_header, std::size_t remaining_length) {
+    if (remaining_length > max_remaining_length) throw remaining_length_error();
+    std::size_t i = 0;
+    out[i++] = static_cast<char>(fixed_header);
+    while (remaining_length > 127) {
+        out[i++] = static_cast<char>((remaining_length & 0b01111111) | 0b10000000);
+        remaining_length >>= 7;
+    }
+    out[i++] = static_cast<char>(remaining_length);
+    return i;
+}
+
+/**
+ * @brief Write PUBACK, PUBREC, PUBREL, PUBCOMP or UNSUBACK.
+ * @param out buffer that has at least 4 bytes
+ * @return the number of the written bytes
+ */
+inline
+std::size_t encode_packet_id_packet(char* out, std::uint8_t control_packet_type, std::uint16_t packet_id) {
+    std::uint8_t flags = control_packet_type == control_packet_type::pubrel ? 0b0010 : 0b0000;
+    std::size_t i = encode_fixed_header(out, make_fixed_header(control_packet_type, flags), 2);
+    out[i++] = static_cast<char>(packet_id >> 8);
+    out[i++] = static_cast<char>(packet_id & 0xff);
+    return i;
+}
+
+/**
+ * @brief Write CONNACK.
+ * @param out buffer that has at least 4 bytes
+ * @return the number of the written bytes
+ */
+inline
+std::size_t encode_connack(char* out, bool session_present, std::uint8_t return_code) {
+    std::size_t i = encode_fixed_header(out, make_fixed_header(control_packet_type::connack, 0b0000), 2);
+    out[i++] = static_cast<char>(session_present ? 1 : 0);
+    out[i++] = static_cast<char>(return_code);
+    return i;
+}
+
+/**
+ * @brief Write PINGREQ, PINGRESP or DISCONNECT.
+ * @param out buffer that has at least 2 bytes
+ * @return the number of the written bytes
+ */
+inline
+std::size_t encode_empty_packet(char* out, std::uint8_t control_packet_type) {
+    return encode_fixed_header(out, make_fixed_header(control_packet_type, 0b0000), 0);
+}
+
+/**
+ * @brief Get the size of PUBLISH except the contents.
+ */
+inline
+std::size_t publish_header_size(std::size_t topic_name_size, std::uint8_t qos, std::size_t contents_size) {
+    std::size_t remaining_length =
+        2 + topic_name_size + (qos == qos::at_most_once ? 0 : 2) + contents_size;
+    return 1 + remaining_length_size(remaining_length) + remaining_length - contents_size;
+}
+
+/**
+ * @brief Write PUBLISH except the contents. The contents follow it on the wire.
+ * @param out buffer that has at least publish_header_size() bytes
+ * @param topic_name topic name. It should be a valid UTF-8 string of at most 65535 bytes.
+ * @param qos mqtt::qos
+ * @param retain retain flag
+ * @param dup dup flag
+ * @param packet_id packet identifier. It is not written if qos is at_most_once.
+ * @param contents_size the size of the contents
+ * @return the number of the written bytes
+ */
+inline
+std::size_t encode_publish_header(
+    char* out,
+    boost::string_ref topic_name,
+    std::uint8_t qos,
+    bool retain,
+    bool dup,
+    std::uint16_t packet_id,
+    std::size_t contents_size) {
+    std::uint8_t flags = static_cast<std::uint8_t>(qos << 1);
+    if (retain) flags |= 0b00000001;
+    if (dup) flags |= 0b00001000;
+    std::size_t remaining_length =
+        2 + topic_name.size() + (qos == qos::at_most_once ? 0 : 2) + contents_size;
+    std::size_t i = encode_fixed_header(out, make_fixed_header(control_packet_type::publish, flags), remaining_length);
+    out[i++] = static_cast<char>(topic_name.size() >> 8);
+    out[i++] = static_cast<char>(topic_name.size() & 0xff);
+    std::memcpy(out + i, topic_name.data(), topic_name.size());
+    i += topic_name.size();
+    if (qos != qos::at_most_once) {
+        out[i++] = static_cast<char>(packet_id >> 8);
+        out[i++] = static_cast<char>(packet_id & 0xff);
+    }
+    return i;
+}
+
+} // namespace codec
+
+} // namespace mqtt
+
+#endif // MQTT_CODEC_HPP
@@ -8,6 +8,7 @@
 #define MQTT_ENDPOINT_HPP
 
 #include <string>
+#include <cstring>
 #include <vector>
 #include <deque>
 #include <functional>
@@ -15,19 +16,19 @@
 #include <memory>
 #include <mutex>
 #include <atomic>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <type_traits>
 
 #include <boost/any.hpp>
 #include <boost/optional.hpp>
+#include <boost/utility/string_ref.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/asio.hpp>
 #include <boost/lexical_cast.hpp>
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/sequenced_index.hpp>
-#include <boost/multi_index/ordered_index.hpp>
-#include <boost/multi_index/member.hpp>
-#include <boost/multi_index/mem_fun.hpp>
-#include <boost/multi_index/composite_key.hpp>
 #include <boost/system/error_code.hpp>
+#include <boost/version.hpp>
 #include <boost/assert.hpp>
 
 #include <mqtt/fixed_header.hpp>
@@ -41,19 +42,36 @@
 #include <mqtt/publish.hpp>
 #include <mqtt/connect_return_code.hpp>
 #include <mqtt/exception.hpp>
+#include <mqtt/store.hpp>
+#include <mqtt/packet_id_allocator.hpp>
+#include <mqtt/session_store.hpp>
+#include <mqtt/mpsc_queue.hpp>
+#include <mqtt/handler_allocator.hpp>
+#include <mqtt/handler_policy.hpp>
+#include <mqtt/shared_publish.hpp>
+#include <mqtt/codec.hpp>
 
 #if defined(MQTT_USE_WS)
 #include <mqtt/ws_endpoint.hpp>
 #endif // defined(MQTT_USE_WS)
 
+#if defined(MQTT_USE_IO_URING)
+#include <mqtt/io_uring_socket.hpp>
+#endif // defined(MQTT_USE_IO_URING)
+
 namespace mqtt {
 
 namespace as = boost::asio;
-namespace mi = boost::multi_index;
 
-template <typename Socket, typename Strand, typename Mutex = std::mutex, template<typename...> class LockGuard = std::lock_guard>
-class endpoint : public std::enable_shared_from_this<endpoint<Socket, Strand, Mutex, LockGuard>> {
-    using this_type = endpoint<Socket, Strand>;
+template <
+    typename Socket,
+    typename Strand,
+    typename Mutex = std::mutex,
+    template<typename...> class LockGuard = std::lock_guard,
+    template<typename...> class Store = multi_index_store,
+    typename Handlers = function_handlers>
+class endpoint : public std::enable_shared_from_this<endpoint<Socket, Strand, Mutex, LockGuard, Store, Handlers>> {
+    using this_type = endpoint<Socket, Strand, Mutex, LockGuard, Store, Handlers>;
 public:
     using async_handler_t = std::function<void(boost::system::error_code const& ec)>;
 
@@ -65,7 +83,15 @@ public:
          connected_(false),
          mqtt_connected_(false),
          clean_session_(false),
-         packet_id_master_(0),
+         read_buf_(default_read_buffer_size),
+         read_begin_(0),
+         read_end_(0),
+         max_inflight_(0),
+         inflight_(0),
+         peak_inflight_(0),
+         total_waited_(0),
+         drain_posted_(false),
+         last_write_(0),
          auto_pub_response_(true),
          auto_pub_response_async_(false)
     {}
@@ -75,12 +101,24 @@ public:
      *        socket should have already been connected with another endpoint.
      */
     endpoint(std::unique_ptr<Socket>&& socket)
+#if BOOST_VERSION >= 107000
+        :strand_(static_cast<as::io_service&>(socket->lowest_layer().get_executor().context())),
+#else  // BOOST_VERSION >= 107000
         :strand_(socket->get_io_service()),
+#endif // BOOST_VERSION >= 107000
          socket_(std::move(socket)),
          connected_(true),
          mqtt_connected_(false),
          clean_session_(false),
-         packet_id_master_(0),
+         read_buf_(default_read_buffer_size),
+         read_begin_(0),
+         read_end_(0),
+         max_inflight_(0),
+         inflight_(0),
+         peak_inflight_(0),
+         total_waited_(0),
+         drain_posted_(false),
+         last_write_(0),
          auto_pub_response_(true),
          auto_pub_response_async_(false)
     {}
@@ -88,13 +126,13 @@ public:
     /**
      * @breif Close handler
      */
-    using close_handler = std::function<void()>;
+    using close_handler = function_handlers::close_handler;
 
     /**
      * @breif Error handler
      * @param ec error code
      */
-    using error_handler = std::function<void(boost::system::error_code const& ec)>;
+    using error_handler = function_handlers::error_handler;
 
     /**
      * @breif Connect handler
@@ -133,13 +171,7 @@ public:
      * @return if the handler returns true, then continue receiving, otherwise quit.
      *
      */
-    using connect_handler = std::function<
-        bool(std::string const& client_id,
-             boost::optional<std::string> const& username,
-             boost::optional<std::string> const& password,
-             boost::optional<will> will,
-             bool clean_session,
-             std::uint16_t keep_alive)>;
+    using connect_handler = function_handlers::connect_handler;
 
     /**
      * @breif Connack handler
@@ -153,7 +185,7 @@ public:
      *        3.2.2.3 Connect Return code
      * @return if the handler returns true, then continue receiving, otherwise quit.
      */
-    using connack_handler = std::function<bool(bool session_present, std::uint8_t return_code)>;
+    using connack_handler = function_handlers::connack_handler;
 
     /**
      * @breif Publish handler
@@ -172,10 +204,29 @@ public:
      *        Published contents
      * @return if the handler returns true, then continue receiving, otherwise quit.
      */
-    using publish_handler = std::function<bool(std::uint8_t fixed_header,
-                                               boost::optional<std::uint16_t> packet_id,
-                                               std::string topic_name,
-                                               std::string contents)>;
+    using publish_handler = function_handlers::publish_handler;
+
+    /**
+     * @breif Publish handler that receives views of the received packet
+     * @param fixed_header
+     *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718038<BR>
+     *        3.3.1 Fixed header<BR>
+     *        You can check the fixed header using mqtt::publish functions.
+     * @param packet_id
+     *        packet identifier<BR>
+     *        If received publish's QoS is 0, packet_id is boost::none.<BR>
+     *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718039<BR>
+     *        3.3.2  Variable header
+     * @param topic_name
+     *        Topic name
+     * @param contents
+     *        Published contents
+     * @return if the handler returns true, then continue receiving, otherwise quit.
+     *
+     * topic_name and contents refer to the receive buffer of the endpoint.
+     * They are valid only until the handler returns. Copy them if you need them later.
+     */
+    using publish_ref_handler = function_handlers::publish_ref_handler;
 
     /**
      * @breif Puback handler
@@ -185,7 +236,7 @@ public:
      *        3.4.2 Variable header
      * @return if the handler returns true, then continue receiving, otherwise quit.
      */
-    using puback_handler = std::function<bool(std::uint16_t packet_id)>;
+    using puback_handler = function_handlers::puback_handler;
 
     /**
      * @breif Pubrec handler
@@ -195,7 +246,7 @@ public:
      *        3.5.2 Variable header
      * @return if the handler returns true, then continue receiving, otherwise quit.
      */
-    using pubrec_handler = std::function<bool(std::uint16_t packet_id)>;
+    using pubrec_handler = function_handlers::pubrec_handler;
 
     /**
      * @breif Pubrel handler
@@ -205,7 +256,7 @@ public:
      *        3.6.2 Variable header
      * @return if the handler returns true, then continue receiving, otherwise quit.
      */
-    using pubrel_handler = std::function<bool(std::uint16_t packet_id)>;
+    using pubrel_handler = function_handlers::pubrel_handler;
 
     /**
      * @breif Pubcomp handler
@@ -215,7 +266,7 @@ public:
      *        3.7.2 Variable header
      * @return if the handler returns true, then continue receiving, otherwise quit.
      */
-    using pubcomp_handler = std::function<bool(std::uint16_t packet_id)>;
+    using pubcomp_handler = function_handlers::pubcomp_handler;
 
     /**
      * @breif Publish response sent handler
@@ -225,7 +276,7 @@ public:
      *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718060<BR>
      *        3.7.2 Variable header
      */
-    using pub_res_sent_handler = std::function<void(std::uint16_t packet_id)>;
+    using pub_res_sent_handler = function_handlers::pub_res_sent_handler;
 
     /**
      * @breif Subscribe handler
@@ -237,8 +288,7 @@ public:
      *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc385349802<BR>
      * @return if the handler returns true, then continue receiving, otherwise quit.
      */
-    using subscribe_handler = std::function<bool(std::uint16_t packet_id,
-                                                 std::vector<std::tuple<std::string, std::uint8_t>> entries)>;
+    using subscribe_handler = function_handlers::subscribe_handler;
 
     /**
      * @breif Suback handler
@@ -251,8 +301,7 @@ public:
      *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718071<BR>
      * @return if the handler returns true, then continue receiving, otherwise quit.
      */
-    using suback_handler = std::function<bool(std::uint16_t packet_id,
-                                              std::vector<boost::optional<std::uint8_t>> qoss)>;
+    using suback_handler = function_handlers::suback_handler;
 
     /**
      * @breif Unsubscribe handler
@@ -264,8 +313,7 @@ public:
      *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc384800448<BR>
      * @return if the handler returns true, then continue receiving, otherwise quit.
      */
-    using unsubscribe_handler = std::function<bool(std::uint16_t packet_id,
-                                                   std::vector<std::string> topics)>;
+    using unsubscribe_handler = function_handlers::unsubscribe_handler;
 
     /**
      * @breif Unsuback handler
@@ -274,7 +322,7 @@ public:
      *        3.11.2 Variable header
      * @return if the handler returns true, then continue receiving, otherwise quit.
      */
-    using unsuback_handler = std::function<bool(std::uint16_t)>;
+    using unsuback_handler = function_handlers::unsuback_handler;
 
     /**
      * @breif Pingreq handler
@@ -282,7 +330,7 @@ public:
      *        3.13 PINGREQ – PING request
      * @return if the handler returns true, then continue receiving, otherwise quit.
      */
-    using pingreq_handler = std::function<bool()>;
+    using pingreq_handler = function_handlers::pingreq_handler;
 
     /**
      * @breif Pingresp handler
@@ -290,14 +338,14 @@ public:
      *        3.13 PINGRESP – PING response
      * @return if the handler returns true, then continue receiving, otherwise quit.
      */
-    using pingresp_handler = std::function<bool()>;
+    using pingresp_handler = function_handlers::pingresp_handler;
 
     /**
      * @breif Disconnect handler
      *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc384800463<BR>
      *        3.14 DISCONNECT – Disconnect notification
      */
-    using disconnect_handler = std::function<void()>;
+    using disconnect_handler = function_handlers::disconnect_handler;
 
     endpoint(endpoint&&) = delete;
 
@@ -328,6 +376,49 @@ public:
         clean_session_ = cs;
     }
 
+    /**
+     * @breif Set session store.
+     * @param ss session store
+     *
+     * The packets that wait for the response, packet_ids in use, and handled QoS2 packet_ids
+     * are restored from ss, and then all changes of them are recorded to ss.
+     * This function should be called before calling connect().
+     * The publishes waiting for the in-flight window are dropped, and their handlers are called
+     * with operation_aborted.
+     * If ss is nullptr, the changes are no longer recorded.
+     */
+    void set_session_store(std::shared_ptr<session_store> ss) {
+        std::vector<async_handler_t> dropped;
+        {
+            LockGuard<Mutex> lck (store_mtx_);
+            ss_ = std::move(ss);
+            if (!ss_) return;
+            store_.clear();
+            inflight_ = 0;
+            packet_id_.clear();
+            qos2_publish_handled_.clear();
+            // The waiting publishes belong to the replaced state.
+            dropped = take_waiting_publishes();
+            ss_->restore(
+                [this]
+                (std::uint16_t packet_id, std::uint8_t expected_control_packet_type, boost::string_ref packet) {
+                    auto buf = std::make_shared<std::string>(packet.data(), packet.size());
+                    store_.emplace(packet_id, expected_control_packet_type, buf, &(*buf)[0], buf->size());
+                    enter_inflight();
+                },
+                [this]
+                (std::uint16_t packet_id) {
+                    qos2_publish_handled_.insert(packet_id);
+                },
+                [this]
+                (std::uint16_t packet_id) {
+                    packet_id_.register_id(packet_id);
+                }
+            );
+        }
+        call_handlers(dropped, as::error::operation_aborted);
+    }
+
     /**
      * @breif Set username.
      * @param name username
@@ -374,12 +465,68 @@ public:
         auto_pub_response_async_ = async;
     }
 
+    /**
+     * @breif Set the maximum number of QoS1 and QoS2 publishes in flight.
+     * @param max the maximum number. 0 means unlimited.
+     *
+     * A QoS1 or QoS2 publish is in flight from sending PUBLISH until receiving PUBACK or PUBCOMP.<BR>
+     * The publishes beyond the maximum are stored like the others, but their writes wait in the
+     * endpoint, and they are sent in order when PUBACK or PUBCOMP arrives.
+     * The publish functions don't wait for it.<BR>
+     * When the connection is closed, the handlers of the waiting async publishes are called
+     * as for publishes made while disconnected. The publishes keep waiting for the next connection.<BR>
+     * A clean session CONNACK drops them with the other stored publishes, and their handlers are
+     * called with operation_aborted.<BR>
+     * After constructing a endpoint, the maximum is 0.
+     */
+    void set_max_inflight(std::size_t max) {
+        {
+            LockGuard<Mutex> lck (store_mtx_);
+            max_inflight_ = max;
+        }
+        send_waiting_publishes();
+    }
+
+    /**
+     * @breif Statistics of the in-flight window
+     */
+    struct inflight_stats {
+        std::size_t inflight;      ///< the number of publishes in flight
+        std::size_t waiting;       ///< the number of publishes waiting for the window
+        std::size_t peak_inflight; ///< the maximum number of publishes that have been in flight
+        std::size_t total_waited;  ///< the total number of publishes that have waited for the window
+    };
+
+    /**
+     * @breif Get statistics of the in-flight window.
+     * @return statistics
+     */
+    inflight_stats get_inflight_stats() {
+        LockGuard<Mutex> lck (store_mtx_);
+        return inflight_stats { inflight_, waiting_publishes_.size(), peak_inflight_, total_waited_ };
+    }
+
+    /**
+     * @breif Set receive buffer size.
+     * @param size buffer size in bytes
+     *
+     * The endpoint reads as many bytes as the socket offers into the receive buffer,
+     * and then handles all complete packets in it before reading again.<BR>
+     * A packet that is larger than the buffer grows the buffer.<BR>
+     * This function should be called before starting the session.
+     */
+    void set_read_buffer_size(std::size_t size) {
+        BOOST_ASSERT(read_begin_ == read_end_);
+        // At least the fixed header and the longest remaining length.
+        read_buf_.resize(std::max<std::size_t>(size, 5));
+    }
+
     /**
      * @brief Set close handler
      * @param h handler
      */
     void set_close_handler(close_handler h = close_handler()) {
-        h_close_ = std::move(h);
+        compat_handlers().h_close = std::move(h);
     }
 
     /**
@@ -387,7 +534,7 @@ public:
      * @param h handler
      */
     void set_error_handler(error_handler h = error_handler()) {
-        h_error_ = std::move(h);
+        compat_handlers().h_error = std::move(h);
     }
 
     /**
@@ -395,7 +542,7 @@ public:
      * @param h handler
      */
     void set_connect_handler(connect_handler h = connect_handler()) {
-        h_connect_ = std::move(h);
+        compat_handlers().h_connect = std::move(h);
     }
 
     /**
@@ -403,7 +550,7 @@ public:
      * @param h handler
      */
     void set_connack_handler(connack_handler h = connack_handler()) {
-        h_connack_ = std::move(h);
+        compat_handlers().h_connack = std::move(h);
     }
 
     /**
@@ -411,7 +558,17 @@ public:
      * @param h handler
      */
     void set_publish_handler(publish_handler h = publish_handler()) {
-        h_publish_ = std::move(h);
+        compat_handlers().h_publish = std::move(h);
+    }
+
+    /**
+     * @brief Set publish handler that receives views of the received packet
+     * @param h handler
+     *
+     * If both publish_ref_handler and publish_handler are set, only publish_ref_handler is called.
+     */
+    void set_publish_ref_handler(publish_ref_handler h = publish_ref_handler()) {
+        compat_handlers().h_publish_ref = std::move(h);
     }
 
     /**
@@ -419,7 +576,7 @@ public:
      * @param h handler
      */
     void set_puback_handler(puback_handler h = puback_handler()) {
-        h_puback_ = std::move(h);
+        compat_handlers().h_puback = std::move(h);
     }
 
     /**
@@ -427,7 +584,7 @@ public:
      * @param h handler
      */
     void set_pubrec_handler(pubrec_handler h = pubrec_handler()) {
-        h_pubrec_ = std::move(h);
+        compat_handlers().h_pubrec = std::move(h);
     }
 
     /**
@@ -435,7 +592,7 @@ public:
      * @param h handler
      */
     void set_pubrel_handler(pubrel_handler h = pubrel_handler()) {
-        h_pubrel_ = std::move(h);
+        compat_handlers().h_pubrel = std::move(h);
     }
 
     /**
@@ -443,7 +600,7 @@ public:
      * @param h handler
      */
     void set_pubcomp_handler(pubcomp_handler h = pubcomp_handler()) {
-        h_pubcomp_ = std::move(h);
+        compat_handlers().h_pubcomp = std::move(h);
     }
 
     /**
@@ -451,7 +608,7 @@ public:
      * @param h handler
      */
     void set_pub_res_sent_handler(pub_res_sent_handler h = pub_res_sent_handler()) {
-        h_pub_res_sent_ = std::move(h);
+        compat_handlers().h_pub_res_sent = std::move(h);
     }
 
     /**
@@ -459,7 +616,7 @@ public:
      * @param h handler
      */
     void set_subscribe_handler(subscribe_handler h = subscribe_handler()) {
-        h_subscribe_ = std::move(h);
+        compat_handlers().h_subscribe = std::move(h);
     }
 
     /**
@@ -467,7 +624,7 @@ public:
      * @param h handler
      */
     void set_suback_handler(suback_handler h = suback_handler()) {
-        h_suback_ = std::move(h);
+        compat_handlers().h_suback = std::move(h);
     }
 
     /**
@@ -475,7 +632,7 @@ public:
      * @param h handler
      */
     void set_unsubscribe_handler(unsubscribe_handler h = unsubscribe_handler()) {
-        h_unsubscribe_ = std::move(h);
+        compat_handlers().h_unsubscribe = std::move(h);
     }
 
     /**
@@ -483,7 +640,7 @@ public:
      * @param h handler
      */
     void set_unsuback_handler(unsuback_handler h = unsuback_handler()) {
-        h_unsuback_ = std::move(h);
+        compat_handlers().h_unsuback = std::move(h);
     }
 
     /**
@@ -491,7 +648,7 @@ public:
      * @param h handler
      */
     void set_pingreq_handler(pingreq_handler h = pingreq_handler()) {
-        h_pingreq_ = std::move(h);
+        compat_handlers().h_pingreq = std::move(h);
     }
 
     /**
@@ -499,7 +656,7 @@ public:
      * @param h handler
      */
     void set_pingresp_handler(pingresp_handler h = pingresp_handler()) {
-        h_pingresp_ = std::move(h);
+        compat_handlers().h_pingresp = std::move(h);
     }
 
     /**
@@ -507,7 +664,16 @@ public:
      * @param h handler
      */
     void set_disconnect_handler(disconnect_handler h = disconnect_handler()) {
-        h_disconnect_ = std::move(h);
+        compat_handlers().h_disconnect = std::move(h);
+    }
+
+    /**
+     * @brief Get the handler policy.
+     *        The set_*_handler functions are available only if it is function_handlers or derived from it.
+     * @return handler policy
+     */
+    Handlers& handlers() {
+        return handlers_;
     }
 
     /**
@@ -539,6 +705,25 @@ public:
         acquired_publish(0, topic_name, contents, qos::at_most_once, retain);
     }
 
+    /**
+     * @brief Publish QoS0
+     * @param topic_name
+     *        A topic name to publish
+     * @param contents
+     *        The contents to publish. They are sent without copying, and the library holds
+     *        the reference until the packet is no longer needed. Don't modify them after calling.
+     * @param retain
+     *        A retain flag. If set it to true, the contents is retained.<BR>
+     *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718038<BR>
+     *        3.3.1.3 RETAIN
+     */
+    void publish_at_most_once(
+        std::string const& topic_name,
+        std::shared_ptr<std::string const> const& contents,
+        bool retain = false) {
+        acquired_publish(0, topic_name, contents, qos::at_most_once, retain);
+    }
+
     /**
      * @brief Publish QoS1
      * @param topic_name
@@ -561,6 +746,29 @@ public:
         return packet_id;
     }
 
+    /**
+     * @brief Publish QoS1
+     * @param topic_name
+     *        A topic name to publish
+     * @param contents
+     *        The contents to publish. They are sent without copying, and the library holds
+     *        the reference until the packet is no longer needed. Don't modify them after calling.
+     * @param retain
+     *        A retain flag. If set it to true, the contents is retained.<BR>
+     *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718038<BR>
+     *        3.3.1.3 RETAIN
+     * @return packet_id
+     * packet_id is automatically generated.
+     */
+    std::uint16_t publish_at_least_once(
+        std::string const& topic_name,
+        std::shared_ptr<std::string const> const& contents,
+        bool retain = false) {
+        std::uint16_t packet_id = acquire_unique_packet_id();
+        acquired_publish(packet_id, topic_name, contents, qos::at_least_once, retain);
+        return packet_id;
+    }
+
     /**
      * @brief Publish QoS2
      * @param topic_name
@@ -583,6 +791,29 @@ public:
         return packet_id;
     }
 
+    /**
+     * @brief Publish QoS2
+     * @param topic_name
+     *        A topic name to publish
+     * @param contents
+     *        The contents to publish. They are sent without copying, and the library holds
+     *        the reference until the packet is no longer needed. Don't modify them after calling.
+     * @param retain
+     *        A retain flag. If set it to true, the contents is retained.<BR>
+     *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718038<BR>
+     *        3.3.1.3 RETAIN
+     * @return packet_id
+     * packet_id is automatically generated.
+     */
+    std::uint16_t publish_exactly_once(
+        std::string const& topic_name,
+        std::shared_ptr<std::string const> const& contents,
+        bool retain = false) {
+        std::uint16_t packet_id = acquire_unique_packet_id();
+        acquired_publish(packet_id, topic_name, contents, qos::exactly_once, retain);
+        return packet_id;
+    }
+
     /**
      * @brief Publish
      * @param topic_name
@@ -608,6 +839,49 @@ public:
         return packet_id;
     }
 
+    /**
+     * @brief Publish
+     * @param topic_name
+     *        A topic name to publish
+     * @param contents
+     *        The contents to publish. They are sent without copying, and the library holds
+     *        the reference until the packet is no longer needed. Don't modify them after calling.
+     * @param qos
+     *        mqtt::qos
+     * @param retain
+     *        A retain flag. If set it to true, the contents is retained.<BR>
+     *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718038<BR>
+     *        3.3.1.3 RETAIN
+     * @return packet_id. If qos is set to at_most_once, return 0.
+     * packet_id is automatically generated.
+     */
+    std::uint16_t publish(
+        std::string const& topic_name,
+        std::shared_ptr<std::string const> const& contents,
+        std::uint8_t qos = qos::at_most_once,
+        bool retain = false) {
+        std::uint16_t packet_id = qos == qos::at_most_once ? 0 : acquire_unique_packet_id();
+        acquired_publish(packet_id, topic_name, contents, qos, retain);
+        return packet_id;
+    }
+
+    /**
+     * @brief Publish the message that is encoded once for many endpoints
+     * @param p
+     *        The message to publish. Its contents are sent without copying.
+     * @param qos
+     *        mqtt::qos
+     * @return packet_id. If qos is set to at_most_once, return 0.
+     * packet_id is automatically generated.
+     */
+    std::uint16_t publish(
+        shared_publish const& p,
+        std::uint8_t qos = qos::at_most_once) {
+        std::uint16_t packet_id = qos == qos::at_most_once ? 0 : acquire_unique_packet_id();
+        acquired_publish(packet_id, p, qos);
+        return packet_id;
+    }
+
     /**
      * @brief Subscribe
      * @param topic_name
@@ -990,6 +1264,55 @@ public:
         send_publish(topic_name, qos, retain, false, packet_id, contents);
     }
 
+    /**
+     * @brief Publish with already acquired packet identifier
+     * @param packet_id
+     *        packet identifier. It should be acquired by acquire_unique_packet_id, or register_packet_id.
+     *        The ownership of  the packet_id moves to the library.
+     *        If qos == qos::at_most_once, packet_id must be 0. But not checked in release mode due to performance.
+     * @param topic_name
+     *        A topic name to publish
+     * @param contents
+     *        The contents to publish. They are sent without copying, and the library holds
+     *        the reference until the packet is no longer needed. Don't modify them after calling.
+     * @param qos
+     *        mqtt::qos
+     * @param retain
+     *        A retain flag. If set it to true, the contents is retained.<BR>
+     *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718038<BR>
+     *        3.3.1.3 RETAIN
+     */
+    void acquired_publish(
+        std::uint16_t packet_id,
+        std::string const& topic_name,
+        std::shared_ptr<std::string const> const& contents,
+        std::uint8_t qos = qos::at_most_once,
+        bool retain = false) {
+        BOOST_ASSERT((qos == qos::at_most_once && packet_id == 0) || (qos != qos::at_most_once && packet_id != 0));
+        send_publish(topic_name, qos, retain, false, packet_id, contents);
+    }
+
+    /**
+     * @brief Publish the message that is encoded once for many endpoints with already acquired packet identifier
+     * @param packet_id
+     *        packet identifier. It should be acquired by acquire_unique_packet_id, or register_packet_id.
+     *        The ownership of  the packet_id moves to the library.
+     *        If qos == qos::at_most_once, packet_id must be 0. But not checked in release mode due to performance.
+     * @param p
+     *        The message to publish. Its contents are sent without copying.
+     * @param qos
+     *        mqtt::qos
+     */
+    void acquired_publish(
+        std::uint16_t packet_id,
+        shared_publish const& p,
+        std::uint8_t qos = qos::at_most_once) {
+        BOOST_ASSERT((qos == qos::at_most_once && packet_id == 0) || (qos != qos::at_most_once && packet_id != 0));
+        send_buffer sb;
+        make_publish_variable_header(sb, p, qos, packet_id);
+        send_publish(sb, qos, p.retain(), false, packet_id, p.contents());
+    }
+
     /**
      * @brief Publish as dup with already acquired packet identifier
      * @param packet_id
@@ -1234,6 +1557,27 @@ public:
         acquired_async_publish(0, topic_name, contents, qos::at_most_once, retain, func);
     }
 
+    /**
+     * @brief Publish QoS0
+     * @param topic_name
+     *        A topic name to publish
+     * @param contents
+     *        The contents to publish. They are sent without copying, and the library holds
+     *        the reference until the packet is no longer needed. Don't modify them after calling.
+     * @param retain
+     *        A retain flag. If set it to true, the contents is retained.<BR>
+     *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718038<BR>
+     *        3.3.1.3 RETAIN
+     * @param func A callback function that is called when async operation will finish.
+     */
+    void async_publish_at_most_once(
+        std::string const& topic_name,
+        std::shared_ptr<std::string const> const& contents,
+        bool retain = false,
+        async_handler_t const& func = async_handler_t()) {
+        acquired_async_publish(0, topic_name, contents, qos::at_most_once, retain, func);
+    }
+
     /**
      * @brief Publish QoS1
      * @param topic_name
@@ -1258,6 +1602,31 @@ public:
         return packet_id;
     }
 
+    /**
+     * @brief Publish QoS1
+     * @param topic_name
+     *        A topic name to publish
+     * @param contents
+     *        The contents to publish. They are sent without copying, and the library holds
+     *        the reference until the packet is no longer needed. Don't modify them after calling.
+     * @param retain
+     *        A retain flag. If set it to true, the contents is retained.<BR>
+     *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718038<BR>
+     *        3.3.1.3 RETAIN
+     * @param func A callback function that is called when async operation will finish.
+     * @return packet_id
+     * packet_id is automatically generated.
+     */
+    std::uint16_t async_publish_at_least_once(
+        std::string const& topic_name,
+        std::shared_ptr<std::string const> const& contents,
+        bool retain = false,
+        async_handler_t const& func = async_handler_t()) {
+        std::uint16_t packet_id = acquire_unique_packet_id();
+        acquired_async_publish(packet_id, topic_name, contents, qos::at_least_once, retain, func);
+        return packet_id;
+    }
+
     /**
      * @brief Publish QoS2
      * @param topic_name
@@ -1282,6 +1651,31 @@ public:
         return packet_id;
     }
 
+    /**
+     * @brief Publish QoS2
+     * @param topic_name
+     *        A topic name to publish
+     * @param contents
+     *        The contents to publish. They are sent without copying, and the library holds
+     *        the reference until the packet is no longer needed. Don't modify them after calling.
+     * @param retain
+     *        A retain flag. If set it to true, the contents is retained.<BR>
+     *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718038<BR>
+     *        3.3.1.3 RETAIN
+     * @param func A callback function that is called when async operation will finish.
+     * @return packet_id
+     * packet_id is automatically generated.
+     */
+    std::uint16_t async_publish_exactly_once(
+        std::string const& topic_name,
+        std::shared_ptr<std::string const> const& contents,
+        bool retain = false,
+        async_handler_t const& func = async_handler_t()) {
+        std::uint16_t packet_id = acquire_unique_packet_id();
+        acquired_async_publish(packet_id, topic_name, contents, qos::exactly_once, retain, func);
+        return packet_id;
+    }
+
     /**
      * @brief Publish
      * @param topic_name
@@ -1310,12 +1704,59 @@ public:
     }
 
     /**
-     * @brief Subscribe
+     * @brief Publish
      * @param topic_name
-     *        A topic name to subscribe
+     *        A topic name to publish
+     * @param contents
+     *        The contents to publish. They are sent without copying, and the library holds
+     *        the reference until the packet is no longer needed. Don't modify them after calling.
      * @param qos
      *        mqtt::qos
-     * @param args
+     * @param retain
+     *        A retain flag. If set it to true, the contents is retained.<BR>
+     *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718038<BR>
+     *        3.3.1.3 RETAIN
+     * @param func A callback function that is called when async operation will finish.
+     * @return packet_id. If qos is set to at_most_once, return 0.
+     * packet_id is automatically generated.
+     */
+    std::uint16_t async_publish(
+        std::string const& topic_name,
+        std::shared_ptr<std::string const> const& contents,
+        std::uint8_t qos = qos::at_most_once,
+        bool retain = false,
+        async_handler_t const& func = async_handler_t()) {
+        std::uint16_t packet_id = qos == qos::at_most_once ? 0 : acquire_unique_packet_id();
+        acquired_async_publish(packet_id, topic_name, contents, qos, retain, func);
+        return packet_id;
+    }
+
+    /**
+     * @brief Publish the message that is encoded once for many endpoints
+     * @param p
+     *        The message to publish. Its contents are sent without copying.
+     * @param qos
+     *        mqtt::qos
+     * @param func A callback function that is called when async operation will finish.
+     * @return packet_id. If qos is set to at_most_once, return 0.
+     * packet_id is automatically generated.
+     */
+    std::uint16_t async_publish(
+        shared_publish const& p,
+        std::uint8_t qos = qos::at_most_once,
+        async_handler_t const& func = async_handler_t()) {
+        std::uint16_t packet_id = qos == qos::at_most_once ? 0 : acquire_unique_packet_id();
+        acquired_async_publish(packet_id, p, qos, func);
+        return packet_id;
+    }
+
+    /**
+     * @brief Subscribe
+     * @param topic_name
+     *        A topic name to subscribe
+     * @param qos
+     *        mqtt::qos
+     * @param args
      *        args should be some pairs of topic_name and qos to subscribe, <BR>
      *        and the last one is a callback function that is called when async operation will finish.
      * @return packet_id.
@@ -1792,6 +2233,59 @@ public:
         async_send_publish(topic_name, qos, retain, false, packet_id, contents, func);
     }
 
+    /**
+     * @brief Publish with a manual set packet identifier
+     * @param packet_id
+     *        packet identifier. It should be acquired by acquire_unique_packet_id, or register_packet_id.
+     *        The ownership of  the packet_id moves to the library.
+     *        If qos == qos::at_most_once, packet_id must be 0. But not checked in release mode due to performance.
+     * @param topic_name
+     *        A topic name to publish
+     * @param contents
+     *        The contents to publish. They are sent without copying, and the library holds
+     *        the reference until the packet is no longer needed. Don't modify them after calling.
+     * @param qos
+     *        mqtt::qos
+     * @param retain
+     *        A retain flag. If set it to true, the contents is retained.<BR>
+     *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718038<BR>
+     *        3.3.1.3 RETAIN
+     * @param func A callback function that is called when async operation will finish.
+     */
+    void acquired_async_publish(
+        std::uint16_t packet_id,
+        std::string const& topic_name,
+        std::shared_ptr<std::string const> const& contents,
+        std::uint8_t qos = qos::at_most_once,
+        bool retain = false,
+        async_handler_t const& func = async_handler_t()) {
+        BOOST_ASSERT((qos == qos::at_most_once && packet_id == 0) || (qos != qos::at_most_once && packet_id != 0));
+        async_send_publish(topic_name, qos, retain, false, packet_id, contents, func);
+    }
+
+    /**
+     * @brief Publish the message that is encoded once for many endpoints with a manual set packet identifier
+     * @param packet_id
+     *        packet identifier. It should be acquired by acquire_unique_packet_id, or register_packet_id.
+     *        The ownership of  the packet_id moves to the library.
+     *        If qos == qos::at_most_once, packet_id must be 0. But not checked in release mode due to performance.
+     * @param p
+     *        The message to publish. Its contents are sent without copying.
+     * @param qos
+     *        mqtt::qos
+     * @param func A callback function that is called when async operation will finish.
+     */
+    void acquired_async_publish(
+        std::uint16_t packet_id,
+        shared_publish const& p,
+        std::uint8_t qos = qos::at_most_once,
+        async_handler_t const& func = async_handler_t()) {
+        BOOST_ASSERT((qos == qos::at_most_once && packet_id == 0) || (qos != qos::at_most_once && packet_id != 0));
+        send_buffer sb;
+        make_publish_variable_header(sb, p, qos, packet_id);
+        async_send_publish(sb, qos, p.retain(), false, packet_id, p.contents(), func);
+    }
+
     /**
      * @brief Publish as dup with a manual set packet identifier
      * @param packet_id
@@ -2084,11 +2578,13 @@ public:
 
     bool handle_close_or_error(boost::system::error_code const& ec) {
         if (!ec) return false;
+        clear_read_buffer();
         if (connected_) {
             connected_ = false;
             mqtt_connected_ = false;
             shutdown_from_server(*socket_);
         }
+        release_waiting_handlers();
         if (ec == as::error::eof ||
             ec == as::error::connection_reset
 #if defined(MQTT_USE_WS)
@@ -2120,16 +2616,37 @@ public:
         return connected_;
     }
 
+    /**
+     * @brief Get the time when the last write to the socket has been finished.
+     * @return the time point. If nothing has been written, it is the epoch of steady_clock.
+     */
+    std::chrono::steady_clock::time_point last_write_time() const {
+        return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(last_write_.load()));
+    }
+
     void set_connect() {
+        clear_read_buffer();
         connected_ = true;
     }
 
     void clear_stored_publish(std::uint16_t packet_id) {
-        LockGuard<Mutex> lck (store_mtx_);
-        auto& idx = store_.template get<tag_packet_id>();
-        auto r = idx.equal_range(packet_id);
-        idx.erase(std::get<0>(r), std::get<1>(r));
-        packet_id_.erase(packet_id);
+        async_handler_t dropped;
+        {
+            LockGuard<Mutex> lck (store_mtx_);
+            auto it = std::find_if(
+                waiting_publishes_.begin(),
+                waiting_publishes_.end(),
+                [packet_id](waiting_publish const& wp) { return wp.packet_id == packet_id; });
+            bool waiting = it != waiting_publishes_.end();
+            if (waiting) {
+                dropped = std::move(it->func);
+                waiting_publishes_.erase(it);
+            }
+            if (store_erase(packet_id) && !waiting) leave_inflight();
+            release_packet_id_locked(packet_id);
+        }
+        if (dropped) dropped(as::error::operation_aborted);
+        send_waiting_publishes();
     }
 
     std::unique_ptr<Socket>& socket() {
@@ -2142,61 +2659,138 @@ public:
     template <typename F>
     void for_each_store(F&& f) {
         LockGuard<Mutex> lck (store_mtx_);
-        auto& idx = store_.template get<tag_seq>();
-        for (auto const & e : idx) {
-            f(e.ptr(), e.size());
-        }
+        store_.for_each(
+            [&f]
+            (store const& e) {
+                if (e.contents()) {
+                    // The shared contents are sent separately from the header.
+                    // Make a contiguous copy to pass the whole packet.
+                    std::string whole;
+                    whole.reserve(e.size() + e.contents()->size());
+                    whole.append(e.ptr(), e.size());
+                    whole.append(*e.contents());
+                    f(whole.data(), whole.size());
+                }
+                else {
+                    f(e.ptr(), e.size());
+                }
+            }
+        );
     }
 
     // manual packet_id management for advanced users
 
     std::uint16_t acquire_unique_packet_id() {
         LockGuard<Mutex> lck (store_mtx_);
-        if (packet_id_.size() == 0xffff - 1) throw packet_id_exhausted_error();
-        do {
-            if (++packet_id_master_ == 0) ++packet_id_master_;
-        } while (!packet_id_.insert(packet_id_master_).second);
-        return packet_id_master_;
+        auto packet_id = packet_id_.acquire();
+        if (ss_) ss_->use_packet_id(packet_id);
+        return packet_id;
     }
 
     bool register_packet_id(std::uint16_t packet_id) {
         if (packet_id == 0) return false;
         LockGuard<Mutex> lck (store_mtx_);
-        return packet_id_.insert(packet_id).second;
+        if (!packet_id_.register_id(packet_id)) return false;
+        if (ss_) ss_->use_packet_id(packet_id);
+        return true;
     }
 
     // Only the packet_id gotten by acquire_unique_packet_id, or
     // register_packet_id is permitted.
     bool release_packet_id(std::uint16_t packet_id) {
         LockGuard<Mutex> lck (store_mtx_);
-        return packet_id_.erase(packet_id);
+        return release_packet_id_locked(packet_id);
     }
 
 protected:
     void async_read_control_packet_type(async_handler_t const& func) {
+        if (!handle_read_buffer(func)) return;
+        prepare_read_buffer();
         auto self = this->shared_from_this();
-        async_read(
+        async_read_socket(
             *socket_,
-            as::buffer(&buf_, 1),
             strand_.wrap(
-                [this, self, func](
-                    boost::system::error_code const& ec,
-                    std::size_t bytes_transferred){
-                    if (handle_close_or_error(ec)) {
-                        if (func) func(ec);
-                        return;
-                    }
-                    if (bytes_transferred != 1) {
-                        if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                        return;
+                make_custom_alloc_handler(
+                    read_handler_memory_,
+                    [this, self, func](
+                        boost::system::error_code const& ec,
+                        std::size_t bytes_transferred){
+                        if (handle_close_or_error(ec)) {
+                            if (func) func(ec);
+                            return;
+                        }
+                        if (bytes_transferred == 0) {
+                            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
+                            return;
+                        }
+                        read_end_ += bytes_transferred;
+                        async_read_control_packet_type(func);
                     }
-                    handle_control_packet_type(func);
-                }
+                )
             )
         );
     }
 
 private:
+    function_handlers& compat_handlers() {
+        static_assert(
+            std::is_base_of<function_handlers, Handlers>::value,
+            "set_*_handler requires function_handlers as the handler policy");
+        return handlers_;
+    }
+
+    template <typename T, typename ReadHandler>
+    void async_read_socket(T& socket, ReadHandler&& h) {
+        socket.async_read_some(
+            as::buffer(&read_buf_[read_end_], read_buf_.size() - read_end_),
+            std::forward<ReadHandler>(h));
+    }
+
+#if defined(MQTT_USE_WS)
+    // The websocket message is read directly into the receive buffer.
+    template <typename T, typename ReadHandler>
+    void async_read_socket(ws_endpoint<T>& socket, ReadHandler&& h) {
+        socket.async_read_into(read_buf_, read_end_, std::forward<ReadHandler>(h));
+    }
+#endif // defined(MQTT_USE_WS)
+
+    // The following functions should be called with store_mtx_ locked.
+    // They also record the changes to the session store.
+    void store_emplace(
+        std::uint16_t packet_id,
+        std::uint8_t expected_control_packet_type,
+        std::shared_ptr<std::string> const& buf,
+        char* ptr,
+        std::size_t size,
+        std::shared_ptr<std::string const> const& contents = nullptr) {
+        store_.emplace(packet_id, expected_control_packet_type, buf, ptr, size, contents);
+        if (ss_) {
+            ss_->add_packet(
+                packet_id,
+                expected_control_packet_type,
+                boost::string_ref(ptr, size),
+                contents ? boost::string_ref(*contents) : boost::string_ref());
+        }
+    }
+
+    std::size_t store_erase(std::uint16_t packet_id, std::uint8_t expected_control_packet_type) {
+        auto erased = store_.erase(packet_id, expected_control_packet_type);
+        if (ss_) ss_->erase_packet(packet_id, expected_control_packet_type);
+        return erased;
+    }
+
+    std::size_t store_erase(std::uint16_t packet_id) {
+        auto erased = store_.erase(packet_id);
+        if (ss_) ss_->erase_packets(packet_id);
+        return erased;
+    }
+
+    bool release_packet_id_locked(std::uint16_t packet_id) {
+        if (!packet_id_.release(packet_id)) return false;
+        if (ss_) ss_->release_packet_id(packet_id);
+        return true;
+    }
+
     template <typename T>
     void shutdown_from_client(T& socket) {
         boost::system::error_code ec;
@@ -2215,6 +2809,18 @@ private:
     }
 #endif // defined(MQTT_USE_WS)
 
+#if defined(MQTT_USE_IO_URING)
+    // The receive in the kernel is cancelled by io_uring_socket::close().
+    void shutdown_from_client(io_uring_socket& socket) {
+        boost::system::error_code ec;
+        socket.close(ec);
+    }
+    void shutdown_from_server(io_uring_socket& socket) {
+        boost::system::error_code ec;
+        socket.close(ec);
+    }
+#endif // defined(MQTT_USE_IO_URING)
+
 #if !defined(MQTT_NO_TLS)
     template <typename T>
     void shutdown_from_client(as::ssl::stream<T>& socket) {
@@ -2343,38 +2949,59 @@ private:
             return buf_;
         }
 
-        std::tuple<char*, std::size_t> finalize(std::uint8_t fixed_header) {
-            auto rb = remaining_bytes(buf_->size() - payload_position_);
-            std::size_t start_position = payload_position_ - rb.size() - 1;
-            (*buf_)[start_position] = fixed_header;
-            buf_->replace(start_position + 1, rb.size(), rb);
+        std::tuple<char*, std::size_t> finalize(std::uint8_t fixed_header, std::size_t contents_size = 0) {
+            auto remaining_length = buf_->size() - payload_position_ + contents_size;
+            if (remaining_length > codec::max_remaining_length) throw remaining_length_error();
+            std::size_t start_position = payload_position_ - codec::remaining_length_size(remaining_length) - 1;
+            codec::encode_fixed_header(&(*buf_)[start_position], fixed_header, remaining_length);
             return std::make_tuple(
                 &(*buf_)[start_position],
                 buf_->size() - start_position);
         }
+
+        // Encode a packet that fits in the space reserved for the fixed header, such as
+        // the packets that have only a packet identifier. f(char* out) returns the written size.
+        template <typename F>
+        std::tuple<char*, std::size_t> encode(F&& f) {
+            auto size = f(&(*buf_)[0]);
+            return std::make_tuple(&(*buf_)[0], size);
+        }
     private:
         static constexpr std::size_t const payload_position_ = 5;
         std::shared_ptr<std::string> buf_;
     };
 
+    // A packet consists of the bytes [ptr, ptr + size) in buf and the optional shared contents
+    // that follow them on the wire.
     class packet {
     public:
         packet(
             std::shared_ptr<std::string> const& b = nullptr,
             char* p = nullptr,
-            std::size_t s = 0)
+            std::size_t s = 0,
+            std::shared_ptr<std::string const> const& c = nullptr)
             :
             buf_(b),
             ptr_(p),
-            size_(s) {}
+            size_(s),
+            contents_(c) {}
         std::shared_ptr<std::string> const& buf() const { return buf_; }
         char const* ptr() const { return ptr_; }
         char* ptr() { return ptr_; }
         std::size_t size() const { return size_; }
+        std::shared_ptr<std::string const> const& contents() const { return contents_; }
+        std::size_t total_size() const { return size_ + (contents_ ? contents_->size() : 0); }
+        std::array<as::const_buffer, 2> buffers() const {
+            return {{
+                as::const_buffer(ptr_, size_),
+                contents_ ? as::const_buffer(contents_->data(), contents_->size()) : as::const_buffer()
+            }};
+        }
     private:
         std::shared_ptr<std::string> buf_;
         char* ptr_;
         std::size_t size_;
+        std::shared_ptr<std::string const> contents_;
     };
 
     struct store {
@@ -2383,137 +3010,168 @@ private:
             std::uint8_t type,
             std::shared_ptr<std::string> const& b = nullptr,
             char* p = nullptr,
-            std::size_t s = 0)
+            std::size_t s = 0,
+            std::shared_ptr<std::string const> const& c = nullptr)
             :
             packet_id_(id),
             expected_control_packet_type_(type),
-            packet_(b, p, s) {}
+            packet_(b, p, s, c) {}
         std::uint16_t packet_id() const { return packet_id_; }
         std::uint8_t expected_control_packet_type() const { return expected_control_packet_type_; }
         std::shared_ptr<std::string> const& buf() const { return packet_.buf(); }
         char const* ptr() const { return packet_.ptr(); }
         char* ptr() { return packet_.ptr(); }
         std::size_t size() const { return packet_.size(); }
+        std::shared_ptr<std::string const> const& contents() const { return packet_.contents(); }
+        std::array<as::const_buffer, 2> buffers() const { return packet_.buffers(); }
     private:
         std::uint16_t packet_id_;
         std::uint8_t expected_control_packet_type_;
         packet packet_;
     };
 
-    struct tag_packet_id {};
-    struct tag_packet_id_type {};
-    struct tag_seq {};
-    using mi_store = mi::multi_index_container<
-        store,
-        mi::indexed_by<
-            mi::ordered_unique<
-                mi::tag<tag_packet_id_type>,
-                mi::composite_key<
-                    store,
-                    mi::const_mem_fun<
-                        store, std::uint16_t,
-                        &store::packet_id
-                    >,
-                    mi::const_mem_fun<
-                        store, std::uint8_t,
-                        &store::expected_control_packet_type
-                    >
-                >
-            >,
-            mi::ordered_non_unique<
-                mi::tag<tag_packet_id>,
-                mi::const_mem_fun<
-                    store, std::uint16_t,
-                    &store::packet_id
-                >
-            >,
-            mi::sequenced<
-                mi::tag<tag_seq>
-            >
-        >
-    >;
-
-    void handle_control_packet_type(async_handler_t const& func) {
-        fixed_header_ = static_cast<std::uint8_t>(buf_);
-        remaining_length_ = 0;
-        remaining_length_multiplier_ = 1;
-        auto self = this->shared_from_this();
-        async_read(
-            *socket_,
-            as::buffer(&buf_, 1),
-            strand_.wrap(
-                [this, self, func](
-                    boost::system::error_code const& ec,
-                    std::size_t bytes_transferred){
-                    if (handle_close_or_error(ec)) {
-                        if (func) func(ec);
-                        return;
-                    }
-                    if (bytes_transferred != 1) {
-                        if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                        return;
-                    }
-                    handle_remaining_length(func);
-                }
-            )
-        );
+    void enter_inflight() {
+        if (++inflight_ > peak_inflight_) peak_inflight_ = inflight_;
     }
 
-    void handle_remaining_length(async_handler_t const& func) {
-        remaining_length_ += (buf_ & 0b01111111) * remaining_length_multiplier_;
-        remaining_length_multiplier_ *= 128;
-        if (remaining_length_multiplier_ > 128 * 128 * 128 * 128) throw remaining_length_error();
-        auto self = this->shared_from_this();
-        if (buf_ & 0b10000000) {
-            async_read(
-                *socket_,
-                as::buffer(&buf_, 1),
-                strand_.wrap(
-                    [this, self, func](
-                        boost::system::error_code const& ec,
-                        std::size_t bytes_transferred){
-                        if (handle_close_or_error(ec)) {
-                            if (func) func(ec);
-                            return;
-                        }
-                        if (bytes_transferred != 1) {
-                            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                            return;
-                        }
-                        handle_remaining_length(func);
-                    }
-                )
-            );
+    void leave_inflight() {
+        if (inflight_ != 0) --inflight_;
+    }
+
+    // A stored QoS1 or QoS2 publish whose write waits for the in-flight window.
+    struct waiting_publish {
+        std::uint16_t packet_id;
+        packet pkt;
+        bool async;
+        async_handler_t func;
+    };
+
+    // Store the QoS1 or QoS2 publish, and record it to the session store.
+    // Returns true if the publish can be written now. Otherwise the write waits for the window.
+    bool store_publish(
+        std::uint16_t packet_id,
+        std::uint8_t qos,
+        packet& p,
+        bool async,
+        async_handler_t const& func) {
+        LockGuard<Mutex> lck (store_mtx_);
+        store_emplace(
+            packet_id,
+            qos == qos::at_least_once ? control_packet_type::puback
+                                      : control_packet_type::pubrec,
+            p.buf(),
+            p.ptr(),
+            p.size(),
+            p.contents());
+        if (max_inflight_ == 0 || (inflight_ < max_inflight_ && waiting_publishes_.empty())) {
+            enter_inflight();
+            return true;
         }
-        else {
-            payload_.resize(remaining_length_);
-            if (remaining_length_ == 0) {
-                handle_payload(func);
-                return;
+        waiting_publishes_.push_back(waiting_publish { packet_id, p, async, func });
+        ++total_waited_;
+        return false;
+    }
+
+    // Write the waiting publishes while the window has room.
+    void send_waiting_publishes() {
+        while (true) {
+            waiting_publish wp;
+            {
+                LockGuard<Mutex> lck (store_mtx_);
+                if (waiting_publishes_.empty()) return;
+                if (max_inflight_ != 0 && inflight_ >= max_inflight_) return;
+                wp = std::move(waiting_publishes_.front());
+                waiting_publishes_.pop_front();
+                enter_inflight();
+            }
+            if (wp.async) {
+                do_async_write(wp.pkt.buf(), wp.pkt.ptr(), wp.pkt.size(), wp.pkt.contents(), wp.func);
+            }
+            else {
+                write_stored_publish(wp.pkt);
+            }
+        }
+    }
+
+    // The waiting publishes stay stored and wait for the next connection.
+    // Their handlers are called as for the publishes made while disconnected.
+    void release_waiting_handlers() {
+        std::vector<async_handler_t> funcs;
+        {
+            LockGuard<Mutex> lck (store_mtx_);
+            for (auto& wp : waiting_publishes_) {
+                if (!wp.func) continue;
+                funcs.push_back(std::move(wp.func));
+                wp.func = nullptr;
+            }
+        }
+        call_handlers(funcs, boost::system::errc::make_error_code(boost::system::errc::success));
+    }
+
+    // Remove the waiting publishes from the queue.
+    // Should be called with store_mtx_ locked. The returned handlers should be called without it.
+    std::vector<async_handler_t> take_waiting_publishes() {
+        std::vector<async_handler_t> funcs;
+        for (auto& wp : waiting_publishes_) {
+            if (wp.func) funcs.push_back(std::move(wp.func));
+        }
+        waiting_publishes_.clear();
+        return funcs;
+    }
+
+    static void call_handlers(std::vector<async_handler_t> const& funcs, boost::system::error_code const& ec) {
+        for (auto const& func : funcs) func(ec);
+    }
+
+    // Handle all complete packets in the receive buffer.
+    // Returns true if the caller should continue receiving.
+    bool handle_read_buffer(async_handler_t const& func) {
+        while (connected_) {
+            char const* p = &read_buf_[read_begin_];
+            codec::frame f;
+            if (!codec::parse_frame(p, read_end_ - read_begin_, f)) {
+                if (f.size != 0 && read_buf_.size() - read_begin_ < f.size) {
+                    compact_read_buffer();
+                    if (read_buf_.size() < f.size) read_buf_.resize(f.size);
+                }
+                return true;
+            }
+            fixed_header_ = f.fixed_header;
+            payload_ = f.body;
+            read_begin_ += f.size;
+            if (!handle_payload(func)) {
+                if (func) func(boost::system::errc::make_error_code(boost::system::errc::success));
+                return false;
             }
-            async_read(
-                *socket_,
-                as::buffer(payload_),
-                strand_.wrap(
-                    [this, self, func](
-                        boost::system::error_code const& ec,
-                        std::size_t bytes_transferred){
-                        if (handle_close_or_error(ec)) {
-                            if (func) func(ec);
-                            return;
-                        }
-                        if (bytes_transferred != remaining_length_) {
-                            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                            return;
-                        }
-                        handle_payload(func);
-                    }
-                )
-            );
         }
+        return true;
     }
 
-    void handle_payload(async_handler_t const& func) {
+    // Move the unhandled bytes to the front of the receive buffer
+    // if the rest of the buffer is not enough to receive them.
+    void prepare_read_buffer() {
+        if (read_begin_ == read_end_) {
+            read_begin_ = 0;
+            read_end_ = 0;
+            return;
+        }
+        if (read_end_ < read_buf_.size() && read_buf_.size() - read_end_ >= read_buf_.size() / 4) return;
+        compact_read_buffer();
+    }
+
+    void compact_read_buffer() {
+        if (read_begin_ == 0) return;
+        std::memmove(&read_buf_[0], &read_buf_[read_begin_], read_end_ - read_begin_);
+        read_end_ -= read_begin_;
+        read_begin_ = 0;
+    }
+
+    void clear_read_buffer() {
+        read_begin_ = 0;
+        read_end_ = 0;
+    }
+
+    bool handle_payload(async_handler_t const& func) {
         auto control_packet_type = get_control_packet_type(fixed_header_);
         bool ret = false;
         switch (control_packet_type) {
@@ -2585,154 +3243,100 @@ private:
         default:
             break;
         }
-        if (ret) async_read_control_packet_type(func);
-        else if (func) func(boost::system::errc::make_error_code(boost::system::errc::success));
+        return ret;
     }
 
     void handle_close() {
-        if (h_close_) h_close_();
+        handlers_.on_close(*this);
     }
 
     void handle_error(boost::system::error_code const& ec) {
-        if (h_error_) h_error_(ec);
+        handlers_.on_error(*this, ec);
     }
 
     bool handle_connect(async_handler_t const& func) {
-        std::size_t i = 0;
-        if (remaining_length_ < 10 ||
-            payload_[i++] != 0x00 ||
-            payload_[i++] != 0x04 ||
-            payload_[i++] != 'M' ||
-            payload_[i++] != 'Q' ||
-            payload_[i++] != 'T' ||
-            payload_[i++] != 'T' ||
-            payload_[i++] != 0x04) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::protocol_error));
-            return false;
-        }
-        char byte8 = payload_[i++];
-
-        std::uint16_t keep_alive;
-        keep_alive = make_uint16_t(payload_[i], payload_[i + 1]);
-        i += 2;
-
-        if (remaining_length_ < i + 2) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-            return false;
-        }
-
-        std::uint16_t client_id_length;
-        client_id_length = make_uint16_t(payload_[i], payload_[i + 1]);
-        i += 2;
-        if (remaining_length_ < i + client_id_length) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
+        codec::connect_packet p;
+        if (auto ec = codec::decode_connect(payload_, p)) {
+            if (func) func(ec);
             return false;
         }
-        std::string client_id(payload_.data() + i, client_id_length);
-        i += client_id_length;
-
-        bool clean_session = connect_flags::has_clean_session(byte8);
         boost::optional<will> w;
-        if (connect_flags::has_will_flag(byte8)) {
-            std::uint16_t topic_name_length;
-            topic_name_length = make_uint16_t(payload_[i], payload_[i + 1]);
-            i += 2;
-            if (remaining_length_ < i + topic_name_length) {
-                if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                return false;
-            }
-            std::string topic_name(payload_.data() + i, topic_name_length);
-            i += topic_name_length;
-            std::uint16_t will_message_length;
-            will_message_length = make_uint16_t(payload_[i], payload_[i + 1]);
-            i += 2;
-            if (remaining_length_ < i + will_message_length) {
-                if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                return false;
-            }
-            std::string will_message(payload_.data() + i, topic_name_length);
-            i += will_message_length;
-            w = will(topic_name,
-                     will_message,
-                     connect_flags::has_will_retain(byte8),
-                     connect_flags::will_qos(byte8));
+        if (p.will_flag) {
+            w = will(std::string(p.will_topic.data(), p.will_topic.size()),
+                     std::string(p.will_message.data(), p.will_message.size()),
+                     p.will_retain,
+                     p.will_qos);
         }
         boost::optional<std::string> user_name;
-        if (connect_flags::has_user_name_flag(byte8)) {
-            std::uint16_t user_name_length;
-            user_name_length = make_uint16_t(payload_[i], payload_[i + 1]);
-            i += 2;
-            if (remaining_length_ < i + user_name_length) {
-                if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                return false;
-            }
-            user_name = std::string(payload_.data() + i, user_name_length);
-            i += user_name_length;
-        }
+        if (p.user_name) user_name = std::string(p.user_name->data(), p.user_name->size());
         boost::optional<std::string> password;
-        if (connect_flags::has_password_flag(byte8)) {
-            std::uint16_t password_length;
-            password_length = make_uint16_t(payload_[i], payload_[i + 1]);
-            i += 2;
-            if (remaining_length_ < i + password_length) {
-                if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                return false;
-            }
-            password = std::string(payload_.data() + i, password_length);
-            i += password_length;
-        }
+        if (p.password) password = std::string(p.password->data(), p.password->size());
         mqtt_connected_ = true;
-        if (h_connect_) {
-            if (h_connect_(client_id, user_name, password, std::move(w), clean_session, keep_alive)) {
-                return true;
-            }
-            return false;
-        }
-        return true;
+        return handlers_.on_connect(
+            *this,
+            std::string(p.client_id.data(), p.client_id.size()),
+            user_name,
+            password,
+            std::move(w),
+            p.clean_session,
+            p.keep_alive);
     }
 
     bool handle_connack(async_handler_t const& func) {
-        if (remaining_length_ != 2) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
+        codec::connack_packet p;
+        if (auto ec = codec::decode_connack(payload_, p)) {
+            if (func) func(ec);
             return false;
         }
-        if (static_cast<std::uint8_t>(payload_[1]) == connect_return_code::accepted) {
+        if (p.return_code == connect_return_code::accepted) {
             if (clean_session_) {
-                LockGuard<Mutex> lck (store_mtx_);
-                store_.clear();
+                std::vector<async_handler_t> dropped;
+                {
+                    LockGuard<Mutex> lck (store_mtx_);
+                    // The packet_ids of the dropped packets are no longer in use.
+                    store_.for_each(
+                        [this](store const& e) {
+                            release_packet_id_locked(e.packet_id());
+                        }
+                    );
+                    store_.clear();
+                    inflight_ = 0;
+                    dropped = take_waiting_publishes();
+                    if (ss_) ss_->clear_packets();
+                }
+                call_handlers(dropped, as::error::operation_aborted);
             }
             else {
                 LockGuard<Mutex> lck (store_mtx_);
-                auto& idx = store_.template get<tag_seq>();
-                auto it = idx.begin();
-                auto end = idx.end();
-                while (it != end) {
-                    if (it->buf()) {
-                        idx.modify(
-                            it,
-                            [this](store& e){
-                                if (e.expected_control_packet_type() == control_packet_type::puback ||
-                                    e.expected_control_packet_type() == control_packet_type::pubrec) {
-                                    *e.ptr() |= 0b00001000; // set DUP flag
-                                }
-                                // I choose sync write intentionaly.
-                                // If calling do_async_write, and then disconnected,
-                                // strand object would be dangling references.
-                                this->do_sync_write(e.ptr(), e.size());
-                            }
-                        );
-                        ++it;
-                    }
-                    else {
-                        it = idx.erase(it);
+                // The waiting publishes are written later through the in-flight window.
+                std::set<std::uint16_t> waiting;
+                for (auto const& wp : waiting_publishes_) waiting.insert(wp.packet_id);
+                store_.update_each(
+                    [this, &waiting](store& e){
+                        if (!e.buf()) {
+                            if (ss_) ss_->erase_packet(e.packet_id(), e.expected_control_packet_type());
+                            return false;
+                        }
+                        if (e.expected_control_packet_type() != control_packet_type::pubcomp &&
+                            waiting.count(e.packet_id())) {
+                            return true;
+                        }
+                        if (e.expected_control_packet_type() == control_packet_type::puback ||
+                            e.expected_control_packet_type() == control_packet_type::pubrec) {
+                            *e.ptr() |= 0b00001000; // set DUP flag
+                        }
+                        // I choose sync write intentionaly.
+                        // If calling do_async_write, and then disconnected,
+                        // strand object would be dangling references.
+                        this->do_sync_write(e.buffers());
+                        return true;
                     }
-                }
+                );
             }
         }
-        bool session_present = is_session_present(payload_[0]);
+        send_waiting_publishes();
         mqtt_connected_ = true;
-        if (h_connack_) return h_connack_(session_present, static_cast<std::uint8_t>(payload_[1]));
-        return true;
+        return handlers_.on_connack(*this, p.session_present, p.return_code);
     }
 
     template <typename F, typename AF>
@@ -2744,85 +3348,48 @@ private:
     }
 
     bool handle_publish(async_handler_t const& func) {
-        if (remaining_length_ < 2) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-            return false;
-        }
-        std::size_t i = 0;
-        std::uint16_t topic_name_length = make_uint16_t(payload_[i], payload_[i + 1]);
-        i += 2;
-        if (remaining_length_ < i + topic_name_length) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
+        codec::publish_packet p;
+        if (auto ec = codec::decode_publish(fixed_header_, payload_, p)) {
+            if (func) func(ec);
             return false;
         }
-        std::string topic_name(payload_.data() + i, topic_name_length);
-        i += topic_name_length;
-        boost::optional<std::uint16_t> packet_id;
-        auto qos = publish::get_qos(fixed_header_);
-        switch (qos) {
+        auto const& packet_id = p.packet_id;
+        switch (publish::get_qos(fixed_header_)) {
         case qos::at_most_once:
-            if (h_publish_) {
-                std::string contents(payload_.data() + i, payload_.size() - i);
-                return h_publish_(fixed_header_, packet_id, std::move(topic_name), std::move(contents));
-            }
-            break;
+            return call_publish_handler(packet_id, p.topic_name, p.contents);
         case qos::at_least_once: {
-            if (remaining_length_ < i + 2) {
-                if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                return false;
-            }
-            packet_id = make_uint16_t(payload_[i], payload_[i + 1]);
-            i += 2;
-            auto res = [this, &packet_id, &func] {
-                auto_pub_response(
-                    [this, &packet_id] {
-                        if (connected_) send_puback(*packet_id);
-                    },
-                    [this, &packet_id, &func] {
-                        if (connected_) async_send_puback(*packet_id, func);
-                    }
-                );
-            };
-            if (h_publish_) {
-                std::string contents(payload_.data() + i, payload_.size() - i);
-                if (h_publish_(fixed_header_, packet_id, std::move(topic_name), std::move(contents))) {
-                    res();
-                    return true;
+            if (!call_publish_handler(packet_id, p.topic_name, p.contents)) return false;
+            auto_pub_response(
+                [this, &packet_id] {
+                    if (connected_) send_puback(*packet_id);
+                },
+                [this, &packet_id, &func] {
+                    if (connected_) async_send_puback(*packet_id, func);
                 }
-                return false;
-            }
-            res();
+            );
         } break;
         case qos::exactly_once: {
-            if (remaining_length_ < i + 2) {
-                if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                return false;
+            bool handled;
+            {
+                LockGuard<Mutex> lck (store_mtx_);
+                handled = qos2_publish_handled_.find(*packet_id) != qos2_publish_handled_.end();
             }
-            packet_id = make_uint16_t(payload_[i], payload_[i + 1]);
-            i += 2;
-            auto res = [this, &packet_id, &func] {
-                auto_pub_response(
-                    [this, &packet_id] {
-                        if (connected_) send_pubrec(*packet_id);
-                    },
-                    [this, &packet_id, &func] {
-                        if (connected_) async_send_pubrec(*packet_id, func);
-                    }
-                );
-            };
-            auto it = qos2_publish_handled_.find(*packet_id);
-            if (it == qos2_publish_handled_.end()) {
-                std::string contents(payload_.data() + i, payload_.size() - i);
-                if (h_publish_) {
-                    std::string contents(payload_.data() + i, payload_.size() - i);
-                    if (h_publish_(fixed_header_, packet_id, std::move(topic_name), std::move(contents))) {
-                        res();
-                        return true;
-                    }
-                    return false;
-                }
+            if (!handled) {
+                // The handler is called without the lock because it may call the endpoint.
+                if (!call_publish_handler(packet_id, p.topic_name, p.contents)) return false;
+                // The resent PUBLISH with the same packet_id is not delivered again until PUBREL.
+                LockGuard<Mutex> lck (store_mtx_);
+                qos2_publish_handled_.insert(*packet_id);
+                if (ss_) ss_->add_qos2_publish_handled(*packet_id);
             }
-            res();
+            auto_pub_response(
+                [this, &packet_id] {
+                    if (connected_) send_pubrec(*packet_id);
+                },
+                [this, &packet_id, &func] {
+                    if (connected_) async_send_pubrec(*packet_id, func);
+                }
+            );
         } break;
         default:
             break;
@@ -2830,34 +3397,40 @@ private:
         return true;
     }
 
-    bool handle_puback(async_handler_t const& func) {
-        if (remaining_length_ != 2) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
+    bool call_publish_handler(
+        boost::optional<std::uint16_t> const& packet_id,
+        boost::string_ref topic_name,
+        boost::string_ref contents) {
+        return handlers_.on_publish(*this, fixed_header_, packet_id, topic_name, contents);
+    }
+
+    // Decode the packet identifier of PUBACK, PUBREC, PUBREL, PUBCOMP and UNSUBACK.
+    bool decode_packet_id(async_handler_t const& func, std::uint16_t& packet_id) {
+        if (auto ec = codec::decode_packet_id(payload_, packet_id)) {
+            if (func) func(ec);
             return false;
         }
-        std::uint16_t packet_id = make_uint16_t(payload_[0], payload_[1]);
+        return true;
+    }
+
+    bool handle_puback(async_handler_t const& func) {
+        std::uint16_t packet_id;
+        if (!decode_packet_id(func, packet_id)) return false;
         {
             LockGuard<Mutex> lck (store_mtx_);
-            auto& idx = store_.template get<tag_packet_id_type>();
-            auto r = idx.equal_range(std::make_tuple(packet_id, control_packet_type::puback));
-            idx.erase(std::get<0>(r), std::get<1>(r));
-            packet_id_.erase(packet_id);
+            if (store_erase(packet_id, control_packet_type::puback)) leave_inflight();
+            release_packet_id_locked(packet_id);
         }
-        if (h_puback_) return h_puback_(packet_id);
-        return true;
+        send_waiting_publishes();
+        return handlers_.on_puback(*this, packet_id);
     }
 
     bool handle_pubrec(async_handler_t const& func) {
-        if (remaining_length_ != 2) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-            return false;
-        }
-        std::uint16_t packet_id = make_uint16_t(payload_[0], payload_[1]);
+        std::uint16_t packet_id;
+        if (!decode_packet_id(func, packet_id)) return false;
         {
             LockGuard<Mutex> lck (store_mtx_);
-            auto& idx = store_.template get<tag_packet_id_type>();
-            auto r = idx.equal_range(std::make_tuple(packet_id, control_packet_type::pubrec));
-            idx.erase(std::get<0>(r), std::get<1>(r));
+            store_erase(packet_id, control_packet_type::pubrec);
             // packet_id shouldn't be erased here.
             // It is reused for pubrel/pubcomp.
         }
@@ -2873,23 +3446,14 @@ private:
                 }
             );
         };
-        if (h_pubrec_) {
-            if (h_pubrec_(packet_id)) {
-                res();
-                return true;
-            }
-            return false;
-        }
+        if (!handlers_.on_pubrec(*this, packet_id)) return false;
         res();
         return true;
     }
 
     bool handle_pubrel(async_handler_t const& func) {
-        if (remaining_length_ != 2) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-            return false;
-        }
-        std::uint16_t packet_id = make_uint16_t(payload_[0], payload_[1]);
+        std::uint16_t packet_id;
+        if (!decode_packet_id(func, packet_id)) return false;
         auto res = [this, &packet_id, &func] {
             auto_pub_response(
                 [this, &packet_id] {
@@ -2900,159 +3464,111 @@ private:
                 }
             );
         };
-        qos2_publish_handled_.erase(packet_id);
-        if (h_pubrel_) {
-            if (h_pubrel_(packet_id)) {
-                res();
-                return true;
+        {
+            LockGuard<Mutex> lck (store_mtx_);
+            if (qos2_publish_handled_.erase(packet_id) && ss_) {
+                ss_->erase_qos2_publish_handled(packet_id);
             }
-            return false;
         }
+        if (!handlers_.on_pubrel(*this, packet_id)) return false;
         res();
         return true;
     }
 
     bool handle_pubcomp(async_handler_t const& func) {
-        if (remaining_length_ != 2) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-            return false;
-        }
-        std::uint16_t packet_id = make_uint16_t(payload_[0], payload_[1]);
+        std::uint16_t packet_id;
+        if (!decode_packet_id(func, packet_id)) return false;
         {
             LockGuard<Mutex> lck (store_mtx_);
-            auto& idx = store_.template get<tag_packet_id_type>();
-            auto r = idx.equal_range(std::make_tuple(packet_id, control_packet_type::pubcomp));
-            idx.erase(std::get<0>(r), std::get<1>(r));
-            packet_id_.erase(packet_id);
+            if (store_erase(packet_id, control_packet_type::pubcomp)) leave_inflight();
+            release_packet_id_locked(packet_id);
         }
-        if (h_pubcomp_) return h_pubcomp_(packet_id);
-        return true;
+        send_waiting_publishes();
+        return handlers_.on_pubcomp(*this, packet_id);
     }
 
     bool handle_subscribe(async_handler_t const& func) {
-        std::size_t i = 0;
-        if (remaining_length_ < 2) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
+        codec::subscribe_packet p;
+        if (auto ec = codec::decode_subscribe(payload_, p)) {
+            if (func) func(ec);
             return false;
         }
-        std::uint16_t packet_id = make_uint16_t(payload_[i], payload_[i + 1]);
-        i += 2;
         std::vector<std::tuple<std::string, std::uint8_t>> entries;
-        while (i < remaining_length_) {
-            if (remaining_length_ < i + 2) {
-                if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                return false;
-            }
-            std::uint16_t topic_length = make_uint16_t(payload_[i], payload_[i + 1]);
-            i += 2;
-            if (remaining_length_ < i + topic_length) {
-                if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                return false;
-            }
-            std::string topic_filter(payload_.data() + i, topic_length);
-            i += topic_length;
-
-            std::uint8_t qos = payload_[i] & 0b00000011;
-            ++i;
-            entries.emplace_back(std::move(topic_filter), qos);
-        }
-        if (h_subscribe_) return h_subscribe_(packet_id, std::move(entries));
-        return true;
+        p.for_each(
+            [&entries]
+            (boost::string_ref topic_filter, std::uint8_t qos) {
+                entries.emplace_back(std::string(topic_filter.data(), topic_filter.size()), qos);
+            });
+        return handlers_.on_subscribe(*this, p.packet_id, std::move(entries));
     }
 
     bool handle_suback(async_handler_t const& func) {
-        if (remaining_length_ < 2) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
+        codec::suback_packet p;
+        if (auto ec = codec::decode_suback(payload_, p)) {
+            if (func) func(ec);
             return false;
         }
-        std::uint16_t packet_id = make_uint16_t(payload_[0], payload_[1]);
         {
             LockGuard<Mutex> lck (store_mtx_);
-            packet_id_.erase(packet_id);
+            release_packet_id_locked(p.packet_id);
         }
         std::vector<boost::optional<std::uint8_t>> results;
-        results.reserve(payload_.size() - 2);
-        auto it = payload_.cbegin() + 2;
-        auto end = payload_.cend();
-        for (; it != end; ++it) {
-            if (*it & 0b10000000) {
-                results.push_back(boost::none);
-            }
-            else {
-                results.push_back(*it);
-            }
-        }
-        if (h_suback_) return h_suback_(packet_id, std::move(results));
-        return true;
+        results.reserve(p.return_codes.size());
+        p.for_each(
+            [&results]
+            (boost::optional<std::uint8_t> const& qos) {
+                results.push_back(qos);
+            });
+        return handlers_.on_suback(*this, p.packet_id, std::move(results));
     }
 
     bool handle_unsubscribe(async_handler_t const& func) {
-        std::size_t i = 0;
-        if (remaining_length_ < 2) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
+        codec::unsubscribe_packet p;
+        if (auto ec = codec::decode_unsubscribe(payload_, p)) {
+            if (func) func(ec);
             return false;
         }
-        std::uint16_t packet_id = make_uint16_t(payload_[i], payload_[i + 1]);
-        i += 2;
         std::vector<std::string> topic_filters;
-        while (i < remaining_length_) {
-            if (remaining_length_ < i + 2) {
-                if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                return false;
-            }
-            std::uint16_t topic_length = make_uint16_t(payload_[i], payload_[i + 1]);
-            i += 2;
-            if (remaining_length_ < i + topic_length) {
-                if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                return false;
-            }
-            std::string topic_filter(payload_.data() + i, topic_length);
-            i += topic_length;
-
-            topic_filters.emplace_back(std::move(topic_filter));
-        }
-        if (h_unsubscribe_) return h_unsubscribe_(packet_id, std::move(topic_filters));
-        return true;
+        p.for_each(
+            [&topic_filters]
+            (boost::string_ref topic_filter) {
+                topic_filters.emplace_back(topic_filter.data(), topic_filter.size());
+            });
+        return handlers_.on_unsubscribe(*this, p.packet_id, std::move(topic_filters));
     }
 
     bool handle_unsuback(async_handler_t const& func) {
-        if (remaining_length_ != 2) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-            return false;
-        }
-        std::uint16_t packet_id = make_uint16_t(payload_[0], payload_[1]);
+        std::uint16_t packet_id;
+        if (!decode_packet_id(func, packet_id)) return false;
         {
             LockGuard<Mutex> lck (store_mtx_);
-            packet_id_.erase(packet_id);
+            release_packet_id_locked(packet_id);
         }
-        if (h_unsuback_) return h_unsuback_(packet_id);
-        return true;
+        return handlers_.on_unsuback(*this, packet_id);
     }
 
-    bool handle_pingreq(async_handler_t const& func) {
-        if (remaining_length_ != 0) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
+    // Decode the empty body of PINGREQ, PINGRESP and DISCONNECT.
+    bool decode_empty(async_handler_t const& func) {
+        if (auto ec = codec::decode_empty(payload_)) {
+            if (func) func(ec);
             return false;
         }
-        if (h_pingreq_) return h_pingreq_();
         return true;
     }
 
+    bool handle_pingreq(async_handler_t const& func) {
+        if (!decode_empty(func)) return false;
+        return handlers_.on_pingreq(*this);
+    }
+
     bool handle_pingresp(async_handler_t const& func) {
-        if (remaining_length_ != 0) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-            return false;
-        }
-        if (h_pingresp_) return h_pingresp_();
-        return true;
+        if (!decode_empty(func)) return false;
+        return handlers_.on_pingresp(*this);
     }
 
     void handle_disconnect(async_handler_t const& func) {
-        if (remaining_length_ != 0) {
-            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-            return;
-        }
-        if (h_disconnect_) h_disconnect_();
+        if (!decode_empty(func)) return;
+        handlers_.on_disconnect(*this);
     }
 
     // Blocking senders.
@@ -3124,9 +3640,8 @@ private:
 
     void send_connack(bool session_present, std::uint8_t return_code) {
         send_buffer sb;
-        sb.buf()->push_back(static_cast<char>(session_present ? 1 : 0));
-        sb.buf()->push_back(static_cast<char>(return_code));
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::connack, 0b0000));
+        auto ptr_size = sb.encode(
+            [&](char* out) { return codec::encode_connack(out, session_present, return_code); });
         do_sync_write(std::get<0>(ptr_size), std::get<1>(ptr_size));
     }
 
@@ -3139,6 +3654,68 @@ private:
         std::string const& payload) {
 
         send_buffer sb;
+        make_publish_variable_header(sb, topic_name, qos, packet_id);
+        sb.buf()->insert(sb.buf()->size(), payload);
+        send_publish(sb, qos, retain, dup, packet_id, nullptr);
+    }
+
+    void send_publish(
+        std::string const& topic_name,
+        std::uint16_t qos,
+        bool retain,
+        bool dup,
+        std::uint16_t packet_id,
+        std::shared_ptr<std::string const> const& payload) {
+
+        send_buffer sb;
+        make_publish_variable_header(sb, topic_name, qos, packet_id);
+        send_publish(sb, qos, retain, dup, packet_id, payload);
+    }
+
+    void send_publish(
+        send_buffer& sb,
+        std::uint16_t qos,
+        bool retain,
+        bool dup,
+        std::uint16_t packet_id,
+        std::shared_ptr<std::string const> const& payload) {
+        auto p = finalize_publish(sb, static_cast<std::uint8_t>(qos), retain, dup, payload);
+        if (qos == qos::at_most_once) {
+            do_sync_write(p.buffers());
+            return;
+        }
+        if (!store_publish(packet_id, static_cast<std::uint8_t>(qos), p, false, async_handler_t())) return;
+        write_stored_publish(p);
+    }
+
+    // Write the stored publish synchronously. The stored copy is resent with the DUP flag.
+    void write_stored_publish(packet& p) {
+        do_sync_write(p.buffers());
+        LockGuard<Mutex> lck (store_mtx_);
+        *p.ptr() |= 0b00001000;
+    }
+
+    static packet finalize_publish(
+        send_buffer& sb,
+        std::uint8_t qos,
+        bool retain,
+        bool dup,
+        std::shared_ptr<std::string const> const& payload) {
+        std::uint8_t flags = 0;
+        if (retain) flags |= 0b00000001;
+        if (dup) flags |= 0b00001000;
+        flags |= qos << 1;
+        auto ptr_size = sb.finalize(
+            make_fixed_header(control_packet_type::publish, flags),
+            payload ? payload->size() : 0);
+        return packet(sb.buf(), std::get<0>(ptr_size), std::get<1>(ptr_size), payload);
+    }
+
+    static void make_publish_variable_header(
+        send_buffer& sb,
+        std::string const& topic_name,
+        std::uint16_t qos,
+        std::uint16_t packet_id) {
         if (!utf8string::is_valid_length(topic_name)) throw utf8string_length_error();
         if (!utf8string::is_valid_contents(topic_name)) throw utf8string_contents_error();
         sb.buf()->insert(sb.buf()->size(), encoded_length(topic_name));
@@ -3148,52 +3725,47 @@ private:
             sb.buf()->push_back(static_cast<char>(packet_id >> 8));
             sb.buf()->push_back(static_cast<char>(packet_id & 0xff));
         }
-        sb.buf()->insert(sb.buf()->size(), payload);
-        std::uint8_t flags = 0;
-        if (retain) flags |= 0b00000001;
-        if (dup) flags |= 0b00001000;
-        flags |= qos << 1;
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::publish, flags));
-        do_sync_write(std::get<0>(ptr_size), std::get<1>(ptr_size));
-        if (qos == qos::at_least_once || qos == qos::exactly_once) {
-            flags |= 0b00001000;
-            ptr_size = sb.finalize(make_fixed_header(control_packet_type::publish, flags));
-            LockGuard<Mutex> lck (store_mtx_);
-            store_.emplace(
-                packet_id,
-                qos == qos::at_least_once ? control_packet_type::puback
-                                          : control_packet_type::pubrec,
-                sb.buf(),
-                std::get<0>(ptr_size),
-                std::get<1>(ptr_size));
+    }
+
+    // The topic name has been validated and encoded by shared_publish.
+    // Only the packet identifier is added, and the contents are not copied.
+    static void make_publish_variable_header(
+        send_buffer& sb,
+        shared_publish const& p,
+        std::uint16_t qos,
+        std::uint16_t packet_id) {
+        auto const& topic = p.encoded_topic_name();
+        sb.buf()->reserve(sb.buf()->size() + topic.size() + 2);
+        sb.buf()->append(topic);
+        if (qos == qos::at_least_once ||
+            qos == qos::exactly_once) {
+            sb.buf()->push_back(static_cast<char>(packet_id >> 8));
+            sb.buf()->push_back(static_cast<char>(packet_id & 0xff));
         }
     }
 
     void send_puback(std::uint16_t packet_id) {
         send_buffer sb;
-        sb.buf()->push_back(static_cast<char>(packet_id >> 8));
-        sb.buf()->push_back(static_cast<char>(packet_id & 0xff));
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::puback, 0b0000));
+        auto ptr_size = sb.encode(
+            [&](char* out) { return codec::encode_packet_id_packet(out, control_packet_type::puback, packet_id); });
         do_sync_write(std::get<0>(ptr_size), std::get<1>(ptr_size));
-        if (h_pub_res_sent_) h_pub_res_sent_(packet_id);
+        handlers_.on_pub_res_sent(*this, packet_id);
     }
 
     void send_pubrec(std::uint16_t packet_id) {
         send_buffer sb;
-        sb.buf()->push_back(static_cast<char>(packet_id >> 8));
-        sb.buf()->push_back(static_cast<char>(packet_id & 0xff));
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::pubrec, 0b0000));
+        auto ptr_size = sb.encode(
+            [&](char* out) { return codec::encode_packet_id_packet(out, control_packet_type::pubrec, packet_id); });
         do_sync_write(std::get<0>(ptr_size), std::get<1>(ptr_size));
     }
 
     void send_pubrel(std::uint16_t packet_id) {
         send_buffer sb;
-        sb.buf()->push_back(static_cast<char>(packet_id >> 8));
-        sb.buf()->push_back(static_cast<char>(packet_id & 0xff));
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::pubrel, 0b0010));
+        auto ptr_size = sb.encode(
+            [&](char* out) { return codec::encode_packet_id_packet(out, control_packet_type::pubrel, packet_id); });
         do_sync_write(std::get<0>(ptr_size), std::get<1>(ptr_size));
         LockGuard<Mutex> lck (store_mtx_);
-        store_.emplace(
+        store_emplace(
             packet_id,
             control_packet_type::pubcomp,
             sb.buf(),
@@ -3203,11 +3775,10 @@ private:
 
     void store_pubrel(std::uint16_t packet_id) {
         send_buffer sb;
-        sb.buf()->push_back(static_cast<char>(packet_id >> 8));
-        sb.buf()->push_back(static_cast<char>(packet_id & 0xff));
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::pubrel, 0b0010));
+        auto ptr_size = sb.encode(
+            [&](char* out) { return codec::encode_packet_id_packet(out, control_packet_type::pubrel, packet_id); });
         LockGuard<Mutex> lck (store_mtx_);
-        store_.emplace(
+        store_emplace(
             packet_id,
             control_packet_type::pubcomp,
             sb.buf(),
@@ -3217,11 +3788,10 @@ private:
 
     void send_pubcomp(std::uint16_t packet_id) {
         send_buffer sb;
-        sb.buf()->push_back(static_cast<char>(packet_id >> 8));
-        sb.buf()->push_back(static_cast<char>(packet_id & 0xff));
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::pubcomp, 0b0000));
+        auto ptr_size = sb.encode(
+            [&](char* out) { return codec::encode_packet_id_packet(out, control_packet_type::pubcomp, packet_id); });
         do_sync_write(std::get<0>(ptr_size), std::get<1>(ptr_size));
-        if (h_pub_res_sent_) h_pub_res_sent_(packet_id);
+        handlers_.on_pub_res_sent(*this, packet_id);
     }
 
     template <typename... Args>
@@ -3302,35 +3872,47 @@ private:
     void send_unsuback(
         std::uint16_t packet_id) {
         send_buffer sb;
-        sb.buf()->push_back(static_cast<char>(packet_id >> 8));
-        sb.buf()->push_back(static_cast<char>(packet_id & 0xff));
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::unsuback, 0b0010));
+        auto ptr_size = sb.encode(
+            [&](char* out) { return codec::encode_packet_id_packet(out, control_packet_type::unsuback, packet_id); });
         do_sync_write(std::get<0>(ptr_size), std::get<1>(ptr_size));
     }
 
     void send_pingreq() {
         send_buffer sb;
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::pingreq, 0b0000));
+        auto ptr_size = sb.encode(
+            [](char* out) { return codec::encode_empty_packet(out, control_packet_type::pingreq); });
         do_sync_write(std::get<0>(ptr_size), std::get<1>(ptr_size));
     }
 
     void send_pingresp() {
         send_buffer sb;
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::pingresp, 0b0000));
+        auto ptr_size = sb.encode(
+            [](char* out) { return codec::encode_empty_packet(out, control_packet_type::pingresp); });
         do_sync_write(std::get<0>(ptr_size), std::get<1>(ptr_size));
     }
     void send_disconnect() {
         send_buffer sb;
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::disconnect, 0b0000));
+        auto ptr_size = sb.encode(
+            [](char* out) { return codec::encode_empty_packet(out, control_packet_type::disconnect); });
         do_sync_write(std::get<0>(ptr_size), std::get<1>(ptr_size));
     }
 
     // Blocking write
     void do_sync_write(char* ptr, std::size_t size) {
+        do_sync_write(as::buffer(ptr, size));
+    }
+
+    template <typename ConstBufferSequence>
+    void do_sync_write(ConstBufferSequence const& buffers) {
         boost::system::error_code ec;
         if (!connected_) return;
-        write(*socket_, as::buffer(ptr, size), ec);
+        write(*socket_, buffers, ec);
         if (ec) handle_error(ec);
+        else update_last_write();
+    }
+
+    void update_last_write() {
+        last_write_ = std::chrono::steady_clock::now().time_since_epoch().count();
     }
 
     // Non blocking (async) senders
@@ -3402,9 +3984,8 @@ private:
 
     void async_send_connack(bool session_present, std::uint8_t return_code, async_handler_t const& func) {
         send_buffer sb;
-        sb.buf()->push_back(static_cast<char>(session_present ? 1 : 0));
-        sb.buf()->push_back(static_cast<char>(return_code));
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::connack, 0b0000));
+        auto ptr_size = sb.encode(
+            [&](char* out) { return codec::encode_connack(out, session_present, return_code); });
         do_async_write(sb.buf(), std::get<0>(ptr_size), std::get<1>(ptr_size), func);
     }
 
@@ -3418,64 +3999,66 @@ private:
         async_handler_t const& func) {
 
         send_buffer sb;
-        if (!utf8string::is_valid_length(topic_name)) throw utf8string_length_error();
-        if (!utf8string::is_valid_contents(topic_name)) throw utf8string_contents_error();
-        sb.buf()->insert(sb.buf()->size(), encoded_length(topic_name));
-        sb.buf()->insert(sb.buf()->size(), topic_name);
-        if (qos == qos::at_least_once ||
-            qos == qos::exactly_once) {
-            sb.buf()->push_back(static_cast<char>(packet_id >> 8));
-            sb.buf()->push_back(static_cast<char>(packet_id & 0xff));
-        }
+        make_publish_variable_header(sb, topic_name, qos, packet_id);
         sb.buf()->insert(sb.buf()->size(), payload);
-        std::uint8_t flags = 0;
-        if (retain) flags |= 0b00000001;
-        if (dup) flags |= 0b00001000;
-        flags |= qos << 1;
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::publish, flags));
-        do_async_write(sb.buf(), std::get<0>(ptr_size), std::get<1>(ptr_size), func);
-        if (qos == qos::at_least_once || qos == qos::exactly_once) {
-            LockGuard<Mutex> lck (store_mtx_);
-            store_.emplace(
-                packet_id,
-                qos == qos::at_least_once ? control_packet_type::puback
-                                          : control_packet_type::pubrec,
-                sb.buf(),
-                std::get<0>(ptr_size),
-                std::get<1>(ptr_size));
-        }
+        async_send_publish(sb, qos, retain, dup, packet_id, nullptr, func);
+    }
+
+    void async_send_publish(
+        std::string const& topic_name,
+        std::uint8_t qos,
+        bool retain,
+        bool dup,
+        std::uint16_t packet_id,
+        std::shared_ptr<std::string const> const& payload,
+        async_handler_t const& func) {
+
+        send_buffer sb;
+        make_publish_variable_header(sb, topic_name, qos, packet_id);
+        async_send_publish(sb, qos, retain, dup, packet_id, payload, func);
+    }
+
+    void async_send_publish(
+        send_buffer& sb,
+        std::uint8_t qos,
+        bool retain,
+        bool dup,
+        std::uint16_t packet_id,
+        std::shared_ptr<std::string const> const& payload,
+        async_handler_t const& func) {
+        auto p = finalize_publish(sb, qos, retain, dup, payload);
+        if (qos != qos::at_most_once &&
+            !store_publish(packet_id, qos, p, true, func)) return;
+        do_async_write(p.buf(), p.ptr(), p.size(), p.contents(), func);
     }
 
     void async_send_puback(std::uint16_t packet_id, async_handler_t const& func) {
         send_buffer sb;
-        sb.buf()->push_back(static_cast<char>(packet_id >> 8));
-        sb.buf()->push_back(static_cast<char>(packet_id & 0xff));
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::puback, 0b0000));
+        auto ptr_size = sb.encode(
+            [&](char* out) { return codec::encode_packet_id_packet(out, control_packet_type::puback, packet_id); });
         auto self = this->shared_from_this();
         do_async_write(
             sb.buf(), std::get<0>(ptr_size), std::get<1>(ptr_size),
             [this, self, packet_id, func](boost::system::error_code const& ec){
                 if (func) func(ec);
-                if (h_pub_res_sent_) h_pub_res_sent_(packet_id);
+                handlers_.on_pub_res_sent(*this, packet_id);
             });
     }
 
     void async_send_pubrec(std::uint16_t packet_id, async_handler_t const& func) {
         send_buffer sb;
-        sb.buf()->push_back(static_cast<char>(packet_id >> 8));
-        sb.buf()->push_back(static_cast<char>(packet_id & 0xff));
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::pubrec, 0b0000));
+        auto ptr_size = sb.encode(
+            [&](char* out) { return codec::encode_packet_id_packet(out, control_packet_type::pubrec, packet_id); });
         do_async_write(sb.buf(), std::get<0>(ptr_size), std::get<1>(ptr_size), func);
     }
 
     void async_send_pubrel(std::uint16_t packet_id, async_handler_t const& func) {
         send_buffer sb;
-        sb.buf()->push_back(static_cast<char>(packet_id >> 8));
-        sb.buf()->push_back(static_cast<char>(packet_id & 0xff));
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::pubrel, 0b0010));
+        auto ptr_size = sb.encode(
+            [&](char* out) { return codec::encode_packet_id_packet(out, control_packet_type::pubrel, packet_id); });
         do_async_write(sb.buf(), std::get<0>(ptr_size), std::get<1>(ptr_size), func);
         LockGuard<Mutex> lck (store_mtx_);
-        store_.emplace(
+        store_emplace(
             packet_id,
             control_packet_type::pubcomp,
             sb.buf(),
@@ -3485,15 +4068,14 @@ private:
 
     void async_send_pubcomp(std::uint16_t packet_id, async_handler_t const& func) {
         send_buffer sb;
-        sb.buf()->push_back(static_cast<char>(packet_id >> 8));
-        sb.buf()->push_back(static_cast<char>(packet_id & 0xff));
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::pubcomp, 0b0000));
+        auto ptr_size = sb.encode(
+            [&](char* out) { return codec::encode_packet_id_packet(out, control_packet_type::pubcomp, packet_id); });
         auto self = this->shared_from_this();
         do_async_write(
             sb.buf(), std::get<0>(ptr_size), std::get<1>(ptr_size),
             [this, self, packet_id, func](boost::system::error_code const& ec){
                 if (func) func(ec);
-                if (h_pub_res_sent_) h_pub_res_sent_(packet_id);
+                handlers_.on_pub_res_sent(*this, packet_id);
             });
     }
 
@@ -3578,27 +4160,29 @@ private:
     void async_send_unsuback(
         std::uint16_t packet_id, async_handler_t const& func) {
         send_buffer sb;
-        sb.buf()->push_back(static_cast<char>(packet_id >> 8));
-        sb.buf()->push_back(static_cast<char>(packet_id & 0xff));
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::unsuback, 0b0010));
+        auto ptr_size = sb.encode(
+            [&](char* out) { return codec::encode_packet_id_packet(out, control_packet_type::unsuback, packet_id); });
         do_async_write(sb.buf(), std::get<0>(ptr_size), std::get<1>(ptr_size), func);
     }
 
     void async_send_pingreq(async_handler_t const& func) {
         send_buffer sb;
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::pingreq, 0b0000));
+        auto ptr_size = sb.encode(
+            [](char* out) { return codec::encode_empty_packet(out, control_packet_type::pingreq); });
         do_async_write(sb.buf(), std::get<0>(ptr_size), std::get<1>(ptr_size), func);
     }
 
     void async_send_pingresp(async_handler_t const& func) {
         send_buffer sb;
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::pingresp, 0b0000));
+        auto ptr_size = sb.encode(
+            [](char* out) { return codec::encode_empty_packet(out, control_packet_type::pingresp); });
         do_async_write(sb.buf(), std::get<0>(ptr_size), std::get<1>(ptr_size), func);
     }
 
     void async_send_disconnect(async_handler_t const& func) {
         send_buffer sb;
-        auto ptr_size = sb.finalize(make_fixed_header(control_packet_type::disconnect, 0b0000));
+        auto ptr_size = sb.encode(
+            [](char* out) { return codec::encode_empty_packet(out, control_packet_type::disconnect); });
         do_async_write(sb.buf(), std::get<0>(ptr_size), std::get<1>(ptr_size), func);
     }
 
@@ -3610,13 +4194,16 @@ private:
             std::shared_ptr<std::string> const& b = nullptr,
             char* p = nullptr,
             std::size_t s = 0,
+            std::shared_ptr<std::string const> const& c = nullptr,
             async_handler_t h = async_handler_t())
             :
-            packet_(b, p, s), handler_(h) {}
+            packet_(b, p, s, c), handler_(h) {}
         std::shared_ptr<std::string> const& buf() const { return packet_.buf(); }
         char const* ptr() const { return packet_.ptr(); }
         char* ptr() { return packet_.ptr(); }
         std::size_t size() const { return packet_.size(); }
+        std::size_t total_size() const { return packet_.total_size(); }
+        std::array<as::const_buffer, 2> buffers() const { return packet_.buffers(); }
         async_handler_t const& handler() const { return handler_; }
         async_handler_t& handler() { return handler_; }
     private:
@@ -3625,71 +4212,121 @@ private:
     };
 
     void do_async_write(std::shared_ptr<std::string> const& buf, char* ptr, std::size_t size, async_handler_t const& func) {
+        do_async_write(buf, ptr, size, nullptr, func);
+    }
+
+    void do_async_write(
+        std::shared_ptr<std::string> const& buf,
+        char* ptr,
+        std::size_t size,
+        std::shared_ptr<std::string const> const& contents,
+        async_handler_t const& func) {
         if (!connected_) {
             if (func) func(boost::system::errc::make_error_code(boost::system::errc::success));
             return;
         }
+        // Any thread can submit the packet. Only the submission that finds
+        // the drain not scheduled wakes up the strand.
+        submit_queue_.push(buf, ptr, size, contents, func);
+        if (drain_posted_.exchange(true)) return;
         auto self = this->shared_from_this();
         strand_.post(
-            [this, self, buf, ptr, size, func]
-            () {
-                queue_.emplace_back(buf, ptr, size, func);
-                if (queue_.size() > 1) return;
-                do_async_write();
+            make_custom_alloc_handler(
+                drain_handler_memory_,
+                [this, self]
+                () {
+                    drain_submit_queue();
+                }
+            )
+        );
+    }
+
+    // Move the submitted packets to the write queue, and start writing if it was idle.
+    void drain_submit_queue() {
+        // Clear the flag first. The packets that are submitted after here post another drain.
+        drain_posted_ = false;
+        bool idle = queue_.empty();
+        submit_queue_.consume_all(
+            [this](async_packet&& p) {
+                queue_.push_back(std::move(p));
             }
         );
+        if (idle && !queue_.empty()) do_async_write();
     }
 
+    // Write the queued packets from the front of the queue all at once as a buffer sequence.
+    // The packets stay in the queue until the write is finished.
     void do_async_write() {
-        auto& elem = queue_.front();
-        auto size = elem.size();
-        auto const& func = elem.handler();
-        auto self = this->shared_from_this();
+        // write_buffers_ keeps its capacity, and async_write copies only the view of it.
+        write_buffers_.clear();
+        std::size_t size = 0;
+        std::size_t num = 0;
+        for (auto const& elem : queue_) {
+            if (num != 0 &&
+                (write_buffers_.size() + 2 > max_write_batch_buffers ||
+                 size + elem.total_size() > max_write_batch_bytes)) break;
+            auto b = elem.buffers();
+            write_buffers_.insert(write_buffers_.end(), b.begin(), b.end());
+            size += elem.total_size();
+            ++num;
+        }
         async_write(
             *socket_,
-            as::buffer(elem.ptr(), size),
+            const_buffers_view(write_buffers_.data(), write_buffers_.data() + write_buffers_.size()),
             strand_.wrap(
-                write_completion_handler(
-                    this->shared_from_this(),
-                    func,
-                    size
+                make_custom_alloc_handler(
+                    write_handler_memory_,
+                    write_completion_handler(
+                        this->shared_from_this(),
+                        num,
+                        size
+                    )
                 )
             )
         );
     }
 
-    static std::uint16_t make_uint16_t(char b1, char b2) {
-        return
-            ((static_cast<std::uint16_t>(b1) & 0xff)) << 8 |
-            (static_cast<std::uint16_t>(b2) & 0xff);
-    }
+    // Non owning buffer sequence. Copying it doesn't allocate.
+    struct const_buffers_view {
+        using value_type = as::const_buffer;
+        using const_iterator = as::const_buffer const*;
+        const_buffers_view(const_iterator b, const_iterator e)
+            :b_(b),
+             e_(e) {}
+        const_iterator begin() const { return b_; }
+        const_iterator end() const { return e_; }
+    private:
+        const_iterator b_;
+        const_iterator e_;
+    };
+
+    static constexpr std::size_t const default_read_buffer_size = 4096;
+    static constexpr std::size_t const max_write_batch_buffers = 64;
+    static constexpr std::size_t const max_write_batch_bytes = 64 * 1024;
 
     struct write_completion_handler {
         write_completion_handler(
             std::shared_ptr<this_type> const& self,
-            async_handler_t const& func,
+            std::size_t num,
             std::size_t expected)
             :self_(self),
-             func_(func),
+             num_(num),
              expected_(expected)
         {}
         void operator()(boost::system::error_code const& ec) const {
             if (!self_->connected_) return;
-            if (func_) func_(ec);
+            complete(ec);
             if (ec) { // Error is handled by async_read.
                 self_->queue_.clear();
                 return;
             }
-            self_->queue_.pop_front();
-            if (!self_->queue_.empty()) {
-                self_->do_async_write();
-            }
+            next();
         }
         void operator()(
             boost::system::error_code const& ec,
             std::size_t bytes_transferred) const {
             if (!self_->connected_) return;
-            if (func_) func_(ec);
+            complete(ec);
             if (ec) { // Error is handled by async_read.
                 self_->queue_.clear();
                 return;
@@ -3698,13 +4335,23 @@ private:
                 self_->queue_.clear();
                 throw write_bytes_transferred_error(expected_, bytes_transferred);
             }
-            self_->queue_.pop_front();
+            next();
+        }
+        void complete(boost::system::error_code const& ec) const {
+            for (std::size_t i = 0; i != num_; ++i) {
+                auto const& func = self_->queue_[i].handler();
+                if (func) func(ec);
+            }
+        }
+        void next() const {
+            self_->update_last_write();
+            self_->queue_.erase(self_->queue_.begin(), self_->queue_.begin() + num_);
             if (!self_->queue_.empty()) {
                 self_->do_async_write();
             }
         }
         std::shared_ptr<this_type> self_;
-        async_handler_t func_;
+        std::size_t num_;
         std::size_t expected_;
     };
 private:
@@ -3717,36 +4364,32 @@ private:
     std::string client_id_;
     bool clean_session_;
     boost::optional<will> will_;
-    char buf_;
+    std::vector<char> read_buf_;
+    std::size_t read_begin_;
+    std::size_t read_end_;
     std::uint8_t fixed_header_;
-    std::size_t remaining_length_multiplier_;
-    std::size_t remaining_length_;
-    std::vector<char> payload_;
-    close_handler h_close_;
-    error_handler h_error_;
-    connect_handler h_connect_;
-    connack_handler h_connack_;
-    publish_handler h_publish_;
-    puback_handler h_puback_;
-    pubrec_handler h_pubrec_;
-    pubrel_handler h_pubrel_;
-    pubcomp_handler h_pubcomp_;
-    pub_res_sent_handler h_pub_res_sent_;
-    subscribe_handler h_subscribe_;
-    suback_handler h_suback_;
-    unsubscribe_handler h_unsubscribe_;
-    unsuback_handler h_unsuback_;
-    pingreq_handler h_pingreq_;
-    pingresp_handler h_pingresp_;
-    disconnect_handler h_disconnect_;
+    boost::string_ref payload_;
+    Handlers handlers_;
     boost::optional<std::string> user_name_;
     boost::optional<std::string> password_;
     Mutex store_mtx_;
-    mi_store store_;
+    Store<store> store_;
     std::set<std::uint16_t> qos2_publish_handled_;
+    std::shared_ptr<session_store> ss_;
+    std::size_t max_inflight_;
+    std::size_t inflight_;
+    std::size_t peak_inflight_;
+    std::size_t total_waited_;
+    std::deque<waiting_publish> waiting_publishes_;
     std::deque<async_packet> queue_;
-    std::uint16_t packet_id_master_;
-    std::set<std::uint16_t> packet_id_;
+    mpsc_queue<async_packet> submit_queue_;
+    std::atomic<bool> drain_posted_;
+    std::vector<as::const_buffer> write_buffers_;
+    handler_memory read_handler_memory_;
+    handler_memory write_handler_memory_;
+    handler_memory drain_handler_memory_;
+    std::atomic<std::chrono::steady_clock::rep> last_write_;
+    packet_id_allocator packet_id_;
     bool auto_pub_response_;
     bool auto_pub_response_async_;
 };
@@ -82,6 +82,33 @@ struct packet_id_exhausted_error : std::exception {
     }
 };
 
+struct session_store_error : std::exception {
+    session_store_error(std::string const& reason)
+        :msg("session store error. " + reason) {}
+    virtual char const* what() const noexcept {
+        return msg.data();
+    }
+    std::string msg;
+};
+
+struct topic_filter_error : std::exception {
+    topic_filter_error(std::string const& topic_filter)
+        :msg("topic filter error. " + topic_filter) {}
+    virtual char const* what() const noexcept {
+        return msg.data();
+    }
+    std::string msg;
+};
+
+struct retained_store_error : std::exception {
+    retained_store_error(std::string const& reason)
+        :msg("retained store error. " + reason) {}
+    virtual char const* what() const noexcept {
+        return msg.data();
+    }
+    std::string msg;
+};
+
 } // namespace mqtt
 
 #endif // MQTT_EXCEPTION_HPP
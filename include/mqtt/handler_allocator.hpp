@@ -0,0 +1,102 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_HANDLER_ALLOCATOR_HPP)
+#define MQTT_HANDLER_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+#include <boost/asio.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Memory for the handler of one asynchronous operation at a time.
+ * An endpoint has one outstanding read and one outstanding write, so a block
+ * per operation kind is recycled and the steady state doesn't allocate.
+ * If the block is in use or too small, the global operator new is used.
+ */
+class handler_memory {
+public:
+    handler_memory()
+        :in_use_(false) {}
+
+    handler_memory(handler_memory const&) = delete;
+    handler_memory& operator=(handler_memory const&) = delete;
+
+    void* allocate(std::size_t size) {
+        if (!in_use_ && size <= sizeof(storage_)) {
+            in_use_ = true;
+            return &storage_;
+        }
+        return ::operator new(size);
+    }
+
+    void deallocate(void* pointer) {
+        if (pointer == &storage_) {
+            in_use_ = false;
+            return;
+        }
+        ::operator delete(pointer);
+    }
+
+private:
+    typename std::aligned_storage<1024>::type storage_;
+    bool in_use_;
+};
+
+/**
+ * @brief Handler wrapper that allocates the operation state from handler_memory.
+ * Invocation is forwarded to the wrapped handler, so a strand wrapped inside is kept.
+ */
+template <typename Handler>
+class custom_alloc_handler {
+public:
+    custom_alloc_handler(handler_memory& memory, Handler h)
+        :memory_(memory),
+         handler_(std::move(h)) {}
+
+    template <typename... Args>
+    void operator()(Args&&... args) {
+        handler_(std::forward<Args>(args)...);
+    }
+
+    friend void* asio_handler_allocate(std::size_t size, custom_alloc_handler* this_handler) {
+        return this_handler->memory_.allocate(size);
+    }
+
+    friend void asio_handler_deallocate(void* pointer, std::size_t /*size*/, custom_alloc_handler* this_handler) {
+        this_handler->memory_.deallocate(pointer);
+    }
+
+    template <typename Function>
+    friend void asio_handler_invoke(Function&& f, custom_alloc_handler* this_handler) {
+        using boost::asio::asio_handler_invoke;
+        asio_handler_invoke(f, std::addressof(this_handler->handler_));
+    }
+
+    friend bool asio_handler_is_continuation(custom_alloc_handler* this_handler) {
+        using boost::asio::asio_handler_is_continuation;
+        return asio_handler_is_continuation(std::addressof(this_handler->handler_));
+    }
+
+private:
+    handler_memory& memory_;
+    Handler handler_;
+};
+
+template <typename Handler>
+inline custom_alloc_handler<typename std::decay<Handler>::type>
+make_custom_alloc_handler(handler_memory& memory, Handler&& h) {
+    return custom_alloc_handler<typename std::decay<Handler>::type>(memory, std::forward<Handler>(h));
+}
+
+} // namespace mqtt
+
+#endif // MQTT_HANDLER_ALLOCATOR_HPP
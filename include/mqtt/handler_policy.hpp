@@ -0,0 +1,313 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_HANDLER_POLICY_HPP)
+#define MQTT_HANDLER_POLICY_HPP
+
+#include <string>
+#include <vector>
+#include <tuple>
+#include <functional>
+
+#include <boost/optional.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <mqtt/will.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Handler policy that does nothing.
+ * A handler policy is the last template parameter of endpoint. The endpoint calls
+ * the on_* member functions of the policy directly, so they can be inlined.
+ * Derive from default_handlers and define only the functions that you need.
+ * The first parameter is the endpoint that received the packet.
+ * The functions that return bool have the same meaning as the corresponding
+ * endpoint handlers: return true to continue receiving, otherwise quit.
+ */
+struct default_handlers {
+    template <typename Endpoint>
+    void on_close(Endpoint&) {}
+
+    template <typename Endpoint>
+    void on_error(Endpoint&, boost::system::error_code const&) {}
+
+    template <typename Endpoint>
+    bool on_connect(Endpoint&,
+                    std::string const& /*client_id*/,
+                    boost::optional<std::string> const& /*username*/,
+                    boost::optional<std::string> const& /*password*/,
+                    boost::optional<will> /*will*/,
+                    bool /*clean_session*/,
+                    std::uint16_t /*keep_alive*/) {
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_connack(Endpoint&, bool /*session_present*/, std::uint8_t /*return_code*/) {
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_publish(Endpoint&,
+                    std::uint8_t /*fixed_header*/,
+                    boost::optional<std::uint16_t> const& /*packet_id*/,
+                    boost::string_ref /*topic_name*/,
+                    boost::string_ref /*contents*/) {
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_puback(Endpoint&, std::uint16_t /*packet_id*/) {
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_pubrec(Endpoint&, std::uint16_t /*packet_id*/) {
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_pubrel(Endpoint&, std::uint16_t /*packet_id*/) {
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_pubcomp(Endpoint&, std::uint16_t /*packet_id*/) {
+        return true;
+    }
+
+    template <typename Endpoint>
+    void on_pub_res_sent(Endpoint&, std::uint16_t /*packet_id*/) {}
+
+    template <typename Endpoint>
+    bool on_subscribe(Endpoint&,
+                      std::uint16_t /*packet_id*/,
+                      std::vector<std::tuple<std::string, std::uint8_t>> /*entries*/) {
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_suback(Endpoint&,
+                   std::uint16_t /*packet_id*/,
+                   std::vector<boost::optional<std::uint8_t>> /*qoss*/) {
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_unsubscribe(Endpoint&,
+                        std::uint16_t /*packet_id*/,
+                        std::vector<std::string> /*topics*/) {
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_unsuback(Endpoint&, std::uint16_t /*packet_id*/) {
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_pingreq(Endpoint&) {
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_pingresp(Endpoint&) {
+        return true;
+    }
+
+    template <typename Endpoint>
+    void on_disconnect(Endpoint&) {}
+};
+
+/**
+ * @brief Handler policy that calls the std::function handlers.
+ * It is the default policy of endpoint, and the endpoint's set_*_handler functions set them.
+ * See endpoint for the meaning of each handler.
+ */
+struct function_handlers {
+    using close_handler = std::function<void()>;
+    using error_handler = std::function<void(boost::system::error_code const& ec)>;
+    using connect_handler = std::function<
+        bool(std::string const& client_id,
+             boost::optional<std::string> const& username,
+             boost::optional<std::string> const& password,
+             boost::optional<will> will,
+             bool clean_session,
+             std::uint16_t keep_alive)>;
+    using connack_handler = std::function<bool(bool session_present, std::uint8_t return_code)>;
+    using publish_handler = std::function<bool(std::uint8_t fixed_header,
+                                               boost::optional<std::uint16_t> packet_id,
+                                               std::string topic_name,
+                                               std::string contents)>;
+    using publish_ref_handler = std::function<bool(std::uint8_t fixed_header,
+                                                   boost::optional<std::uint16_t> packet_id,
+                                                   boost::string_ref topic_name,
+                                                   boost::string_ref contents)>;
+    using puback_handler = std::function<bool(std::uint16_t packet_id)>;
+    using pubrec_handler = std::function<bool(std::uint16_t packet_id)>;
+    using pubrel_handler = std::function<bool(std::uint16_t packet_id)>;
+    using pubcomp_handler = std::function<bool(std::uint16_t packet_id)>;
+    using pub_res_sent_handler = std::function<void(std::uint16_t packet_id)>;
+    using subscribe_handler = std::function<bool(std::uint16_t packet_id,
+                                                 std::vector<std::tuple<std::string, std::uint8_t>> entries)>;
+    using suback_handler = std::function<bool(std::uint16_t packet_id,
+                                              std::vector<boost::optional<std::uint8_t>> qoss)>;
+    using unsubscribe_handler = std::function<bool(std::uint16_t packet_id,
+                                                   std::vector<std::string> topics)>;
+    using unsuback_handler = std::function<bool(std::uint16_t)>;
+    using pingreq_handler = std::function<bool()>;
+    using pingresp_handler = std::function<bool()>;
+    using disconnect_handler = std::function<void()>;
+
+    template <typename Endpoint>
+    void on_close(Endpoint&) {
+        if (h_close) h_close();
+    }
+
+    template <typename Endpoint>
+    void on_error(Endpoint&, boost::system::error_code const& ec) {
+        if (h_error) h_error(ec);
+    }
+
+    template <typename Endpoint>
+    bool on_connect(Endpoint&,
+                    std::string const& client_id,
+                    boost::optional<std::string> const& username,
+                    boost::optional<std::string> const& password,
+                    boost::optional<will> will,
+                    bool clean_session,
+                    std::uint16_t keep_alive) {
+        if (h_connect) return h_connect(client_id, username, password, std::move(will), clean_session, keep_alive);
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_connack(Endpoint&, bool session_present, std::uint8_t return_code) {
+        if (h_connack) return h_connack(session_present, return_code);
+        return true;
+    }
+
+    // If both publish_ref_handler and publish_handler are set, only publish_ref_handler is called.
+    template <typename Endpoint>
+    bool on_publish(Endpoint&,
+                    std::uint8_t fixed_header,
+                    boost::optional<std::uint16_t> const& packet_id,
+                    boost::string_ref topic_name,
+                    boost::string_ref contents) {
+        if (h_publish_ref) {
+            return h_publish_ref(fixed_header, packet_id, topic_name, contents);
+        }
+        if (h_publish) {
+            return h_publish(
+                fixed_header,
+                packet_id,
+                std::string(topic_name.data(), topic_name.size()),
+                std::string(contents.data(), contents.size()));
+        }
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_puback(Endpoint&, std::uint16_t packet_id) {
+        if (h_puback) return h_puback(packet_id);
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_pubrec(Endpoint&, std::uint16_t packet_id) {
+        if (h_pubrec) return h_pubrec(packet_id);
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_pubrel(Endpoint&, std::uint16_t packet_id) {
+        if (h_pubrel) return h_pubrel(packet_id);
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_pubcomp(Endpoint&, std::uint16_t packet_id) {
+        if (h_pubcomp) return h_pubcomp(packet_id);
+        return true;
+    }
+
+    template <typename Endpoint>
+    void on_pub_res_sent(Endpoint&, std::uint16_t packet_id) {
+        if (h_pub_res_sent) h_pub_res_sent(packet_id);
+    }
+
+    template <typename Endpoint>
+    bool on_subscribe(Endpoint&,
+                      std::uint16_t packet_id,
+                      std::vector<std::tuple<std::string, std::uint8_t>> entries) {
+        if (h_subscribe) return h_subscribe(packet_id, std::move(entries));
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_suback(Endpoint&,
+                   std::uint16_t packet_id,
+                   std::vector<boost::optional<std::uint8_t>> qoss) {
+        if (h_suback) return h_suback(packet_id, std::move(qoss));
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_unsubscribe(Endpoint&,
+                        std::uint16_t packet_id,
+                        std::vector<std::string> topics) {
+        if (h_unsubscribe) return h_unsubscribe(packet_id, std::move(topics));
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_unsuback(Endpoint&, std::uint16_t packet_id) {
+        if (h_unsuback) return h_unsuback(packet_id);
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_pingreq(Endpoint&) {
+        if (h_pingreq) return h_pingreq();
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_pingresp(Endpoint&) {
+        if (h_pingresp) return h_pingresp();
+        return true;
+    }
+
+    template <typename Endpoint>
+    void on_disconnect(Endpoint&) {
+        if (h_disconnect) h_disconnect();
+    }
+
+    close_handler h_close;
+    error_handler h_error;
+    connect_handler h_connect;
+    connack_handler h_connack;
+    publish_handler h_publish;
+    publish_ref_handler h_publish_ref;
+    puback_handler h_puback;
+    pubrec_handler h_pubrec;
+    pubrel_handler h_pubrel;
+    pubcomp_handler h_pubcomp;
+    pub_res_sent_handler h_pub_res_sent;
+    subscribe_handler h_subscribe;
+    suback_handler h_suback;
+    unsubscribe_handler h_unsubscribe;
+    unsuback_handler h_unsuback;
+    pingreq_handler h_pingreq;
+    pingresp_handler h_pingresp;
+    disconnect_handler h_disconnect;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_HANDLER_POLICY_HPP
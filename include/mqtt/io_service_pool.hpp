@@ -0,0 +1,203 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_IO_SERVICE_POOL_HPP)
+#define MQTT_IO_SERVICE_POOL_HPP
+
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <functional>
+#include <utility>
+#include <algorithm>
+
+#include <boost/asio.hpp>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif // defined(__linux__)
+
+namespace mqtt {
+
+namespace as = boost::asio;
+
+/**
+ * @brief Thread per core runtime.
+ * The pool has N io_services (shards) and runs each of them on its own thread.
+ * Place each endpoint on one shard, and it is handled by only one thread, so
+ * the endpoints don't need a strand. Use make_client_no_strand() with
+ * get_io_service(), and post() or dispatch() to call the endpoint from other threads.
+ */
+class io_service_pool {
+public:
+    /**
+     * @brief Constructor
+     * @param size the number of the shards. 0 means the number of the hardware threads.
+     * @param pin_threads If true, the thread of the shard i is pinned to the CPU i % (the number of CPUs).
+     *                    It is supported only on Linux, and it is ignored if it fails.
+     */
+    explicit io_service_pool(std::size_t size = 0, bool pin_threads = false)
+        :pin_threads_(pin_threads),
+         next_(0) {
+        if (size == 0) size = std::max(1U, std::thread::hardware_concurrency());
+        for (std::size_t i = 0; i != size; ++i) {
+            shards_.emplace_back(new shard);
+        }
+    }
+
+    io_service_pool(io_service_pool const&) = delete;
+    io_service_pool& operator=(io_service_pool const&) = delete;
+
+    ~io_service_pool() {
+        stop();
+        join();
+    }
+
+    /**
+     * @brief Start the threads. The io_services keep running until stop() is called.
+     */
+    void run() {
+        for (std::size_t i = 0; i != shards_.size(); ++i) {
+            auto& s = *shards_[i];
+            if (s.thread.joinable()) continue;
+            s.work.reset(new as::io_service::work(s.ios));
+            s.thread = std::thread(
+                [this, i, &s] {
+                    if (pin_threads_) pin(i);
+                    current_shard() = &s;
+                    s.ios.run();
+                    current_shard() = nullptr;
+                }
+            );
+        }
+    }
+
+    /**
+     * @brief Stop the io_services. The handlers that are not invoked yet are discarded.
+     */
+    void stop() {
+        for (auto& s : shards_) {
+            s->work.reset();
+            s->ios.stop();
+        }
+    }
+
+    /**
+     * @brief Let the io_services finish the current work and wait for the threads.
+     */
+    void join() {
+        for (auto& s : shards_) {
+            s->work.reset();
+        }
+        for (auto& s : shards_) {
+            if (s->thread.joinable()) s->thread.join();
+        }
+    }
+
+    /**
+     * @brief Get the number of the shards.
+     * @return the number of the shards
+     */
+    std::size_t size() const {
+        return shards_.size();
+    }
+
+    /**
+     * @brief Get the io_service of the shard.
+     * @param shard shard index
+     * @return io_service
+     */
+    as::io_service& get_io_service(std::size_t shard) {
+        return shards_[shard]->ios;
+    }
+
+    /**
+     * @brief Choose a shard in round robin.
+     * @return shard index
+     */
+    std::size_t next_shard() {
+        return next_++ % shards_.size();
+    }
+
+    /**
+     * @brief Choose the shard for the key, e.g. client_id.
+     *        The same key is always placed on the same shard.
+     * @return shard index
+     */
+    std::size_t shard_of(std::string const& key) const {
+        return std::hash<std::string>()(key) % shards_.size();
+    }
+
+    /**
+     * @brief Check whether the current thread is the thread of the shard.
+     * @param shard shard index
+     * @return If the current thread runs the shard then true, otherwise false.
+     */
+    bool running_in_this_thread(std::size_t shard) const {
+        return current_shard() == shards_[shard].get();
+    }
+
+    /**
+     * @brief Call f on the thread of the shard later.
+     * @param shard shard index
+     * @param f function object
+     */
+    template <typename F>
+    void post(std::size_t shard, F&& f) {
+        shards_[shard]->ios.post(std::forward<F>(f));
+    }
+
+    /**
+     * @brief Call f immediately if the current thread is the thread of the shard,
+     *        otherwise call it on the thread of the shard later.
+     * @param shard shard index
+     * @param f function object
+     */
+    template <typename F>
+    void dispatch(std::size_t shard, F&& f) {
+        if (running_in_this_thread(shard)) {
+            f();
+            return;
+        }
+        post(shard, std::forward<F>(f));
+    }
+
+private:
+    struct shard {
+        as::io_service ios;
+        std::unique_ptr<as::io_service::work> work;
+        std::thread thread;
+    };
+
+    static shard const*& current_shard() {
+        static thread_local shard const* s = nullptr;
+        return s;
+    }
+
+    static void pin(std::size_t i) {
+#if defined(__linux__)
+        auto cpus = std::max(1U, std::thread::hardware_concurrency());
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(static_cast<int>(i % cpus), &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else  // defined(__linux__)
+        static_cast<void>(i);
+#endif // defined(__linux__)
+    }
+
+    bool pin_threads_;
+    std::atomic<std::size_t> next_;
+    std::vector<std::unique_ptr<shard>> shards_;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_IO_SERVICE_POOL_HPP
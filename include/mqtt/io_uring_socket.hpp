@@ -0,0 +1,1137 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_IO_URING_SOCKET_HPP)
+#define MQTT_IO_URING_SOCKET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include <boost/version.hpp>
+#include <boost/asio.hpp>
+#include <boost/asio/detail/bind_handler.hpp>
+#include <boost/asio/detail/handler_alloc_helpers.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/system/system_error.hpp>
+
+namespace mqtt {
+
+namespace as = boost::asio;
+
+class io_uring_ring;
+
+namespace detail {
+
+// io_uring is used by the system calls directly, so liburing is not required.
+inline int io_uring_setup(unsigned entries, io_uring_params* p) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+inline int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+inline int io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+template <typename T>
+inline T io_uring_load_acquire(T const* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+inline void io_uring_store_release(T* p, T v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+inline void throw_io_uring_error(int err, char const* what) {
+    throw boost::system::system_error(
+        boost::system::error_code(err, boost::system::system_category()), what);
+}
+
+#if BOOST_VERSION >= 106600
+
+template <typename BufferSequence>
+inline auto io_uring_buffers_begin(BufferSequence const& b) -> decltype(as::buffer_sequence_begin(b)) {
+    return as::buffer_sequence_begin(b);
+}
+
+template <typename BufferSequence>
+inline auto io_uring_buffers_end(BufferSequence const& b) -> decltype(as::buffer_sequence_end(b)) {
+    return as::buffer_sequence_end(b);
+}
+
+#else  // BOOST_VERSION >= 106600
+
+template <typename BufferSequence>
+inline typename BufferSequence::const_iterator io_uring_buffers_begin(BufferSequence const& b) {
+    return b.begin();
+}
+
+template <typename BufferSequence>
+inline typename BufferSequence::const_iterator io_uring_buffers_end(BufferSequence const& b) {
+    return b.end();
+}
+
+#endif // BOOST_VERSION >= 106600
+
+// An operation that is submitted to the ring. The address is the user_data of the submission.
+class io_uring_operation {
+public:
+    // Called for each completion of the operation.
+    virtual void complete(int res, std::uint32_t flags) = 0;
+    // Called when the cancel request of the operation is completed.
+    virtual void release() {}
+    // Called when the ring is shut down before the operation is completed.
+    virtual void destroy() = 0;
+
+protected:
+    io_uring_operation()
+        :prev_(nullptr),
+         next_(nullptr) {}
+    ~io_uring_operation() = default;
+
+private:
+    friend class mqtt::io_uring_ring;
+    // The list of the operations in the kernel. It is used to destroy them at shutdown.
+    io_uring_operation* prev_;
+    io_uring_operation* next_;
+};
+
+// A socket that waits for the provided buffers.
+class io_uring_buffer_waiter {
+public:
+    virtual void on_buffers() = 0;
+
+protected:
+    ~io_uring_buffer_waiter() = default;
+};
+
+} // namespace detail
+
+/**
+ * @brief io_uring instance of an io_service.
+ * The submissions of the io_uring_sockets are queued and submitted by one io_uring_enter()
+ * per turn of the io_service, and the completions are reaped when the io_service observes
+ * the ring file descriptor as readable. All sockets of the io_service share a ring of
+ * provided buffers that the multishot receives pick from, so an idle connection doesn't
+ * hold a receive buffer.
+ * The completions are reaped by one thread at a time. To use more cores, use an io_service
+ * per thread, e.g. io_service_pool. Each io_service has its own ring.
+ */
+class io_uring_ring : public as::detail::service_base<io_uring_ring> {
+public:
+    /**
+     * @brief The number of the submission queue entries.
+     */
+    static constexpr unsigned const queue_entries = 1024;
+
+    /**
+     * @brief The number of the provided receive buffers. It must be a power of 2.
+     */
+    static constexpr unsigned const buffer_count = 1024;
+
+    /**
+     * @brief The size of each provided receive buffer.
+     */
+    static constexpr std::size_t const buffer_size = 4096;
+
+    /**
+     * @brief The buffer group identifier of the provided receive buffers.
+     */
+    static constexpr std::uint16_t const buffer_group = 0;
+
+    /**
+     * @brief Constructor. It is called by as::use_service<io_uring_ring>(ios).
+     *        boost::system::system_error is thrown if the kernel doesn't support io_uring,
+     *        the ring of provided buffers, or the multishot receive (Linux 6.0 or later).
+     * @param ios io_service object.
+     */
+    explicit io_uring_ring(as::io_service& ios)
+        :as::detail::service_base<io_uring_ring>(ios),
+         ios_(ios),
+         ring_fd_(-1),
+         sq_ptr_(MAP_FAILED),
+         sq_size_(0),
+         cq_ptr_(MAP_FAILED),
+         cq_size_(0),
+         sqes_(static_cast<io_uring_sqe*>(MAP_FAILED)),
+         sqes_size_(0),
+         buf_ptr_(MAP_FAILED),
+         buf_size_(0),
+         buf_ring_(nullptr),
+         buf_data_(nullptr),
+         buf_tail_(0),
+         free_buffers_(0),
+         sq_tail_local_(0),
+         unsubmitted_(0),
+         outstanding_(0),
+         flush_posted_(false),
+         waiting_(false),
+         reaping_(false),
+         reap_again_(false),
+         shut_down_(false),
+         ops_(nullptr),
+         desc_(ios) {
+        try {
+            setup();
+        }
+        catch (...) {
+            release_resources();
+            throw;
+        }
+    }
+
+    ~io_uring_ring() {
+        release_resources();
+    }
+
+    void shutdown() {
+        detail::io_uring_operation* ops;
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            shut_down_ = true;
+            ops = ops_;
+            ops_ = nullptr;
+        }
+        while (ops) {
+            auto next = ops->next_;
+            ops->destroy();
+            ops = next;
+        }
+    }
+
+    void shutdown_service() {
+        shutdown();
+    }
+
+    /**
+     * @brief Queue a submission. It is submitted with the other submissions of the turn.
+     * @param op operation that receives the completions.
+     * @param prepare function object that fills io_uring_sqe&. user_data is set by the ring.
+     */
+    template <typename Prepare>
+    void submit(detail::io_uring_operation* op, Prepare&& prepare) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        if (shut_down_) return;
+        auto sqe = next_sqe();
+        prepare(*sqe);
+        sqe->user_data = reinterpret_cast<std::uint64_t>(op);
+        link(op);
+        ++outstanding_;
+        start_wait();
+        schedule_flush();
+    }
+
+    /**
+     * @brief Cancel the operation. op->release() is called when the cancel is completed,
+     *        so the operation must live until then.
+     * @param op operation to cancel
+     */
+    void cancel(detail::io_uring_operation* op) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        if (shut_down_) return;
+        auto sqe = next_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<std::uint64_t>(op);
+        // The lowest bit tells the cancel completion from the completions of op.
+        sqe->user_data = reinterpret_cast<std::uint64_t>(op) | 1;
+        ++outstanding_;
+        start_wait();
+        schedule_flush();
+    }
+
+    /**
+     * @brief Submit the queued submissions now. Call it before closing a file descriptor
+     *        that queued submissions refer to.
+     */
+    void flush() {
+        std::lock_guard<std::mutex> lck(mtx_);
+        flush_locked();
+    }
+
+    /**
+     * @brief Get the data of the provided buffer.
+     * @param bid buffer identifier of the completion
+     * @return pointer to the buffer
+     */
+    char const* buffer(std::uint16_t bid) const {
+        return buf_data_ + static_cast<std::size_t>(bid) * buffer_size;
+    }
+
+    /**
+     * @brief Give the provided buffer back to the kernel.
+     * @param bid buffer identifier of the completion
+     */
+    void recycle(std::uint16_t bid) {
+        std::vector<std::weak_ptr<detail::io_uring_buffer_waiter>> waiters;
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            add_buffer(bid);
+            detail::io_uring_store_release(&buf_tail_shared(), buf_tail_);
+            ++free_buffers_;
+            waiters.swap(waiters_);
+        }
+        // The recycling socket may be a waiter, so they are notified later.
+        if (!waiters.empty()) notify(std::move(waiters));
+    }
+
+    /**
+     * @brief Call w->on_buffers() when a provided buffer is recycled.
+     * @param w socket that got ENOBUFS
+     */
+    void wait_for_buffers(std::weak_ptr<detail::io_uring_buffer_waiter> w) {
+        std::vector<std::weak_ptr<detail::io_uring_buffer_waiter>> waiters;
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            waiters_.push_back(std::move(w));
+            if (free_buffers_ == 0) return;
+            waiters.swap(waiters_);
+        }
+        notify(std::move(waiters));
+    }
+
+private:
+    void setup() {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring_fd_ = detail::io_uring_setup(queue_entries, &params);
+        if (ring_fd_ < 0) {
+            int err = errno;
+            ring_fd_ = -1;
+            detail::throw_io_uring_error(err, "io_uring_setup");
+        }
+
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        sq_ptr_ = ::mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring_fd_, IORING_OFF_SQ_RING);
+        if (sq_ptr_ == MAP_FAILED) detail::throw_io_uring_error(errno, "io_uring sq ring mmap");
+        if (single_mmap) {
+            cq_ptr_ = sq_ptr_;
+        }
+        else {
+            cq_ptr_ = ::mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring_fd_, IORING_OFF_CQ_RING);
+            if (cq_ptr_ == MAP_FAILED) detail::throw_io_uring_error(errno, "io_uring cq ring mmap");
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(
+            ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring_fd_, IORING_OFF_SQES));
+        if (sqes_ == MAP_FAILED) detail::throw_io_uring_error(errno, "io_uring sqes mmap");
+
+        auto sq = static_cast<char*>(sq_ptr_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_entries_ = params.sq_entries;
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_tail_local_ = *sq_tail_;
+        auto cq = static_cast<char*>(cq_ptr_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // The ring of provided buffers and the buffers are mapped together.
+        // Writes after the unmapping fault instead of corrupting the heap.
+        std::size_t ring_size = buffer_count * sizeof(io_uring_buf);
+        buf_size_ = ring_size + buffer_count * buffer_size;
+        buf_ptr_ = ::mmap(nullptr, buf_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf_ptr_ == MAP_FAILED) detail::throw_io_uring_error(errno, "io_uring buffer mmap");
+        buf_ring_ = static_cast<io_uring_buf_ring*>(buf_ptr_);
+        buf_data_ = static_cast<char*>(buf_ptr_) + ring_size;
+
+        io_uring_buf_reg reg;
+        std::memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<std::uint64_t>(buf_ring_);
+        reg.ring_entries = buffer_count;
+        reg.bgid = buffer_group;
+        if (detail::io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            detail::throw_io_uring_error(errno, "io_uring provided buffer ring");
+        }
+        for (unsigned bid = 0; bid != buffer_count; ++bid) add_buffer(static_cast<std::uint16_t>(bid));
+        detail::io_uring_store_release(&buf_tail_shared(), buf_tail_);
+        free_buffers_ = buffer_count;
+
+        probe_multishot_recv();
+        desc_.assign(ring_fd_);
+    }
+
+    // Kernels older than Linux 6.0 reject IORING_RECV_MULTISHOT with EINVAL, but some
+    // distributions backport it, so a receive is submitted on a closed socket pair.
+    void probe_multishot_recv() {
+        int sv[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+            detail::throw_io_uring_error(errno, "io_uring multishot receive probe");
+        }
+        struct closer {
+            ~closer() {
+                ::close(sv[0]);
+                ::close(sv[1]);
+            }
+            int* sv;
+        } c { sv };
+        // The receive completes with the end of file at once.
+        ::shutdown(sv[1], SHUT_WR);
+
+        std::lock_guard<std::mutex> lck(mtx_);
+        auto sqe = next_sqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = sv[0];
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = buffer_group;
+        detail::io_uring_store_release(sq_tail_, sq_tail_local_);
+        for (;;) {
+            while (!completion_ready()) {
+                int ret = detail::io_uring_enter(ring_fd_, unsubmitted_, 1, IORING_ENTER_GETEVENTS);
+                if (ret >= 0) unsubmitted_ -= static_cast<unsigned>(ret);
+                else if (errno != EINTR) detail::throw_io_uring_error(errno, "io_uring_enter");
+            }
+            auto head = *cq_head_;
+            io_uring_cqe cqe = cqes_[head & cq_mask_];
+            detail::io_uring_store_release(cq_head_, head + 1);
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                add_buffer(static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+                detail::io_uring_store_release(&buf_tail_shared(), buf_tail_);
+            }
+            if (cqe.res == -EINVAL) {
+                detail::throw_io_uring_error(ENOSYS, "io_uring multishot receive is not supported");
+            }
+            if (!(cqe.flags & IORING_CQE_F_MORE)) return;
+        }
+    }
+
+    void release_resources() {
+        if (sqes_ != MAP_FAILED) ::munmap(sqes_, sqes_size_);
+        if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) ::munmap(cq_ptr_, cq_size_);
+        if (sq_ptr_ != MAP_FAILED) ::munmap(sq_ptr_, sq_size_);
+        sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+        cq_ptr_ = sq_ptr_ = MAP_FAILED;
+        if (desc_.is_open()) {
+            boost::system::error_code ec;
+            desc_.close(ec);
+        }
+        else if (ring_fd_ >= 0) {
+            ::close(ring_fd_);
+        }
+        ring_fd_ = -1;
+        // The buffers are unmapped after the ring is closed.
+        if (buf_ptr_ != MAP_FAILED) ::munmap(buf_ptr_, buf_size_);
+        buf_ptr_ = MAP_FAILED;
+    }
+
+    // The tail of the provided buffer ring overlays the reserved field of the first entry.
+    std::uint16_t& buf_tail_shared() {
+        return buf_ring_->tail;
+    }
+
+    void add_buffer(std::uint16_t bid) {
+        auto& b = reinterpret_cast<io_uring_buf*>(buf_ring_)[buf_tail_ & (buffer_count - 1)];
+        b.addr = reinterpret_cast<std::uint64_t>(buf_data_ + static_cast<std::size_t>(bid) * buffer_size);
+        b.len = static_cast<std::uint32_t>(buffer_size);
+        b.bid = bid;
+        ++buf_tail_;
+    }
+
+    void notify(std::vector<std::weak_ptr<detail::io_uring_buffer_waiter>> waiters) {
+        auto p = std::make_shared<std::vector<std::weak_ptr<detail::io_uring_buffer_waiter>>>(std::move(waiters));
+        ios_.post(
+            [p] {
+                for (auto const& w : *p) {
+                    if (auto s = w.lock()) s->on_buffers();
+                }
+            });
+    }
+
+    // The following functions should be called with mtx_ locked.
+    io_uring_sqe* next_sqe() {
+        if (sq_tail_local_ - detail::io_uring_load_acquire(sq_head_) == sq_entries_) {
+            flush_locked();
+            if (sq_tail_local_ - detail::io_uring_load_acquire(sq_head_) == sq_entries_) {
+                detail::throw_io_uring_error(EBUSY, "io_uring submission queue is full");
+            }
+        }
+        auto idx = sq_tail_local_ & sq_mask_;
+        sq_array_[idx] = idx;
+        ++sq_tail_local_;
+        ++unsubmitted_;
+        auto sqe = &sqes_[idx];
+        std::memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    void schedule_flush() {
+        if (flush_posted_) return;
+        flush_posted_ = true;
+        ios_.post(
+            [this] {
+                std::lock_guard<std::mutex> lck(mtx_);
+                flush_posted_ = false;
+                flush_locked();
+            });
+    }
+
+    void flush_locked() {
+        if (unsubmitted_ == 0 || shut_down_) return;
+        detail::io_uring_store_release(sq_tail_, sq_tail_local_);
+        for (;;) {
+            int ret = detail::io_uring_enter(ring_fd_, unsubmitted_, 0, 0);
+            if (ret >= 0) {
+                unsubmitted_ -= static_cast<unsigned>(ret);
+                if (unsubmitted_ == 0) return;
+            }
+            else if (errno != EINTR) {
+                break;
+            }
+        }
+        // The completion queue is full (EBUSY) or the kernel is short of memory (EAGAIN).
+        // Retry after the completions are reaped.
+        schedule_flush();
+    }
+
+    void link(detail::io_uring_operation* op) {
+        op->prev_ = nullptr;
+        op->next_ = ops_;
+        if (ops_) ops_->prev_ = op;
+        ops_ = op;
+    }
+
+    void unlink(detail::io_uring_operation* op) {
+        if (op->prev_) op->prev_->next_ = op->next_;
+        else if (ops_ == op) ops_ = op->next_;
+        if (op->next_) op->next_->prev_ = op->prev_;
+        op->prev_ = op->next_ = nullptr;
+    }
+
+    bool completion_ready() const {
+        return *cq_head_ != detail::io_uring_load_acquire(cq_tail_);
+    }
+
+    void start_wait() {
+        if (waiting_ || outstanding_ == 0 || shut_down_) return;
+        waiting_ = true;
+        desc_.async_read_some(
+            as::null_buffers(),
+            [this]
+            (boost::system::error_code const&, std::size_t) {
+                {
+                    std::lock_guard<std::mutex> lck(mtx_);
+                    waiting_ = false;
+                }
+                reap();
+            });
+    }
+
+    // Invoke the completions. The handlers are called without the lock, one thread at a time,
+    // so the completions of a multishot receive are delivered in order.
+    void reap() {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (reaping_) {
+            reap_again_ = true;
+            return;
+        }
+        reaping_ = true;
+        while (!shut_down_) {
+            auto head = *cq_head_;
+            if (head == detail::io_uring_load_acquire(cq_tail_)) {
+                if (!reap_again_) break;
+                reap_again_ = false;
+                continue;
+            }
+            io_uring_cqe cqe = cqes_[head & cq_mask_];
+            detail::io_uring_store_release(cq_head_, head + 1);
+            if (cqe.user_data == 0) continue;
+            if (cqe.flags & IORING_CQE_F_BUFFER) --free_buffers_;
+            bool cancel = cqe.user_data & 1;
+            auto op = reinterpret_cast<detail::io_uring_operation*>(cqe.user_data & ~std::uint64_t(1));
+            if (cancel || !(cqe.flags & IORING_CQE_F_MORE)) {
+                --outstanding_;
+                if (!cancel) unlink(op);
+            }
+            lck.unlock();
+            if (cancel) op->release();
+            else op->complete(cqe.res, cqe.flags);
+            lck.lock();
+        }
+        reaping_ = false;
+        if (shut_down_) return;
+        if (outstanding_ == 0) {
+            // Don't keep the io_service running without operations.
+            if (waiting_) {
+                boost::system::error_code ec;
+                desc_.cancel(ec);
+            }
+            return;
+        }
+        start_wait();
+        // The completions that arrived before the wait was started don't wake it up.
+        if (completion_ready()) ios_.post([this] { reap(); });
+    }
+
+    as::io_service& ios_;
+    std::mutex mtx_;
+    int ring_fd_;
+    void* sq_ptr_;
+    std::size_t sq_size_;
+    void* cq_ptr_;
+    std::size_t cq_size_;
+    io_uring_sqe* sqes_;
+    std::size_t sqes_size_;
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    io_uring_cqe* cqes_;
+    void* buf_ptr_;
+    std::size_t buf_size_;
+    io_uring_buf_ring* buf_ring_;
+    char* buf_data_;
+    std::uint16_t buf_tail_;
+    std::size_t free_buffers_;
+    std::vector<std::weak_ptr<detail::io_uring_buffer_waiter>> waiters_;
+    unsigned sq_tail_local_;
+    unsigned unsubmitted_;
+    std::size_t outstanding_;
+    bool flush_posted_;
+    bool waiting_;
+    bool reaping_;
+    bool reap_again_;
+    bool shut_down_;
+    detail::io_uring_operation* ops_;
+    as::posix::stream_descriptor desc_;
+};
+
+/**
+ * @brief TCP socket that reads and writes with io_uring.
+ * It can be used as the Socket template parameter of endpoint, client and server.
+ * Reading uses a multishot receive with the provided buffers of the io_uring_ring, so a
+ * connection has one receive in the kernel for its whole lifetime, and writing uses
+ * IORING_OP_SENDMSG. The submissions of all sockets on the io_service are batched.
+ * Connecting, accepting and the socket options use lowest_layer(), an as::ip::tcp::socket.
+ * Close the socket by close() instead of lowest_layer().close(), so the receive is cancelled.
+ * It is defined if MQTT_USE_IO_URING is defined, and requires the multishot receive (Linux 6.0 or later).
+ * boost::system::system_error is thrown at the construction if io_uring is not available.
+ */
+class io_uring_socket {
+public:
+    using lowest_layer_type = as::ip::tcp::socket;
+    using next_layer_type = as::ip::tcp::socket;
+
+    /**
+     * @brief Constructor
+     * @param ios io_service object. The io_uring_ring of it is created at the first socket.
+     */
+    explicit io_uring_socket(as::io_service& ios)
+        :ios_(ios),
+         impl_(std::make_shared<impl>(ios, as::use_service<io_uring_ring>(ios))) {}
+
+    io_uring_socket(io_uring_socket const&) = delete;
+    io_uring_socket& operator=(io_uring_socket const&) = delete;
+
+    ~io_uring_socket() {
+        boost::system::error_code ec;
+        impl_->close(ec);
+    }
+
+    as::io_service& get_io_service() {
+        return ios_;
+    }
+
+#if BOOST_VERSION >= 106600
+    as::io_service::executor_type get_executor() {
+        return ios_.get_executor();
+    }
+#endif // BOOST_VERSION >= 106600
+
+    lowest_layer_type& lowest_layer() {
+        return impl_->socket;
+    }
+
+    next_layer_type& next_layer() {
+        return impl_->socket;
+    }
+
+    /**
+     * @brief Cancel the receive and close the socket.
+     *        The waiting async_read_some is called with as::error::operation_aborted.
+     * @param ec error code
+     */
+    void close(boost::system::error_code& ec) {
+        impl_->close(ec);
+    }
+
+    void close() {
+        boost::system::error_code ec;
+        close(ec);
+        if (ec) throw boost::system::system_error(ec);
+    }
+
+    /**
+     * @brief Read the received data. The multishot receive is started at the first call.
+     *        as::error::eof is passed after the peer closed the connection.
+     * @param buffers buffers to read into
+     * @param handler handler that is called with (error_code, std::size_t)
+     */
+    template <typename MutableBufferSequence, typename ReadHandler>
+    void async_read_some(MutableBufferSequence const& buffers, ReadHandler&& handler) {
+        using op_type = read_op<MutableBufferSequence, typename std::decay<ReadHandler>::type>;
+        impl_->start_read<op_type>(buffers, std::forward<ReadHandler>(handler));
+    }
+
+    /**
+     * @brief Write all bytes of the buffers with IORING_OP_SENDMSG.
+     * @param buffers buffers to write. They must be valid until the handler is called.
+     * @param handler handler that is called with (error_code, std::size_t)
+     */
+    template <typename ConstBufferSequence, typename WriteHandler>
+    void async_write(ConstBufferSequence const& buffers, WriteHandler&& handler) {
+        using handler_type = typename std::decay<WriteHandler>::type;
+        using op_type = write_op<ConstBufferSequence, handler_type>;
+        handler_type h(std::forward<WriteHandler>(handler));
+        void* p = boost_asio_handler_alloc_helpers::allocate(sizeof(op_type), h);
+        auto op = new (p) op_type(impl_, buffers, std::move(h));
+        if (op->total == 0) {
+            ios_.post([op] { op->finish(boost::system::error_code()); });
+            return;
+        }
+        op->submit();
+    }
+
+    /**
+     * @brief Write all bytes of the buffers. It blocks until they are written.
+     * @param buffers buffers to write
+     * @param ec error code
+     * @return the number of the written bytes
+     */
+    template <typename ConstBufferSequence>
+    std::size_t write(ConstBufferSequence const& buffers, boost::system::error_code& ec) {
+        ec = boost::system::error_code();
+        iovec iov[max_iovs];
+        std::size_t done = 0;
+        int fd = impl_->socket.native_handle();
+        for (;;) {
+            auto n = fill_iovecs(buffers, done, iov);
+            if (n == 0) return done;
+            msghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = n;
+            auto ret = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+            if (ret >= 0) {
+                done += static_cast<std::size_t>(ret);
+                continue;
+            }
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // The descriptor is non-blocking after async_connect.
+                pollfd pfd { fd, static_cast<short>(POLLOUT), 0 };
+                if (::poll(&pfd, 1, -1) >= 0 || errno == EINTR) continue;
+            }
+            ec = boost::system::error_code(errno, boost::system::system_category());
+            return done;
+        }
+    }
+
+    template <typename ConstBufferSequence>
+    std::size_t write(ConstBufferSequence const& buffers) {
+        boost::system::error_code ec;
+        auto ret = write(buffers, ec);
+        if (ec) throw boost::system::system_error(ec);
+        return ret;
+    }
+
+private:
+    static constexpr std::size_t const max_iovs = 64;
+
+    // Fill iov from the bytes of the buffers after skip. Returns the number of the iovecs.
+    template <typename ConstBufferSequence>
+    static std::size_t fill_iovecs(ConstBufferSequence const& buffers, std::size_t skip, iovec* iov) {
+        std::size_t n = 0;
+        auto end = detail::io_uring_buffers_end(buffers);
+        for (auto it = detail::io_uring_buffers_begin(buffers); it != end && n != max_iovs; ++it) {
+            as::const_buffer b(*it);
+            auto size = as::buffer_size(b);
+            if (skip >= size) {
+                skip -= size;
+                continue;
+            }
+            iov[n].iov_base = const_cast<char*>(as::buffer_cast<char const*>(b)) + skip;
+            iov[n].iov_len = size - skip;
+            skip = 0;
+            ++n;
+        }
+        return n;
+    }
+
+    struct impl;
+
+    // The waiting async_read_some.
+    struct read_op_base {
+        virtual std::size_t copy(impl& i) = 0;
+        virtual void complete(boost::system::error_code const& ec, std::size_t bytes_transferred) = 0;
+
+    protected:
+        ~read_op_base() = default;
+    };
+
+    template <typename MutableBufferSequence, typename Handler>
+    struct read_op final : read_op_base {
+        read_op(MutableBufferSequence const& buffers, Handler&& h)
+            :buffers(buffers),
+             handler(std::move(h)) {}
+
+        std::size_t copy(impl& i) override {
+            return i.consume(buffers);
+        }
+
+        void complete(boost::system::error_code const& ec, std::size_t bytes_transferred) override {
+            Handler h(std::move(handler));
+            this->~read_op();
+            boost_asio_handler_alloc_helpers::deallocate(this, sizeof(read_op), h);
+            h(ec, bytes_transferred);
+        }
+
+        MutableBufferSequence buffers;
+        Handler handler;
+    };
+
+    // The multishot receive. It lives until the last completion and the completion of the cancel.
+    struct recv_op final : detail::io_uring_operation {
+        explicit recv_op(std::shared_ptr<impl> owner)
+            :owner(std::move(owner)),
+             refs(1),
+             detached(false) {}
+
+        void complete(int res, std::uint32_t flags) override {
+            owner->on_recv(this, res, flags);
+            if (!(flags & IORING_CQE_F_MORE)) release();
+        }
+
+        void release() override {
+            if (--refs == 0) delete this;
+        }
+
+        void destroy() override {
+            delete this;
+        }
+
+        std::shared_ptr<impl> owner;
+        std::atomic<int> refs;
+        // The socket is closed. The received data are dropped.
+        bool detached;
+    };
+
+    template <typename ConstBufferSequence, typename Handler>
+    struct write_op final : detail::io_uring_operation {
+        write_op(std::shared_ptr<impl> owner, ConstBufferSequence const& buffers, Handler&& h)
+            :owner(std::move(owner)),
+             buffers(buffers),
+             handler(std::move(h)),
+             total(as::buffer_size(buffers)),
+             done(0) {}
+
+        void submit() {
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = fill_iovecs(buffers, done, iov);
+            int fd = owner->socket.native_handle();
+            owner->ring.submit(
+                this,
+                [&]
+                (io_uring_sqe& sqe) {
+                    sqe.opcode = IORING_OP_SENDMSG;
+                    sqe.fd = fd;
+                    sqe.addr = reinterpret_cast<std::uint64_t>(&msg);
+                    sqe.len = 1;
+                    sqe.msg_flags = MSG_NOSIGNAL;
+                });
+        }
+
+        void complete(int res, std::uint32_t) override {
+            if (res < 0) {
+                finish(boost::system::error_code(-res, boost::system::system_category()));
+                return;
+            }
+            done += static_cast<std::size_t>(res);
+            if (done == total) {
+                finish(boost::system::error_code());
+                return;
+            }
+            if (res == 0) {
+                finish(boost::system::errc::make_error_code(boost::system::errc::broken_pipe));
+                return;
+            }
+            // Partial write
+            submit();
+        }
+
+        void destroy() override {
+            Handler h(std::move(handler));
+            this->~write_op();
+            boost_asio_handler_alloc_helpers::deallocate(this, sizeof(write_op), h);
+        }
+
+        void finish(boost::system::error_code const& ec) {
+            Handler h(std::move(handler));
+            auto bytes_transferred = done;
+            this->~write_op();
+            boost_asio_handler_alloc_helpers::deallocate(this, sizeof(write_op), h);
+            h(ec, bytes_transferred);
+        }
+
+        std::shared_ptr<impl> owner;
+        ConstBufferSequence buffers;
+        Handler handler;
+        std::size_t total;
+        std::size_t done;
+        msghdr msg;
+        iovec iov[max_iovs];
+    };
+
+    // The state that the operations refer to. It outlives the io_uring_socket until they are completed.
+    struct impl : detail::io_uring_buffer_waiter, std::enable_shared_from_this<impl> {
+        impl(as::io_service& ios, io_uring_ring& ring)
+            :ios(ios),
+             socket(ios),
+             ring(ring),
+             recv(nullptr),
+             recv_fd(-1),
+             read(nullptr),
+             starved(false) {}
+
+        ~impl() {
+            for (auto const& c : chunks) ring.recycle(c.bid);
+        }
+
+        template <typename Op, typename MutableBufferSequence, typename Handler>
+        void start_read(MutableBufferSequence const& buffers, Handler&& handler) {
+            typename std::decay<Handler>::type h(std::forward<Handler>(handler));
+            std::unique_lock<std::mutex> lck(mtx);
+            int fd = socket.native_handle();
+            if (recv_fd != fd) {
+                // The socket is reopened without close(), e.g. by lowest_layer().
+                reset();
+                recv_fd = fd;
+            }
+            if (!chunks.empty() || read_error) {
+                auto bytes_transferred = consume(buffers);
+                auto ec = bytes_transferred ? boost::system::error_code() : read_error;
+                lck.unlock();
+                ios.post(as::detail::bind_handler(std::move(h), ec, bytes_transferred));
+                return;
+            }
+            void* p = boost_asio_handler_alloc_helpers::allocate(sizeof(Op), h);
+            read = new (p) Op(buffers, std::move(h));
+            if (!recv && !starved) arm();
+        }
+
+        template <typename MutableBufferSequence>
+        std::size_t consume(MutableBufferSequence const& buffers) {
+            std::size_t bytes_transferred = 0;
+            auto end = detail::io_uring_buffers_end(buffers);
+            for (auto it = detail::io_uring_buffers_begin(buffers); it != end && !chunks.empty(); ++it) {
+                as::mutable_buffer b(*it);
+                auto dst = as::buffer_cast<char*>(b);
+                auto size = as::buffer_size(b);
+                while (size != 0 && !chunks.empty()) {
+                    auto& c = chunks.front();
+                    auto len = std::min(size, c.size - c.offset);
+                    std::memcpy(dst, ring.buffer(c.bid) + c.offset, len);
+                    dst += len;
+                    size -= len;
+                    bytes_transferred += len;
+                    c.offset += len;
+                    if (c.offset == c.size) {
+                        ring.recycle(c.bid);
+                        chunks.pop_front();
+                    }
+                }
+            }
+            return bytes_transferred;
+        }
+
+        void on_recv(recv_op* op, int res, std::uint32_t flags) {
+            read_op_base* completed = nullptr;
+            boost::system::error_code ec;
+            std::size_t bytes_transferred = 0;
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+                bool more = flags & IORING_CQE_F_MORE;
+                auto bid = static_cast<std::uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+                if (op->detached) {
+                    if (flags & IORING_CQE_F_BUFFER) ring.recycle(bid);
+                    return;
+                }
+                if (!more) recv = nullptr;
+                if (res > 0) {
+                    chunks.push_back(chunk { bid, 0, static_cast<std::size_t>(res) });
+                }
+                else if (res == -ENOBUFS) {
+                    // All provided buffers are in use. Receive again when one is recycled.
+                    if (!more) {
+                        starved = true;
+                        ring.wait_for_buffers(shared_from_this());
+                    }
+                }
+                else if (res == 0) {
+                    read_error = as::error::eof;
+                }
+                else if (res == -ECANCELED) {
+                    read_error = as::error::operation_aborted;
+                }
+                else {
+                    read_error = boost::system::error_code(-res, boost::system::system_category());
+                }
+                // The kernel stops the multishot receive e.g. when the completion queue overflows.
+                if (!recv && !starved && !read_error) arm();
+                if (read && (!chunks.empty() || read_error)) {
+                    completed = read;
+                    read = nullptr;
+                    bytes_transferred = completed->copy(*this);
+                    if (bytes_transferred == 0) ec = read_error;
+                }
+            }
+            if (completed) completed->complete(ec, bytes_transferred);
+        }
+
+        void on_buffers() override {
+            std::lock_guard<std::mutex> lck(mtx);
+            if (!starved) return;
+            starved = false;
+            if (!recv && !read_error && socket.is_open()) arm();
+        }
+
+        void close(boost::system::error_code& ec) {
+            read_op_base* aborted = nullptr;
+            {
+                std::lock_guard<std::mutex> lck(mtx);
+                aborted = read;
+                read = nullptr;
+                if (socket.is_open()) {
+                    // The peer and the receive see the end of the stream even if the cancel is late.
+                    ::shutdown(socket.native_handle(), SHUT_RDWR);
+                }
+                reset();
+                // The queued submissions refer to the file descriptor.
+                ring.flush();
+                socket.close(ec);
+            }
+            if (aborted) {
+                ios.post(
+                    [aborted] {
+                        aborted->complete(as::error::operation_aborted, 0);
+                    });
+            }
+        }
+
+        // The following functions should be called with mtx locked.
+        void arm() {
+            auto op = new recv_op(shared_from_this());
+            recv = op;
+            int fd = socket.native_handle();
+            ring.submit(
+                op,
+                [&]
+                (io_uring_sqe& sqe) {
+                    sqe.opcode = IORING_OP_RECV;
+                    sqe.fd = fd;
+                    sqe.ioprio = IORING_RECV_MULTISHOT;
+                    sqe.flags = IOSQE_BUFFER_SELECT;
+                    sqe.buf_group = io_uring_ring::buffer_group;
+                });
+        }
+
+        void reset() {
+            if (recv) {
+                recv->detached = true;
+                ++recv->refs;
+                ring.cancel(recv);
+                recv = nullptr;
+            }
+            for (auto const& c : chunks) ring.recycle(c.bid);
+            chunks.clear();
+            read_error = boost::system::error_code();
+            starved = false;
+        }
+
+        struct chunk {
+            std::uint16_t bid;
+            std::size_t offset;
+            std::size_t size;
+        };
+
+        as::io_service& ios;
+        as::ip::tcp::socket socket;
+        io_uring_ring& ring;
+        std::mutex mtx;
+        recv_op* recv;
+        int recv_fd;
+        read_op_base* read;
+        std::deque<chunk> chunks;
+        boost::system::error_code read_error;
+        bool starved;
+    };
+
+    as::io_service& ios_;
+    std::shared_ptr<impl> impl_;
+};
+
+template <typename ConstBufferSequence>
+inline std::size_t write(
+    io_uring_socket& socket,
+    ConstBufferSequence const& buffers) {
+    return socket.write(buffers);
+}
+
+template <typename ConstBufferSequence>
+inline std::size_t write(
+    io_uring_socket& socket,
+    ConstBufferSequence const& buffers,
+    boost::system::error_code& ec) {
+    return socket.write(buffers, ec);
+}
+
+template <typename ConstBufferSequence, typename WriteHandler>
+inline void async_write(
+    io_uring_socket& socket,
+    ConstBufferSequence const& buffers,
+    WriteHandler&& handler) {
+    socket.async_write(buffers, std::forward<WriteHandler>(handler));
+}
+
+} // namespace mqtt
+
+#endif // MQTT_IO_URING_SOCKET_HPP
@@ -0,0 +1,267 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_MMAP_LOG_HPP)
+#define MQTT_MMAP_LOG_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include <algorithm>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif // !defined(_WIN32)
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/crc.hpp>
+
+namespace mqtt {
+
+namespace detail {
+
+/**
+ * @brief Memory mapped append only log file of mmap_session_store and retained_store.
+ * The file starts with a 16 bytes header that has the 8 bytes magic.
+ * Each record starts with the 4 bytes size of the whole record including the padding to
+ * 8 bytes, followed by the 4 bytes crc32 of the rest of the header and the body. The size is written
+ * at last, so a record that was being written when the process crashed is discarded by
+ * recover(). The size 0 means the end of the log.
+ * The layout after the size and the checksum is up to the owner of the log.
+ * Error is the type of the exception that is thrown when the file can't be used.
+ */
+template <typename Error>
+class mmap_log {
+public:
+    static constexpr std::size_t const header_size = 16;
+    static constexpr std::size_t const checksum_offset = 8;
+    static constexpr std::size_t const initial_size = 1024 * 1024;
+
+    /**
+     * @brief Open the log file. If it doesn't exist, it is created.
+     * @param path log file path
+     * @param magic 8 bytes that identify the owner of the log
+     * @param name name of the owner in the error messages
+     * @param sync flush each record to the disk in commit(), and the directory when the file is created or replaced
+     */
+    mmap_log(std::string path, char const* magic, char const* name, bool sync)
+        :path_(std::move(path)),
+         magic_(magic),
+         name_(name),
+         sync_(sync) {
+        {
+            std::ifstream ifs(path_, std::ios::binary);
+            if (!ifs) {
+                create(path_, initial_size);
+                if (sync_) sync_dir();
+            }
+        }
+        map();
+    }
+
+    mmap_log(mmap_log const&) = delete;
+    mmap_log& operator=(mmap_log const&) = delete;
+
+    static std::size_t align(std::size_t size) {
+        return (size + 7) & ~std::size_t(7);
+    }
+
+    static std::uint32_t checksum(char const* p, std::size_t size) {
+        boost::crc_32_type crc;
+        crc.process_bytes(p, size);
+        return crc.checksum();
+    }
+
+    /**
+     * @brief Write the checksum and the size of the record at p. The record becomes valid when the size is written.
+     * @param p the record
+     * @param used the size of the header and the body. The padding is not covered by the checksum.
+     * @return the size of the record including the padding
+     */
+    static std::size_t seal(char* p, std::size_t used) {
+        auto cs = checksum(p + checksum_offset, used - checksum_offset);
+        std::memcpy(p + 4, &cs, sizeof(cs));
+        auto size = static_cast<std::uint32_t>(align(used));
+        std::memcpy(p, &size, sizeof(size));
+        return size;
+    }
+
+    char* at(std::size_t offset) const {
+        return base_ + offset;
+    }
+
+    std::uint32_t record_size(std::size_t offset) const {
+        std::uint32_t s;
+        std::memcpy(&s, base_ + offset, sizeof(s));
+        return s;
+    }
+
+    std::size_t end() const {
+        return end_;
+    }
+
+    /**
+     * @brief Check that size bytes can be written at end() without growing the file.
+     */
+    bool fits(std::size_t size) const {
+        return end_ + size <= capacity_;
+    }
+
+    /**
+     * @brief Grow the file so that size bytes can be written at end(). The mapping is replaced.
+     */
+    void reserve(std::size_t size) {
+        if (fits(size)) return;
+        region_ = boost::interprocess::mapped_region();
+        {
+            std::ofstream ofs(path_, std::ios::binary | std::ios::in | std::ios::out);
+            extend(ofs, std::max(capacity_ * 2, end_ + size));
+            if (!ofs) throw Error("cannot extend " + path_);
+        }
+        map();
+    }
+
+    /**
+     * @brief Make the record of size bytes that is written at end() a part of the log.
+     * @return the offset of the record
+     */
+    std::size_t commit(std::size_t size) {
+        auto offset = end_;
+        end_ += size;
+        if (sync_) region_.flush(offset, size, false);
+        return offset;
+    }
+
+    /**
+     * @brief Scan the records and call replay(offset) for each valid one.
+     *        The first broken record and the following bytes are cleared, so that they are
+     *        not mistaken for records after new records are appended.
+     * @param record_header_size the size of the header of the owner's records
+     * @param body_size body_size(offset) returns the size of the body after the header
+     * @param replay function object that is called with the offset of each record
+     */
+    template <typename BodySize, typename Replay>
+    void recover(std::size_t record_header_size, BodySize&& body_size, Replay&& replay) {
+        std::size_t pos = header_size;
+        while (pos + record_header_size <= capacity_) {
+            std::size_t size = record_size(pos);
+            if (size == 0) break;
+            std::size_t bs = size < record_header_size ? 0 : body_size(pos);
+            if (size < record_header_size ||
+                pos + size > capacity_ ||
+                align(record_header_size + bs) != size ||
+                checksum(base_ + pos + checksum_offset, record_header_size + bs - checksum_offset) != stored_checksum(pos)) {
+                std::memset(base_ + pos, 0, capacity_ - pos);
+                break;
+            }
+            replay(pos);
+            pos += size;
+        }
+        end_ = pos;
+    }
+
+    /**
+     * @brief Rewrite the log into a new file, and replace the log with it.
+     * @param live_size the size of the header and the records that write() writes
+     * @param write write(char* base) writes the records from base + header_size of the
+     *              new file, and returns the end offset.
+     */
+    template <typename Write>
+    void rewrite(std::size_t live_size, Write&& write) {
+        std::string tmp = path_ + ".tmp";
+        create(tmp, live_size * 2 < initial_size ? initial_size : live_size * 2);
+        {
+            namespace ip = boost::interprocess;
+            ip::file_mapping fm(tmp.c_str(), ip::read_write);
+            ip::mapped_region r(fm, ip::read_write);
+            end_ = write(static_cast<char*>(r.get_address()));
+            r.flush();
+        }
+        region_ = boost::interprocess::mapped_region();
+        if (std::rename(tmp.c_str(), path_.c_str()) != 0) {
+            throw Error("cannot rename " + tmp + " to " + path_);
+        }
+        if (sync_) sync_dir();
+        map();
+    }
+
+    /**
+     * @brief Flush the whole log to the disk.
+     */
+    void flush() {
+        region_.flush(0, end_, false);
+    }
+
+private:
+    static constexpr std::size_t const magic_size = 8;
+
+    std::uint32_t stored_checksum(std::size_t offset) const {
+        std::uint32_t cs;
+        std::memcpy(&cs, base_ + offset + 4, sizeof(cs));
+        return cs;
+    }
+
+    void create(std::string const& path, std::size_t size) const {
+        std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+        if (!ofs) throw Error("cannot create " + path);
+        ofs.write(magic_, magic_size);
+        extend(ofs, size);
+        if (!ofs) throw Error("cannot write " + path);
+    }
+
+    // A new or renamed file can disappear at a power loss until its directory entry is
+    // flushed, and the records that commit() flushed into the file are lost with it.
+    void sync_dir() const {
+#if !defined(_WIN32)
+        auto pos = path_.find_last_of('/');
+        std::string dir =
+            pos == std::string::npos ? std::string(".") :
+            pos == 0                 ? std::string("/") :
+                                       path_.substr(0, pos);
+        int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0) throw Error("cannot open " + dir);
+        int ret = ::fsync(fd);
+        ::close(fd);
+        if (ret != 0) throw Error("cannot sync " + dir);
+#endif // !defined(_WIN32)
+    }
+
+    static void extend(std::ostream& os, std::size_t size) {
+        // The extended area is filled with zero.
+        os.seekp(static_cast<std::streamoff>((size < header_size ? header_size : size) - 1));
+        os.put('\0');
+    }
+
+    void map() {
+        namespace ip = boost::interprocess;
+        ip::file_mapping fm(path_.c_str(), ip::read_write);
+        region_ = ip::mapped_region(fm, ip::read_write);
+        base_ = static_cast<char*>(region_.get_address());
+        capacity_ = region_.get_size();
+        if (capacity_ < header_size || std::memcmp(base_, magic_, magic_size) != 0) {
+            throw Error(path_ + " is not a " + name_);
+        }
+    }
+
+    std::string path_;
+    char const* magic_;
+    char const* name_;
+    bool sync_;
+    boost::interprocess::mapped_region region_;
+    char* base_ = nullptr;
+    std::size_t capacity_ = 0;
+    std::size_t end_ = header_size;
+};
+
+} // namespace detail
+
+} // namespace mqtt
+
+#endif // MQTT_MMAP_LOG_HPP
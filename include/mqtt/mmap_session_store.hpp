@@ -0,0 +1,321 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_MMAP_SESSION_STORE_HPP)
+#define MQTT_MMAP_SESSION_STORE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <bitset>
+#include <algorithm>
+
+#include <boost/utility/string_ref.hpp>
+
+#include <mqtt/session_store.hpp>
+#include <mqtt/exception.hpp>
+#include <mqtt/mmap_log.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Session store that appends records to a memory mapped log file.
+ *
+ * Each change of the session state is appended as a record. The record size is
+ * written at last, and the record is protected by crc32, so a record that was
+ * being written when the process crashed is ignored at the next open.
+ * The records are in the page cache as soon as they are written. If sync is true,
+ * each record is also flushed to the disk, so they survive an OS crash or a power loss.
+ *
+ * The log is compacted when it has to grow and less than half of it is live.
+ * The log file is in the host byte order.
+ */
+class mmap_session_store : public session_store {
+public:
+    /**
+     * @brief Open the log file. If it doesn't exist, it is created.
+     *        The records are replayed to rebuild the session state.
+     * @param path log file path
+     * @param sync flush each record to the disk
+     */
+    explicit mmap_session_store(std::string path, bool sync = false)
+        :log_(std::move(path), "MQTTSS01", "session store", sync) {
+        log_.recover(
+            record_header_size,
+            [this](std::size_t offset) { return record_at(offset).body_size; },
+            [this](std::size_t offset) { replay(offset); });
+    }
+
+    void add_packet(
+        std::uint16_t packet_id,
+        std::uint8_t expected_control_packet_type,
+        boost::string_ref header,
+        boost::string_ref contents) override {
+        auto key = std::make_pair(packet_id, expected_control_packet_type);
+        auto it = packets_.find(key);
+        if (it != packets_.end()) {
+            live_bytes_ -= record_at(it->second).size;
+            packets_.erase(it);
+        }
+        auto offset = append(record_kind::add_packet, expected_control_packet_type, packet_id, header, contents);
+        packets_.emplace(key, offset);
+        live_bytes_ += record_at(offset).size;
+    }
+
+    void erase_packet(
+        std::uint16_t packet_id,
+        std::uint8_t expected_control_packet_type) override {
+        auto it = packets_.find(std::make_pair(packet_id, expected_control_packet_type));
+        if (it == packets_.end()) return;
+        live_bytes_ -= record_at(it->second).size;
+        packets_.erase(it);
+        append(record_kind::erase_packet, expected_control_packet_type, packet_id);
+    }
+
+    void erase_packets(std::uint16_t packet_id) override {
+        auto b = packets_.lower_bound(std::make_pair(packet_id, std::uint8_t(0)));
+        auto e = packets_.upper_bound(std::make_pair(packet_id, std::uint8_t(0xff)));
+        if (b == e) return;
+        for (auto it = b; it != e; ++it) live_bytes_ -= record_at(it->second).size;
+        packets_.erase(b, e);
+        append(record_kind::erase_packets, 0, packet_id);
+    }
+
+    void clear_packets() override {
+        if (packets_.empty()) return;
+        packets_.clear();
+        live_bytes_ = 0;
+        append(record_kind::clear_packets, 0, 0);
+    }
+
+    void add_qos2_publish_handled(std::uint16_t packet_id) override {
+        if (qos2_publish_handled_.test(packet_id)) return;
+        qos2_publish_handled_.set(packet_id);
+        append(record_kind::add_qos2_publish_handled, 0, packet_id);
+    }
+
+    void erase_qos2_publish_handled(std::uint16_t packet_id) override {
+        if (!qos2_publish_handled_.test(packet_id)) return;
+        qos2_publish_handled_.reset(packet_id);
+        append(record_kind::erase_qos2_publish_handled, 0, packet_id);
+    }
+
+    void use_packet_id(std::uint16_t packet_id) override {
+        if (packet_ids_.test(packet_id)) return;
+        packet_ids_.set(packet_id);
+        append(record_kind::use_packet_id, 0, packet_id);
+    }
+
+    void release_packet_id(std::uint16_t packet_id) override {
+        if (!packet_ids_.test(packet_id)) return;
+        packet_ids_.reset(packet_id);
+        append(record_kind::release_packet_id, 0, packet_id);
+    }
+
+    void restore(
+        packet_restorer const& packet,
+        packet_id_restorer const& qos2_publish_handled,
+        packet_id_restorer const& packet_id) override {
+        if (packet) {
+            // The log is append only, so the offset order is the recorded order.
+            std::vector<std::size_t> offsets;
+            offsets.reserve(packets_.size());
+            for (auto const& e : packets_) offsets.push_back(e.second);
+            std::sort(offsets.begin(), offsets.end());
+            for (auto offset : offsets) {
+                auto const& r = record_at(offset);
+                packet(r.packet_id, r.expected_control_packet_type, boost::string_ref(body_at(offset), r.body_size));
+            }
+        }
+        for (std::size_t i = 1; i != id_size; ++i) {
+            auto id = static_cast<std::uint16_t>(i);
+            if (qos2_publish_handled && qos2_publish_handled_.test(i)) qos2_publish_handled(id);
+            if (packet_id && packet_ids_.test(i)) packet_id(id);
+        }
+    }
+
+    /**
+     * @brief Flush the whole log to the disk.
+     */
+    void flush() {
+        log_.flush();
+    }
+
+    /**
+     * @brief Rewrite the log with only the live records.
+     */
+    void compact() {
+        log_.rewrite(
+            live_size(),
+            [this](char* base) {
+                std::size_t pos = log_t::header_size;
+                std::vector<std::pair<std::size_t, std::pair<std::uint16_t, std::uint8_t>>> offsets;
+                offsets.reserve(packets_.size());
+                for (auto const& e : packets_) offsets.emplace_back(e.second, e.first);
+                std::sort(offsets.begin(), offsets.end());
+                for (auto const& e : offsets) {
+                    auto s = record_at(e.first).size;
+                    std::memcpy(base + pos, log_.at(e.first), s);
+                    packets_[e.second] = pos;
+                    pos += s;
+                }
+                for (std::size_t i = 1; i != id_size; ++i) {
+                    auto id = static_cast<std::uint16_t>(i);
+                    if (qos2_publish_handled_.test(i)) {
+                        pos += write_record(base + pos, record_kind::add_qos2_publish_handled, 0, id, {}, {});
+                    }
+                    if (packet_ids_.test(i)) {
+                        pos += write_record(base + pos, record_kind::use_packet_id, 0, id, {}, {});
+                    }
+                }
+                return pos;
+            });
+    }
+
+    /**
+     * @brief Get the size of the log in bytes.
+     * @return the size of the log
+     */
+    std::size_t size() const {
+        return log_.end();
+    }
+
+private:
+    enum class record_kind : std::uint8_t {
+        add_packet = 1,
+        erase_packet,
+        erase_packets,
+        clear_packets,
+        add_qos2_publish_handled,
+        erase_qos2_publish_handled,
+        use_packet_id,
+        release_packet_id
+    };
+
+    struct record_header {
+        std::uint32_t size;     // whole record size including padding. 0 means the end of the log.
+        std::uint32_t checksum; // crc32 from kind to the end of the body
+        record_kind kind;
+        std::uint8_t expected_control_packet_type;
+        std::uint16_t packet_id;
+        std::uint32_t body_size;
+    };
+
+    using log_t = detail::mmap_log<session_store_error>;
+
+    static constexpr std::size_t const record_header_size = sizeof(record_header);
+    static constexpr std::size_t const id_size = 0x10000;
+
+    record_header const& record_at(std::size_t offset) const {
+        return *reinterpret_cast<record_header const*>(log_.at(offset));
+    }
+
+    char const* body_at(std::size_t offset) const {
+        return log_.at(offset) + record_header_size;
+    }
+
+    // The size of the log after compaction.
+    std::size_t live_size() const {
+        return
+            log_t::header_size + live_bytes_ +
+            record_header_size * (qos2_publish_handled_.count() + packet_ids_.count());
+    }
+
+    static std::size_t write_record(
+        char* p,
+        record_kind kind,
+        std::uint8_t expected_control_packet_type,
+        std::uint16_t packet_id,
+        boost::string_ref b1,
+        boost::string_ref b2) {
+        auto& r = *reinterpret_cast<record_header*>(p);
+        auto body_size = b1.size() + b2.size();
+        r.kind = kind;
+        r.expected_control_packet_type = expected_control_packet_type;
+        r.packet_id = packet_id;
+        r.body_size = static_cast<std::uint32_t>(body_size);
+        std::memcpy(p + record_header_size, b1.data(), b1.size());
+        std::memcpy(p + record_header_size + b1.size(), b2.data(), b2.size());
+        return log_t::seal(p, record_header_size + body_size);
+    }
+
+    std::size_t append(
+        record_kind kind,
+        std::uint8_t expected_control_packet_type,
+        std::uint16_t packet_id,
+        boost::string_ref b1 = boost::string_ref(),
+        boost::string_ref b2 = boost::string_ref()) {
+        auto size = log_t::align(record_header_size + b1.size() + b2.size());
+        // Keep the terminator of the log after the new record.
+        if (!log_.fits(size + record_header_size)) {
+            if (live_size() * 2 < log_.end()) compact();
+            log_.reserve(size + record_header_size);
+        }
+        write_record(log_.at(log_.end()), kind, expected_control_packet_type, packet_id, b1, b2);
+        return log_.commit(size);
+    }
+
+    void replay(std::size_t offset) {
+        auto const& r = record_at(offset);
+        switch (r.kind) {
+        case record_kind::add_packet: {
+            auto key = std::make_pair(r.packet_id, r.expected_control_packet_type);
+            auto it = packets_.find(key);
+            if (it != packets_.end()) {
+                live_bytes_ -= record_at(it->second).size;
+                it->second = offset;
+            }
+            else {
+                packets_.emplace(key, offset);
+            }
+            live_bytes_ += r.size;
+        } break;
+        case record_kind::erase_packet: {
+            auto it = packets_.find(std::make_pair(r.packet_id, r.expected_control_packet_type));
+            if (it != packets_.end()) {
+                live_bytes_ -= record_at(it->second).size;
+                packets_.erase(it);
+            }
+        } break;
+        case record_kind::erase_packets: {
+            auto b = packets_.lower_bound(std::make_pair(r.packet_id, std::uint8_t(0)));
+            auto e = packets_.upper_bound(std::make_pair(r.packet_id, std::uint8_t(0xff)));
+            for (auto it = b; it != e; ++it) live_bytes_ -= record_at(it->second).size;
+            packets_.erase(b, e);
+        } break;
+        case record_kind::clear_packets:
+            packets_.clear();
+            live_bytes_ = 0;
+            break;
+        case record_kind::add_qos2_publish_handled:
+            qos2_publish_handled_.set(r.packet_id);
+            break;
+        case record_kind::erase_qos2_publish_handled:
+            qos2_publish_handled_.reset(r.packet_id);
+            break;
+        case record_kind::use_packet_id:
+            packet_ids_.set(r.packet_id);
+            break;
+        case record_kind::release_packet_id:
+            packet_ids_.reset(r.packet_id);
+            break;
+        }
+    }
+
+    log_t log_;
+    // The offsets of the live packet records.
+    std::map<std::pair<std::uint16_t, std::uint8_t>, std::size_t> packets_;
+    // The total size of the live packet records.
+    std::size_t live_bytes_ = 0;
+    std::bitset<id_size> qos2_publish_handled_;
+    std::bitset<id_size> packet_ids_;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_MMAP_SESSION_STORE_HPP
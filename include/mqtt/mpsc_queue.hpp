@@ -0,0 +1,115 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_MPSC_QUEUE_HPP)
+#define MQTT_MPSC_QUEUE_HPP
+
+#include <cstddef>
+#include <atomic>
+#include <array>
+#include <utility>
+
+#include <boost/optional.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Lock-free multi producer single consumer queue.
+ * push() can be called from any thread. consume_all() must be called from one thread at a time.
+ * It is an intrusive linked list of nodes that is known as Vyukov's MPSC queue.
+ * push() is wait-free. A push that is in progress may not be visible to consume_all() yet,
+ * but it becomes visible once push() returns.
+ * The consumed nodes are kept in a small cache and reused by push(), so a queue that holds
+ * a few elements at a time doesn't allocate in the steady state.
+ */
+template <typename T>
+class mpsc_queue {
+public:
+    mpsc_queue()
+        :head_(&stub_),
+         tail_(&stub_) {
+        for (auto& c : cache_) c.store(nullptr, std::memory_order_relaxed);
+    }
+
+    mpsc_queue(mpsc_queue const&) = delete;
+    mpsc_queue& operator=(mpsc_queue const&) = delete;
+
+    ~mpsc_queue() {
+        consume_all([](T&&){});
+        if (tail_ != &stub_) delete tail_;
+        for (auto& c : cache_) delete c.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Push an element constructed from args.
+     */
+    template <typename... Args>
+    void push(Args&&... args) {
+        auto n = acquire_node();
+        n->value.emplace(std::forward<Args>(args)...);
+        node* prev = head_.exchange(n, std::memory_order_acq_rel);
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    /**
+     * @brief Call f(T&&) for each element in the pushed order and remove it.
+     * @return the number of the consumed elements
+     */
+    template <typename F>
+    std::size_t consume_all(F&& f) {
+        std::size_t num = 0;
+        for (;;) {
+            node* tail = tail_;
+            node* next = tail->next.load(std::memory_order_acquire);
+            if (!next) return num;
+            // next becomes the new stub.
+            tail_ = next;
+            if (tail != &stub_) release_node(tail);
+            f(std::move(*next->value));
+            next->value = boost::none;
+            ++num;
+        }
+    }
+
+private:
+    struct node {
+        node()
+            :next(nullptr) {}
+        std::atomic<node*> next;
+        boost::optional<T> value;
+    };
+
+    // Each slot owns the node in it. Exchanging the pointer moves the ownership,
+    // so a node is never taken twice.
+    node* acquire_node() {
+        for (auto& c : cache_) {
+            if (node* n = c.exchange(nullptr, std::memory_order_acquire)) {
+                n->next.store(nullptr, std::memory_order_relaxed);
+                return n;
+            }
+        }
+        return new node;
+    }
+
+    void release_node(node* n) {
+        for (auto& c : cache_) {
+            node* expected = nullptr;
+            if (c.compare_exchange_strong(expected, n, std::memory_order_release, std::memory_order_relaxed)) return;
+        }
+        delete n;
+    }
+
+    static constexpr std::size_t const node_cache_size = 16;
+
+    node stub_;
+    std::atomic<node*> head_;
+    node* tail_;
+    std::array<std::atomic<node*>, node_cache_size> cache_;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_MPSC_QUEUE_HPP
@@ -19,7 +19,7 @@ struct null_strand {
     null_strand(as::io_service& ios) : ios_(ios) {}
     template <typename Func>
     void post(Func&& f) {
-        ios_.post([MQTT_CAPTURE_FORWARD(Func, f)]{ f(); });
+        ios_.post(std::forward<Func>(f));
     }
     template <typename Func>
     void dispatch(Func&& f) {
@@ -0,0 +1,129 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_PACKET_ID_ALLOCATOR_HPP)
+#define MQTT_PACKET_ID_ALLOCATOR_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+
+#include <mqtt/exception.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Packet identifier allocator using a bitmap of all 65536 ids.
+ * The id 0 is never allocated. acquire() returns the next free id after the
+ * last acquired one, so ids are not reused immediately after they are released.
+ */
+class packet_id_allocator {
+public:
+    packet_id_allocator()
+        :bits_(),
+         size_(0),
+         last_(0) {
+        bits_[0] = 1; // 0 is not a valid packet_id
+    }
+
+    /**
+     * @brief Acquire a free packet_id.
+     * @return packet_id
+     * Throws packet_id_exhausted_error if all packet_ids are in use.
+     */
+    std::uint16_t acquire() {
+        if (size_ == max_size) throw packet_id_exhausted_error();
+        std::size_t start = static_cast<std::uint16_t>(last_ + 1);
+        std::size_t idx = start / bits_per_word;
+        // Ignore the ids before start in the first word.
+        std::uint64_t used = bits_[idx] | ((std::uint64_t(1) << (start % bits_per_word)) - 1);
+        while (used == ~std::uint64_t(0)) {
+            idx = (idx + 1) % word_size;
+            used = bits_[idx];
+        }
+        auto id = static_cast<std::uint16_t>(idx * bits_per_word + find_first_zero(used));
+        set(id);
+        last_ = id;
+        return id;
+    }
+
+    /**
+     * @brief Register packet_id as in use.
+     * @param packet_id packet_id to register
+     * @return If packet_id is not 0 and not in use then true, otherwise false.
+     */
+    bool register_id(std::uint16_t packet_id) {
+        if (packet_id == 0 || in_use(packet_id)) return false;
+        set(packet_id);
+        return true;
+    }
+
+    /**
+     * @brief Release packet_id.
+     * @param packet_id packet_id to release
+     * @return If packet_id was in use then true, otherwise false.
+     */
+    bool release(std::uint16_t packet_id) {
+        if (packet_id == 0 || !in_use(packet_id)) return false;
+        bits_[packet_id / bits_per_word] &= ~(std::uint64_t(1) << (packet_id % bits_per_word));
+        --size_;
+        return true;
+    }
+
+    bool in_use(std::uint16_t packet_id) const {
+        return bits_[packet_id / bits_per_word] & (std::uint64_t(1) << (packet_id % bits_per_word));
+    }
+
+    /**
+     * @brief Get the number of packet_ids in use.
+     * @return the number of packet_ids in use
+     */
+    std::size_t size() const {
+        return size_;
+    }
+
+    /**
+     * @brief Release all packet_ids.
+     */
+    void clear() {
+        bits_.fill(0);
+        bits_[0] = 1;
+        size_ = 0;
+    }
+
+    static constexpr std::size_t const max_size = 0xffff;
+
+private:
+    void set(std::uint16_t packet_id) {
+        bits_[packet_id / bits_per_word] |= std::uint64_t(1) << (packet_id % bits_per_word);
+        ++size_;
+    }
+
+    // word must have at least one zero bit.
+    static std::size_t find_first_zero(std::uint64_t word) {
+#if defined(__GNUC__)
+        return static_cast<std::size_t>(__builtin_ctzll(~word));
+#else  // defined(__GNUC__)
+        std::size_t i = 0;
+        while (word & 1) {
+            word >>= 1;
+            ++i;
+        }
+        return i;
+#endif // defined(__GNUC__)
+    }
+
+    static constexpr std::size_t const bits_per_word = 64;
+    static constexpr std::size_t const word_size = 0x10000 / bits_per_word;
+
+    std::array<std::uint64_t, word_size> bits_;
+    std::size_t size_;
+    std::uint16_t last_;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_PACKET_ID_ALLOCATOR_HPP
@@ -0,0 +1,244 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_RESOLVER_CACHE_HPP)
+#define MQTT_RESOLVER_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+#include <boost/asio.hpp>
+#include <boost/system/error_code.hpp>
+
+namespace mqtt {
+
+namespace as = boost::asio;
+
+using resolved_endpoints = std::vector<as::ip::tcp::endpoint>;
+
+using resolve_handler = std::function<
+    void(boost::system::error_code const& ec,
+         std::shared_ptr<resolved_endpoints const> const& endpoints)>;
+
+/**
+ * @brief Resolve host and port asynchronously.
+ * @param ios io_service that resolves and calls the handler
+ * @param host host name or address
+ * @param port port number or service name
+ * @param h handler that is called with the resolved endpoints
+ */
+inline void async_resolve(
+    as::io_service& ios,
+    std::string const& host,
+    std::string const& port,
+    resolve_handler h) {
+    auto r = std::make_shared<as::ip::tcp::resolver>(ios);
+    r->async_resolve(
+        as::ip::tcp::resolver::query(host, port),
+        [r, h]
+        (boost::system::error_code const& ec, as::ip::tcp::resolver::iterator it) {
+            auto eps = std::make_shared<resolved_endpoints>();
+            if (!ec) {
+                for (; it != as::ip::tcp::resolver::iterator(); ++it) {
+                    eps->push_back(it->endpoint());
+                }
+            }
+            h(ec, eps);
+        }
+    );
+}
+
+/**
+ * @brief Cache of the resolved endpoints.
+ * The cache can be shared by clients on different io_services and threads.
+ * Concurrent resolutions of the same host and port are merged into one.
+ * The merged resolution runs on the cache's own thread, so it doesn't depend on
+ * the io_service of any caller. Each handler is called via the io_service of its caller.
+ * The resolved endpoints are reused until the ttl expires, and the expired entries are removed.
+ * Failures are not cached.
+ */
+class resolver_cache {
+public:
+    /**
+     * @brief Constructor
+     * @param ttl time to live of the resolved endpoints
+     */
+    explicit resolver_cache(std::chrono::steady_clock::duration ttl = std::chrono::seconds(60))
+        :ttl_(ttl),
+         next_sweep_(std::chrono::steady_clock::now() + ttl),
+         resolved_count_(0),
+         work_(new as::io_service::work(ios_)),
+         thread_([this] { ios_.run(); }) {}
+
+    resolver_cache(resolver_cache const&) = delete;
+    resolver_cache& operator=(resolver_cache const&) = delete;
+
+    /**
+     * @brief Destructor
+     * The handlers of the resolutions in progress are called with operation_aborted.
+     */
+    ~resolver_cache() {
+        work_.reset();
+        ios_.stop();
+        thread_.join();
+        for (auto& e : entries_) {
+            for (auto& w : e.second.waiters) {
+                complete(w, as::error::operation_aborted, std::make_shared<resolved_endpoints>());
+            }
+        }
+    }
+
+    /**
+     * @brief Resolve host and port using the cache.
+     * @param ios io_service that calls the handler. It has work until the handler is called.
+     * @param host host name or address
+     * @param port port number or service name
+     * @param h handler that is called with the resolved endpoints. It is always called via ios.
+     */
+    void async_resolve(
+        as::io_service& ios,
+        std::string const& host,
+        std::string const& port,
+        resolve_handler h) {
+        auto key = host + ':' + port;
+        {
+            std::lock_guard<std::mutex> lck (mtx_);
+            auto now = std::chrono::steady_clock::now();
+            evict_expired(now);
+            auto& e = entries_[key];
+            if (e.endpoints && now < e.expiry) {
+                auto eps = e.endpoints;
+                ios.post(
+                    [h, eps] {
+                        h(boost::system::errc::make_error_code(boost::system::errc::success), eps);
+                    }
+                );
+                return;
+            }
+            e.waiters.push_back(waiter { &ios, as::io_service::work(ios), std::move(h) });
+            if (e.resolving) return;
+            e.resolving = true;
+            ++resolved_count_;
+        }
+        mqtt::async_resolve(
+            ios_,
+            host,
+            port,
+            [this, key]
+            (boost::system::error_code const& ec, std::shared_ptr<resolved_endpoints const> const& eps) {
+                std::vector<waiter> waiters;
+                {
+                    std::lock_guard<std::mutex> lck (mtx_);
+                    auto it = entries_.find(key);
+                    auto& e = it->second;
+                    e.resolving = false;
+                    waiters.swap(e.waiters);
+                    if (ec) {
+                        entries_.erase(it);
+                    }
+                    else {
+                        e.endpoints = eps;
+                        e.expiry = std::chrono::steady_clock::now() + ttl_;
+                    }
+                }
+                for (auto& w : waiters) complete(w, ec, eps);
+            }
+        );
+    }
+
+    /**
+     * @brief Remove all resolved endpoints.
+     */
+    void clear() {
+        std::lock_guard<std::mutex> lck (mtx_);
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (it->second.resolving) {
+                it->second.endpoints.reset();
+                ++it;
+            }
+            else {
+                it = entries_.erase(it);
+            }
+        }
+    }
+
+    /**
+     * @brief Get the number of the resolutions that were not served by the cache.
+     * @return the number of the resolutions
+     */
+    std::size_t resolved_count() const {
+        std::lock_guard<std::mutex> lck (mtx_);
+        return resolved_count_;
+    }
+
+    /**
+     * @brief Get the number of the host and port entries, including the resolutions in progress.
+     * @return the number of the entries
+     */
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lck (mtx_);
+        return entries_.size();
+    }
+
+private:
+    // The work keeps the caller's io_service running until the handler is posted.
+    struct waiter {
+        as::io_service* ios;
+        as::io_service::work work;
+        resolve_handler h;
+    };
+
+    struct entry {
+        std::shared_ptr<resolved_endpoints const> endpoints;
+        std::chrono::steady_clock::time_point expiry;
+        bool resolving = false;
+        std::vector<waiter> waiters;
+    };
+
+    static void complete(
+        waiter& w,
+        boost::system::error_code const& ec,
+        std::shared_ptr<resolved_endpoints const> const& eps) {
+        w.ios->post(
+            [h = std::move(w.h), ec, eps] {
+                h(ec, eps);
+            }
+        );
+    }
+
+    // Remove the expired entries at most once per ttl. Should be called with mtx_ locked.
+    void evict_expired(std::chrono::steady_clock::time_point now) {
+        if (now < next_sweep_) return;
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (!it->second.resolving && it->second.expiry <= now) {
+                it = entries_.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        next_sweep_ = now + ttl_;
+    }
+
+    std::chrono::steady_clock::duration ttl_;
+    std::chrono::steady_clock::time_point next_sweep_;
+    mutable std::mutex mtx_;
+    std::map<std::string, entry> entries_;
+    std::size_t resolved_count_;
+    as::io_service ios_;
+    std::unique_ptr<as::io_service::work> work_;
+    std::thread thread_;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_RESOLVER_CACHE_HPP
@@ -0,0 +1,507 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_RETAINED_STORE_HPP)
+#define MQTT_RETAINED_STORE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <boost/optional.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <mqtt/exception.hpp>
+#include <mqtt/topic_level.hpp>
+#include <mqtt/mmap_log.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Store of the retained messages for the server side endpoints.
+ * The messages are kept in a trie over the '/' separated levels of the topic names,
+ * so find() visits only the subtrees that the topic filter can match.
+ * Store the publishes that have the retain flag, and send the retained messages when
+ * a subscribe is received:
+ * @code
+ * ep.set_publish_ref_handler(
+ *     [&](std::uint8_t header, boost::optional<std::uint16_t>,
+ *         boost::string_ref topic_name, boost::string_ref contents) {
+ *         if (mqtt::publish::is_retain(header)) {
+ *             rs.store(topic_name, contents, mqtt::publish::get_qos(header));
+ *         }
+ *         ...
+ *     });
+ * // In the subscribe handler, after suback:
+ * rs.find(topic_filter, [&](boost::string_ref topic_name, boost::string_ref contents, std::uint8_t qos) {
+ *     ep.publish(std::string(topic_name), std::string(contents), std::min(qos, subscribed_qos), true);
+ * });
+ * @endcode
+ * If a path is given, the messages are kept in a memory mapped log file instead of
+ * the heap, and they are restored when the store is opened again. The log is the same
+ * kind as the one of mmap_session_store: each record is protected by crc32, and the log
+ * is compacted when it has to grow and less than half of it is live.
+ * It is not thread safe.
+ */
+class retained_store {
+public:
+    /**
+     * @brief Create a store that keeps the messages in the heap.
+     */
+    retained_store() = default;
+
+    /**
+     * @brief Open the log file. If it doesn't exist, it is created.
+     *        The records are replayed to rebuild the store.
+     * @param path log file path
+     * @param sync flush each record to the disk
+     */
+    explicit retained_store(std::string path, bool sync = false)
+        :log_(new log_t(std::move(path), "MQTTRS01", "retained store", sync)) {
+        log_->recover(
+            record_header_size,
+            [this](std::size_t offset) {
+                auto const& r = record_at(offset);
+                return std::size_t(r.topic_size) + r.contents_size;
+            },
+            [this](std::size_t offset) { replay(offset); });
+    }
+
+    retained_store(retained_store const&) = delete;
+    retained_store& operator=(retained_store const&) = delete;
+
+    /**
+     * @brief Retain the message of the topic name. The existing message is replaced.
+     *        If contents is empty, the retained message is removed.
+     *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718038<BR>
+     *        3.3.1.3 RETAIN
+     * @param topic_name topic name. retained_store_error is thrown if it contains a wildcard.
+     * @param contents the contents of the message
+     * @param qos the QoS of the message
+     * @return false if the memory limit would be exceeded. The store is not changed.
+     */
+    bool store(boost::string_ref topic_name, boost::string_ref contents, std::uint8_t qos) {
+        if (contents.empty()) {
+            erase(topic_name);
+            return true;
+        }
+        check_topic_name(topic_name);
+        std::size_t usage = topic_name.size() + contents.size();
+        if (memory_limit_ != 0) {
+            std::size_t old = 0;
+            std::size_t nodes = 0;
+            find_node(topic_name, old, nodes);
+            if (memory_usage_ - old + nodes + usage > memory_limit_) return false;
+        }
+
+        auto& slot = get_node(topic_name).value;
+        entry e;
+        e.topic_size = static_cast<std::uint32_t>(topic_name.size());
+        e.contents_size = static_cast<std::uint32_t>(contents.size());
+        e.qos = qos;
+        if (log_) {
+            // append() can compact the log. The old entry is still live at that time.
+            e.offset = append(record_kind::store, qos, topic_name, contents);
+            if (slot) live_bytes_ -= record_at(slot->offset).size;
+            live_bytes_ += record_at(e.offset).size;
+        }
+        else {
+            e.data.reset(new char[usage]);
+            std::memcpy(e.data.get(), topic_name.data(), topic_name.size());
+            std::memcpy(e.data.get() + topic_name.size(), contents.data(), contents.size());
+        }
+        if (slot) {
+            memory_usage_ -= usage_of(*slot);
+        }
+        else {
+            ++size_;
+        }
+        memory_usage_ += usage;
+        slot = std::move(e);
+        return true;
+    }
+
+    /**
+     * @brief Remove the retained message of the topic name.
+     * @param topic_name topic name
+     * @return true if the message was found and removed.
+     */
+    bool erase(boost::string_ref topic_name) {
+        std::size_t record_size = 0;
+        if (!remove_entry(topic_name, record_size)) return false;
+        if (log_) {
+            live_bytes_ -= record_size;
+            append(record_kind::erase, 0, topic_name);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Remove all retained messages.
+     */
+    void clear() {
+        root_ = node();
+        size_ = 0;
+        memory_usage_ = 0;
+        if (log_) {
+            live_bytes_ = 0;
+            append(record_kind::clear, 0);
+        }
+    }
+
+    /**
+     * @brief Call f(boost::string_ref topic_name, boost::string_ref contents, std::uint8_t qos)
+     *        for each retained message that matches the topic filter.
+     *        The topic names that start with '$' don't match the filters that start with a wildcard.
+     *        The references are valid until the store is modified.
+     * @param topic_filter topic filter. topic_filter_error is thrown if it is invalid.
+     * @param f function object
+     * @return the number of the matched messages
+     */
+    template <typename F>
+    std::size_t find(boost::string_ref topic_filter, F&& f) const {
+        detail::validate_topic_filter(topic_filter);
+        std::size_t count = 0;
+        find_from(root_, topic_filter, 0, true, f, count);
+        return count;
+    }
+
+    /**
+     * @brief Get the number of the retained messages.
+     * @return the number of the retained messages
+     */
+    std::size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    /**
+     * @brief Get the memory used by the retained messages. It is the total size of the topic
+     *        names and the contents, and an estimate of the trie nodes and their hash map entries.
+     *        If the store is backed by a file, the topic names and the contents are in the page
+     *        cache instead of the heap, but they are counted too.
+     * @return the size in bytes
+     */
+    std::size_t memory_usage() const {
+        return memory_usage_;
+    }
+
+    /**
+     * @brief Set the limit of memory_usage(). store() fails if the limit would be exceeded.
+     * @param bytes the limit in bytes. 0 means no limit.
+     */
+    void set_memory_limit(std::size_t bytes) {
+        memory_limit_ = bytes;
+    }
+
+    std::size_t memory_limit() const {
+        return memory_limit_;
+    }
+
+    /**
+     * @brief Flush the whole log to the disk. It does nothing if the store is not backed by a file.
+     */
+    void flush() {
+        if (log_) log_->flush();
+    }
+
+    /**
+     * @brief Rewrite the log with only the live records.
+     *        It does nothing if the store is not backed by a file.
+     */
+    void compact() {
+        if (!log_) return;
+        std::vector<entry*> entries;
+        entries.reserve(size_);
+        collect(root_, entries);
+        // The log is append only, so the offset order is the recorded order.
+        std::sort(
+            entries.begin(),
+            entries.end(),
+            [](entry const* lhs, entry const* rhs) { return lhs->offset < rhs->offset; });
+        log_->rewrite(
+            log_t::header_size + live_bytes_,
+            [&](char* base) {
+                std::size_t pos = log_t::header_size;
+                for (auto e : entries) {
+                    auto s = record_at(e->offset).size;
+                    std::memcpy(base + pos, log_->at(e->offset), s);
+                    e->offset = pos;
+                    pos += s;
+                }
+                live_bytes_ = pos - log_t::header_size;
+                return pos;
+            });
+    }
+
+    /**
+     * @brief Get the size of the log in bytes.
+     * @return the size of the log. 0 if the store is not backed by a file.
+     */
+    std::size_t log_size() const {
+        return log_ ? log_->end() : 0;
+    }
+
+private:
+    struct entry {
+        // The topic name followed by the contents. nullptr if they are in the log.
+        std::unique_ptr<char[]> data;
+        // The offset of the record in the log.
+        std::size_t offset = 0;
+        std::uint32_t topic_size = 0;
+        std::uint32_t contents_size = 0;
+        std::uint8_t qos = 0;
+    };
+
+    using level_hash = detail::level_hash;
+    using level_equal = detail::level_equal;
+
+    struct node;
+    using children_t = boost::unordered_map<std::string, std::unique_ptr<node>, level_hash, level_equal>;
+
+    struct node {
+        bool empty() const {
+            return !value && children.empty();
+        }
+        // The retained message of the topic name that ends at this node.
+        boost::optional<entry> value;
+        children_t children;
+    };
+
+    enum class record_kind : std::uint8_t {
+        store = 1,
+        erase,
+        clear
+    };
+
+    struct record_header {
+        std::uint32_t size;     // whole record size including padding. 0 means the end of the log.
+        std::uint32_t checksum; // crc32 from kind to the end of the body
+        record_kind kind;
+        std::uint8_t qos;
+        std::uint16_t reserved;
+        std::uint32_t topic_size;
+        std::uint32_t contents_size;
+    };
+
+    using log_t = detail::mmap_log<retained_store_error>;
+
+    static constexpr std::size_t const record_header_size = sizeof(record_header);
+    static constexpr std::size_t const npos = detail::level_npos;
+
+    static void check_topic_name(boost::string_ref topic_name) {
+        if (topic_name.empty() ||
+            topic_name.find('#') != boost::string_ref::npos ||
+            topic_name.find('+') != boost::string_ref::npos) {
+            throw retained_store_error("invalid topic name " + std::string(topic_name));
+        }
+    }
+
+    std::size_t usage_of(entry const& e) const {
+        return e.topic_size + e.contents_size;
+    }
+
+    // An estimate of the heap used by a child node: the node, the hash map entry with its
+    // link and bucket, and the key.
+    static std::size_t usage_of_node(boost::string_ref level) {
+        return
+            sizeof(node) +
+            sizeof(children_t::value_type) + 2 * sizeof(void*) +
+            level.size();
+    }
+
+    char const* data_of(entry const& e) const {
+        return e.data ? e.data.get() : body_at(e.offset);
+    }
+
+    // Get the usage of the existing message of the topic name, and the usage of the nodes
+    // that get_node() would create.
+    void find_node(boost::string_ref topic_name, std::size_t& old, std::size_t& nodes) const {
+        node const* n = &root_;
+        std::size_t pos = 0;
+        while (pos != npos) {
+            auto level = detail::next_level(topic_name, pos);
+            if (n) {
+                auto it = n->children.find(level, level_hash(), level_equal());
+                n = it == n->children.end() ? nullptr : it->second.get();
+            }
+            if (!n) nodes += usage_of_node(level);
+        }
+        if (n && n->value) old = usage_of(*n->value);
+    }
+
+    node& get_node(boost::string_ref topic_name) {
+        node* n = &root_;
+        std::size_t pos = 0;
+        while (pos != npos) {
+            auto level = detail::next_level(topic_name, pos);
+            auto it = n->children.find(level, level_hash(), level_equal());
+            if (it == n->children.end()) {
+                it = n->children.emplace(std::string(level), std::unique_ptr<node>(new node)).first;
+                memory_usage_ += usage_of_node(level);
+            }
+            n = it->second.get();
+        }
+        return *n;
+    }
+
+    bool remove_entry(boost::string_ref topic_name, std::size_t& record_size) {
+        if (!erase_from(root_, topic_name, 0, record_size)) return false;
+        --size_;
+        return true;
+    }
+
+    // Remove the message from pos under n, and remove the nodes that become empty.
+    bool erase_from(node& n, boost::string_ref topic_name, std::size_t pos, std::size_t& record_size) {
+        if (pos == npos) {
+            if (!n.value) return false;
+            memory_usage_ -= usage_of(*n.value);
+            if (log_) record_size = record_at(n.value->offset).size;
+            n.value = boost::none;
+            return true;
+        }
+        auto level = detail::next_level(topic_name, pos);
+        auto it = n.children.find(level, level_hash(), level_equal());
+        if (it == n.children.end() || !erase_from(*it->second, topic_name, pos, record_size)) return false;
+        if (it->second->empty()) {
+            memory_usage_ -= usage_of_node(it->first);
+            n.children.erase(it);
+        }
+        return true;
+    }
+
+    template <typename F>
+    void call(entry const& e, F& f, std::size_t& count) const {
+        char const* p = data_of(e);
+        f(boost::string_ref(p, e.topic_size), boost::string_ref(p + e.topic_size, e.contents_size), e.qos);
+        ++count;
+    }
+
+    template <typename F>
+    void find_from(node const& n, boost::string_ref topic_filter, std::size_t pos, bool root, F& f, std::size_t& count) const {
+        if (pos == npos) {
+            if (n.value) call(*n.value, f, count);
+            return;
+        }
+        auto level = detail::next_level(topic_filter, pos);
+        if (level == "#") {
+            // "a/#" matches "a" too.
+            if (n.value) call(*n.value, f, count);
+            for (auto const& c : n.children) {
+                if (root && !c.first.empty() && c.first.front() == '$') continue;
+                find_all(*c.second, f, count);
+            }
+            return;
+        }
+        if (level == "+") {
+            for (auto const& c : n.children) {
+                if (root && !c.first.empty() && c.first.front() == '$') continue;
+                find_from(*c.second, topic_filter, pos, false, f, count);
+            }
+            return;
+        }
+        auto it = n.children.find(level, level_hash(), level_equal());
+        if (it != n.children.end()) find_from(*it->second, topic_filter, pos, false, f, count);
+    }
+
+    template <typename F>
+    void find_all(node const& n, F& f, std::size_t& count) const {
+        if (n.value) call(*n.value, f, count);
+        for (auto const& c : n.children) find_all(*c.second, f, count);
+    }
+
+    static void collect(node& n, std::vector<entry*>& entries) {
+        if (n.value) entries.push_back(n.value.get_ptr());
+        for (auto& c : n.children) collect(*c.second, entries);
+    }
+
+    record_header const& record_at(std::size_t offset) const {
+        return *reinterpret_cast<record_header const*>(log_->at(offset));
+    }
+
+    char const* body_at(std::size_t offset) const {
+        return log_->at(offset) + record_header_size;
+    }
+
+    std::size_t append(
+        record_kind kind,
+        std::uint8_t qos,
+        boost::string_ref topic_name = boost::string_ref(),
+        boost::string_ref contents = boost::string_ref()) {
+        auto body_size = topic_name.size() + contents.size();
+        auto size = log_t::align(record_header_size + body_size);
+        // Keep the terminator of the log after the new record.
+        if (!log_->fits(size + record_header_size)) {
+            if ((log_t::header_size + live_bytes_) * 2 < log_->end()) compact();
+            log_->reserve(size + record_header_size);
+        }
+        char* p = log_->at(log_->end());
+        auto& r = *reinterpret_cast<record_header*>(p);
+        r.kind = kind;
+        r.qos = qos;
+        r.reserved = 0;
+        r.topic_size = static_cast<std::uint32_t>(topic_name.size());
+        r.contents_size = static_cast<std::uint32_t>(contents.size());
+        std::memcpy(p + record_header_size, topic_name.data(), topic_name.size());
+        std::memcpy(p + record_header_size + topic_name.size(), contents.data(), contents.size());
+        log_t::seal(p, record_header_size + body_size);
+        return log_->commit(size);
+    }
+
+    void replay(std::size_t offset) {
+        auto const& r = record_at(offset);
+        boost::string_ref topic_name(body_at(offset), r.topic_size);
+        switch (r.kind) {
+        case record_kind::store: {
+            auto& slot = get_node(topic_name).value;
+            if (slot) {
+                memory_usage_ -= usage_of(*slot);
+                live_bytes_ -= record_at(slot->offset).size;
+            }
+            else {
+                ++size_;
+            }
+            slot = entry();
+            slot->offset = offset;
+            slot->topic_size = r.topic_size;
+            slot->contents_size = r.contents_size;
+            slot->qos = r.qos;
+            memory_usage_ += usage_of(*slot);
+            live_bytes_ += r.size;
+        } break;
+        case record_kind::erase: {
+            std::size_t record_size = 0;
+            if (remove_entry(topic_name, record_size)) live_bytes_ -= record_size;
+        } break;
+        case record_kind::clear:
+            root_ = node();
+            size_ = 0;
+            memory_usage_ = 0;
+            live_bytes_ = 0;
+            break;
+        }
+    }
+
+    node root_;
+    std::size_t size_ = 0;
+    std::size_t memory_usage_ = 0;
+    std::size_t memory_limit_ = 0;
+    // The log. nullptr if the store is not backed by a file.
+    std::unique_ptr<log_t> log_;
+    // The total size of the live store records.
+    std::size_t live_bytes_ = 0;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_RETAINED_STORE_HPP
@@ -0,0 +1,526 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_SERVER_HPP)
+#define MQTT_SERVER_HPP
+
+#include <memory>
+#include <functional>
+#include <type_traits>
+
+#include <boost/optional.hpp>
+#include <boost/asio.hpp>
+
+#if !defined(MQTT_NO_TLS)
+#include <boost/asio/ssl.hpp>
+#endif // !defined(MQTT_NO_TLS)
+
+#if defined(MQTT_USE_WS)
+#include <mqtt/ws_endpoint.hpp>
+#endif // defined(MQTT_USE_WS)
+
+#include <mqtt/endpoint.hpp>
+#include <mqtt/null_strand.hpp>
+#include <mqtt/socket_options.hpp>
+
+namespace mqtt {
+
+namespace as = boost::asio;
+
+/**
+ * @brief Accepts connections and hands back endpoints that are ready for MQTT.
+ * The next connection is accepted before the TLS and WebSocket handshakes of the
+ * accepted one, so slow handshakes don't block the accept loop.
+ * To scale accepting to several threads, create a server per io_service with the
+ * same port and set_reuse_port(true). The kernel distributes the connections.
+ * Call the member functions on the thread that runs the io_service.
+ * Mutex, LockGuard, Store and Handlers are passed to the endpoints that are handed back.
+ */
+template <
+    typename Socket,
+    typename Strand = as::io_service::strand,
+    typename Mutex = std::mutex,
+    template<typename...> class LockGuard = std::lock_guard,
+    template<typename...> class Store = multi_index_store,
+    typename Handlers = function_handlers>
+class server : public std::enable_shared_from_this<server<Socket, Strand, Mutex, LockGuard, Store, Handlers>> {
+public:
+    using endpoint_t = endpoint<Socket, Strand, Mutex, LockGuard, Store, Handlers>;
+
+    /**
+     * @brief Accept handler
+     * @param ep endpoint of the accepted connection. The handshakes are finished.
+     *           Set the handlers of ep, and then call ep->start_session().
+     */
+    using accept_handler = std::function<void(std::shared_ptr<endpoint_t> const& ep)>;
+
+    /**
+     * @brief Error handler
+     * @param ec error code of accept or of applying the socket options.
+     *           The server keeps accepting unless close() is called.
+     */
+    using error_handler = std::function<void(boost::system::error_code const& ec)>;
+
+    /**
+     * @brief Constructor
+     * @param ios io_service that runs the acceptor and the accepted endpoints
+     * @param ep local endpoint to listen on
+     */
+    server(as::io_service& ios, as::ip::tcp::endpoint ep)
+        :ios_(ios),
+         endpoint_(std::move(ep)),
+         acceptor_(ios),
+         retry_timer_(ios),
+         backlog_(as::socket_base::max_connections),
+         reuse_port_(false),
+         handshake_timeout_ms_(0),
+         accept_retry_delay_ms_(100)
+#if !defined(MQTT_NO_TLS)
+         ,
+         ctx_(as::ssl::context::tlsv12)
+#endif // !defined(MQTT_NO_TLS)
+    {}
+
+    /**
+     * @brief Set accept handler
+     * @param h handler
+     */
+    void set_accept_handler(accept_handler h = accept_handler()) {
+        h_accept_ = std::move(h);
+    }
+
+    /**
+     * @brief Set error handler
+     * @param h handler
+     */
+    void set_error_handler(error_handler h = error_handler()) {
+        h_error_ = std::move(h);
+    }
+
+    /**
+     * @brief Set the backlog of listen().
+     * @param backlog The default is as::socket_base::max_connections.
+     */
+    void set_backlog(int backlog) {
+        backlog_ = backlog;
+    }
+
+    /**
+     * @brief Set SO_REUSEPORT to the acceptor. It is ignored if the platform doesn't support it.
+     * @param reuse_port The default is false.
+     */
+    void set_reuse_port(bool reuse_port) {
+        reuse_port_ = reuse_port;
+    }
+
+    /**
+     * @brief Set the socket options that are applied to the accepted sockets.
+     * @param opts socket options
+     */
+    void set_socket_options(socket_options const& opts) {
+        socket_options_ = opts;
+    }
+
+    /**
+     * @brief Set the time limit of the TLS and WebSocket handshakes.
+     *        The connection that doesn't finish the handshakes in time is closed.
+     * @param ms timeout in milliseconds. 0 means no limit. The default is 0.
+     */
+    void set_handshake_timeout_ms(std::size_t ms) {
+        handshake_timeout_ms_ = ms;
+    }
+
+    /**
+     * @brief Set the delay before accepting again after the accept failed for lack of
+     *        resources, such as file descriptors or buffer space.
+     *        Accepting again at once would fail the same way until a resource is released.
+     * @param ms delay in milliseconds. The default is 100.
+     */
+    void set_accept_retry_delay_ms(std::size_t ms) {
+        accept_retry_delay_ms_ = ms;
+    }
+
+#if !defined(MQTT_NO_TLS)
+    void set_certificate_chain_file(std::string file) {
+        ctx_.use_certificate_chain_file(std::move(file));
+    }
+    void set_private_key_file(std::string file) {
+        ctx_.use_private_key_file(std::move(file), as::ssl::context::pem);
+    }
+
+    /**
+     * @brief Get the SSL context of the TLS servers to configure it directly.
+     * @return SSL context
+     */
+    as::ssl::context& get_ssl_context() {
+        return ctx_;
+    }
+#endif // !defined(MQTT_NO_TLS)
+
+#if defined(MQTT_USE_WS)
+    /**
+     * @brief Set permessage-deflate options of the WebSocket transport.
+     *        The server accepts the extension if the client offers it.
+     * @param opts options. boost::none disables the extension. The default is boost::none.
+     */
+    void set_ws_permessage_deflate(boost::optional<permessage_deflate_options> opts) {
+        ws_deflate_ = std::move(opts);
+    }
+#endif // defined(MQTT_USE_WS)
+
+    /**
+     * @brief Open the acceptor and start accepting.
+     *        It throws boost::system::system_error if the acceptor can't listen.
+     */
+    void listen() {
+        acceptor_.open(endpoint_.protocol());
+        acceptor_.set_option(as::socket_base::reuse_address(true));
+#if defined(SO_REUSEPORT)
+        if (reuse_port_) acceptor_.set_option(as::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#endif // defined(SO_REUSEPORT)
+        acceptor_.bind(endpoint_);
+        acceptor_.listen(backlog_);
+        do_accept();
+    }
+
+    /**
+     * @brief Stop accepting. The endpoints that are already handed back are not affected.
+     */
+    void close() {
+        boost::system::error_code ec;
+        acceptor_.close(ec);
+        retry_timer_.cancel(ec);
+    }
+
+    /**
+     * @brief Get the port that the server listens on.
+     * @return port number
+     */
+    std::uint16_t port() const {
+        return acceptor_.local_endpoint().port();
+    }
+
+private:
+    // The accepted socket until the handshakes are finished.
+    struct connection {
+        explicit connection(as::io_service& ios)
+            :strand(ios),
+             timer(ios) {}
+        std::unique_ptr<Socket> socket;
+        Strand strand;
+        as::deadline_timer timer;
+    };
+
+    void do_accept() {
+        auto con = std::make_shared<connection>(ios_);
+        setup_socket(con->socket);
+        auto self = this->shared_from_this();
+        acceptor_.async_accept(
+            con->socket->lowest_layer(),
+            [this, self, con]
+            (boost::system::error_code const& ec) {
+                if (!acceptor_.is_open()) return;
+                if (ec) {
+                    if (h_error_) h_error_(ec);
+                    if (!acceptor_.is_open()) return;
+                    if (is_resource_exhausted(ec)) {
+                        retry_accept();
+                    }
+                    else {
+                        do_accept();
+                    }
+                    return;
+                }
+                do_accept();
+                boost::system::error_code oec;
+                socket_options_.apply(con->socket->lowest_layer(), oec);
+                if (oec) {
+                    boost::system::error_code cec;
+                    con->socket->lowest_layer().close(cec);
+                    if (h_error_) h_error_(oec);
+                    return;
+                }
+                start_handshake(con);
+            });
+    }
+
+    void retry_accept() {
+        retry_timer_.expires_from_now(boost::posix_time::milliseconds(accept_retry_delay_ms_));
+        auto self = this->shared_from_this();
+        retry_timer_.async_wait(
+            [this, self]
+            (boost::system::error_code const& ec) {
+                if (ec || !acceptor_.is_open()) return;
+                do_accept();
+            });
+    }
+
+    static bool is_resource_exhausted(boost::system::error_code const& ec) {
+        return
+            ec == as::error::no_descriptors ||
+            ec == boost::system::errc::too_many_files_open_in_system ||
+            ec == as::error::no_buffer_space ||
+            ec == as::error::no_memory;
+    }
+
+    void start_handshake(std::shared_ptr<connection> const& con) {
+        if (handshake_timeout_ms_ != 0) {
+            con->timer.expires_from_now(boost::posix_time::milliseconds(handshake_timeout_ms_));
+            con->timer.async_wait(
+                con->strand.wrap(
+                    [con]
+                    (boost::system::error_code const& ec) {
+                        if (ec || !con->socket) return;
+                        boost::system::error_code cec;
+                        con->socket->lowest_layer().close(cec);
+                    }));
+        }
+        auto self = this->shared_from_this();
+        handshake_socket(
+            con->socket,
+            con,
+            [this, self, con]
+            (boost::system::error_code const& ec) {
+                boost::system::error_code cec;
+                con->timer.cancel(cec);
+                if (ec) return;
+                auto ep = std::make_shared<endpoint_t>(std::move(con->socket));
+                if (h_accept_) h_accept_(ep);
+            });
+    }
+
+    template <typename T>
+    typename std::enable_if<
+        std::is_same<T, std::unique_ptr<as::ip::tcp::socket>>::value
+    >::type setup_socket(T& socket) {
+        socket.reset(new Socket(ios_));
+    }
+
+    template <typename T, typename F>
+    typename std::enable_if<
+        std::is_same<T, std::unique_ptr<as::ip::tcp::socket>>::value
+    >::type handshake_socket(T&, std::shared_ptr<connection> const&, F const& done) {
+        done(boost::system::error_code());
+    }
+
+#if defined(MQTT_USE_IO_URING)
+    template <typename T>
+    typename std::enable_if<
+        std::is_same<T, std::unique_ptr<io_uring_socket>>::value
+    >::type setup_socket(T& socket) {
+        socket.reset(new Socket(ios_));
+    }
+
+    template <typename T, typename F>
+    typename std::enable_if<
+        std::is_same<T, std::unique_ptr<io_uring_socket>>::value
+    >::type handshake_socket(T&, std::shared_ptr<connection> const&, F const& done) {
+        done(boost::system::error_code());
+    }
+#endif // defined(MQTT_USE_IO_URING)
+
+#if defined(MQTT_USE_WS)
+    template <typename T>
+    typename std::enable_if<
+        std::is_same<T, std::unique_ptr<ws_endpoint<as::ip::tcp::socket>>>::value
+    >::type setup_socket(T& socket) {
+        socket.reset(new Socket(ios_));
+        if (ws_deflate_) socket->enable_permessage_deflate(*ws_deflate_);
+    }
+
+    template <typename T, typename F>
+    typename std::enable_if<
+        std::is_same<T, std::unique_ptr<ws_endpoint<as::ip::tcp::socket>>>::value
+    >::type handshake_socket(T& socket, std::shared_ptr<connection> const& con, F const& done) {
+        socket->async_accept(con->strand.wrap(done));
+    }
+#endif // defined(MQTT_USE_WS)
+
+#if !defined(MQTT_NO_TLS)
+    template <typename T>
+    typename std::enable_if<
+        std::is_same<T, std::unique_ptr<as::ssl::stream<as::ip::tcp::socket>>>::value
+    >::type setup_socket(T& socket) {
+        socket.reset(new Socket(ios_, ctx_));
+    }
+
+    template <typename T, typename F>
+    typename std::enable_if<
+        std::is_same<T, std::unique_ptr<as::ssl::stream<as::ip::tcp::socket>>>::value
+    >::type handshake_socket(T& socket, std::shared_ptr<connection> const& con, F const& done) {
+        socket->async_handshake(as::ssl::stream_base::server, con->strand.wrap(done));
+    }
+
+#if defined(MQTT_USE_WS)
+    template <typename T>
+    typename std::enable_if<
+        std::is_same<T, std::unique_ptr<ws_endpoint<as::ssl::stream<as::ip::tcp::socket>>>>::value
+    >::type setup_socket(T& socket) {
+        socket.reset(new Socket(ios_, ctx_));
+        if (ws_deflate_) socket->enable_permessage_deflate(*ws_deflate_);
+    }
+
+    template <typename T, typename F>
+    typename std::enable_if<
+        std::is_same<T, std::unique_ptr<ws_endpoint<as::ssl::stream<as::ip::tcp::socket>>>>::value
+    >::type handshake_socket(T& socket, std::shared_ptr<connection> const& con, F const& done) {
+        socket->next_layer().async_handshake(
+            as::ssl::stream_base::server,
+            con->strand.wrap(
+                [con, done]
+                (boost::system::error_code const& ec) {
+                    if (ec) {
+                        done(ec);
+                        return;
+                    }
+                    con->socket->async_accept(con->strand.wrap(done));
+                }));
+    }
+#endif // defined(MQTT_USE_WS)
+
+#endif // !defined(MQTT_NO_TLS)
+
+    as::io_service& ios_;
+    as::ip::tcp::endpoint endpoint_;
+    as::ip::tcp::acceptor acceptor_;
+    as::deadline_timer retry_timer_;
+    int backlog_;
+    bool reuse_port_;
+    std::size_t handshake_timeout_ms_;
+    std::size_t accept_retry_delay_ms_;
+    socket_options socket_options_;
+    accept_handler h_accept_;
+    error_handler h_error_;
+#if !defined(MQTT_NO_TLS)
+    as::ssl::context ctx_;
+#endif // !defined(MQTT_NO_TLS)
+#if defined(MQTT_USE_WS)
+    boost::optional<permessage_deflate_options> ws_deflate_;
+#endif // defined(MQTT_USE_WS)
+};
+
+inline std::shared_ptr<server<as::ip::tcp::socket, as::io_service::strand>>
+make_server(as::io_service& ios, as::ip::tcp::endpoint ep) {
+    return std::make_shared<server<as::ip::tcp::socket, as::io_service::strand>>(ios, std::move(ep));
+}
+
+inline std::shared_ptr<server<as::ip::tcp::socket, as::io_service::strand>>
+make_server(as::io_service& ios, std::uint16_t port) {
+    return make_server(ios, as::ip::tcp::endpoint(as::ip::tcp::v4(), port));
+}
+
+inline std::shared_ptr<server<as::ip::tcp::socket, null_strand>>
+make_server_no_strand(as::io_service& ios, as::ip::tcp::endpoint ep) {
+    return std::make_shared<server<as::ip::tcp::socket, null_strand>>(ios, std::move(ep));
+}
+
+inline std::shared_ptr<server<as::ip::tcp::socket, null_strand>>
+make_server_no_strand(as::io_service& ios, std::uint16_t port) {
+    return make_server_no_strand(ios, as::ip::tcp::endpoint(as::ip::tcp::v4(), port));
+}
+
+#if defined(MQTT_USE_IO_URING)
+
+// boost::system::system_error is thrown if io_uring is not available.
+inline std::shared_ptr<server<io_uring_socket, as::io_service::strand>>
+make_server_io_uring(as::io_service& ios, as::ip::tcp::endpoint ep) {
+    as::use_service<io_uring_ring>(ios);
+    return std::make_shared<server<io_uring_socket, as::io_service::strand>>(ios, std::move(ep));
+}
+
+inline std::shared_ptr<server<io_uring_socket, as::io_service::strand>>
+make_server_io_uring(as::io_service& ios, std::uint16_t port) {
+    return make_server_io_uring(ios, as::ip::tcp::endpoint(as::ip::tcp::v4(), port));
+}
+
+inline std::shared_ptr<server<io_uring_socket, null_strand>>
+make_server_no_strand_io_uring(as::io_service& ios, as::ip::tcp::endpoint ep) {
+    as::use_service<io_uring_ring>(ios);
+    return std::make_shared<server<io_uring_socket, null_strand>>(ios, std::move(ep));
+}
+
+inline std::shared_ptr<server<io_uring_socket, null_strand>>
+make_server_no_strand_io_uring(as::io_service& ios, std::uint16_t port) {
+    return make_server_no_strand_io_uring(ios, as::ip::tcp::endpoint(as::ip::tcp::v4(), port));
+}
+
+#endif // defined(MQTT_USE_IO_URING)
+
+#if defined(MQTT_USE_WS)
+
+inline std::shared_ptr<server<ws_endpoint<as::ip::tcp::socket>, as::io_service::strand>>
+make_server_ws(as::io_service& ios, as::ip::tcp::endpoint ep) {
+    return std::make_shared<server<ws_endpoint<as::ip::tcp::socket>, as::io_service::strand>>(ios, std::move(ep));
+}
+
+inline std::shared_ptr<server<ws_endpoint<as::ip::tcp::socket>, as::io_service::strand>>
+make_server_ws(as::io_service& ios, std::uint16_t port) {
+    return make_server_ws(ios, as::ip::tcp::endpoint(as::ip::tcp::v4(), port));
+}
+
+inline std::shared_ptr<server<ws_endpoint<as::ip::tcp::socket>, null_strand>>
+make_server_no_strand_ws(as::io_service& ios, as::ip::tcp::endpoint ep) {
+    return std::make_shared<server<ws_endpoint<as::ip::tcp::socket>, null_strand>>(ios, std::move(ep));
+}
+
+inline std::shared_ptr<server<ws_endpoint<as::ip::tcp::socket>, null_strand>>
+make_server_no_strand_ws(as::io_service& ios, std::uint16_t port) {
+    return make_server_no_strand_ws(ios, as::ip::tcp::endpoint(as::ip::tcp::v4(), port));
+}
+
+#endif // defined(MQTT_USE_WS)
+
+#if !defined(MQTT_NO_TLS)
+
+inline std::shared_ptr<server<as::ssl::stream<as::ip::tcp::socket>, as::io_service::strand>>
+make_tls_server(as::io_service& ios, as::ip::tcp::endpoint ep) {
+    return std::make_shared<server<as::ssl::stream<as::ip::tcp::socket>, as::io_service::strand>>(ios, std::move(ep));
+}
+
+inline std::shared_ptr<server<as::ssl::stream<as::ip::tcp::socket>, as::io_service::strand>>
+make_tls_server(as::io_service& ios, std::uint16_t port) {
+    return make_tls_server(ios, as::ip::tcp::endpoint(as::ip::tcp::v4(), port));
+}
+
+inline std::shared_ptr<server<as::ssl::stream<as::ip::tcp::socket>, null_strand>>
+make_tls_server_no_strand(as::io_service& ios, as::ip::tcp::endpoint ep) {
+    return std::make_shared<server<as::ssl::stream<as::ip::tcp::socket>, null_strand>>(ios, std::move(ep));
+}
+
+inline std::shared_ptr<server<as::ssl::stream<as::ip::tcp::socket>, null_strand>>
+make_tls_server_no_strand(as::io_service& ios, std::uint16_t port) {
+    return make_tls_server_no_strand(ios, as::ip::tcp::endpoint(as::ip::tcp::v4(), port));
+}
+
+#if defined(MQTT_USE_WS)
+
+inline std::shared_ptr<server<ws_endpoint<as::ssl::stream<as::ip::tcp::socket>>, as::io_service::strand>>
+make_tls_server_ws(as::io_service& ios, as::ip::tcp::endpoint ep) {
+    return std::make_shared<server<ws_endpoint<as::ssl::stream<as::ip::tcp::socket>>, as::io_service::strand>>(ios, std::move(ep));
+}
+
+inline std::shared_ptr<server<ws_endpoint<as::ssl::stream<as::ip::tcp::socket>>, as::io_service::strand>>
+make_tls_server_ws(as::io_service& ios, std::uint16_t port) {
+    return make_tls_server_ws(ios, as::ip::tcp::endpoint(as::ip::tcp::v4(), port));
+}
+
+inline std::shared_ptr<server<ws_endpoint<as::ssl::stream<as::ip::tcp::socket>>, null_strand>>
+make_tls_server_no_strand_ws(as::io_service& ios, as::ip::tcp::endpoint ep) {
+    return std::make_shared<server<ws_endpoint<as::ssl::stream<as::ip::tcp::socket>>, null_strand>>(ios, std::move(ep));
+}
+
+inline std::shared_ptr<server<ws_endpoint<as::ssl::stream<as::ip::tcp::socket>>, null_strand>>
+make_tls_server_no_strand_ws(as::io_service& ios, std::uint16_t port) {
+    return make_tls_server_no_strand_ws(ios, as::ip::tcp::endpoint(as::ip::tcp::v4(), port));
+}
+
+#endif // defined(MQTT_USE_WS)
+
+#endif // !defined(MQTT_NO_TLS)
+
+} // namespace mqtt
+
+#endif // MQTT_SERVER_HPP
@@ -0,0 +1,108 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_SESSION_STORE_HPP)
+#define MQTT_SESSION_STORE_HPP
+
+#include <cstdint>
+#include <functional>
+
+#include <boost/utility/string_ref.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Interface of the persistent session state.
+ * endpoint calls the recorders when the session state is changed,
+ * and calls restore() when the session store is set.
+ * The calls are serialized by endpoint.
+ */
+class session_store {
+public:
+    virtual ~session_store() = default;
+
+    /**
+     * @brief Record a packet that waits for the response.
+     * @param packet_id packet identifier
+     * @param expected_control_packet_type the control packet type of the response
+     * @param header the packet except the contents
+     * @param contents the contents of PUBLISH. It is empty for PUBREL.
+     */
+    virtual void add_packet(
+        std::uint16_t packet_id,
+        std::uint8_t expected_control_packet_type,
+        boost::string_ref header,
+        boost::string_ref contents) = 0;
+
+    /**
+     * @brief Record that the packet has been responded.
+     */
+    virtual void erase_packet(
+        std::uint16_t packet_id,
+        std::uint8_t expected_control_packet_type) = 0;
+
+    /**
+     * @brief Record that all packets that have packet_id have been erased.
+     */
+    virtual void erase_packets(std::uint16_t packet_id) = 0;
+
+    /**
+     * @brief Record that all packets have been erased.
+     */
+    virtual void clear_packets() = 0;
+
+    /**
+     * @brief Record that the QoS2 PUBLISH that has packet_id has been handled.
+     */
+    virtual void add_qos2_publish_handled(std::uint16_t packet_id) = 0;
+
+    /**
+     * @brief Record that the PUBREL for packet_id has been received.
+     */
+    virtual void erase_qos2_publish_handled(std::uint16_t packet_id) = 0;
+
+    /**
+     * @brief Record that packet_id is in use.
+     */
+    virtual void use_packet_id(std::uint16_t packet_id) = 0;
+
+    /**
+     * @brief Record that packet_id is released.
+     */
+    virtual void release_packet_id(std::uint16_t packet_id) = 0;
+
+    /**
+     * @brief Packet restore handler
+     * @param packet_id packet identifier
+     * @param expected_control_packet_type the control packet type of the response
+     * @param packet the whole packet. It is valid only during the call.
+     */
+    using packet_restorer = std::function<
+        void(std::uint16_t packet_id,
+             std::uint8_t expected_control_packet_type,
+             boost::string_ref packet)>;
+
+    /**
+     * @brief Packet identifier restore handler
+     */
+    using packet_id_restorer = std::function<void(std::uint16_t packet_id)>;
+
+    /**
+     * @brief Call the handlers for the recorded state.
+     *        The packets are restored in the recorded order.
+     * @param packet called for each packet that waits for the response
+     * @param qos2_publish_handled called for each handled QoS2 PUBLISH
+     * @param packet_id called for each packet_id in use
+     */
+    virtual void restore(
+        packet_restorer const& packet,
+        packet_id_restorer const& qos2_publish_handled,
+        packet_id_restorer const& packet_id) = 0;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_SESSION_STORE_HPP
@@ -0,0 +1,110 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_SHARED_PUBLISH_HPP)
+#define MQTT_SHARED_PUBLISH_HPP
+
+#include <string>
+#include <memory>
+
+#include <boost/utility/string_ref.hpp>
+
+#include <mqtt/utf8encoded_strings.hpp>
+#include <mqtt/encoded_length.hpp>
+#include <mqtt/exception.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief A PUBLISH message that is encoded once and sent by many endpoints.
+ * The topic name is validated and encoded when it is constructed, and the contents
+ * are shared by all endpoints without copying. Each endpoint only builds a small
+ * header that has the fixed header, the encoded topic name and its own packet identifier.
+ * @code
+ * mqtt::shared_publish p("sensors/1/temperature", std::make_shared<std::string const>(payload));
+ * for (auto& ep : subscribers) ep->async_publish(p, ep_qos);
+ * @endcode
+ * It is immutable, so it can be used from the threads of the endpoints at the same time.
+ */
+class shared_publish {
+public:
+    /**
+     * @brief constructor
+     * @param topic_name
+     *        A topic name to publish. utf8string_length_error or utf8string_contents_error
+     *        is thrown if it is invalid.
+     * @param contents
+     *        The contents to publish. The endpoints hold the reference until the packets
+     *        are no longer needed. Don't modify them after calling.
+     * @param retain
+     *        A retain flag. If set it to true, the contents is retained.<BR>
+     *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718038<BR>
+     *        3.3.1.3 RETAIN
+     */
+    shared_publish(
+        std::string const& topic_name,
+        std::shared_ptr<std::string const> contents,
+        bool retain = false)
+        :encoded_topic_name_(encode(topic_name)),
+         contents_(std::move(contents)),
+         retain_(retain) {}
+
+    /**
+     * @brief constructor
+     * @param topic_name
+     *        A topic name to publish
+     * @param contents
+     *        The contents to publish. They are moved to a shared buffer.
+     * @param retain
+     *        A retain flag.
+     */
+    shared_publish(
+        std::string const& topic_name,
+        std::string contents,
+        bool retain = false)
+        :shared_publish(topic_name, std::make_shared<std::string const>(std::move(contents)), retain) {}
+
+    /**
+     * @brief Get the topic name.
+     * @return topic name
+     */
+    boost::string_ref topic_name() const {
+        return boost::string_ref(encoded_topic_name_).substr(2);
+    }
+
+    /**
+     * @brief Get the topic name that is prefixed by its length, as it is on the wire.
+     * @return encoded topic name
+     */
+    std::string const& encoded_topic_name() const {
+        return encoded_topic_name_;
+    }
+
+    std::shared_ptr<std::string const> const& contents() const {
+        return contents_;
+    }
+
+    bool retain() const {
+        return retain_;
+    }
+
+private:
+    static std::string encode(std::string const& topic_name) {
+        if (!utf8string::is_valid_length(topic_name)) throw utf8string_length_error();
+        if (!utf8string::is_valid_contents(topic_name)) throw utf8string_contents_error();
+        std::string ret = encoded_length(topic_name);
+        ret += topic_name;
+        return ret;
+    }
+
+    std::string encoded_topic_name_;
+    std::shared_ptr<std::string const> contents_;
+    bool retain_;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_SHARED_PUBLISH_HPP
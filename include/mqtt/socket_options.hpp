@@ -0,0 +1,153 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_SOCKET_OPTIONS_HPP)
+#define MQTT_SOCKET_OPTIONS_HPP
+
+#include <cerrno>
+
+#include <boost/optional.hpp>
+#include <boost/asio.hpp>
+#include <boost/system/error_code.hpp>
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif // defined(__linux__)
+
+namespace mqtt {
+
+namespace as = boost::asio;
+
+/**
+ * @brief TCP socket options.
+ * Only the options that are set are applied. The options that are not supported
+ * on the platform are ignored.
+ */
+struct socket_options {
+    /**
+     * @brief TCP_NODELAY. true disables Nagle's algorithm.
+     */
+    boost::optional<bool> no_delay;
+
+    /**
+     * @brief SO_SNDBUF in bytes
+     */
+    boost::optional<int> send_buffer_size;
+
+    /**
+     * @brief SO_RCVBUF in bytes
+     */
+    boost::optional<int> receive_buffer_size;
+
+    /**
+     * @brief SO_KEEPALIVE
+     */
+    boost::optional<bool> keep_alive;
+
+    /**
+     * @brief TCP_KEEPIDLE in seconds (Linux only)
+     */
+    boost::optional<int> keep_alive_idle_sec;
+
+    /**
+     * @brief TCP_KEEPINTVL in seconds (Linux only)
+     */
+    boost::optional<int> keep_alive_interval_sec;
+
+    /**
+     * @brief TCP_KEEPCNT (Linux only)
+     */
+    boost::optional<int> keep_alive_count;
+
+    /**
+     * @brief TCP_USER_TIMEOUT in milliseconds (Linux only)
+     */
+    boost::optional<unsigned int> user_timeout_ms;
+
+    /**
+     * @brief SO_BUSY_POLL in microseconds (Linux only)
+     */
+    boost::optional<int> busy_poll_us;
+
+    /**
+     * @brief TCP_QUICKACK (Linux only)
+     * The kernel may clear it, so it is applied again after connect.
+     */
+    boost::optional<bool> quick_ack;
+
+    /**
+     * @brief Apply the options to the socket.
+     *        It is called after the socket is opened and before it is connected.
+     * @param s opened socket
+     * @param ec set if an option can't be applied
+     */
+    template <typename Socket>
+    void apply(Socket& s, boost::system::error_code& ec) const {
+        if (no_delay) {
+            s.set_option(as::ip::tcp::no_delay(*no_delay), ec);
+            if (ec) return;
+        }
+        if (send_buffer_size) {
+            s.set_option(as::socket_base::send_buffer_size(*send_buffer_size), ec);
+            if (ec) return;
+        }
+        if (receive_buffer_size) {
+            s.set_option(as::socket_base::receive_buffer_size(*receive_buffer_size), ec);
+            if (ec) return;
+        }
+        if (keep_alive) {
+            s.set_option(as::socket_base::keep_alive(*keep_alive), ec);
+            if (ec) return;
+        }
+#if defined(__linux__)
+        if (keep_alive_idle_sec && set_int(s, IPPROTO_TCP, TCP_KEEPIDLE, *keep_alive_idle_sec, ec)) return;
+        if (keep_alive_interval_sec && set_int(s, IPPROTO_TCP, TCP_KEEPINTVL, *keep_alive_interval_sec, ec)) return;
+        if (keep_alive_count && set_int(s, IPPROTO_TCP, TCP_KEEPCNT, *keep_alive_count, ec)) return;
+#if defined(TCP_USER_TIMEOUT)
+        if (user_timeout_ms && set_int(s, IPPROTO_TCP, TCP_USER_TIMEOUT, static_cast<int>(*user_timeout_ms), ec)) return;
+#endif // defined(TCP_USER_TIMEOUT)
+#if defined(SO_BUSY_POLL)
+        if (busy_poll_us && set_int(s, SOL_SOCKET, SO_BUSY_POLL, *busy_poll_us, ec)) return;
+#endif // defined(SO_BUSY_POLL)
+#endif // defined(__linux__)
+        apply_after_connect(s, ec);
+    }
+
+    /**
+     * @brief Apply the options that have to be set again after the socket is connected.
+     * @param s connected socket
+     * @param ec set if an option can't be applied
+     */
+    template <typename Socket>
+    void apply_after_connect(Socket& s, boost::system::error_code& ec) const {
+#if defined(__linux__) && defined(TCP_QUICKACK)
+        if (quick_ack) set_int(s, IPPROTO_TCP, TCP_QUICKACK, *quick_ack ? 1 : 0, ec);
+#else  // defined(__linux__) && defined(TCP_QUICKACK)
+        static_cast<void>(s);
+        static_cast<void>(ec);
+#endif // defined(__linux__) && defined(TCP_QUICKACK)
+    }
+
+private:
+#if defined(__linux__)
+    // Returns true on error.
+    template <typename Socket>
+    static bool set_int(Socket& s, int level, int name, int value, boost::system::error_code& ec) {
+        if (::setsockopt(s.native_handle(), level, name, &value, sizeof(value)) != 0) {
+            ec = boost::system::error_code(errno, boost::system::system_category());
+            return true;
+        }
+        ec = boost::system::error_code();
+        return false;
+    }
+#endif // defined(__linux__)
+};
+
+} // namespace mqtt
+
+#endif // MQTT_SOCKET_OPTIONS_HPP
@@ -0,0 +1,235 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_STORE_HPP)
+#define MQTT_STORE_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include <iterator>
+
+#include <boost/optional.hpp>
+#include <boost/assert.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/mem_fun.hpp>
+#include <boost/multi_index/composite_key.hpp>
+
+namespace mqtt {
+
+namespace mi = boost::multi_index;
+
+// The stores keep the packets that wait for the response from the counterpart.
+// Elem has to provide packet_id() and expected_control_packet_type().
+//
+// emplace(args...)           : Insert an element constructed from args.
+// erase(packet_id, type)     : Erase the element that has packet_id and the expected type.
+//                              Returns the number of erased elements.
+// erase(packet_id)           : Erase all elements that have packet_id.
+//                              Returns the number of erased elements.
+// clear()                    : Erase all elements.
+// for_each(f)                : Call f(Elem const&) for each element in insertion order.
+// update_each(f)             : Call f(Elem&) for each element in insertion order.
+//                              If f returns false, the element is erased.
+
+/**
+ * @brief Store that is implemented by boost::multi_index.
+ * Each packet_id can have one element per expected control packet type.
+ * The elements are allocated one by one.
+ */
+template <typename Elem>
+class multi_index_store {
+public:
+    template <typename... Args>
+    void emplace(Args&&... args) {
+        elems_.emplace(std::forward<Args>(args)...);
+    }
+
+    std::size_t erase(std::uint16_t packet_id, std::uint8_t expected_control_packet_type) {
+        auto& idx = elems_.template get<tag_packet_id_type>();
+        auto r = idx.equal_range(std::make_tuple(packet_id, expected_control_packet_type));
+        auto erased = static_cast<std::size_t>(std::distance(std::get<0>(r), std::get<1>(r)));
+        idx.erase(std::get<0>(r), std::get<1>(r));
+        return erased;
+    }
+
+    std::size_t erase(std::uint16_t packet_id) {
+        auto& idx = elems_.template get<tag_packet_id>();
+        return idx.erase(packet_id);
+    }
+
+    void clear() {
+        elems_.clear();
+    }
+
+    template <typename F>
+    void for_each(F&& f) const {
+        auto& idx = elems_.template get<tag_seq>();
+        for (auto const& e : idx) f(e);
+    }
+
+    template <typename F>
+    void update_each(F&& f) {
+        auto& idx = elems_.template get<tag_seq>();
+        auto it = idx.begin();
+        auto end = idx.end();
+        while (it != end) {
+            bool keep = true;
+            // f must not modify the keys.
+            idx.modify(it, [&](Elem& e){ keep = f(e); });
+            if (keep) ++it;
+            else it = idx.erase(it);
+        }
+    }
+
+private:
+    struct tag_packet_id {};
+    struct tag_packet_id_type {};
+    struct tag_seq {};
+    using mi_store = mi::multi_index_container<
+        Elem,
+        mi::indexed_by<
+            mi::ordered_unique<
+                mi::tag<tag_packet_id_type>,
+                mi::composite_key<
+                    Elem,
+                    mi::const_mem_fun<
+                        Elem, std::uint16_t,
+                        &Elem::packet_id
+                    >,
+                    mi::const_mem_fun<
+                        Elem, std::uint8_t,
+                        &Elem::expected_control_packet_type
+                    >
+                >
+            >,
+            mi::ordered_non_unique<
+                mi::tag<tag_packet_id>,
+                mi::const_mem_fun<
+                    Elem, std::uint16_t,
+                    &Elem::packet_id
+                >
+            >,
+            mi::sequenced<
+                mi::tag<tag_seq>
+            >
+        >
+    >;
+
+    mi_store elems_;
+};
+
+/**
+ * @brief Store that has a slot for every packet_id.
+ * Insert and erase are constant time and don't allocate after the first insert.
+ * The insertion order is kept as a doubly linked list of packet_ids in the slots.
+ * Each packet_id can have only one element. Emplacing an element for a packet_id
+ * that already has one replaces it, e.g. PUBREL replaces PUBLISH on PUBREC.
+ * The table is allocated at the first insert and is about 65536 * (sizeof(Elem) + 8) bytes.
+ */
+template <typename Elem>
+class flat_store {
+public:
+    template <typename... Args>
+    void emplace(std::uint16_t packet_id, Args&&... args) {
+        BOOST_ASSERT(packet_id != 0);
+        if (slots_.empty()) {
+            slots_.resize(slot_size);
+            slots_[sentinel].prev = sentinel;
+            slots_[sentinel].next = sentinel;
+        }
+        auto& s = slots_[packet_id];
+        if (s.elem) unlink(packet_id);
+        s.elem.emplace(packet_id, std::forward<Args>(args)...);
+        link_back(packet_id);
+    }
+
+    std::size_t erase(std::uint16_t packet_id, std::uint8_t expected_control_packet_type) {
+        if (slots_.empty()) return 0;
+        auto& s = slots_[packet_id];
+        if (!s.elem || s.elem->expected_control_packet_type() != expected_control_packet_type) return 0;
+        unlink(packet_id);
+        s.elem = boost::none;
+        return 1;
+    }
+
+    std::size_t erase(std::uint16_t packet_id) {
+        if (slots_.empty()) return 0;
+        auto& s = slots_[packet_id];
+        if (!s.elem) return 0;
+        unlink(packet_id);
+        s.elem = boost::none;
+        return 1;
+    }
+
+    void clear() {
+        if (slots_.empty()) return;
+        std::uint16_t id = slots_[sentinel].next;
+        while (id != sentinel) {
+            auto next = slots_[id].next;
+            slots_[id].elem = boost::none;
+            id = next;
+        }
+        slots_[sentinel].prev = sentinel;
+        slots_[sentinel].next = sentinel;
+    }
+
+    template <typename F>
+    void for_each(F&& f) const {
+        if (slots_.empty()) return;
+        for (std::uint16_t id = slots_[sentinel].next; id != sentinel; id = slots_[id].next) {
+            f(*slots_[id].elem);
+        }
+    }
+
+    template <typename F>
+    void update_each(F&& f) {
+        if (slots_.empty()) return;
+        std::uint16_t id = slots_[sentinel].next;
+        while (id != sentinel) {
+            auto next = slots_[id].next;
+            if (!f(*slots_[id].elem)) {
+                unlink(id);
+                slots_[id].elem = boost::none;
+            }
+            id = next;
+        }
+    }
+
+private:
+    // packet_id 0 is never used, so slot 0 is the head of the list.
+    static constexpr std::uint16_t const sentinel = 0;
+    static constexpr std::size_t const slot_size = 0x10000;
+
+    struct slot {
+        boost::optional<Elem> elem;
+        std::uint16_t prev = 0;
+        std::uint16_t next = 0;
+    };
+
+    void link_back(std::uint16_t id) {
+        auto tail = slots_[sentinel].prev;
+        slots_[id].prev = tail;
+        slots_[id].next = sentinel;
+        slots_[tail].next = id;
+        slots_[sentinel].prev = id;
+    }
+
+    void unlink(std::uint16_t id) {
+        auto& s = slots_[id];
+        slots_[s.prev].next = s.next;
+        slots_[s.next].prev = s.prev;
+    }
+
+    std::vector<slot> slots_;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_STORE_HPP
@@ -0,0 +1,142 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_TLS_SESSION_CACHE_HPP)
+#define MQTT_TLS_SESSION_CACHE_HPP
+
+#if !defined(MQTT_NO_TLS)
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <boost/asio/ssl.hpp>
+
+namespace mqtt {
+
+namespace as = boost::asio;
+
+/**
+ * @brief Cache of the TLS client sessions for session resumption.
+ * The sessions are kept per broker (host and port). Both session ids and
+ * session tickets are supported. A cache can be shared by clients on
+ * different threads.
+ */
+class tls_session_cache {
+public:
+    tls_session_cache() = default;
+    tls_session_cache(tls_session_cache const&) = delete;
+    tls_session_cache& operator=(tls_session_cache const&) = delete;
+
+    ~tls_session_cache() {
+        for (auto& e : sessions_) SSL_SESSION_free(e.second);
+    }
+
+    /**
+     * @brief Key of the cache and the SSL objects that use it.
+     * It has to outlive the SSL objects that are passed to attach().
+     */
+    struct binding {
+        binding(std::shared_ptr<tls_session_cache> cache, std::string key)
+            :cache(std::move(cache)),
+             key(std::move(key)) {}
+        std::shared_ptr<tls_session_cache> cache;
+        std::string key;
+    };
+
+    /**
+     * @brief Enable the client session cache of ctx.
+     *        New sessions of the SSL objects that are attached are stored to the cache.
+     * @param ctx SSL context of the client
+     */
+    static void enable(as::ssl::context& ctx) {
+        SSL_CTX_set_session_cache_mode(
+            ctx.native_handle(),
+            SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx.native_handle(), &tls_session_cache::new_session);
+    }
+
+    /**
+     * @brief Attach the SSL object to the binding before the handshake.
+     *        If the cache has a session for the key, the handshake tries to resume it.
+     * @param ssl SSL object of the client
+     * @param b binding
+     */
+    static void attach(SSL* ssl, binding& b) {
+        SSL_set_ex_data(ssl, ex_data_index(), &b);
+        std::lock_guard<std::mutex> lck (b.cache->mtx_);
+        auto it = b.cache->sessions_.find(b.key);
+        if (it != b.cache->sessions_.end()) SSL_set_session(ssl, it->second);
+    }
+
+    /**
+     * @brief Remove the session for key.
+     * @param key host:port
+     */
+    void erase(std::string const& key) {
+        std::lock_guard<std::mutex> lck (mtx_);
+        auto it = sessions_.find(key);
+        if (it == sessions_.end()) return;
+        SSL_SESSION_free(it->second);
+        sessions_.erase(it);
+    }
+
+    /**
+     * @brief Remove all sessions.
+     */
+    void clear() {
+        std::lock_guard<std::mutex> lck (mtx_);
+        for (auto& e : sessions_) SSL_SESSION_free(e.second);
+        sessions_.clear();
+    }
+
+    /**
+     * @brief Get the number of the cached sessions.
+     * @return the number of the cached sessions
+     */
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lck (mtx_);
+        return sessions_.size();
+    }
+
+private:
+    static int ex_data_index() {
+        static int const idx = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return idx;
+    }
+
+    // Called by OpenSSL when a new session is established or a session ticket is received.
+    // The connection is closed without close_notify, and then OpenSSL marks its session
+    // as not resumable. So a copy of the session is stored.
+    static int new_session(SSL* ssl, SSL_SESSION* sess) {
+        auto b = static_cast<binding*>(SSL_get_ex_data(ssl, ex_data_index()));
+        if (!b) return 0;
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        SSL_SESSION* copy = SSL_SESSION_dup(sess);
+        if (!copy) return 0;
+        int ret = 0;
+#else  // OPENSSL_VERSION_NUMBER >= 0x10101000L
+        // Returning 1 takes the ownership of sess.
+        SSL_SESSION* copy = sess;
+        int ret = 1;
+#endif // OPENSSL_VERSION_NUMBER >= 0x10101000L
+        std::lock_guard<std::mutex> lck (b->cache->mtx_);
+        auto& s = b->cache->sessions_[b->key];
+        if (s) SSL_SESSION_free(s);
+        s = copy;
+        return ret;
+    }
+
+    mutable std::mutex mtx_;
+    std::map<std::string, SSL_SESSION*> sessions_;
+};
+
+} // namespace mqtt
+
+#endif // !defined(MQTT_NO_TLS)
+
+#endif // MQTT_TLS_SESSION_CACHE_HPP
@@ -0,0 +1,104 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_TOPIC_DISPATCHER_HPP)
+#define MQTT_TOPIC_DISPATCHER_HPP
+
+#include <cstdint>
+#include <functional>
+
+#include <boost/optional.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include <mqtt/topic_filter_map.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Calls the handlers of the topic filters that match the received publish.
+ * Register a handler per topic filter when subscribing, and set the dispatcher as
+ * the publish_ref_handler of the endpoint:
+ * @code
+ * mqtt::topic_dispatcher d;
+ * d.set_handler("sensors/+/temperature", on_temperature);
+ * c->set_publish_ref_handler(std::ref(d));
+ * c->subscribe("sensors/+/temperature", mqtt::qos::at_most_once);
+ * @endcode
+ * It is not thread safe. Modify it on the thread that receives the publishes.
+ */
+class topic_dispatcher {
+public:
+    /**
+     * @brief Handler of a topic filter. The parameters are the same as publish_ref_handler.
+     */
+    using handler = std::function<void(std::uint8_t fixed_header,
+                                       boost::optional<std::uint16_t> packet_id,
+                                       boost::string_ref topic_name,
+                                       boost::string_ref contents)>;
+
+    /**
+     * @brief Set the handler of the topic filter. The existing handler of the filter is replaced.
+     * @param topic_filter topic filter. topic_filter_error is thrown if it is invalid.
+     * @param h handler
+     */
+    void set_handler(boost::string_ref topic_filter, handler h) {
+        handlers_.insert_or_assign(topic_filter, std::move(h));
+    }
+
+    /**
+     * @brief Remove the handler of the topic filter.
+     * @param topic_filter topic filter
+     * @return true if the handler was found and removed.
+     */
+    bool erase_handler(boost::string_ref topic_filter) {
+        return handlers_.erase(topic_filter);
+    }
+
+    /**
+     * @brief Call the handlers of the topic filters that match topic_name.
+     *        If several filters match, each handler is called once.
+     * @return the number of the called handlers
+     */
+    std::size_t dispatch(std::uint8_t fixed_header,
+                         boost::optional<std::uint16_t> const& packet_id,
+                         boost::string_ref topic_name,
+                         boost::string_ref contents) const {
+        std::size_t called = 0;
+        handlers_.match(
+            topic_name,
+            [&](handler const& h) {
+                if (h) h(fixed_header, packet_id, topic_name, contents);
+                ++called;
+            });
+        return called;
+    }
+
+    /**
+     * @brief Dispatch as a publish_ref_handler. It always continues receiving.
+     */
+    bool operator()(std::uint8_t fixed_header,
+                    boost::optional<std::uint16_t> packet_id,
+                    boost::string_ref topic_name,
+                    boost::string_ref contents) const {
+        dispatch(fixed_header, packet_id, topic_name, contents);
+        return true;
+    }
+
+    /**
+     * @brief Get the number of the topic filters that have a handler.
+     * @return the number of the topic filters
+     */
+    std::size_t size() const {
+        return handlers_.size();
+    }
+
+private:
+    topic_filter_map<handler> handlers_;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_TOPIC_DISPATCHER_HPP
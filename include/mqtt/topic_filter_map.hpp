@@ -0,0 +1,211 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_TOPIC_FILTER_MAP_HPP)
+#define MQTT_TOPIC_FILTER_MAP_HPP
+
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <utility>
+
+#include <boost/optional.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <mqtt/exception.hpp>
+#include <mqtt/topic_level.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Map from topic filters to values that finds the filters matching a topic name.
+ * It is a trie over the '/' separated levels, and the single level wildcard '+' and
+ * the multi level wildcard '#' are supported.
+ * See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718106<BR>
+ * 4.7 Topic Names and Topic Filters
+ * The cost of match() depends on the number of the levels of the topic name and the
+ * number of the matching wildcards, not on the number of the filters.
+ * It is not thread safe.
+ */
+template <typename Value>
+class topic_filter_map {
+public:
+    topic_filter_map()
+        :size_(0) {}
+
+    /**
+     * @brief Set the value of the topic filter.
+     * @param topic_filter topic filter. topic_filter_error is thrown if it is invalid.
+     * @param v value
+     * @return true if the topic filter is inserted, false if the value is replaced.
+     */
+    bool insert_or_assign(boost::string_ref topic_filter, Value v) {
+        auto& slot = get_slot(root_, topic_filter);
+        bool inserted = !slot;
+        slot = std::move(v);
+        if (inserted) ++size_;
+        return inserted;
+    }
+
+    /**
+     * @brief Find the value of the topic filter. Wildcards are compared literally.
+     * @param topic_filter topic filter
+     * @return pointer to the value, or nullptr if the topic filter is not found.
+     */
+    Value* find(boost::string_ref topic_filter) {
+        auto slot = find_slot(root_, topic_filter);
+        return slot && *slot ? slot->get_ptr() : nullptr;
+    }
+
+    Value const* find(boost::string_ref topic_filter) const {
+        return const_cast<topic_filter_map&>(*this).find(topic_filter);
+    }
+
+    /**
+     * @brief Remove the topic filter.
+     * @param topic_filter topic filter
+     * @return true if the topic filter was found and removed.
+     */
+    bool erase(boost::string_ref topic_filter) {
+        if (!erase_from(root_, topic_filter, 0)) return false;
+        --size_;
+        return true;
+    }
+
+    /**
+     * @brief Call f(Value const&) for each topic filter that matches the topic name.
+     *        The topic names that start with '$' don't match the filters that start with a wildcard.
+     * @param topic_name topic name
+     * @param f function object
+     */
+    template <typename F>
+    void match(boost::string_ref topic_name, F&& f) const {
+        bool dollar = !topic_name.empty() && topic_name.front() == '$';
+        match_from(root_, topic_name, 0, !dollar, f);
+    }
+
+    /**
+     * @brief Get the number of the topic filters.
+     * @return the number of the topic filters
+     */
+    std::size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    void clear() {
+        root_ = node();
+        size_ = 0;
+    }
+
+private:
+    using level_hash = detail::level_hash;
+    using level_equal = detail::level_equal;
+
+    struct node {
+        bool empty() const {
+            return !value && !multi_level && !plus && children.empty();
+        }
+        // The value of the filter that ends at this node.
+        boost::optional<Value> value;
+        // The value of the filter that ends with "#" after this node.
+        boost::optional<Value> multi_level;
+        std::unique_ptr<node> plus;
+        boost::unordered_map<std::string, std::unique_ptr<node>, level_hash, level_equal> children;
+    };
+
+    static constexpr std::size_t const npos = detail::level_npos;
+
+    // The filter is validated before any node is created, so an invalid filter leaves the trie as it was.
+    static boost::optional<Value>& get_slot(node& root, boost::string_ref topic_filter) {
+        detail::validate_topic_filter(topic_filter);
+        node* n = &root;
+        std::size_t pos = 0;
+        while (pos != npos) {
+            auto level = detail::next_level(topic_filter, pos);
+            if (level == "#") return n->multi_level;
+            if (level == "+") {
+                if (!n->plus) n->plus.reset(new node);
+                n = n->plus.get();
+                continue;
+            }
+            auto it = n->children.find(level, level_hash(), level_equal());
+            if (it == n->children.end()) {
+                it = n->children.emplace(std::string(level), std::unique_ptr<node>(new node)).first;
+            }
+            n = it->second.get();
+        }
+        return n->value;
+    }
+
+    static boost::optional<Value>* find_slot(node& root, boost::string_ref topic_filter) {
+        node* n = &root;
+        std::size_t pos = 0;
+        while (pos != npos) {
+            auto level = detail::next_level(topic_filter, pos);
+            if (level == "#") return pos == npos ? &n->multi_level : nullptr;
+            if (level == "+") {
+                n = n->plus.get();
+            }
+            else {
+                auto it = n->children.find(level, level_hash(), level_equal());
+                n = it == n->children.end() ? nullptr : it->second.get();
+            }
+            if (!n) return nullptr;
+        }
+        return &n->value;
+    }
+
+    // Remove the filter from pos under n, and remove the nodes that become empty.
+    static bool erase_from(node& n, boost::string_ref topic_filter, std::size_t pos) {
+        if (pos == npos) {
+            if (!n.value) return false;
+            n.value = boost::none;
+            return true;
+        }
+        auto level = detail::next_level(topic_filter, pos);
+        if (level == "#" && pos == npos) {
+            if (!n.multi_level) return false;
+            n.multi_level = boost::none;
+            return true;
+        }
+        if (level == "+") {
+            if (!n.plus || !erase_from(*n.plus, topic_filter, pos)) return false;
+            if (n.plus->empty()) n.plus.reset();
+            return true;
+        }
+        auto it = n.children.find(level, level_hash(), level_equal());
+        if (it == n.children.end() || !erase_from(*it->second, topic_filter, pos)) return false;
+        if (it->second->empty()) n.children.erase(it);
+        return true;
+    }
+
+    template <typename F>
+    static void match_from(node const& n, boost::string_ref topic_name, std::size_t pos, bool wildcard, F& f) {
+        if (pos == npos) {
+            if (n.value) f(*n.value);
+            // "a/#" matches "a" too.
+            if (n.multi_level) f(*n.multi_level);
+            return;
+        }
+        if (wildcard && n.multi_level) f(*n.multi_level);
+        auto level = detail::next_level(topic_name, pos);
+        auto it = n.children.find(level, level_hash(), level_equal());
+        if (it != n.children.end()) match_from(*it->second, topic_name, pos, true, f);
+        if (wildcard && n.plus) match_from(*n.plus, topic_name, pos, true, f);
+    }
+
+    node root_;
+    std::size_t size_;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_TOPIC_FILTER_MAP_HPP
@@ -0,0 +1,65 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_TOPIC_LEVEL_HPP)
+#define MQTT_TOPIC_LEVEL_HPP
+
+#include <cstddef>
+#include <string>
+
+#include <boost/utility/string_ref.hpp>
+#include <boost/functional/hash.hpp>
+
+#include <mqtt/exception.hpp>
+
+namespace mqtt {
+
+namespace detail {
+
+// The tries of topic_filter_map and retained_store are keyed by the '/' separated levels.
+// The hash and the equality accept boost::string_ref, so a level can be looked up without a copy.
+struct level_hash {
+    std::size_t operator()(boost::string_ref s) const {
+        return boost::hash_range(s.begin(), s.end());
+    }
+};
+
+struct level_equal {
+    bool operator()(boost::string_ref lhs, boost::string_ref rhs) const {
+        return lhs == rhs;
+    }
+};
+
+constexpr std::size_t const level_npos = static_cast<std::size_t>(-1);
+
+// Get the level that starts at pos, and advance pos to the next level, or level_npos after the last level.
+inline boost::string_ref next_level(boost::string_ref s, std::size_t& pos) {
+    auto begin = pos;
+    auto end = begin;
+    while (end != s.size() && s[end] != '/') ++end;
+    pos = end == s.size() ? level_npos : end + 1;
+    return s.substr(begin, end - begin);
+}
+
+// Throw topic_filter_error if the filter is invalid.
+inline void validate_topic_filter(boost::string_ref topic_filter) {
+    if (topic_filter.empty()) throw topic_filter_error(std::string(topic_filter));
+    std::size_t pos = 0;
+    while (pos != level_npos) {
+        auto level = next_level(topic_filter, pos);
+        if (level == "#" && pos == level_npos) return;
+        if (level == "+") continue;
+        if (level.find('#') != boost::string_ref::npos || level.find('+') != boost::string_ref::npos) {
+            throw topic_filter_error(std::string(topic_filter));
+        }
+    }
+}
+
+} // namespace detail
+
+} // namespace mqtt
+
+#endif // MQTT_TOPIC_LEVEL_HPP
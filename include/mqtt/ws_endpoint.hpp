@@ -11,6 +11,17 @@
 #include <beast/websocket/ssl.hpp>
 #endif // !defined(MQTT_NO_TLS)
 
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include <boost/optional.hpp>
+#include <boost/asio/detail/bind_handler.hpp>
+#include <boost/asio/detail/handler_alloc_helpers.hpp>
+#include <boost/asio/detail/handler_cont_helpers.hpp>
+#include <boost/asio/detail/handler_invoke_helpers.hpp>
+
 #include <beast/websocket.hpp>
 
 #include <mqtt/utility.hpp>
@@ -19,6 +30,56 @@ namespace mqtt {
 
 namespace as = boost::asio;
 
+/**
+ * @brief permessage-deflate (RFC 7692) options of the WebSocket transport.
+ * The window bits are clamped to 9..15 because zlib doesn't support 8.
+ */
+struct permessage_deflate_options {
+    permessage_deflate_options(
+        int server_max_window_bits = 15,
+        int client_max_window_bits = 15,
+        bool server_no_context_takeover = false,
+        bool client_no_context_takeover = false,
+        int level = 8,
+        int mem_level = 4)
+        :server_max_window_bits(server_max_window_bits),
+         client_max_window_bits(client_max_window_bits),
+         server_no_context_takeover(server_no_context_takeover),
+         client_no_context_takeover(client_no_context_takeover),
+         level(level),
+         mem_level(mem_level) {}
+
+    /**
+     * @brief The maximum LZ77 window bits of the server side compressor to offer or accept.
+     */
+    int server_max_window_bits;
+
+    /**
+     * @brief The maximum LZ77 window bits of the client side compressor to offer or accept.
+     */
+    int client_max_window_bits;
+
+    /**
+     * @brief The server resets the compression context for each message.
+     */
+    bool server_no_context_takeover;
+
+    /**
+     * @brief The client resets the compression context for each message.
+     */
+    bool client_no_context_takeover;
+
+    /**
+     * @brief zlib compression level (0..9)
+     */
+    int level;
+
+    /**
+     * @brief zlib memory level (1..9)
+     */
+    int mem_level;
+};
+
 template <typename Socket>
 class ws_endpoint {
 public:
@@ -58,10 +119,38 @@ public:
         ws_.set_option(std::forward<T>(t));
     }
 
+    /**
+     * @brief Enable permessage-deflate.
+     *        It has to be called before the handshake. The role decides the side that is enabled:
+     *        async_handshake() offers the extension as a client, and async_accept() accepts it
+     *        as a server if the peer offers it.
+     *        If it is negotiated, all messages are compressed.
+     * @param opts options
+     */
+    void enable_permessage_deflate(permessage_deflate_options const& opts) {
+        auto window_bits = [](int bits) { return std::min(std::max(bits, 9), 15); };
+        beast::websocket::permessage_deflate pmd;
+        pmd.server_max_window_bits = window_bits(opts.server_max_window_bits);
+        pmd.client_max_window_bits = window_bits(opts.client_max_window_bits);
+        pmd.server_no_context_takeover = opts.server_no_context_takeover;
+        pmd.client_no_context_takeover = opts.client_no_context_takeover;
+        pmd.compLevel = opts.level;
+        pmd.memLevel = opts.mem_level;
+        pmd_ = pmd;
+    }
+
+    template <typename AcceptHandler>
+    void async_accept(
+        AcceptHandler&& handler) {
+        apply_permessage_deflate(false);
+        ws_.async_accept(std::forward<AcceptHandler>(handler));
+    }
+
     template <typename ConstBufferSequence, typename AcceptHandler>
     void async_accept(
         ConstBufferSequence const& buffers,
         AcceptHandler&& handler) {
+        apply_permessage_deflate(false);
         ws_.async_accept(buffers, std::forward<AcceptHandler>(handler));
     }
 
@@ -70,6 +159,7 @@ public:
         boost::string_ref const& host,
         boost::string_ref const& resource,
         HandshakeHandler&& h) {
+        apply_permessage_deflate(true);
         ws_.async_handshake(host, resource, std::forward<HandshakeHandler>(h));
     }
 
@@ -78,58 +168,64 @@ public:
         MutableBufferSequence const& buffers,
         ReadHandler&& handler) {
         auto req_size = as::buffer_size(buffers);
-
-        using beast_read_handler_t =
-            std::function<void(boost::system::error_code const& ec, std::shared_ptr<void>)>;
-
-        std::shared_ptr<beast_read_handler_t> beast_read_handler;
         if (req_size <= sb_.size()) {
             as::buffer_copy(buffers, sb_.data(), req_size);
             sb_.consume(req_size);
-            handler(boost::system::errc::make_error_code(boost::system::errc::success), req_size);
+            post_read_completion(std::forward<ReadHandler>(handler), req_size);
             return;
         }
+        ws_.async_read(
+            op_,
+            sb_,
+            read_op<MutableBufferSequence, typename std::decay<ReadHandler>::type>(
+                *this, buffers, req_size, std::forward<ReadHandler>(handler)));
+    }
 
-        beast_read_handler.reset(
-            new beast_read_handler_t(
-                [this, req_size, buffers, MQTT_CAPTURE_FORWARD(ReadHandler, handler)]
-                (boost::system::error_code const& ec, std::shared_ptr<void> const& v) mutable {
-                    if (ec) {
-                        handler(ec, 0);
-                        return;
-                    }
-                    if (op_ != beast::websocket::opcode::binary) {
-                        sb_.consume(sb_.size());
-                        std::forward<ReadHandler>(handler)
-                            (boost::system::errc::make_error_code(boost::system::errc::bad_message), 0);
-                        return;
-                    }
-                    if (req_size > sb_.size()) {
-                        auto beast_read_handler = std::static_pointer_cast<beast_read_handler_t>(v);
-                        ws_.async_read(
-                            op_,
-                            sb_,
-                            [beast_read_handler]
-                            (boost::system::error_code const& ec) {
-                                (*beast_read_handler)(ec, beast_read_handler);
-                            }
-                        );
-                        return;
-                    }
-                    as::buffer_copy(buffers, sb_.data(), req_size);
-                    sb_.consume(req_size);
-                    handler(boost::system::errc::make_error_code(boost::system::errc::success), req_size);
-                }
-            )
-        );
+    template <typename MutableBufferSequence, typename ReadHandler>
+    void async_read_some(
+        MutableBufferSequence const& buffers,
+        ReadHandler&& handler) {
+        if (sb_.size() > 0) {
+            auto size = as::buffer_copy(buffers, sb_.data());
+            sb_.consume(size);
+            post_read_completion(std::forward<ReadHandler>(handler), size);
+            return;
+        }
         ws_.async_read(
             op_,
             sb_,
-            [beast_read_handler]
-            (boost::system::error_code const& ec) {
-                (*beast_read_handler)(ec, beast_read_handler);
-            }
-        );
+            read_op<MutableBufferSequence, typename std::decay<ReadHandler>::type>(
+                *this, buffers, 0, std::forward<ReadHandler>(handler)));
+    }
+
+    /**
+     * @brief Read a websocket message directly into buf.
+     *        The message is appended after offset, and buf grows if the message doesn't fit.
+     *        There is no intermediate buffer and no allocation except growing buf.
+     * @param buf receive buffer. It must not be touched until the handler is called.
+     * @param offset the position where the message is stored
+     * @param handler handler(boost::system::error_code const& ec, std::size_t bytes_transferred)
+     */
+    template <typename ReadHandler>
+    void async_read_into(
+        std::vector<char>& buf,
+        std::size_t offset,
+        ReadHandler&& handler) {
+        if (sb_.size() > 0) {
+            // Data that has been received by async_read() or async_read_some().
+            auto size = sb_.size();
+            if (buf.size() < offset + size) buf.resize(offset + size);
+            as::buffer_copy(as::buffer(&buf[offset], size), sb_.data());
+            sb_.consume(size);
+            post_read_completion(std::forward<ReadHandler>(handler), size);
+            return;
+        }
+        db_.reset(buf, offset);
+        ws_.async_read(
+            op_,
+            db_,
+            read_into_op<typename std::decay<ReadHandler>::type>(
+                *this, std::forward<ReadHandler>(handler)));
     }
 
     template <typename ConstBufferSequence>
@@ -154,9 +250,171 @@ public:
         ws_.async_write(buffers, std::forward<WriteHandler>(handler));
     }
 private:
+    void apply_permessage_deflate(bool client) {
+        if (!pmd_) return;
+        auto pmd = *pmd_;
+        pmd.client_enable = client;
+        pmd.server_enable = !client;
+        ws_.set_option(pmd);
+    }
+
+    // Complete a read that has been served from sb_. The handler is posted, so it is never
+    // called from the initiating function, and the caller's read loop doesn't recurse.
+    template <typename ReadHandler>
+    void post_read_completion(ReadHandler&& handler, std::size_t size) {
+        ws_.get_io_service().post(
+            as::detail::bind_handler(
+                std::forward<ReadHandler>(handler),
+                boost::system::errc::make_error_code(boost::system::errc::success),
+                size));
+    }
+
+    // DynamicBuffer that appends to the receive buffer of the endpoint.
+    class vector_buffer {
+    public:
+        using const_buffers_type = as::const_buffers_1;
+        using mutable_buffers_type = as::mutable_buffers_1;
+
+        vector_buffer()
+            :buf_(nullptr),
+             begin_(0),
+             end_(0) {}
+
+        void reset(std::vector<char>& buf, std::size_t offset) {
+            buf_ = &buf;
+            begin_ = offset;
+            end_ = offset;
+        }
+
+        std::size_t size() const {
+            return end_ - begin_;
+        }
+
+        std::size_t max_size() const {
+            return buf_->max_size() - begin_;
+        }
+
+        std::size_t capacity() const {
+            return buf_->size() - begin_;
+        }
+
+        const_buffers_type data() const {
+            return const_buffers_type(buf_->data() + begin_, size());
+        }
+
+        mutable_buffers_type prepare(std::size_t n) {
+            if (n > max_size() - size()) throw std::length_error("mqtt::ws_endpoint buffer overflow");
+            if (buf_->size() < end_ + n) buf_->resize(end_ + n);
+            return mutable_buffers_type(buf_->data() + end_, n);
+        }
+
+        void commit(std::size_t n) {
+            end_ += std::min(n, buf_->size() - end_);
+        }
+
+        void consume(std::size_t n) {
+            begin_ += std::min(n, size());
+        }
+
+    private:
+        std::vector<char>* buf_;
+        std::size_t begin_;
+        std::size_t end_;
+    };
+
+    // The operations forward the handler hooks so that the allocation and
+    // the invocation (e.g. strand) of the user's handler are applied.
+    template <typename Handler>
+    struct op_base {
+        explicit op_base(Handler&& h)
+            :handler(std::move(h)) {}
+        explicit op_base(Handler const& h)
+            :handler(h) {}
+
+        friend void* asio_handler_allocate(std::size_t size, op_base* op) {
+            return boost_asio_handler_alloc_helpers::allocate(size, op->handler);
+        }
+        friend void asio_handler_deallocate(void* p, std::size_t size, op_base* op) {
+            boost_asio_handler_alloc_helpers::deallocate(p, size, op->handler);
+        }
+        friend bool asio_handler_is_continuation(op_base* op) {
+            return boost_asio_handler_cont_helpers::is_continuation(op->handler);
+        }
+        template <typename Function>
+        friend void asio_handler_invoke(Function&& f, op_base* op) {
+            boost_asio_handler_invoke_helpers::invoke(f, op->handler);
+        }
+
+        Handler handler;
+    };
+
+    // Reads messages into sb_ until req_size bytes are available,
+    // then copies them to buffers. If req_size is 0, copies what has been read.
+    template <typename MutableBufferSequence, typename Handler>
+    struct read_op : op_base<Handler> {
+        template <typename H>
+        read_op(ws_endpoint& ep, MutableBufferSequence const& buffers, std::size_t req_size, H&& h)
+            :op_base<Handler>(std::forward<H>(h)),
+             ep(ep),
+             buffers(buffers),
+             req_size(req_size) {}
+
+        void operator()(boost::system::error_code const& ec) {
+            if (ec) {
+                this->handler(ec, 0);
+                return;
+            }
+            if (ep.op_ != beast::websocket::opcode::binary) {
+                ep.sb_.consume(ep.sb_.size());
+                this->handler(boost::system::errc::make_error_code(boost::system::errc::bad_message), 0);
+                return;
+            }
+            if (req_size > ep.sb_.size()) {
+                auto& ws = ep.ws_;
+                auto& op = ep.op_;
+                auto& sb = ep.sb_;
+                ws.async_read(op, sb, std::move(*this));
+                return;
+            }
+            auto size = req_size == 0
+                ? as::buffer_copy(buffers, ep.sb_.data())
+                : as::buffer_copy(buffers, ep.sb_.data(), req_size);
+            ep.sb_.consume(size);
+            this->handler(boost::system::errc::make_error_code(boost::system::errc::success), size);
+        }
+
+        ws_endpoint& ep;
+        MutableBufferSequence buffers;
+        std::size_t req_size;
+    };
+
+    template <typename Handler>
+    struct read_into_op : op_base<Handler> {
+        template <typename H>
+        read_into_op(ws_endpoint& ep, H&& h)
+            :op_base<Handler>(std::forward<H>(h)),
+             ep(ep) {}
+
+        void operator()(boost::system::error_code const& ec) {
+            if (ec) {
+                this->handler(ec, 0);
+                return;
+            }
+            if (ep.op_ != beast::websocket::opcode::binary) {
+                this->handler(boost::system::errc::make_error_code(boost::system::errc::bad_message), 0);
+                return;
+            }
+            this->handler(boost::system::errc::make_error_code(boost::system::errc::success), ep.db_.size());
+        }
+
+        ws_endpoint& ep;
+    };
+
     beast::websocket::stream<Socket> ws_;
     beast::websocket::opcode op_;
     beast::streambuf sb_;
+    vector_buffer db_;
+    boost::optional<beast::websocket::permessage_deflate> pmd_;
     as::io_service::strand strand_;
 };
 
@@ -0,0 +1,366 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include "loopback.hpp"
+#include <mqtt/codec.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_codec)
+
+namespace {
+
+namespace codec = mqtt::codec;
+
+// Records the decoded packets as strings.
+struct recorder {
+    bool on_connect(codec::connect_packet const& p) {
+        events.push_back(
+            "connect " + std::string(p.client_id) +
+            " " + (p.user_name ? std::string(*p.user_name) : "-") +
+            " " + (p.password ? std::string(*p.password) : "-") +
+            " " + (p.will_flag ? std::string(p.will_topic) + ":" + std::string(p.will_message) + ":" + std::to_string(p.will_qos) : "-") +
+            " " + std::to_string(p.keep_alive) +
+            (p.clean_session ? " clean" : ""));
+        return true;
+    }
+    bool on_connack(codec::connack_packet const& p) {
+        events.push_back("connack " + std::to_string(p.session_present) + " " + std::to_string(p.return_code));
+        return true;
+    }
+    bool on_publish(codec::publish_packet const& p) {
+        events.push_back(
+            "publish " + std::to_string(mqtt::publish::get_qos(p.fixed_header)) +
+            " " + (p.packet_id ? std::to_string(*p.packet_id) : "-") +
+            " " + std::string(p.topic_name) + " " + std::string(p.contents));
+        return cont;
+    }
+    bool on_puback(std::uint16_t packet_id) { return id("puback", packet_id); }
+    bool on_pubrec(std::uint16_t packet_id) { return id("pubrec", packet_id); }
+    bool on_pubrel(std::uint16_t packet_id) { return id("pubrel", packet_id); }
+    bool on_pubcomp(std::uint16_t packet_id) { return id("pubcomp", packet_id); }
+    bool on_unsuback(std::uint16_t packet_id) { return id("unsuback", packet_id); }
+    bool on_subscribe(codec::subscribe_packet const& p) {
+        std::string s = "subscribe " + std::to_string(p.packet_id);
+        p.for_each([&](boost::string_ref f, std::uint8_t qos) { s += " " + std::string(f) + ":" + std::to_string(qos); });
+        events.push_back(s);
+        return true;
+    }
+    bool on_suback(codec::suback_packet const& p) {
+        std::string s = "suback " + std::to_string(p.packet_id);
+        p.for_each([&](boost::optional<std::uint8_t> qos) { s += " " + (qos ? std::to_string(*qos) : "x"); });
+        events.push_back(s);
+        return true;
+    }
+    bool on_unsubscribe(codec::unsubscribe_packet const& p) {
+        std::string s = "unsubscribe " + std::to_string(p.packet_id);
+        p.for_each([&](boost::string_ref f) { s += " " + std::string(f); });
+        events.push_back(s);
+        return true;
+    }
+    bool on_pingreq() { events.push_back("pingreq"); return true; }
+    bool on_pingresp() { events.push_back("pingresp"); return true; }
+    bool on_disconnect() { events.push_back("disconnect"); return true; }
+    void on_error(boost::system::error_code const& ec) {
+        events.push_back("error " + ec.message());
+    }
+
+    bool id(char const* name, std::uint16_t packet_id) {
+        events.push_back(std::string(name) + " " + std::to_string(packet_id));
+        return true;
+    }
+
+    std::vector<std::string> events;
+    bool cont = true;
+};
+
+std::string packet(std::uint8_t fixed_header, std::string const& body) {
+    std::string ret(codec::max_fixed_header_size, '\0');
+    ret.resize(codec::encode_fixed_header(&ret[0], fixed_header, body.size()));
+    return ret + body;
+}
+
+std::string encoded(std::string const& s) {
+    return std::string(1, static_cast<char>(s.size() >> 8)) + static_cast<char>(s.size() & 0xff) + s;
+}
+
+// All kinds of packets that the encoders and the test write.
+std::string all_packets() {
+    std::string bytes;
+    char buf[16];
+    bytes += packet(
+        mqtt::make_fixed_header(mqtt::control_packet_type::connect, 0),
+        encoded("MQTT") + '\x04' + '\xee' + '\x00' + '\x3c' +
+        encoded("cid") + encoded("wt") + encoded("wm") + encoded("user") + encoded("pass"));
+    bytes.append(buf, codec::encode_connack(buf, true, 0));
+    std::string header(codec::publish_header_size(6, mqtt::qos::at_least_once, 8), '\0');
+    BOOST_TEST(codec::encode_publish_header(&header[0], "topic1", mqtt::qos::at_least_once, false, false, 0x1234, 8) == header.size());
+    bytes += header + "contents";
+    header.resize(codec::publish_header_size(6, mqtt::qos::at_most_once, 0));
+    BOOST_TEST(codec::encode_publish_header(&header[0], "topic2", mqtt::qos::at_most_once, true, false, 0, 0) == header.size());
+    bytes += header;
+    bytes.append(buf, codec::encode_packet_id_packet(buf, mqtt::control_packet_type::puback, 1));
+    bytes.append(buf, codec::encode_packet_id_packet(buf, mqtt::control_packet_type::pubrec, 2));
+    bytes.append(buf, codec::encode_packet_id_packet(buf, mqtt::control_packet_type::pubrel, 3));
+    bytes.append(buf, codec::encode_packet_id_packet(buf, mqtt::control_packet_type::pubcomp, 4));
+    bytes += packet(
+        mqtt::make_fixed_header(mqtt::control_packet_type::subscribe, 0b0010),
+        std::string("\x00\x05", 2) + encoded("a/+") + '\x01' + encoded("b/#") + '\x02');
+    bytes += packet(
+        mqtt::make_fixed_header(mqtt::control_packet_type::suback, 0),
+        std::string("\x00\x05", 2) + '\x01' + '\x80');
+    bytes += packet(
+        mqtt::make_fixed_header(mqtt::control_packet_type::unsubscribe, 0b0010),
+        std::string("\x00\x06", 2) + encoded("a/+") + encoded("b/#"));
+    bytes.append(buf, codec::encode_packet_id_packet(buf, mqtt::control_packet_type::unsuback, 6));
+    bytes.append(buf, codec::encode_empty_packet(buf, mqtt::control_packet_type::pingreq));
+    bytes.append(buf, codec::encode_empty_packet(buf, mqtt::control_packet_type::pingresp));
+    bytes.append(buf, codec::encode_empty_packet(buf, mqtt::control_packet_type::disconnect));
+    return bytes;
+}
+
+std::vector<std::string> const all_events {
+    "connect cid user pass wt:wm:1 60 clean",
+    "connack 1 0",
+    "publish 1 4660 topic1 contents",
+    "publish 0 - topic2 ",
+    "puback 1",
+    "pubrec 2",
+    "pubrel 3",
+    "pubcomp 4",
+    "subscribe 5 a/+:1 b/#:2",
+    "suback 5 1 x",
+    "unsubscribe 6 a/+ b/#",
+    "unsuback 6",
+    "pingreq",
+    "pingresp",
+    "disconnect",
+};
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( decode_all ) {
+    auto bytes = all_packets();
+    codec::decoder d;
+    recorder r;
+    BOOST_TEST(d.feed(bytes.data(), bytes.size(), r) == bytes.size());
+    BOOST_TEST(d.buffered() == 0U);
+    BOOST_TEST(r.events == all_events);
+}
+
+BOOST_AUTO_TEST_CASE( feed_incrementally ) {
+    auto bytes = all_packets();
+    for (std::size_t chunk : { 1, 2, 3, 7, 100 }) {
+        codec::decoder d;
+        recorder r;
+        for (std::size_t pos = 0; pos < bytes.size(); pos += chunk) {
+            std::size_t n = std::min(chunk, bytes.size() - pos);
+            BOOST_TEST(d.feed(bytes.data() + pos, n, r) == n);
+        }
+        BOOST_TEST(d.buffered() == 0U);
+        BOOST_TEST(r.events == all_events);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( stop ) {
+    auto bytes = all_packets();
+    codec::decoder d;
+    recorder r;
+    r.cont = false;
+    auto consumed = d.feed(bytes.data(), bytes.size(), r);
+    BOOST_TEST(r.events.size() == 3U);
+    r.cont = true;
+    BOOST_TEST(d.feed(bytes.data() + consumed, bytes.size() - consumed, r) == bytes.size() - consumed);
+    BOOST_TEST(r.events == all_events);
+}
+
+BOOST_AUTO_TEST_CASE( frame ) {
+    std::string bytes;
+    std::string body(200, 'x');
+    bytes = packet(mqtt::make_fixed_header(mqtt::control_packet_type::publish, 0), body);
+    BOOST_TEST(bytes.size() == 203U);
+    codec::frame f;
+    BOOST_TEST(!codec::parse_frame(bytes.data(), 1, f));
+    BOOST_TEST(f.size == 0U);
+    BOOST_TEST(!codec::parse_frame(bytes.data(), 2, f));
+    BOOST_TEST(f.size == 0U);
+    BOOST_TEST(!codec::parse_frame(bytes.data(), 3, f));
+    BOOST_TEST(f.size == 203U);
+    BOOST_TEST(codec::parse_frame(bytes.data(), bytes.size(), f));
+    BOOST_TEST(f.body == body);
+
+    char buf[8];
+    BOOST_TEST(codec::encode_fixed_header(buf, 0, codec::max_remaining_length) == 5U);
+    BOOST_CHECK_THROW(codec::encode_fixed_header(buf, 0, codec::max_remaining_length + 1), mqtt::remaining_length_error);
+    std::string too_long("\x30\xff\xff\xff\xff\x01", 6);
+    BOOST_CHECK_THROW(codec::parse_frame(too_long.data(), too_long.size(), f), mqtt::remaining_length_error);
+}
+
+BOOST_AUTO_TEST_CASE( malformed ) {
+    auto message_size = boost::system::errc::make_error_code(boost::system::errc::message_size).message();
+    auto protocol_error = boost::system::errc::make_error_code(boost::system::errc::protocol_error).message();
+    std::string bytes;
+    // The will message is longer than the packet.
+    bytes = packet(
+        mqtt::make_fixed_header(mqtt::control_packet_type::connect, 0),
+        encoded("MQTT") + '\x04' + '\x06' + '\x00' + '\x3c' + encoded("cid") + encoded("wt") + std::string("\x00\x05", 2) + "wm");
+    bytes += packet(mqtt::make_fixed_header(mqtt::control_packet_type::connect, 0), encoded("MQIsdp") + '\x03' + '\x02' + "xx");
+    bytes += packet(mqtt::make_fixed_header(mqtt::control_packet_type::publish, 0b0010), encoded("t"));
+    bytes += packet(mqtt::make_fixed_header(mqtt::control_packet_type::puback, 0), "\x01");
+    // The requested QoS is missing.
+    bytes += packet(mqtt::make_fixed_header(mqtt::control_packet_type::subscribe, 0b0010), std::string("\x00\x01", 2) + encoded("a"));
+    bytes += packet(mqtt::make_fixed_header(mqtt::control_packet_type::pingreq, 0), "x");
+    bytes += packet(0, "");
+    for (std::size_t i = 0; i != 7; ++i) {
+        codec::frame f;
+        BOOST_TEST(codec::parse_frame(bytes.data(), bytes.size(), f));
+        recorder r;
+        BOOST_TEST(!codec::decode(f.fixed_header, f.body, r));
+        BOOST_TEST(r.events.size() == 1U);
+        BOOST_TEST(r.events.front() == "error " + (i == 1 || i == 6 ? protocol_error : message_size));
+        bytes.erase(0, f.size);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( large_remaining_length ) {
+    auto message_size = boost::system::errc::make_error_code(boost::system::errc::message_size).message();
+    // The remaining length is 256MB, but the body never arrives.
+    std::string header("\x30\xff\xff\xff\x7f", 5);
+    {
+        // Only the received bytes are buffered.
+        codec::decoder d;
+        recorder r;
+        BOOST_TEST(d.feed(header.data(), header.size(), r) == 5U);
+        BOOST_TEST(d.feed("abc", 3, r) == 3U);
+        BOOST_TEST(d.buffered() == 8U);
+        BOOST_TEST(r.events.empty());
+    }
+    {
+        codec::decoder d(1024);
+        recorder r;
+        BOOST_TEST(d.feed(header.data(), header.size(), r) == 0U);
+        BOOST_TEST(d.buffered() == 0U);
+        BOOST_TEST(r.events == std::vector<std::string>{ "error " + message_size });
+    }
+    {
+        // The header is split.
+        codec::decoder d(1024);
+        recorder r;
+        BOOST_TEST(d.feed(header.data(), 2, r) == 2U);
+        BOOST_TEST(r.events.empty());
+        BOOST_TEST(d.feed(header.data() + 2, 3, r) == 3U);
+        BOOST_TEST(d.buffered() == 0U);
+        BOOST_TEST(r.events == std::vector<std::string>{ "error " + message_size });
+    }
+    {
+        // The packets up to the maximum size are decoded.
+        auto bytes = all_packets();
+        codec::decoder d(bytes.size());
+        recorder r;
+        BOOST_TEST(d.feed(bytes.data(), bytes.size(), r) == bytes.size());
+        BOOST_TEST(r.events == all_events);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( endpoint_will ) {
+    // endpoint decodes CONNECT with the codec.
+    boost::asio::io_service ios;
+    loopback<> lb(ios);
+    boost::optional<mqtt::will> received;
+    lb.server->set_connect_handler(
+        [&]
+        (std::string const& client_id,
+         boost::optional<std::string> const& user_name,
+         boost::optional<std::string> const& password,
+         boost::optional<mqtt::will> w,
+         bool,
+         std::uint16_t) {
+            BOOST_TEST(client_id == "cid1");
+            BOOST_TEST(!user_name);
+            BOOST_TEST(!password);
+            received = w;
+            lb.server->connack(false, mqtt::connect_return_code::accepted);
+            return true;
+        });
+    lb.client->set_client_id("cid1");
+    lb.client->set_will(mqtt::will("topic1", "a longer will message", true, mqtt::qos::at_least_once));
+    lb.client->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            lb.client->disconnect();
+            return true;
+        });
+    lb.start();
+    ios.run();
+    BOOST_TEST(static_cast<bool>(received));
+    BOOST_TEST(received->topic() == "topic1");
+    BOOST_TEST(received->message() == "a longer will message");
+    BOOST_TEST(received->retain());
+    BOOST_TEST(received->qos() == mqtt::qos::at_least_once);
+}
+
+BOOST_AUTO_TEST_CASE( endpoint_encode ) {
+    // endpoint encodes the packets that have no variable length part with the codec.
+    namespace as = boost::asio;
+    as::io_service ios;
+    as::ip::tcp::acceptor ac(ios, as::ip::tcp::endpoint(as::ip::address_v4::loopback(), 0));
+    as::ip::tcp::socket raw(ios);
+    raw.connect(ac.local_endpoint());
+    std::unique_ptr<as::ip::tcp::socket> ss(new as::ip::tcp::socket(ios));
+    ac.accept(*ss);
+    auto server = std::make_shared<mqtt::endpoint<as::ip::tcp::socket, as::io_service::strand>>(std::move(ss));
+    server->set_connect_handler(
+        [&]
+        (std::string const&,
+         boost::optional<std::string> const&,
+         boost::optional<std::string> const&,
+         boost::optional<mqtt::will>,
+         bool,
+         std::uint16_t) {
+            server->connack(true, mqtt::connect_return_code::not_authorized);
+            server->puback(1);
+            server->pubrec(2);
+            server->pubrel(3);
+            server->pubcomp(4);
+            server->unsuback(6);
+            server->pingreq();
+            server->pingresp();
+            server->disconnect();
+            server->force_disconnect();
+            return true;
+        });
+    server->start_session();
+    as::write(
+        raw,
+        as::buffer(
+            packet(
+                mqtt::make_fixed_header(mqtt::control_packet_type::connect, 0),
+                encoded("MQTT") + '\x04' + '\x02' + '\x00' + '\x00' + encoded("cid"))));
+    std::string received;
+    std::array<char, 64> buf;
+    std::function<void(boost::system::error_code const&, std::size_t)> on_read =
+        [&]
+        (boost::system::error_code const& ec, std::size_t size) {
+            received.append(buf.data(), size);
+            if (!ec) raw.async_read_some(as::buffer(buf), on_read);
+        };
+    raw.async_read_some(as::buffer(buf), on_read);
+    ios.run();
+
+    std::string expected;
+    char b[16];
+    expected.append(b, codec::encode_connack(b, true, mqtt::connect_return_code::not_authorized));
+    expected.append(b, codec::encode_packet_id_packet(b, mqtt::control_packet_type::puback, 1));
+    expected.append(b, codec::encode_packet_id_packet(b, mqtt::control_packet_type::pubrec, 2));
+    expected.append(b, codec::encode_packet_id_packet(b, mqtt::control_packet_type::pubrel, 3));
+    expected.append(b, codec::encode_packet_id_packet(b, mqtt::control_packet_type::pubcomp, 4));
+    expected.append(b, codec::encode_packet_id_packet(b, mqtt::control_packet_type::unsuback, 6));
+    expected.append(b, codec::encode_empty_packet(b, mqtt::control_packet_type::pingreq));
+    expected.append(b, codec::encode_empty_packet(b, mqtt::control_packet_type::pingresp));
+    expected.append(b, codec::encode_empty_packet(b, mqtt::control_packet_type::disconnect));
+    BOOST_TEST(received == expected);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,116 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include "loopback.hpp"
+#include <mqtt/store.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_flat_store)
+
+namespace {
+
+struct elem {
+    elem(std::uint16_t id, std::uint8_t type, int v)
+        :id_(id), type_(type), v_(v) {}
+    std::uint16_t packet_id() const { return id_; }
+    std::uint8_t expected_control_packet_type() const { return type_; }
+    std::uint16_t id_;
+    std::uint8_t type_;
+    int v_;
+};
+
+template <typename Store>
+std::vector<int> values(Store const& s) {
+    std::vector<int> ret;
+    s.for_each([&](elem const& e) { ret.push_back(e.v_); });
+    return ret;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( insertion_order ) {
+    mqtt::flat_store<elem> s;
+    BOOST_TEST(values(s).empty());
+    s.emplace(3, mqtt::control_packet_type::puback, 1);
+    s.emplace(1, mqtt::control_packet_type::pubrec, 2);
+    s.emplace(0xffff, mqtt::control_packet_type::puback, 3);
+    s.emplace(2, mqtt::control_packet_type::pubcomp, 4);
+    BOOST_TEST((values(s) == std::vector<int>{ 1, 2, 3, 4 }));
+
+    // Different expected type is not erased.
+    s.erase(1, mqtt::control_packet_type::puback);
+    BOOST_TEST((values(s) == std::vector<int>{ 1, 2, 3, 4 }));
+
+    s.erase(1, mqtt::control_packet_type::pubrec);
+    BOOST_TEST((values(s) == std::vector<int>{ 1, 3, 4 }));
+
+    // Replaced element moves to the back.
+    s.emplace(3, mqtt::control_packet_type::pubcomp, 5);
+    BOOST_TEST((values(s) == std::vector<int>{ 3, 4, 5 }));
+
+    s.erase(0xffff);
+    BOOST_TEST((values(s) == std::vector<int>{ 4, 5 }));
+
+    s.clear();
+    BOOST_TEST(values(s).empty());
+    s.emplace(10, mqtt::control_packet_type::puback, 6);
+    BOOST_TEST((values(s) == std::vector<int>{ 6 }));
+}
+
+BOOST_AUTO_TEST_CASE( update_each ) {
+    mqtt::flat_store<elem> s;
+    for (int i = 1; i <= 5; ++i) {
+        s.emplace(static_cast<std::uint16_t>(i), mqtt::control_packet_type::puback, i);
+    }
+    s.update_each(
+        [](elem& e) {
+            e.v_ *= 10;
+            return e.packet_id() % 2 == 0;
+        });
+    BOOST_TEST((values(s) == std::vector<int>{ 20, 40 }));
+}
+
+BOOST_AUTO_TEST_CASE( endpoint_qos1_qos2 ) {
+    using ep_t = mqtt::endpoint<
+        boost::asio::ip::tcp::socket,
+        boost::asio::io_service::strand,
+        std::mutex,
+        std::lock_guard,
+        mqtt::flat_store>;
+    boost::asio::io_service ios;
+    loopback<ep_t> lb(ios);
+    std::size_t const num = 2000;
+    std::size_t acked = 0;
+    lb.client->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            for (std::size_t i = 0; i != num; ++i) {
+                lb.client->async_publish(
+                    "topic1",
+                    "contents",
+                    i % 2 ? mqtt::qos::at_least_once : mqtt::qos::exactly_once);
+            }
+            return true;
+        });
+    auto acked_handler =
+        [&]
+        (std::uint16_t) {
+            if (++acked == num) {
+                std::size_t stored = 0;
+                lb.client->for_each_store([&](char const*, std::size_t) { ++stored; });
+                BOOST_TEST(stored == 0U);
+                lb.client->disconnect();
+            }
+            return true;
+        };
+    lb.client->set_puback_handler(acked_handler);
+    lb.client->set_pubcomp_handler(acked_handler);
+    lb.start();
+    ios.run();
+    BOOST_TEST(acked == num);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
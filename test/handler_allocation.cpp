@@ -0,0 +1,201 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include "test_broker.hpp"
+
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <string>
+
+#include <mqtt/handler_allocator.hpp>
+
+namespace {
+
+std::atomic<bool> counting(false);
+std::atomic<std::size_t> allocations(0);
+
+} // anonymous namespace
+
+// Count the allocations of this test binary while counting is true.
+void* operator new(std::size_t size) {
+    if (counting) ++allocations;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+BOOST_AUTO_TEST_SUITE(test_handler_allocation)
+
+BOOST_AUTO_TEST_CASE( handler_memory ) {
+    mqtt::handler_memory m;
+    void* p1 = m.allocate(100);
+    // The block is in use, so operator new is used.
+    void* p2 = m.allocate(100);
+    BOOST_TEST(p1 != p2);
+    m.deallocate(p2);
+    m.deallocate(p1);
+    // The block is recycled.
+    BOOST_TEST(m.allocate(200) == p1);
+    m.deallocate(p1);
+    // Too large for the block.
+    void* p3 = m.allocate(2048);
+    BOOST_TEST(p3 != p1);
+    m.deallocate(p3);
+}
+
+namespace {
+
+std::string connect_packet() {
+    // CONNECT clean session, keep alive 0, client id "c"
+    return std::string("\x10\x0d\x00\x04MQTT\x04\x02\x00\x00\x00\x01" "c", 15);
+}
+
+std::string publish_packet() {
+    // PUBLISH QoS0 topic "t" payload "x"
+    return std::string("\x30\x04\x00\x01tx", 6);
+}
+
+} // anonymous namespace
+
+// Each PUBLISH is written when the previous one is received, so every message is
+// one read, one strand dispatch and one handler call on the receiving endpoint.
+BOOST_AUTO_TEST_CASE( receive_steady_state ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    boost::asio::ip::tcp::socket raw(ios);
+    raw.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), b.port()));
+
+    std::size_t const warmup = 100;
+    std::size_t const measured = 1000;
+    std::string const pub = publish_packet();
+    std::size_t received = 0;
+    std::size_t measured_allocations = 0;
+
+    b.on_accept =
+        [&]
+        (std::shared_ptr<server_endpoint> const& ep, std::size_t) {
+            ep->set_publish_ref_handler(
+                [&, ep]
+                (std::uint8_t,
+                 boost::optional<std::uint16_t>,
+                 boost::string_ref,
+                 boost::string_ref contents) {
+                    BOOST_CHECK(contents == "x");
+                    ++received;
+                    if (received == warmup) {
+                        allocations = 0;
+                        counting = true;
+                    }
+                    if (received == warmup + measured) {
+                        counting = false;
+                        measured_allocations = allocations;
+                        ep->force_disconnect();
+                        b.close();
+                        raw.close();
+                        return true;
+                    }
+                    boost::asio::write(raw, boost::asio::buffer(pub));
+                    return true;
+                });
+            ep->set_connect_handler(
+                [&, ep]
+                (std::string const&,
+                 boost::optional<std::string> const&,
+                 boost::optional<std::string> const&,
+                 boost::optional<mqtt::will>,
+                 bool,
+                 std::uint16_t) {
+                    ep->connack(false, mqtt::connect_return_code::accepted);
+                    boost::asio::write(raw, boost::asio::buffer(pub));
+                    return true;
+                });
+        };
+    boost::asio::write(raw, boost::asio::buffer(connect_packet()));
+    ios.run();
+    BOOST_TEST(received == warmup + measured);
+    BOOST_TEST(measured_allocations == 0U);
+}
+
+namespace {
+
+// Publishes the next message when the previous one is written.
+struct sender {
+    std::shared_ptr<server_endpoint> ep;
+    std::shared_ptr<std::string const> contents;
+    std::size_t sent;
+    std::size_t warmup;
+    std::size_t measured;
+    std::size_t measured_allocations;
+
+    void send() {
+        if (sent == warmup) {
+            allocations = 0;
+            counting = true;
+        }
+        if (sent == warmup + measured) {
+            counting = false;
+            measured_allocations = allocations;
+            ep->force_disconnect();
+            return;
+        }
+        ++sent;
+        auto self = this;
+        ep->async_publish_at_most_once(
+            "t",
+            contents,
+            false,
+            [self](boost::system::error_code const& ec) {
+                if (ec) return;
+                self->send();
+            });
+    }
+};
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( send_steady_state ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    boost::asio::ip::tcp::socket raw(ios);
+    raw.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), b.port()));
+
+    sender s { nullptr, std::make_shared<std::string const>("x"), 0, 100, 1000, 0 };
+    b.on_accept =
+        [&]
+        (std::shared_ptr<server_endpoint> const& ep, std::size_t) {
+            s.ep = ep;
+            ep->set_connect_handler(
+                [&]
+                (std::string const&,
+                 boost::optional<std::string> const&,
+                 boost::optional<std::string> const&,
+                 boost::optional<mqtt::will>,
+                 bool,
+                 std::uint16_t) {
+                    s.ep->connack(false, mqtt::connect_return_code::accepted);
+                    b.close();
+                    s.send();
+                    return true;
+                });
+        };
+    boost::asio::write(raw, boost::asio::buffer(connect_packet()));
+    ios.run();
+    BOOST_TEST(s.sent == s.warmup + s.measured);
+    // Only the encoded packet is allocated. The node of the submit queue is reused.
+    // The write operation, the buffer sequence and the strand dispatch are not.
+    BOOST_TEST(s.measured_allocations == s.measured);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
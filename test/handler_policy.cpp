@@ -0,0 +1,136 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include <mqtt/client.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_handler_policy)
+
+namespace {
+
+struct received {
+    std::size_t connect = 0;
+    std::size_t publish = 0;
+    std::size_t pubrel = 0;
+    std::size_t disconnect = 0;
+    std::vector<std::string> topics;
+    std::vector<std::string> contents;
+};
+
+// Handlers are bound at compile time. Only the needed functions are defined.
+struct recording_handlers : mqtt::default_handlers {
+    template <typename Endpoint>
+    bool on_connect(Endpoint& ep,
+                    std::string const& client_id,
+                    boost::optional<std::string> const&,
+                    boost::optional<std::string> const&,
+                    boost::optional<mqtt::will>,
+                    bool,
+                    std::uint16_t) {
+        BOOST_CHECK(client_id == "cid1");
+        ++r->connect;
+        ep.connack(false, mqtt::connect_return_code::accepted);
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_publish(Endpoint&,
+                    std::uint8_t,
+                    boost::optional<std::uint16_t> const&,
+                    boost::string_ref topic_name,
+                    boost::string_ref contents) {
+        ++r->publish;
+        r->topics.emplace_back(topic_name.data(), topic_name.size());
+        r->contents.emplace_back(contents.data(), contents.size());
+        return true;
+    }
+
+    template <typename Endpoint>
+    bool on_pubrel(Endpoint&, std::uint16_t) {
+        ++r->pubrel;
+        return true;
+    }
+
+    template <typename Endpoint>
+    void on_disconnect(Endpoint& ep) {
+        ++r->disconnect;
+        ep.force_disconnect();
+    }
+
+    received* r = nullptr;
+};
+
+using policy_endpoint = mqtt::endpoint<
+    boost::asio::ip::tcp::socket,
+    boost::asio::io_service::strand,
+    std::mutex,
+    std::lock_guard,
+    mqtt::multi_index_store,
+    recording_handlers>;
+
+using function_endpoint = mqtt::endpoint<
+    boost::asio::ip::tcp::socket,
+    boost::asio::io_service::strand>;
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( smaller_than_function_handlers ) {
+    BOOST_TEST(sizeof(policy_endpoint) + 17 * sizeof(std::function<void()>) <= sizeof(function_endpoint) + sizeof(void*));
+}
+
+BOOST_AUTO_TEST_CASE( server_with_policy ) {
+    boost::asio::io_service ios;
+    boost::asio::ip::tcp::acceptor acceptor(
+        ios,
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    received r;
+    std::shared_ptr<policy_endpoint> server;
+    std::unique_ptr<boost::asio::ip::tcp::socket> s(new boost::asio::ip::tcp::socket(ios));
+    acceptor.async_accept(
+        *s,
+        [&]
+        (boost::system::error_code const& ec) {
+            BOOST_TEST(!ec);
+            server = std::make_shared<policy_endpoint>(std::move(s));
+            server->handlers().r = &r;
+            server->start_session();
+            acceptor.close();
+        });
+
+    auto c = mqtt::make_client(ios, "127.0.0.1", acceptor.local_endpoint().port());
+    c->set_client_id("cid1");
+    c->set_clean_session(true);
+    c->set_connack_handler(
+        [&c]
+        (bool sp, std::uint8_t connack_return_code) {
+            BOOST_TEST(sp == false);
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            c->publish_at_least_once("topic1", "contents1");
+            return true;
+        });
+    c->set_puback_handler(
+        [&c]
+        (std::uint16_t) {
+            c->publish_exactly_once("topic2", "contents2");
+            return true;
+        });
+    c->set_pubcomp_handler(
+        [&c]
+        (std::uint16_t) {
+            c->disconnect();
+            return true;
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(r.connect == 1U);
+    BOOST_TEST(r.publish == 2U);
+    BOOST_TEST(r.pubrel == 1U);
+    BOOST_TEST(r.disconnect == 1U);
+    BOOST_TEST(r.topics == (std::vector<std::string>{ "topic1", "topic2" }));
+    BOOST_TEST(r.contents == (std::vector<std::string>{ "contents1", "contents2" }));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
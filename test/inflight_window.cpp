@@ -0,0 +1,234 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include "loopback.hpp"
+#include "test_broker.hpp"
+#include <cstdio>
+#include <mqtt/mmap_session_store.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_inflight_window)
+
+BOOST_AUTO_TEST_CASE( qos1_qos2 ) {
+    boost::asio::io_service ios;
+    loopback<> lb(ios);
+    std::size_t const window = 3;
+    std::size_t const num = 30;
+    lb.client->set_max_inflight(window);
+    // The server responds only when the client has filled the window.
+    // If the client sent more than the window, the server would receive it unacknowledged.
+    lb.server->set_auto_pub_response(false);
+    std::vector<std::uint16_t> unacked;
+    std::vector<std::string> received;
+    lb.server->set_publish_handler(
+        [&]
+        (std::uint8_t header,
+         boost::optional<std::uint16_t> packet_id,
+         std::string,
+         std::string contents) {
+            received.push_back(contents);
+            unacked.push_back(*packet_id);
+            BOOST_TEST(unacked.size() <= window);
+            if (unacked.size() == window) {
+                for (auto id : unacked) {
+                    if (mqtt::publish::get_qos(header) == mqtt::qos::at_least_once) {
+                        lb.server->async_puback(id);
+                    }
+                    else {
+                        lb.server->async_pubrec(id);
+                    }
+                }
+                unacked.clear();
+            }
+            return true;
+        });
+    lb.server->set_pubrel_handler(
+        [&]
+        (std::uint16_t packet_id) {
+            lb.server->async_pubcomp(packet_id);
+            return true;
+        });
+    lb.client->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            for (std::size_t i = 0; i != num; ++i) {
+                lb.client->async_publish(
+                    "topic1",
+                    std::to_string(i),
+                    // The same qos in a window to respond them by the same packet type.
+                    i / window % 2 ? mqtt::qos::exactly_once : mqtt::qos::at_least_once);
+            }
+            auto stats = lb.client->get_inflight_stats();
+            BOOST_TEST(stats.inflight == window);
+            BOOST_TEST(stats.waiting == num - window);
+            return true;
+        });
+    std::size_t acked = 0;
+    auto acked_handler =
+        [&]
+        (std::uint16_t) {
+            if (++acked == num) lb.client->disconnect();
+            return true;
+        };
+    lb.client->set_puback_handler(acked_handler);
+    lb.client->set_pubcomp_handler(acked_handler);
+    lb.start();
+    ios.run();
+    BOOST_TEST(acked == num);
+    BOOST_TEST(received.size() == num);
+    for (std::size_t i = 0; i != received.size(); ++i) {
+        BOOST_TEST(received[i] == std::to_string(i));
+    }
+    auto stats = lb.client->get_inflight_stats();
+    BOOST_TEST(stats.inflight == 0U);
+    BOOST_TEST(stats.waiting == 0U);
+    BOOST_TEST(stats.peak_inflight == window);
+    BOOST_TEST(stats.total_waited == num - window);
+}
+
+BOOST_AUTO_TEST_CASE( unlimited ) {
+    boost::asio::io_service ios;
+    loopback<> lb(ios);
+    std::size_t const num = 30;
+    lb.client->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            for (std::size_t i = 0; i != num; ++i) {
+                lb.client->async_publish("topic1", "contents", mqtt::qos::at_least_once);
+            }
+            auto stats = lb.client->get_inflight_stats();
+            BOOST_TEST(stats.inflight == num);
+            BOOST_TEST(stats.waiting == 0U);
+            return true;
+        });
+    std::size_t acked = 0;
+    lb.client->set_puback_handler(
+        [&]
+        (std::uint16_t) {
+            if (++acked == num) lb.client->disconnect();
+            return true;
+        });
+    lb.start();
+    ios.run();
+    BOOST_TEST(acked == num);
+    BOOST_TEST(lb.client->get_inflight_stats().total_waited == 0U);
+}
+
+BOOST_AUTO_TEST_CASE( waiting_survives_restart ) {
+    char const* const path = "mqtt_test_inflight_window.log";
+    std::remove(path);
+    using ep_t = mqtt::endpoint<boost::asio::ip::tcp::socket, boost::asio::io_service::strand>;
+    boost::asio::io_service ios;
+    std::vector<std::uint16_t> published;
+    {
+        // Publish beyond the window while offline, and then the process exits.
+        auto ep = std::make_shared<ep_t>(ios);
+        ep->set_session_store(std::make_shared<mqtt::mmap_session_store>(path));
+        ep->set_max_inflight(1);
+        for (std::size_t i = 0; i != 3; ++i) {
+            published.push_back(ep->publish_at_least_once("topic1", std::to_string(i)));
+        }
+        auto stats = ep->get_inflight_stats();
+        BOOST_TEST(stats.inflight == 1U);
+        BOOST_TEST(stats.waiting == 2U);
+        std::size_t stored = 0;
+        ep->for_each_store([&](char const*, std::size_t) { ++stored; });
+        BOOST_TEST(stored == 3U);
+    }
+
+    loopback<> lb(ios);
+    lb.client->set_session_store(std::make_shared<mqtt::mmap_session_store>(path));
+    std::size_t stored = 0;
+    lb.client->for_each_store([&](char const*, std::size_t) { ++stored; });
+    BOOST_TEST(stored == 3U);
+    std::vector<std::uint16_t> received;
+    lb.server->set_publish_handler(
+        [&]
+        (std::uint8_t,
+         boost::optional<std::uint16_t> packet_id,
+         std::string,
+         std::string contents) {
+            BOOST_TEST(contents == std::to_string(received.size()));
+            received.push_back(*packet_id);
+            return true;
+        });
+    std::size_t acked = 0;
+    lb.client->set_puback_handler(
+        [&]
+        (std::uint16_t) {
+            if (++acked == 3) lb.client->disconnect();
+            return true;
+        });
+    lb.start();
+    ios.run();
+    BOOST_TEST(received == published);
+    BOOST_TEST(acked == 3U);
+    lb.client->set_session_store(nullptr);
+    std::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE( waiting_dropped_by_clean_session ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    std::size_t received = 0;
+    b.on_accept =
+        [&]
+        (std::shared_ptr<server_endpoint> const& ep, std::size_t) {
+            ep->set_publish_handler(
+                [&]
+                (std::uint8_t,
+                 boost::optional<std::uint16_t>,
+                 std::string,
+                 std::string) {
+                    ++received;
+                    return true;
+                });
+        };
+    auto c = mqtt::make_client(ios, "127.0.0.1", b.port());
+    c->set_client_id("cid1");
+    c->set_clean_session(true);
+    c->set_max_inflight(1);
+    std::vector<boost::system::error_code> results;
+    for (std::size_t i = 0; i != 3; ++i) {
+        c->async_publish(
+            "topic1",
+            "contents",
+            mqtt::qos::at_least_once,
+            false,
+            [&]
+            (boost::system::error_code const& ec) {
+                results.push_back(ec);
+            });
+    }
+    // The first publish is stored for resending. The others wait for the window.
+    BOOST_TEST(results.size() == 1U);
+    BOOST_TEST(c->get_inflight_stats().waiting == 2U);
+    c->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            BOOST_TEST(results.size() == 3U);
+            BOOST_TEST(results[1] == boost::asio::error::operation_aborted);
+            BOOST_TEST(results[2] == boost::asio::error::operation_aborted);
+            auto stats = c->get_inflight_stats();
+            BOOST_TEST(stats.inflight == 0U);
+            BOOST_TEST(stats.waiting == 0U);
+            std::size_t stored = 0;
+            c->for_each_store([&](char const*, std::size_t) { ++stored; });
+            BOOST_TEST(stored == 0U);
+            c->disconnect();
+            return true;
+        });
+    c->set_close_handler(
+        [&]
+        () {
+            b.close();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(received == 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
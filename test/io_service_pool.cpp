@@ -0,0 +1,103 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include <mqtt/client.hpp>
+#include <mqtt/io_service_pool.hpp>
+#include "test_broker.hpp"
+
+#include <future>
+
+BOOST_AUTO_TEST_SUITE(test_io_service_pool)
+
+BOOST_AUTO_TEST_CASE( shards ) {
+    mqtt::io_service_pool pool(3);
+    BOOST_TEST(pool.size() == 3U);
+    BOOST_TEST(pool.next_shard() == 0U);
+    BOOST_TEST(pool.next_shard() == 1U);
+    BOOST_TEST(pool.next_shard() == 2U);
+    BOOST_TEST(pool.next_shard() == 0U);
+    BOOST_TEST(pool.shard_of("client1") == pool.shard_of("client1"));
+    BOOST_TEST(pool.shard_of("client1") < 3U);
+
+    pool.run();
+    struct result {
+        std::thread::id id;
+        bool in_own_shard;
+        bool in_other_shard;
+        bool dispatched;
+    };
+    std::vector<std::promise<result>> results(3);
+    for (std::size_t i = 0; i != pool.size(); ++i) {
+        pool.post(
+            i,
+            [&, i] {
+                result r;
+                r.id = std::this_thread::get_id();
+                r.in_own_shard = pool.running_in_this_thread(i);
+                r.in_other_shard = pool.running_in_this_thread((i + 1) % 3);
+                // dispatch() on the own shard is called immediately.
+                r.dispatched = false;
+                pool.dispatch(i, [&] { r.dispatched = true; });
+                results[i].set_value(r);
+            });
+    }
+    std::vector<result> r;
+    for (auto& p : results) r.push_back(p.get_future().get());
+    for (auto const& e : r) {
+        BOOST_TEST(e.in_own_shard);
+        BOOST_TEST(!e.in_other_shard);
+        BOOST_TEST(e.dispatched);
+        BOOST_CHECK(e.id != std::this_thread::get_id());
+    }
+    BOOST_CHECK(r[0].id != r[1].id);
+    BOOST_CHECK(r[1].id != r[2].id);
+    BOOST_TEST(!pool.running_in_this_thread(0));
+    pool.stop();
+    pool.join();
+}
+
+BOOST_AUTO_TEST_CASE( cross_shard_publish ) {
+    mqtt::io_service_pool pool(2, true);
+    // The broker is on the shard 0 and the client is on the shard 1.
+    test_broker b(pool.get_io_service(0));
+    std::promise<std::string> received;
+    b.on_accept =
+        [&]
+        (std::shared_ptr<server_endpoint> const& ep, std::size_t) {
+            ep->set_publish_handler(
+                [&]
+                (std::uint8_t,
+                 boost::optional<std::uint16_t>,
+                 std::string,
+                 std::string contents) {
+                    received.set_value(contents);
+                    return true;
+                });
+        };
+    auto c = mqtt::make_client_no_strand(pool.get_io_service(1), "127.0.0.1", b.port());
+    c->set_clean_session(true);
+    std::promise<void> connected;
+    c->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            connected.set_value();
+            return true;
+        });
+    pool.run();
+    pool.post(1, [&] { c->connect(); });
+    connected.get_future().get();
+
+    // The client on the shard 1 publishes to the broker on the shard 0 through the loopback.
+    pool.post(1, [&] { c->publish_at_most_once("topic1", "topic1_contents"); });
+    BOOST_TEST(received.get_future().get() == "topic1_contents");
+
+    pool.post(1, [&] { c->disconnect(); });
+    pool.post(0, [&] { b.close(); });
+    pool.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
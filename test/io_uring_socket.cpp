@@ -0,0 +1,245 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+
+#if defined(MQTT_USE_IO_URING)
+
+#include <mqtt/server.hpp>
+#include "loopback.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_io_uring_socket)
+
+namespace {
+
+namespace as = boost::asio;
+
+// The tests pass without checking anything on the kernels that don't support it.
+bool io_uring_available(as::io_service& ios) {
+    try {
+        as::use_service<mqtt::io_uring_ring>(ios);
+        return true;
+    }
+    catch (boost::system::system_error const& e) {
+        BOOST_TEST_MESSAGE("io_uring is not available: " << e.what());
+        return false;
+    }
+}
+
+char pattern(std::size_t i) {
+    return static_cast<char>(i * 7 + i / 4096);
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( construct ) {
+    as::io_service ios;
+    bool available = io_uring_available(ios);
+    try {
+        mqtt::io_uring_socket s(ios);
+        BOOST_TEST(available);
+        BOOST_TEST(!s.lowest_layer().is_open());
+    }
+    catch (boost::system::system_error const&) {
+        BOOST_TEST(!available);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( stream ) {
+    as::io_service ios;
+    if (!io_uring_available(ios)) return;
+    as::ip::tcp::acceptor ac(ios, as::ip::tcp::endpoint(as::ip::address_v4::loopback(), 0));
+    mqtt::io_uring_socket cs(ios);
+    mqtt::io_uring_socket ss(ios);
+    cs.lowest_layer().connect(ac.local_endpoint());
+    ac.accept(ss.lowest_layer());
+
+    // More than the provided buffers, so they are recycled.
+    std::size_t const total = 2 * mqtt::io_uring_ring::buffer_count * mqtt::io_uring_ring::buffer_size + 123;
+    std::vector<char> data(total);
+    for (std::size_t i = 0; i != total; ++i) data[i] = pattern(i);
+
+    std::size_t written = 0;
+    std::function<void()> write_next =
+        [&] {
+            auto size = std::min<std::size_t>(65536, total - written);
+            cs.async_write(
+                as::buffer(&data[written], size),
+                [&, size]
+                (boost::system::error_code const& ec, std::size_t bytes_transferred) {
+                    BOOST_TEST(!ec);
+                    BOOST_TEST(bytes_transferred == size);
+                    written += bytes_transferred;
+                    if (written == total) {
+                        boost::system::error_code cec;
+                        cs.close(cec);
+                        return;
+                    }
+                    write_next();
+                });
+        };
+    write_next();
+
+    std::size_t received = 0;
+    bool mismatch = false;
+    boost::system::error_code read_ec;
+    std::vector<char> buf(3000);
+    std::function<void()> read_next =
+        [&] {
+            ss.async_read_some(
+                as::buffer(buf),
+                [&]
+                (boost::system::error_code const& ec, std::size_t bytes_transferred) {
+                    if (ec) {
+                        read_ec = ec;
+                        return;
+                    }
+                    for (std::size_t i = 0; i != bytes_transferred; ++i) {
+                        if (buf[i] != pattern(received + i)) mismatch = true;
+                    }
+                    received += bytes_transferred;
+                    read_next();
+                });
+        };
+    read_next();
+    ios.run();
+    BOOST_TEST(written == total);
+    BOOST_TEST(received == total);
+    BOOST_TEST(!mismatch);
+    BOOST_TEST(read_ec == as::error::eof);
+}
+
+BOOST_AUTO_TEST_CASE( close_aborts_read ) {
+    as::io_service ios;
+    if (!io_uring_available(ios)) return;
+    as::ip::tcp::acceptor ac(ios, as::ip::tcp::endpoint(as::ip::address_v4::loopback(), 0));
+    mqtt::io_uring_socket cs(ios);
+    mqtt::io_uring_socket ss(ios);
+    cs.lowest_layer().connect(ac.local_endpoint());
+    ac.accept(ss.lowest_layer());
+
+    char buf[16];
+    boost::system::error_code read_ec;
+    ss.async_read_some(
+        as::buffer(buf),
+        [&]
+        (boost::system::error_code const& ec, std::size_t) {
+            read_ec = ec;
+        });
+    as::deadline_timer tim(ios);
+    tim.expires_from_now(boost::posix_time::milliseconds(10));
+    tim.async_wait(
+        [&]
+        (boost::system::error_code const&) {
+            boost::system::error_code ec;
+            ss.close(ec);
+            BOOST_TEST(!ec);
+        });
+    ios.run();
+    BOOST_TEST(read_ec == as::error::operation_aborted);
+    BOOST_TEST(!ss.lowest_layer().is_open());
+}
+
+BOOST_AUTO_TEST_CASE( pubsub ) {
+    using endpoint_t = mqtt::endpoint<mqtt::io_uring_socket, as::io_service::strand>;
+    as::io_service ios;
+    if (!io_uring_available(ios)) return;
+    loopback<endpoint_t, mqtt::io_uring_socket> lb(ios);
+    std::string contents(100000, 'c');
+
+    std::size_t received = 0;
+    std::size_t acked = 0;
+    lb.client->set_connack_handler(
+        [&]
+        (bool, std::uint8_t connack_return_code) {
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            lb.server->publish_at_most_once("topic1", contents);
+            lb.server->publish_at_least_once("topic1", contents);
+            lb.server->publish_exactly_once("topic1", contents);
+            return true;
+        });
+    lb.client->set_publish_ref_handler(
+        [&]
+        (std::uint8_t,
+         boost::optional<std::uint16_t>,
+         boost::string_ref topic,
+         boost::string_ref received_contents) {
+            BOOST_TEST(topic == "topic1");
+            BOOST_TEST(received_contents == contents);
+            ++received;
+            return true;
+        });
+    auto acked_handler =
+        [&]
+        (std::uint16_t) {
+            if (++acked == 2) lb.client->disconnect();
+            return true;
+        };
+    lb.server->set_puback_handler(acked_handler);
+    lb.server->set_pubcomp_handler(acked_handler);
+    lb.start();
+    ios.run();
+    BOOST_TEST(received == 3U);
+    BOOST_TEST(acked == 2U);
+}
+
+BOOST_AUTO_TEST_CASE( client_server ) {
+    as::io_service ios;
+    if (!io_uring_available(ios)) return;
+    auto s = mqtt::make_server_io_uring(ios, as::ip::tcp::endpoint(as::ip::address_v4::loopback(), 0));
+    std::size_t accepted = 0;
+    s->set_accept_handler(
+        [&]
+        (std::shared_ptr<mqtt::server<mqtt::io_uring_socket>::endpoint_t> const& ep) {
+            ++accepted;
+            ep->set_connect_handler(
+                [ep]
+                (std::string const&,
+                 boost::optional<std::string> const&,
+                 boost::optional<std::string> const&,
+                 boost::optional<mqtt::will>,
+                 bool,
+                 std::uint16_t) {
+                    ep->connack(false, mqtt::connect_return_code::accepted);
+                    return true;
+                });
+            ep->set_disconnect_handler(
+                [ep] {
+                    ep->force_disconnect();
+                });
+            ep->start_session();
+        });
+    s->listen();
+
+    bool connacked = false;
+    bool closed = false;
+    auto c = mqtt::make_client_io_uring(ios, "127.0.0.1", s->port());
+    c->set_client_id("cid1");
+    c->set_clean_session(true);
+    c->set_connack_handler(
+        [&]
+        (bool sp, std::uint8_t connack_return_code) {
+            BOOST_TEST(sp == false);
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            connacked = true;
+            s->close();
+            c->disconnect();
+            return true;
+        });
+    c->set_close_handler(
+        [&] {
+            closed = true;
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(accepted == 1U);
+    BOOST_TEST(connacked);
+    BOOST_TEST(closed);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif // defined(MQTT_USE_IO_URING)
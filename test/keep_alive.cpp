@@ -0,0 +1,131 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include <mqtt/client.hpp>
+#include "test_broker.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_keep_alive)
+
+BOOST_AUTO_TEST_CASE( pingreq_suppressed_by_traffic ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    std::size_t pingreq = 0;
+    std::size_t publish = 0;
+    b.on_accept =
+        [&]
+        (std::shared_ptr<server_endpoint> const& ep, std::size_t) {
+            ep->set_pingreq_handler(
+                [&, ep] {
+                    ++pingreq;
+                    ep->pingresp();
+                    return true;
+                });
+            ep->set_publish_handler(
+                [&]
+                (std::uint8_t,
+                 boost::optional<std::uint16_t>,
+                 std::string,
+                 std::string) {
+                    ++publish;
+                    return true;
+                });
+        };
+
+    auto c = mqtt::make_client(ios, "127.0.0.1", b.port());
+    c->set_clean_session(true);
+    c->set_keep_alive_sec_ping_ms(10, 200);
+    std::size_t pingresp = 0;
+    c->set_pingresp_handler(
+        [&] {
+            ++pingresp;
+            return true;
+        });
+
+    boost::asio::deadline_timer tim(ios);
+    std::size_t sent = 0;
+    std::size_t pingreq_while_sending = 0;
+    std::function<void(boost::system::error_code const&)> tick =
+        [&](boost::system::error_code const& ec) {
+            if (ec) return;
+            if (sent == 20) {
+                // Nothing is sent from now on, so PINGREQ is sent.
+                pingreq_while_sending = pingreq;
+                tim.expires_from_now(boost::posix_time::milliseconds(700));
+                tim.async_wait(
+                    [&](boost::system::error_code const&) {
+                        c->disconnect();
+                        b.close();
+                    });
+                return;
+            }
+            c->publish_at_most_once("topic1", "topic1_contents");
+            ++sent;
+            tim.expires_from_now(boost::posix_time::milliseconds(50));
+            tim.async_wait(tick);
+        };
+    c->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            tick(boost::system::error_code());
+            return true;
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(publish == 20U);
+    BOOST_TEST(pingreq_while_sending == 0U);
+    BOOST_TEST(pingreq >= 2U);
+    BOOST_TEST(pingresp == pingreq);
+}
+
+BOOST_AUTO_TEST_CASE( pingresp_timeout ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    std::size_t pingreq = 0;
+    b.on_accept =
+        [&]
+        (std::shared_ptr<server_endpoint> const& ep, std::size_t n) {
+            if (n == 0) {
+                // The link is dead. PINGRESP never comes back.
+                ep->set_pingreq_handler(
+                    [&] {
+                        ++pingreq;
+                        return true;
+                    });
+            }
+        };
+
+    auto c = mqtt::make_client(ios, "127.0.0.1", b.port());
+    c->set_clean_session(true);
+    c->set_keep_alive_sec_ping_ms(10, 100);
+    c->set_pingresp_timeout_ms(100);
+    c->set_auto_reconnect(true, 10, 10, 0, 0.0);
+    std::vector<boost::system::error_code> errors;
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const& ec) {
+            errors.push_back(ec);
+        });
+    std::size_t connack = 0;
+    c->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            if (++connack == 2) {
+                c->disconnect();
+                b.close();
+            }
+            return true;
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(pingreq == 1U);
+    BOOST_TEST(errors.size() == 1U);
+    BOOST_TEST(errors.front() == boost::system::errc::timed_out);
+    BOOST_TEST(connack == 2U);
+    BOOST_TEST(b.sessions.size() == 2U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
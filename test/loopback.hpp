@@ -0,0 +1,59 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_TEST_LOOPBACK_HPP)
+#define MQTT_TEST_LOOPBACK_HPP
+
+#include <memory>
+#include <boost/asio.hpp>
+#include <mqtt/endpoint.hpp>
+
+// A pair of endpoints that are connected via the loopback interface.
+// It doesn't require any broker. The server side endpoint plays a broker role.
+template <
+    typename Endpoint = mqtt::endpoint<boost::asio::ip::tcp::socket, boost::asio::io_service::strand>,
+    typename Socket = boost::asio::ip::tcp::socket>
+struct loopback {
+    loopback(boost::asio::io_service& ios) {
+        namespace as = boost::asio;
+        as::ip::tcp::acceptor ac(
+            ios,
+            as::ip::tcp::endpoint(as::ip::address_v4::loopback(), 0));
+        std::unique_ptr<Socket> cs(new Socket(ios));
+        std::unique_ptr<Socket> ss(new Socket(ios));
+        cs->lowest_layer().connect(ac.local_endpoint());
+        ac.accept(ss->lowest_layer());
+        server = std::make_shared<Endpoint>(std::move(ss));
+        client = std::make_shared<Endpoint>(std::move(cs));
+        server->set_connect_handler(
+            [this]
+            (std::string const&,
+             boost::optional<std::string> const&,
+             boost::optional<std::string> const&,
+             boost::optional<mqtt::will>,
+             bool,
+             std::uint16_t) {
+                server->connack(false, mqtt::connect_return_code::accepted);
+                return true;
+            });
+        server->set_disconnect_handler(
+            [this] {
+                server->force_disconnect();
+            });
+    }
+
+    // Start both sessions and send connect from the client.
+    void start() {
+        server->start_session();
+        client->start_session();
+        client->connect(0);
+    }
+
+    std::shared_ptr<Endpoint> server;
+    std::shared_ptr<Endpoint> client;
+};
+
+#endif // MQTT_TEST_LOOPBACK_HPP
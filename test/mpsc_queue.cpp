@@ -0,0 +1,102 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include "loopback.hpp"
+#include <mqtt/mpsc_queue.hpp>
+
+#include <thread>
+
+BOOST_AUTO_TEST_SUITE(test_mpsc_queue)
+
+BOOST_AUTO_TEST_CASE( single_thread ) {
+    mqtt::mpsc_queue<std::string> q;
+    BOOST_TEST(q.consume_all([](std::string&&){}) == 0U);
+    q.push("a");
+    q.push(2U, 'b');
+    std::vector<std::string> v;
+    BOOST_TEST(q.consume_all([&](std::string&& s){ v.push_back(std::move(s)); }) == 2U);
+    BOOST_TEST(v.size() == 2U);
+    BOOST_TEST(v[0] == "a");
+    BOOST_TEST(v[1] == "bb");
+    q.push("c");
+    BOOST_TEST(q.consume_all([&](std::string&& s){ v.push_back(std::move(s)); }) == 1U);
+    BOOST_TEST(v[2] == "c");
+    // Remaining elements are destroyed with the queue.
+    q.push("d");
+}
+
+BOOST_AUTO_TEST_CASE( multi_producer ) {
+    mqtt::mpsc_queue<std::pair<std::size_t, std::size_t>> q;
+    std::size_t const producers = 4;
+    std::size_t const num = 10000;
+    std::vector<std::thread> threads;
+    for (std::size_t p = 0; p != producers; ++p) {
+        threads.emplace_back(
+            [&q, p, num] {
+                for (std::size_t i = 0; i != num; ++i) q.push(p, i);
+            });
+    }
+    std::vector<std::size_t> next(producers, 0);
+    bool ordered = true;
+    std::size_t consumed = 0;
+    while (consumed != producers * num) {
+        consumed += q.consume_all(
+            [&](std::pair<std::size_t, std::size_t>&& e) {
+                if (next[e.first] != e.second) ordered = false;
+                next[e.first] = e.second + 1;
+            });
+    }
+    for (auto& t : threads) t.join();
+    BOOST_TEST(ordered);
+    BOOST_TEST(q.consume_all([](std::pair<std::size_t, std::size_t>&&){}) == 0U);
+}
+
+BOOST_AUTO_TEST_CASE( publish_from_threads ) {
+    boost::asio::io_service ios;
+    loopback<> lb(ios);
+    std::size_t const producers = 4;
+    std::size_t const num = 500;
+    std::vector<std::thread> threads;
+    lb.client->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            for (std::size_t p = 0; p != producers; ++p) {
+                threads.emplace_back(
+                    [&, p] {
+                        for (std::size_t i = 0; i != num; ++i) {
+                            lb.client->async_publish_at_most_once(
+                                "topic" + std::to_string(p),
+                                std::to_string(i));
+                        }
+                    });
+            }
+            return true;
+        });
+    std::vector<std::size_t> next(producers, 0);
+    bool ordered = true;
+    std::size_t received = 0;
+    lb.server->set_publish_handler(
+        [&]
+        (std::uint8_t,
+         boost::optional<std::uint16_t>,
+         std::string topic,
+         std::string contents) {
+            auto p = static_cast<std::size_t>(std::stoul(topic.substr(5)));
+            auto i = static_cast<std::size_t>(std::stoul(contents));
+            if (next[p] != i) ordered = false;
+            next[p] = i + 1;
+            if (++received == producers * num) lb.client->disconnect();
+            return true;
+        });
+    lb.start();
+    ios.run();
+    for (auto& t : threads) t.join();
+    BOOST_TEST(received == producers * num);
+    BOOST_TEST(ordered);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,66 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include <mqtt/packet_id_allocator.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_packet_id_allocator)
+
+BOOST_AUTO_TEST_CASE( acquire_release ) {
+    mqtt::packet_id_allocator a;
+    BOOST_TEST(a.acquire() == 1);
+    BOOST_TEST(a.acquire() == 2);
+    BOOST_TEST(a.release(1));
+    BOOST_TEST(!a.release(1));
+    // Released ids are not reused immediately.
+    BOOST_TEST(a.acquire() == 3);
+    BOOST_TEST(a.size() == 2U);
+    BOOST_TEST(!a.in_use(1));
+    BOOST_TEST(a.in_use(2));
+    BOOST_TEST(a.in_use(3));
+}
+
+BOOST_AUTO_TEST_CASE( register_id ) {
+    mqtt::packet_id_allocator a;
+    BOOST_TEST(!a.register_id(0));
+    BOOST_TEST(a.register_id(1));
+    BOOST_TEST(!a.register_id(1));
+    BOOST_TEST(a.register_id(2));
+    BOOST_TEST(a.acquire() == 3);
+    BOOST_TEST(!a.release(0));
+}
+
+BOOST_AUTO_TEST_CASE( wrap_around ) {
+    mqtt::packet_id_allocator a;
+    BOOST_TEST(a.register_id(0xfffe));
+    BOOST_TEST(a.register_id(0xffff));
+    BOOST_TEST(a.register_id(1));
+    BOOST_TEST(a.register_id(2));
+    // Move the last acquired id to 0xfffd.
+    for (std::uint32_t i = 3; i <= 0xfffd; ++i) {
+        BOOST_TEST(a.acquire() == i);
+    }
+    BOOST_TEST(a.release(2));
+    BOOST_TEST(a.release(0xfffe));
+    BOOST_TEST(a.acquire() == 0xfffe);
+    BOOST_TEST(a.acquire() == 2);
+}
+
+BOOST_AUTO_TEST_CASE( exhausted ) {
+    mqtt::packet_id_allocator a;
+    for (std::uint32_t i = 1; i <= 0xffff; ++i) {
+        BOOST_TEST(a.acquire() == i);
+    }
+    BOOST_TEST(a.size() == 0xffffU);
+    BOOST_CHECK_THROW(a.acquire(), mqtt::packet_id_exhausted_error);
+    BOOST_TEST(a.release(100));
+    BOOST_TEST(a.acquire() == 100);
+    a.clear();
+    BOOST_TEST(a.size() == 0U);
+    BOOST_TEST(!a.in_use(100));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,90 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include "loopback.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_publish_ref)
+
+BOOST_AUTO_TEST_CASE( qos0_qos1_qos2 ) {
+    boost::asio::io_service ios;
+    loopback<> lb(ios);
+    int order = 0;
+    std::uint16_t pid_qos1;
+    std::uint16_t pid_qos2;
+    lb.server->set_connect_handler(
+        [&]
+        (std::string const&,
+         boost::optional<std::string> const&,
+         boost::optional<std::string> const&,
+         boost::optional<mqtt::will>,
+         bool,
+         std::uint16_t) {
+            lb.server->connack(false, mqtt::connect_return_code::accepted);
+            lb.server->publish_at_most_once("topic0", "contents0");
+            pid_qos1 = lb.server->publish_at_least_once("topic1", "contents1");
+            pid_qos2 = lb.server->publish_exactly_once("topic2", "contents2");
+            return true;
+        });
+    lb.server->set_puback_handler(
+        [&]
+        (std::uint16_t packet_id) {
+            BOOST_TEST(packet_id == pid_qos1);
+            return true;
+        });
+    lb.server->set_pubcomp_handler(
+        [&]
+        (std::uint16_t packet_id) {
+            BOOST_TEST(packet_id == pid_qos2);
+            BOOST_TEST(order++ == 3);
+            lb.client->disconnect();
+            return true;
+        });
+    lb.client->set_publish_handler(
+        []
+        (std::uint8_t,
+         boost::optional<std::uint16_t>,
+         std::string,
+         std::string) {
+            BOOST_CHECK(false);
+            return true;
+        });
+    lb.client->set_publish_ref_handler(
+        [&]
+        (std::uint8_t header,
+         boost::optional<std::uint16_t> packet_id,
+         boost::string_ref topic,
+         boost::string_ref contents) {
+            switch (order++) {
+            case 0:
+                BOOST_TEST(mqtt::publish::get_qos(header) == mqtt::qos::at_most_once);
+                BOOST_TEST(!packet_id);
+                BOOST_TEST(topic == "topic0");
+                BOOST_TEST(contents == "contents0");
+                break;
+            case 1:
+                BOOST_TEST(mqtt::publish::get_qos(header) == mqtt::qos::at_least_once);
+                BOOST_TEST(*packet_id == pid_qos1);
+                BOOST_TEST(topic == "topic1");
+                BOOST_TEST(contents == "contents1");
+                break;
+            case 2:
+                BOOST_TEST(mqtt::publish::get_qos(header) == mqtt::qos::exactly_once);
+                BOOST_TEST(*packet_id == pid_qos2);
+                BOOST_TEST(topic == "topic2");
+                BOOST_TEST(contents == "contents2");
+                break;
+            default:
+                BOOST_CHECK(false);
+            }
+            return true;
+        });
+    lb.start();
+    ios.run();
+    BOOST_TEST(order == 4);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,90 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include "loopback.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_receive_buffer)
+
+BOOST_AUTO_TEST_CASE( many_small_packets ) {
+    boost::asio::io_service ios;
+    loopback<> lb(ios);
+    std::size_t const num = 1000;
+    std::size_t received = 0;
+    lb.server->set_read_buffer_size(64);
+    lb.client->set_connack_handler(
+        [&]
+        (bool sp, std::uint8_t connack_return_code) {
+            BOOST_TEST(sp == false);
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            for (std::size_t i = 0; i != num; ++i) {
+                lb.client->async_publish_at_most_once("topic1", boost::lexical_cast<std::string>(i));
+            }
+            return true;
+        });
+    lb.server->set_publish_handler(
+        [&]
+        (std::uint8_t,
+         boost::optional<std::uint16_t>,
+         std::string topic,
+         std::string contents) {
+            BOOST_TEST(topic == "topic1");
+            BOOST_TEST(contents == boost::lexical_cast<std::string>(received));
+            if (++received == num) lb.client->disconnect();
+            return true;
+        });
+    lb.start();
+    ios.run();
+    BOOST_TEST(received == num);
+}
+
+BOOST_AUTO_TEST_CASE( packet_larger_than_buffer ) {
+    boost::asio::io_service ios;
+    loopback<> lb(ios);
+    std::string large(100000, 'a');
+    std::size_t received = 0;
+    lb.server->set_read_buffer_size(16);
+    lb.client->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            lb.client->async_publish_at_most_once("topic1", "small");
+            lb.client->async_publish_at_least_once("topic1", large);
+            lb.client->async_publish_at_most_once("topic1", "small");
+            return true;
+        });
+    lb.client->set_puback_handler(
+        [&]
+        (std::uint16_t) {
+            lb.client->disconnect();
+            return true;
+        });
+    lb.server->set_publish_handler(
+        [&]
+        (std::uint8_t,
+         boost::optional<std::uint16_t> packet_id,
+         std::string,
+         std::string contents) {
+            switch (received++) {
+            case 0:
+            case 2:
+                BOOST_TEST(contents == "small");
+                BOOST_TEST(!packet_id);
+                break;
+            case 1:
+                BOOST_TEST(contents == large);
+                BOOST_TEST(packet_id.is_initialized());
+                break;
+            default:
+                BOOST_CHECK(false);
+            }
+            return true;
+        });
+    lb.start();
+    ios.run();
+    BOOST_TEST(received == 3U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
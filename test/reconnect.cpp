@@ -0,0 +1,141 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include <mqtt/client.hpp>
+#include "test_broker.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_reconnect)
+
+BOOST_AUTO_TEST_CASE( reconnect_and_resend ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    std::vector<bool> received_dup;
+    b.on_accept =
+        [&]
+        (std::shared_ptr<server_endpoint> const& ep, std::size_t n) {
+            if (n == 0) {
+                // The first session dies without acknowledging the publish.
+                ep->set_auto_pub_response(false);
+            }
+            ep->set_publish_handler(
+                [&, ep, n]
+                (std::uint8_t header,
+                 boost::optional<std::uint16_t>,
+                 std::string,
+                 std::string contents) {
+                    BOOST_TEST(contents == "contents");
+                    received_dup.push_back(mqtt::publish::is_dup(header));
+                    if (n == 0) ep->force_disconnect();
+                    return true;
+                });
+        };
+
+    auto c = mqtt::make_client(ios, "127.0.0.1", b.port());
+    c->set_client_id("cid1");
+    c->set_clean_session(false);
+    c->set_auto_reconnect(true, 10, 100);
+    std::vector<bool> session_present;
+    std::size_t closed = 0;
+    std::size_t acked = 0;
+    c->set_connack_handler(
+        [&]
+        (bool sp, std::uint8_t connack_return_code) {
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            session_present.push_back(sp);
+            if (session_present.size() == 1) {
+                c->publish_at_least_once("topic1", "contents");
+            }
+            return true;
+        });
+    c->set_puback_handler(
+        [&]
+        (std::uint16_t) {
+            ++acked;
+            c->disconnect();
+            return true;
+        });
+    c->set_close_handler(
+        [&]
+        () {
+            ++closed;
+            if (acked != 0) b.close();
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST((session_present == std::vector<bool>{ false, true }));
+    BOOST_TEST((received_dup == std::vector<bool>{ false, true }));
+    BOOST_TEST(acked == 1U);
+    // Closed by the broker, and then closed after disconnect().
+    BOOST_TEST(closed == 2U);
+    BOOST_TEST(b.sessions.size() == 2U);
+}
+
+BOOST_AUTO_TEST_CASE( max_attempts ) {
+    boost::asio::io_service ios;
+    std::uint16_t port;
+    {
+        // Get a port that nobody listens.
+        boost::asio::ip::tcp::acceptor a(
+            ios,
+            boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        port = a.local_endpoint().port();
+    }
+    auto c = mqtt::make_client(ios, "127.0.0.1", port);
+    c->set_auto_reconnect(true, 1, 5, 3);
+    std::size_t errors = 0;
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            ++errors;
+        });
+    c->connect();
+    ios.run();
+    // The first connect and 3 reconnects.
+    BOOST_TEST(errors == 4U);
+}
+
+BOOST_AUTO_TEST_CASE( connect_in_close_handler ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    b.on_accept =
+        [&]
+        (std::shared_ptr<server_endpoint> const& ep, std::size_t n) {
+            // Close the first session from the broker side.
+            if (n == 0) ep->set_pingreq_handler([ep] { ep->force_disconnect(); return true; });
+        };
+    auto c = mqtt::make_client(ios, "127.0.0.1", b.port());
+    c->set_client_id("cid1");
+    c->set_auto_reconnect(true, 10, 100);
+    std::size_t connacked = 0;
+    std::size_t closed = 0;
+    c->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            if (++connacked == 1) c->pingreq();
+            else c->disconnect();
+            return true;
+        });
+    c->set_close_handler(
+        [&]
+        () {
+            // The client doesn't reconnect by itself because the handler connects.
+            if (++closed == 1) c->connect();
+            else b.close();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(connacked == 2U);
+    BOOST_TEST(closed == 2U);
+    BOOST_TEST(b.sessions.size() == 2U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
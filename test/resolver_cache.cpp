@@ -0,0 +1,169 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include <mqtt/client.hpp>
+#include <mqtt/resolver_cache.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_resolver_cache)
+
+BOOST_AUTO_TEST_CASE( merge_and_cache ) {
+    boost::asio::io_service ios;
+    auto cache = std::make_shared<mqtt::resolver_cache>(std::chrono::seconds(60));
+    std::size_t called = 0;
+    auto h =
+        [&]
+        (boost::system::error_code const& ec, std::shared_ptr<mqtt::resolved_endpoints const> const& eps) {
+            BOOST_TEST(!ec);
+            BOOST_TEST(eps->size() == 1U);
+            BOOST_TEST(eps->front().port() == 1883);
+            BOOST_TEST(eps->front().address() == boost::asio::ip::address_v4::loopback());
+            ++called;
+        };
+    cache->async_resolve(ios, "127.0.0.1", "1883", h);
+    cache->async_resolve(ios, "127.0.0.1", "1883", h);
+    cache->async_resolve(ios, "127.0.0.1", "1883", h);
+    ios.run();
+    BOOST_TEST(called == 3U);
+    BOOST_TEST(cache->resolved_count() == 1U);
+
+    ios.reset();
+    cache->async_resolve(ios, "127.0.0.1", "1883", h);
+    ios.run();
+    BOOST_TEST(called == 4U);
+    BOOST_TEST(cache->resolved_count() == 1U);
+
+    cache->clear();
+    ios.reset();
+    cache->async_resolve(ios, "127.0.0.1", "1883", h);
+    ios.run();
+    BOOST_TEST(called == 5U);
+    BOOST_TEST(cache->resolved_count() == 2U);
+}
+
+BOOST_AUTO_TEST_CASE( ttl_expired ) {
+    boost::asio::io_service ios;
+    auto cache = std::make_shared<mqtt::resolver_cache>(std::chrono::seconds(0));
+    std::size_t called = 0;
+    auto h =
+        [&]
+        (boost::system::error_code const& ec, std::shared_ptr<mqtt::resolved_endpoints const> const&) {
+            BOOST_TEST(!ec);
+            ++called;
+        };
+    cache->async_resolve(ios, "127.0.0.1", "1883", h);
+    ios.run();
+    ios.reset();
+    cache->async_resolve(ios, "127.0.0.1", "1883", h);
+    ios.run();
+    BOOST_TEST(called == 2U);
+    BOOST_TEST(cache->resolved_count() == 2U);
+}
+
+BOOST_AUTO_TEST_CASE( first_caller_not_running ) {
+    boost::asio::io_service ios1;
+    boost::asio::io_service ios2;
+    auto cache = std::make_shared<mqtt::resolver_cache>(std::chrono::seconds(60));
+    std::size_t called1 = 0;
+    std::size_t called2 = 0;
+    // ios1 starts the merged resolution, but it never runs.
+    cache->async_resolve(
+        ios1, "127.0.0.1", "1883",
+        [&]
+        (boost::system::error_code const&, std::shared_ptr<mqtt::resolved_endpoints const> const&) {
+            ++called1;
+        });
+    cache->async_resolve(
+        ios2, "127.0.0.1", "1883",
+        [&]
+        (boost::system::error_code const& ec, std::shared_ptr<mqtt::resolved_endpoints const> const& eps) {
+            BOOST_TEST(!ec);
+            BOOST_TEST(eps->size() == 1U);
+            ++called2;
+        });
+    // The waiter keeps ios2 running until its handler is called.
+    ios2.run();
+    BOOST_TEST(called2 == 1U);
+    BOOST_TEST(called1 == 0U);
+    BOOST_TEST(cache->resolved_count() == 1U);
+    ios1.run();
+    BOOST_TEST(called1 == 1U);
+}
+
+BOOST_AUTO_TEST_CASE( evict_expired ) {
+    boost::asio::io_service ios;
+    auto cache = std::make_shared<mqtt::resolver_cache>(std::chrono::seconds(0));
+    auto h =
+        []
+        (boost::system::error_code const& ec, std::shared_ptr<mqtt::resolved_endpoints const> const&) {
+            BOOST_TEST(!ec);
+        };
+    for (int port = 1883; port != 1893; ++port) {
+        cache->async_resolve(ios, "127.0.0.1", std::to_string(port), h);
+        ios.run();
+        ios.reset();
+        // The expired entries of the other ports have been removed.
+        BOOST_TEST(cache->size() == 1U);
+    }
+    BOOST_TEST(cache->resolved_count() == 10U);
+}
+
+BOOST_AUTO_TEST_CASE( client_uses_cache ) {
+    boost::asio::io_service ios;
+    boost::asio::ip::tcp::acceptor acceptor(
+        ios, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    auto port = acceptor.local_endpoint().port();
+    auto cache = std::make_shared<mqtt::resolver_cache>();
+
+    std::size_t accepted = 0;
+    std::vector<std::shared_ptr<boost::asio::ip::tcp::socket>> sockets;
+    std::function<void()> accept =
+        [&] {
+            auto s = std::make_shared<boost::asio::ip::tcp::socket>(ios);
+            acceptor.async_accept(
+                *s,
+                [&, s]
+                (boost::system::error_code const& ec) {
+                    if (ec) return;
+                    sockets.push_back(s);
+                    if (++accepted == 2) {
+                        acceptor.close();
+                        for (auto& s : sockets) s->close();
+                    }
+                    else {
+                        accept();
+                    }
+                });
+        };
+    accept();
+
+    auto c1 = mqtt::make_client(ios, "127.0.0.1", port);
+    auto c2 = mqtt::make_client(ios, "127.0.0.1", port);
+    c1->set_resolver_cache(cache);
+    c2->set_resolver_cache(cache);
+    c1->connect();
+    c2->connect();
+    ios.run();
+    BOOST_TEST(accepted == 2U);
+    BOOST_TEST(cache->resolved_count() == 1U);
+}
+
+BOOST_AUTO_TEST_CASE( resolve_error ) {
+    boost::asio::io_service ios;
+    auto c = mqtt::make_client(ios, "127.0.0.1", "no-such-service-for-mqtt");
+    bool error = false;
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const& ec) {
+            BOOST_TEST(ec);
+            error = true;
+        });
+    BOOST_CHECK_NO_THROW(c->connect());
+    ios.run();
+    BOOST_TEST(error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,252 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <mqtt/retained_store.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_retained_store)
+
+namespace {
+
+char const* const path = "mqtt_test_retained_store.log";
+
+using strs = std::vector<std::string>;
+
+// "topic=contents:qos" of the matched messages
+strs found(mqtt::retained_store const& rs, std::string const& topic_filter) {
+    strs ret;
+    auto n = rs.find(
+        topic_filter,
+        [&]
+        (boost::string_ref topic_name, boost::string_ref contents, std::uint8_t qos) {
+            ret.push_back(
+                std::string(topic_name) + "=" + std::string(contents) + ":" + std::to_string(qos));
+        });
+    BOOST_TEST(n == ret.size());
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+void fill(mqtt::retained_store& rs) {
+    rs.store("sport/tennis/player1", "p1", 0);
+    rs.store("sport/tennis/player1/ranking", "r1", 1);
+    rs.store("sport/tennis/player2", "p2", 2);
+    rs.store("sport", "s", 0);
+    rs.store("/finance", "f", 1);
+    rs.store("$SYS/monitor", "m", 0);
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( find ) {
+    mqtt::retained_store rs;
+    fill(rs);
+    BOOST_TEST(rs.size() == 6U);
+    BOOST_TEST(found(rs, "sport/tennis/player1") == (strs{ "sport/tennis/player1=p1:0" }));
+    BOOST_TEST(found(rs, "sport/tennis/+") == (strs{ "sport/tennis/player1=p1:0", "sport/tennis/player2=p2:2" }));
+    BOOST_TEST(found(rs, "sport/+") == strs());
+    BOOST_TEST(
+        found(rs, "sport/#") ==
+        (strs{ "sport/tennis/player1/ranking=r1:1", "sport/tennis/player1=p1:0", "sport/tennis/player2=p2:2", "sport=s:0" }));
+    BOOST_TEST(found(rs, "+/tennis/#") == (strs{ "sport/tennis/player1/ranking=r1:1", "sport/tennis/player1=p1:0", "sport/tennis/player2=p2:2" }));
+    BOOST_TEST(found(rs, "+") == (strs{ "sport=s:0" }));
+    BOOST_TEST(found(rs, "+/+") == (strs{ "/finance=f:1" }));
+    BOOST_TEST(found(rs, "/+") == (strs{ "/finance=f:1" }));
+    BOOST_TEST(found(rs, "#").size() == 5U);
+    BOOST_TEST(found(rs, "$SYS/#") == (strs{ "$SYS/monitor=m:0" }));
+    BOOST_TEST(found(rs, "+/monitor") == strs());
+    BOOST_TEST(found(rs, "sport/tennis/player3") == strs());
+}
+
+BOOST_AUTO_TEST_CASE( replace_and_erase ) {
+    mqtt::retained_store rs;
+    fill(rs);
+    // The trie nodes are counted in addition to the topic names and the contents.
+    BOOST_TEST(rs.memory_usage() > 20U + 2U + 28U + 2U + 20U + 2U + 5U + 1U + 8U + 1U + 12U + 1U);
+    auto usage = rs.memory_usage();
+    rs.store("sport", "ss", 1);
+    BOOST_TEST(rs.size() == 6U);
+    BOOST_TEST(rs.memory_usage() == usage + 1U);
+    BOOST_TEST(found(rs, "sport") == (strs{ "sport=ss:1" }));
+
+    // An empty message removes the retained message.
+    rs.store("sport/tennis/player1", "", 0);
+    BOOST_TEST(rs.size() == 5U);
+    BOOST_TEST(found(rs, "sport/tennis/player1") == strs());
+    BOOST_TEST(found(rs, "sport/tennis/player1/#") == (strs{ "sport/tennis/player1/ranking=r1:1" }));
+
+    BOOST_TEST(rs.erase("sport/tennis/player1/ranking"));
+    BOOST_TEST(!rs.erase("sport/tennis/player1/ranking"));
+    BOOST_TEST(!rs.erase("sport/tennis"));
+    BOOST_TEST(rs.size() == 4U);
+    BOOST_TEST(found(rs, "sport/tennis/#") == (strs{ "sport/tennis/player2=p2:2" }));
+
+    rs.clear();
+    BOOST_TEST(rs.empty());
+    BOOST_TEST(rs.memory_usage() == 0U);
+    BOOST_TEST(found(rs, "#") == strs());
+}
+
+BOOST_AUTO_TEST_CASE( memory_limit ) {
+    mqtt::retained_store rs;
+    rs.store("a", "1", 0);
+    // The topic name, the contents and the node of "a".
+    auto one = rs.memory_usage();
+    BOOST_TEST(one > 2U);
+    rs.clear();
+    BOOST_TEST(rs.memory_usage() == 0U);
+
+    rs.set_memory_limit(one + 8);
+    BOOST_TEST(rs.store("a", "123456789", 0));
+    BOOST_TEST(!rs.store("b", "1", 0));
+    BOOST_TEST(rs.size() == 1U);
+    // Replacing is accounted by the difference.
+    BOOST_TEST(rs.store("a", "12345678", 0));
+    BOOST_TEST(rs.store("b", "", 0));
+    BOOST_TEST(rs.memory_usage() == one + 7);
+    // The node is released with the message.
+    BOOST_TEST(rs.store("a", "", 0));
+    BOOST_TEST(rs.memory_usage() == 0U);
+    BOOST_TEST(rs.store("b", "1", 0));
+    BOOST_TEST(rs.memory_usage() == one);
+}
+
+BOOST_AUTO_TEST_CASE( memory_limit_nodes ) {
+    mqtt::retained_store rs;
+    rs.store("a/b/c", "1", 0);
+    auto three = rs.memory_usage();
+    rs.store("a/b/d", "1", 0);
+    // Only the node of "d" is added.
+    auto shared = rs.memory_usage() - three;
+    BOOST_TEST(shared < three);
+    rs.clear();
+
+    // The nodes that would be created are counted by the limit check.
+    rs.set_memory_limit(three - 1);
+    BOOST_TEST(!rs.store("a/b/c", "1", 0));
+    BOOST_TEST(rs.memory_usage() == 0U);
+    rs.set_memory_limit(three + shared);
+    BOOST_TEST(rs.store("a/b/c", "1", 0));
+    BOOST_TEST(rs.store("a/b/d", "1", 0));
+    BOOST_TEST(!rs.store("a/b/e", "1", 0));
+    BOOST_TEST(rs.memory_usage() == three + shared);
+}
+
+BOOST_AUTO_TEST_CASE( invalid ) {
+    mqtt::retained_store rs;
+    BOOST_CHECK_THROW(rs.store("a/+", "1", 0), mqtt::retained_store_error);
+    BOOST_CHECK_THROW(rs.store("a/#", "1", 0), mqtt::retained_store_error);
+    BOOST_CHECK_THROW(rs.store("", "1", 0), mqtt::retained_store_error);
+    auto f = [](boost::string_ref, boost::string_ref, std::uint8_t) {};
+    BOOST_CHECK_THROW(rs.find("a/#/b", f), mqtt::topic_filter_error);
+    BOOST_CHECK_THROW(rs.find("a+", f), mqtt::topic_filter_error);
+    BOOST_CHECK_THROW(rs.find("", f), mqtt::topic_filter_error);
+}
+
+BOOST_AUTO_TEST_CASE( reopen ) {
+    std::remove(path);
+    {
+        mqtt::retained_store rs(path);
+        fill(rs);
+        rs.store("sport", "ss", 1);
+        rs.erase("sport/tennis/player2");
+        BOOST_TEST(rs.size() == 5U);
+    }
+    {
+        mqtt::retained_store rs(path);
+        BOOST_TEST(rs.size() == 5U);
+        BOOST_TEST(
+            found(rs, "sport/#") ==
+            (strs{ "sport/tennis/player1/ranking=r1:1", "sport/tennis/player1=p1:0", "sport=ss:1" }));
+        BOOST_TEST(found(rs, "$SYS/+") == (strs{ "$SYS/monitor=m:0" }));
+        rs.clear();
+        rs.store("a", "1", 0);
+    }
+    {
+        mqtt::retained_store rs(path);
+        BOOST_TEST(found(rs, "#") == (strs{ "a=1:0" }));
+        mqtt::retained_store heap;
+        heap.store("a", "1", 0);
+        BOOST_TEST(rs.memory_usage() == heap.memory_usage());
+    }
+    std::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE( broken_record ) {
+    std::remove(path);
+    std::size_t size;
+    {
+        mqtt::retained_store rs(path);
+        rs.store("a", "1", 0);
+        size = rs.log_size();
+        rs.store("b", "2", 0);
+    }
+    {
+        // Break the checksum of the last record.
+        std::fstream fs(path, std::ios::binary | std::ios::in | std::ios::out);
+        fs.seekp(static_cast<std::streamoff>(size + 4));
+        fs.put('\xff');
+    }
+    {
+        mqtt::retained_store rs(path);
+        BOOST_TEST(found(rs, "#") == (strs{ "a=1:0" }));
+        BOOST_TEST(rs.log_size() == size);
+        rs.store("c", "3", 0);
+    }
+    {
+        mqtt::retained_store rs(path);
+        BOOST_TEST(found(rs, "#") == (strs{ "a=1:0", "c=3:0" }));
+    }
+    std::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE( compact ) {
+    std::remove(path);
+    {
+        mqtt::retained_store rs(path);
+        std::string contents(1000, 'x');
+        // Overwrite the same topics many times so that the log has to grow.
+        for (int i = 0; i != 3000; ++i) {
+            rs.store("t/" + std::to_string(i % 10), contents + std::to_string(i), 0);
+        }
+        BOOST_TEST(rs.size() == 10U);
+        BOOST_TEST(rs.log_size() < 1024U * 1024U);
+        auto before = rs.log_size();
+        rs.compact();
+        BOOST_TEST(rs.log_size() <= before);
+        BOOST_TEST(found(rs, "t/3") == (strs{ "t/3=" + contents + "2993:0" }));
+    }
+    {
+        mqtt::retained_store rs(path);
+        BOOST_TEST(rs.size() == 10U);
+        BOOST_TEST(found(rs, "t/9") == (strs{ "t/9=" + std::string(1000, 'x') + "2999:0" }));
+    }
+    std::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE( compact_sync ) {
+    std::remove(path);
+    {
+        // The log is created and replaced with the directory flushed.
+        mqtt::retained_store rs(path, true);
+        fill(rs);
+        rs.store("sport", "s2", 1);
+        rs.compact();
+        rs.store("/finance", "f2", 0);
+    }
+    {
+        mqtt::retained_store rs(path, true);
+        BOOST_TEST(rs.size() == 6U);
+        BOOST_TEST(found(rs, "sport") == (strs{ "sport=s2:1" }));
+        BOOST_TEST(found(rs, "/finance") == (strs{ "/finance=f2:0" }));
+    }
+    std::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
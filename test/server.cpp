@@ -0,0 +1,263 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include <mqtt/client.hpp>
+#include <mqtt/server.hpp>
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif // defined(__linux__)
+
+#if !defined(MQTT_NO_TLS)
+#include "test_cert.hpp"
+#endif // !defined(MQTT_NO_TLS)
+
+BOOST_AUTO_TEST_SUITE(test_server)
+
+namespace {
+
+namespace as = boost::asio;
+
+as::ip::tcp::endpoint loopback_any_port() {
+    return as::ip::tcp::endpoint(as::ip::address_v4::loopback(), 0);
+}
+
+// Accept the connection as a broker that only answers CONNECT and DISCONNECT.
+template <typename Server>
+void serve(Server& s, std::size_t& accepted) {
+    s.set_accept_handler(
+        [&accepted]
+        (std::shared_ptr<typename Server::endpoint_t> const& ep) {
+            ++accepted;
+            ep->set_connect_handler(
+                [ep]
+                (std::string const&,
+                 boost::optional<std::string> const&,
+                 boost::optional<std::string> const&,
+                 boost::optional<mqtt::will>,
+                 bool,
+                 std::uint16_t) {
+                    ep->connack(false, mqtt::connect_return_code::accepted);
+                    return true;
+                });
+            ep->set_disconnect_handler(
+                [ep] {
+                    ep->force_disconnect();
+                });
+            ep->start_session();
+        });
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( accept_clients ) {
+    as::io_service ios;
+    auto s = mqtt::make_server(ios, loopback_any_port());
+    std::size_t accepted = 0;
+    serve(*s, accepted);
+    s->set_backlog(16);
+    mqtt::socket_options opts;
+    opts.no_delay = true;
+    s->set_socket_options(opts);
+    s->listen();
+
+    std::size_t const num = 3;
+    std::size_t connacked = 0;
+    std::vector<std::shared_ptr<mqtt::client<as::ip::tcp::socket, as::io_service::strand>>> clients;
+    for (std::size_t i = 0; i != num; ++i) {
+        auto c = mqtt::make_client(ios, "127.0.0.1", s->port());
+        c->set_client_id("cid" + std::to_string(i));
+        c->set_clean_session(true);
+        c->set_connack_handler(
+            [&, c]
+            (bool sp, std::uint8_t connack_return_code) {
+                BOOST_TEST(sp == false);
+                BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+                if (++connacked == num) s->close();
+                c->disconnect();
+                return true;
+            });
+        c->connect();
+        clients.push_back(c);
+    }
+    ios.run();
+    BOOST_TEST(accepted == num);
+    BOOST_TEST(connacked == num);
+}
+
+BOOST_AUTO_TEST_CASE( endpoint_template_params ) {
+    using server_t = mqtt::server<
+        as::ip::tcp::socket,
+        as::io_service::strand,
+        std::mutex,
+        std::lock_guard,
+        mqtt::flat_store>;
+    static_assert(
+        std::is_same<
+            server_t::endpoint_t,
+            mqtt::endpoint<as::ip::tcp::socket, as::io_service::strand, std::mutex, std::lock_guard, mqtt::flat_store>
+        >::value,
+        "the endpoint uses the template parameters of the server");
+    as::io_service ios;
+    auto s = std::make_shared<server_t>(ios, loopback_any_port());
+    std::size_t accepted = 0;
+    serve(*s, accepted);
+    s->listen();
+
+    auto c = mqtt::make_client(ios, "127.0.0.1", s->port());
+    c->set_client_id("cid1");
+    c->set_clean_session(true);
+    bool connacked = false;
+    c->set_connack_handler(
+        [&]
+        (bool, std::uint8_t connack_return_code) {
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            connacked = true;
+            s->close();
+            c->disconnect();
+            return true;
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(accepted == 1U);
+    BOOST_TEST(connacked);
+}
+
+#if defined(__linux__)
+
+BOOST_AUTO_TEST_CASE( accept_retry_delay ) {
+    as::io_service ios;
+    auto s = mqtt::make_server(ios, loopback_any_port());
+    std::size_t accepted = 0;
+    s->set_accept_handler(
+        [&]
+        (std::shared_ptr<mqtt::server<as::ip::tcp::socket>::endpoint_t> const&) {
+            ++accepted;
+            s->close();
+        });
+    std::size_t errors = 0;
+    s->set_error_handler(
+        [&]
+        (boost::system::error_code const& ec) {
+            BOOST_TEST(ec == as::error::no_descriptors);
+            ++errors;
+        });
+    s->set_accept_retry_delay_ms(100);
+    s->listen();
+
+    as::ip::tcp::socket raw(ios);
+    raw.open(as::ip::tcp::v4());
+
+    // Run out of file descriptors, so that accept() fails with EMFILE.
+    rlimit org;
+    BOOST_REQUIRE(getrlimit(RLIMIT_NOFILE, &org) == 0);
+    int const next_fd = dup(0);
+    BOOST_REQUIRE(next_fd >= 0);
+    close(next_fd);
+    rlimit lowered = org;
+    lowered.rlim_cur = static_cast<rlim_t>(next_fd);
+    BOOST_REQUIRE(setrlimit(RLIMIT_NOFILE, &lowered) == 0);
+
+    raw.connect(as::ip::tcp::endpoint(as::ip::address_v4::loopback(), s->port()));
+    as::deadline_timer t(ios);
+    t.expires_from_now(boost::posix_time::milliseconds(350));
+    t.async_wait(
+        [&]
+        (boost::system::error_code const&) {
+            setrlimit(RLIMIT_NOFILE, &org);
+        });
+    ios.run();
+    setrlimit(RLIMIT_NOFILE, &org);
+    // The accept is tried again once per delay, not in a busy loop.
+    BOOST_TEST(errors >= 1U);
+    BOOST_TEST(errors <= 5U);
+    BOOST_TEST(accepted == 1U);
+}
+
+BOOST_AUTO_TEST_CASE( reuse_port ) {
+    as::io_service ios;
+    auto s1 = mqtt::make_server(ios, loopback_any_port());
+    s1->set_reuse_port(true);
+    s1->listen();
+    auto s2 = mqtt::make_server(ios, as::ip::tcp::endpoint(as::ip::address_v4::loopback(), s1->port()));
+    s2->set_reuse_port(true);
+    s2->listen();
+    BOOST_TEST(s1->port() == s2->port());
+
+    auto s3 = mqtt::make_server(ios, as::ip::tcp::endpoint(as::ip::address_v4::loopback(), s1->port()));
+    BOOST_CHECK_THROW(s3->listen(), boost::system::system_error);
+    s1->close();
+    s2->close();
+    ios.run();
+}
+
+#endif // defined(__linux__)
+
+#if !defined(MQTT_NO_TLS)
+
+BOOST_AUTO_TEST_CASE( accept_tls_client ) {
+    test_cert cert("test_server_ca.pem");
+    as::io_service ios;
+    auto s = mqtt::make_tls_server(ios, loopback_any_port());
+    s->get_ssl_context().use_certificate(as::buffer(cert.cert), as::ssl::context::pem);
+    s->get_ssl_context().use_private_key(as::buffer(cert.key), as::ssl::context::pem);
+    std::size_t accepted = 0;
+    serve(*s, accepted);
+    s->listen();
+
+    auto c = mqtt::make_tls_client(ios, "127.0.0.1", s->port());
+    c->set_ca_cert_file(cert.ca_file);
+    c->set_client_id("cid1");
+    c->set_clean_session(true);
+    bool connacked = false;
+    c->set_connack_handler(
+        [&]
+        (bool, std::uint8_t connack_return_code) {
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            connacked = true;
+            s->close();
+            c->disconnect();
+            return true;
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(accepted == 1U);
+    BOOST_TEST(connacked);
+}
+
+BOOST_AUTO_TEST_CASE( handshake_timeout ) {
+    test_cert cert("test_server_ca.pem");
+    as::io_service ios;
+    auto s = mqtt::make_tls_server(ios, loopback_any_port());
+    s->get_ssl_context().use_certificate(as::buffer(cert.cert), as::ssl::context::pem);
+    s->get_ssl_context().use_private_key(as::buffer(cert.key), as::ssl::context::pem);
+    std::size_t accepted = 0;
+    serve(*s, accepted);
+    s->set_handshake_timeout_ms(100);
+    s->listen();
+
+    // The peer never starts the TLS handshake.
+    as::ip::tcp::socket raw(ios);
+    raw.connect(as::ip::tcp::endpoint(as::ip::address_v4::loopback(), s->port()));
+    char buf[1];
+    boost::system::error_code read_ec;
+    raw.async_read_some(
+        as::buffer(buf),
+        [&]
+        (boost::system::error_code const& ec, std::size_t) {
+            read_ec = ec;
+            s->close();
+        });
+    ios.run();
+    BOOST_TEST(read_ec == as::error::eof);
+    BOOST_TEST(accepted == 0U);
+}
+
+#endif // !defined(MQTT_NO_TLS)
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,208 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include "loopback.hpp"
+#include <cstdio>
+#include <fstream>
+#include <mqtt/mmap_session_store.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_session_store)
+
+namespace {
+
+char const* const path = "mqtt_test_session_store.log";
+
+struct restored {
+    std::vector<std::tuple<std::uint16_t, std::uint8_t, std::string>> packets;
+    std::vector<std::uint16_t> qos2_publish_handled;
+    std::vector<std::uint16_t> packet_ids;
+};
+
+restored restore(mqtt::session_store& ss) {
+    restored r;
+    ss.restore(
+        [&]
+        (std::uint16_t packet_id, std::uint8_t type, boost::string_ref packet) {
+            r.packets.emplace_back(packet_id, type, std::string(packet.data(), packet.size()));
+        },
+        [&]
+        (std::uint16_t packet_id) {
+            r.qos2_publish_handled.push_back(packet_id);
+        },
+        [&]
+        (std::uint16_t packet_id) {
+            r.packet_ids.push_back(packet_id);
+        });
+    return r;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( reopen ) {
+    std::remove(path);
+    {
+        mqtt::mmap_session_store ss(path);
+        ss.use_packet_id(1);
+        ss.use_packet_id(2);
+        ss.use_packet_id(3);
+        ss.add_packet(2, mqtt::control_packet_type::puback, "h2", "c2");
+        ss.add_packet(1, mqtt::control_packet_type::pubrec, "h1", "c1");
+        ss.add_packet(3, mqtt::control_packet_type::puback, "h3", "");
+        ss.erase_packet(3, mqtt::control_packet_type::puback);
+        ss.release_packet_id(3);
+        ss.erase_packet(1, mqtt::control_packet_type::pubrec);
+        ss.add_packet(1, mqtt::control_packet_type::pubcomp, "rel1", "");
+        ss.add_qos2_publish_handled(10);
+        ss.add_qos2_publish_handled(11);
+        ss.erase_qos2_publish_handled(10);
+    }
+    {
+        mqtt::mmap_session_store ss(path);
+        auto r = restore(ss);
+        BOOST_TEST(r.packets.size() == 2U);
+        BOOST_TEST(std::get<0>(r.packets[0]) == 2);
+        BOOST_TEST(std::get<1>(r.packets[0]) == mqtt::control_packet_type::puback);
+        BOOST_TEST(std::get<2>(r.packets[0]) == "h2c2");
+        BOOST_TEST(std::get<0>(r.packets[1]) == 1);
+        BOOST_TEST(std::get<1>(r.packets[1]) == mqtt::control_packet_type::pubcomp);
+        BOOST_TEST(std::get<2>(r.packets[1]) == "rel1");
+        BOOST_TEST((r.qos2_publish_handled == std::vector<std::uint16_t>{ 11 }));
+        BOOST_TEST((r.packet_ids == std::vector<std::uint16_t>{ 1, 2 }));
+
+        ss.clear_packets();
+        BOOST_TEST(restore(ss).packets.empty());
+    }
+    {
+        mqtt::mmap_session_store ss(path);
+        BOOST_TEST(restore(ss).packets.empty());
+    }
+    std::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE( broken_record ) {
+    std::remove(path);
+    std::size_t broken;
+    {
+        mqtt::mmap_session_store ss(path);
+        ss.add_packet(1, mqtt::control_packet_type::puback, "h1", "c1");
+        broken = ss.size();
+        ss.add_packet(2, mqtt::control_packet_type::puback, "h2", "c2");
+    }
+    {
+        // Emulate the record that was being written when the process crashed.
+        std::fstream fs(path, std::ios::binary | std::ios::in | std::ios::out);
+        fs.seekp(static_cast<std::streamoff>(broken + 16));
+        fs.put('x');
+    }
+    {
+        mqtt::mmap_session_store ss(path);
+        auto r = restore(ss);
+        BOOST_TEST(r.packets.size() == 1U);
+        BOOST_TEST(std::get<2>(r.packets[0]) == "h1c1");
+        BOOST_TEST(ss.size() == broken);
+        ss.add_packet(3, mqtt::control_packet_type::puback, "h3", "c3");
+    }
+    {
+        mqtt::mmap_session_store ss(path);
+        auto r = restore(ss);
+        BOOST_TEST(r.packets.size() == 2U);
+        BOOST_TEST(std::get<2>(r.packets[1]) == "h3c3");
+    }
+    std::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE( compaction ) {
+    std::remove(path);
+    std::string contents(100, 'c');
+    {
+        mqtt::mmap_session_store ss(path);
+        ss.add_packet(0xffff, mqtt::control_packet_type::puback, "first", contents);
+        for (std::size_t i = 0; i != 100000; ++i) {
+            auto id = static_cast<std::uint16_t>(i % 100 + 1);
+            ss.use_packet_id(id);
+            ss.add_packet(id, mqtt::control_packet_type::puback, "h", contents);
+            ss.erase_packet(id, mqtt::control_packet_type::puback);
+            ss.release_packet_id(id);
+        }
+        ss.add_packet(1, mqtt::control_packet_type::pubrec, "last", contents);
+        // The log would be more than 10MB without compaction.
+        BOOST_TEST(ss.size() < 1024U * 1024U);
+    }
+    {
+        mqtt::mmap_session_store ss(path);
+        auto r = restore(ss);
+        BOOST_TEST(r.packets.size() == 2U);
+        BOOST_TEST(std::get<2>(r.packets[0]) == "first" + contents);
+        BOOST_TEST(std::get<2>(r.packets[1]) == "last" + contents);
+        BOOST_TEST(r.packet_ids.empty());
+    }
+    std::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE( endpoint_resend_after_restart ) {
+    std::remove(path);
+    using ep_t = mqtt::endpoint<boost::asio::ip::tcp::socket, boost::asio::io_service::strand>;
+    boost::asio::io_service ios;
+    std::uint16_t pid1;
+    std::uint16_t pid2;
+    {
+        // Offline publish, and then the process exits.
+        auto ep = std::make_shared<ep_t>(ios);
+        ep->set_session_store(std::make_shared<mqtt::mmap_session_store>(path));
+        pid1 = ep->publish_at_least_once("topic1", "contents1");
+        pid2 = ep->publish_exactly_once("topic1", "contents2");
+    }
+    std::size_t stored = 0;
+    {
+        auto ep = std::make_shared<ep_t>(ios);
+        ep->set_session_store(std::make_shared<mqtt::mmap_session_store>(path));
+        ep->for_each_store([&](char const*, std::size_t) { ++stored; });
+        BOOST_TEST(stored == 2U);
+        // Restored packet_ids are not acquired again.
+        auto pid3 = ep->acquire_unique_packet_id();
+        BOOST_TEST(pid3 != pid1);
+        BOOST_TEST(pid3 != pid2);
+        BOOST_TEST(ep->release_packet_id(pid3));
+    }
+
+    loopback<> lb(ios);
+    lb.client->set_session_store(std::make_shared<mqtt::mmap_session_store>(path));
+    std::vector<std::uint16_t> received;
+    lb.server->set_publish_handler(
+        [&]
+        (std::uint8_t header,
+         boost::optional<std::uint16_t> packet_id,
+         std::string,
+         std::string) {
+            BOOST_TEST(mqtt::publish::is_dup(header));
+            received.push_back(*packet_id);
+            return true;
+        });
+    std::size_t acked = 0;
+    auto acked_handler =
+        [&]
+        (std::uint16_t) {
+            if (++acked == 2) lb.client->disconnect();
+            return true;
+        };
+    lb.client->set_puback_handler(acked_handler);
+    lb.client->set_pubcomp_handler(acked_handler);
+    lb.start();
+    ios.run();
+    BOOST_TEST((received == std::vector<std::uint16_t>{ pid1, pid2 }));
+    BOOST_TEST(acked == 2U);
+    lb.client->set_session_store(nullptr);
+    {
+        mqtt::mmap_session_store ss(path);
+        auto r = restore(ss);
+        BOOST_TEST(r.packets.empty());
+        BOOST_TEST(r.packet_ids.empty());
+    }
+    std::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
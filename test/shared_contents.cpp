@@ -0,0 +1,63 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include "loopback.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_shared_contents)
+
+BOOST_AUTO_TEST_CASE( sync_and_async ) {
+    boost::asio::io_service ios;
+    loopback<> lb(ios);
+    auto contents = std::make_shared<std::string const>(10000, 'x');
+    std::size_t received = 0;
+    std::size_t acked = 0;
+    lb.client->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            lb.client->publish_at_most_once("topic1", contents);
+            lb.client->publish_at_least_once("topic1", contents);
+            lb.client->async_publish_exactly_once("topic1", contents);
+            lb.client->async_publish("topic1", contents, mqtt::qos::at_most_once);
+            std::size_t stored = 0;
+            lb.client->for_each_store(
+                [&]
+                (char const* ptr, std::size_t size) {
+                    BOOST_TEST(size > contents->size());
+                    BOOST_TEST(std::string(ptr + size - contents->size(), contents->size()) == *contents);
+                    ++stored;
+                });
+            BOOST_TEST(stored == 2U);
+            return true;
+        });
+    auto acked_handler =
+        [&]
+        (std::uint16_t) {
+            if (++acked == 2) lb.client->disconnect();
+            return true;
+        };
+    lb.client->set_puback_handler(acked_handler);
+    lb.client->set_pubcomp_handler(acked_handler);
+    lb.server->set_publish_ref_handler(
+        [&]
+        (std::uint8_t,
+         boost::optional<std::uint16_t>,
+         boost::string_ref topic,
+         boost::string_ref received_contents) {
+            BOOST_TEST(topic == "topic1");
+            BOOST_TEST(received_contents == *contents);
+            ++received;
+            return true;
+        });
+    lb.start();
+    ios.run();
+    BOOST_TEST(received == 4U);
+    BOOST_TEST(acked == 2U);
+    // The library releases the shared contents after acknowledged.
+    BOOST_TEST(contents.use_count() == 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
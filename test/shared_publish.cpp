@@ -0,0 +1,85 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include "loopback.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_shared_publish)
+
+BOOST_AUTO_TEST_CASE( fan_out ) {
+    boost::asio::io_service ios;
+    std::vector<std::unique_ptr<loopback<>>> lbs;
+    for (int i = 0; i != 3; ++i) lbs.emplace_back(new loopback<>(ios));
+    auto contents = std::make_shared<std::string const>(10000, 'x');
+    mqtt::shared_publish p("topic1", contents, true);
+    BOOST_TEST(p.topic_name() == "topic1");
+
+    std::size_t connected = 0;
+    std::size_t received = 0;
+    std::size_t acked = 0;
+    auto acked_handler =
+        [&]
+        (std::uint16_t) {
+            if (++acked == 2) {
+                for (auto& lb : lbs) lb->client->disconnect();
+            }
+            return true;
+        };
+    for (std::size_t i = 0; i != lbs.size(); ++i) {
+        auto& lb = *lbs[i];
+        std::uint8_t qos = static_cast<std::uint8_t>(i);
+        lb.client->set_connack_handler(
+            [&]
+            (bool, std::uint8_t) {
+                if (++connected != lbs.size()) return true;
+                // Each endpoint has its own qos and packet identifier, and all share the contents.
+                lbs[0]->server->publish(p, mqtt::qos::at_most_once);
+                BOOST_TEST(lbs[1]->server->async_publish(p, mqtt::qos::at_least_once) != 0);
+                BOOST_TEST(lbs[2]->server->async_publish(p, mqtt::qos::exactly_once) != 0);
+                for (std::size_t j = 1; j != lbs.size(); ++j) {
+                    std::size_t stored = 0;
+                    lbs[j]->server->for_each_store(
+                        [&]
+                        (char const* ptr, std::size_t size) {
+                            BOOST_TEST(std::string(ptr + size - contents->size(), contents->size()) == *contents);
+                            ++stored;
+                        });
+                    BOOST_TEST(stored == 1U);
+                }
+                return true;
+            });
+        lb.client->set_publish_ref_handler(
+            [&, qos]
+            (std::uint8_t header,
+             boost::optional<std::uint16_t> packet_id,
+             boost::string_ref topic,
+             boost::string_ref received_contents) {
+                BOOST_TEST(mqtt::publish::get_qos(header) == qos);
+                BOOST_TEST(mqtt::publish::is_retain(header));
+                BOOST_TEST(!mqtt::publish::is_dup(header));
+                BOOST_TEST(static_cast<bool>(packet_id) == (qos != mqtt::qos::at_most_once));
+                BOOST_TEST(topic == "topic1");
+                BOOST_TEST(received_contents == *contents);
+                ++received;
+                return true;
+            });
+        lb.server->set_puback_handler(acked_handler);
+        lb.server->set_pubcomp_handler(acked_handler);
+        lb.start();
+    }
+    ios.run();
+    BOOST_TEST(connected == 3U);
+    BOOST_TEST(received == 3U);
+    BOOST_TEST(acked == 2U);
+    // Only p holds the contents after all publishes are acknowledged.
+    BOOST_TEST(contents.use_count() == 2);
+}
+
+BOOST_AUTO_TEST_CASE( invalid_topic_name ) {
+    BOOST_CHECK_THROW(mqtt::shared_publish(std::string(0x10000, 'a'), "contents"), mqtt::utf8string_length_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
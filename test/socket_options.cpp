@@ -0,0 +1,86 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include <mqtt/client.hpp>
+#include "test_broker.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_socket_options)
+
+BOOST_AUTO_TEST_CASE( apply ) {
+    boost::asio::io_service ios;
+    boost::asio::ip::tcp::socket s(ios);
+    s.open(boost::asio::ip::tcp::v4());
+
+    mqtt::socket_options opts;
+    opts.no_delay = true;
+    opts.keep_alive = true;
+    opts.receive_buffer_size = 65536;
+    opts.keep_alive_idle_sec = 30;
+    boost::system::error_code ec;
+    opts.apply(s, ec);
+    BOOST_TEST(!ec);
+
+    boost::asio::ip::tcp::no_delay nd;
+    s.get_option(nd);
+    BOOST_TEST(nd.value());
+    boost::asio::socket_base::keep_alive ka;
+    s.get_option(ka);
+    BOOST_TEST(ka.value());
+    boost::asio::socket_base::receive_buffer_size rb;
+    s.get_option(rb);
+    BOOST_TEST(rb.value() >= 65536);
+#if defined(__linux__)
+    int idle = 0;
+    socklen_t len = sizeof(idle);
+    ::getsockopt(s.native_handle(), IPPROTO_TCP, TCP_KEEPIDLE, &idle, &len);
+    BOOST_TEST(idle == 30);
+#endif // defined(__linux__)
+}
+
+BOOST_AUTO_TEST_CASE( apply_error ) {
+    boost::asio::io_service ios;
+    boost::asio::ip::tcp::socket s(ios);
+    mqtt::socket_options opts;
+    opts.no_delay = true;
+    boost::system::error_code ec;
+    // Not opened
+    opts.apply(s, ec);
+    BOOST_TEST(ec);
+}
+
+BOOST_AUTO_TEST_CASE( client_applies_options ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    auto c = mqtt::make_client(ios, "127.0.0.1", b.port());
+    c->set_clean_session(true);
+    mqtt::socket_options opts;
+    opts.no_delay = true;
+    opts.keep_alive = true;
+    opts.quick_ack = true;
+    c->set_socket_options(opts);
+    bool no_delay = false;
+    bool keep_alive = false;
+    c->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            boost::asio::ip::tcp::no_delay nd;
+            c->socket()->lowest_layer().get_option(nd);
+            no_delay = nd.value();
+            boost::asio::socket_base::keep_alive ka;
+            c->socket()->lowest_layer().get_option(ka);
+            keep_alive = ka.value();
+            c->disconnect();
+            b.close();
+            return true;
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(no_delay);
+    BOOST_TEST(keep_alive);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
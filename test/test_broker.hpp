@@ -0,0 +1,72 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_TEST_BROKER_HPP)
+#define MQTT_TEST_BROKER_HPP
+
+#include <memory>
+#include <vector>
+#include <functional>
+#include <boost/asio.hpp>
+#include <mqtt/endpoint.hpp>
+
+using server_endpoint = mqtt::endpoint<boost::asio::ip::tcp::socket, boost::asio::io_service::strand>;
+
+// Accepts connections on the loopback interface and plays a broker role.
+struct test_broker {
+    test_broker(boost::asio::io_service& ios)
+        :ios(ios),
+         acceptor(ios, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)) {
+        accept();
+    }
+
+    std::uint16_t port() const {
+        return acceptor.local_endpoint().port();
+    }
+
+    void close() {
+        acceptor.close();
+    }
+
+    void accept() {
+        auto s = std::make_shared<std::unique_ptr<boost::asio::ip::tcp::socket>>(
+            new boost::asio::ip::tcp::socket(ios));
+        acceptor.async_accept(
+            **s,
+            [this, s]
+            (boost::system::error_code const& ec) {
+                if (ec) return;
+                auto ep = std::make_shared<server_endpoint>(std::move(*s));
+                std::size_t n = sessions.size();
+                sessions.push_back(ep);
+                ep->set_connect_handler(
+                    [ep, n]
+                    (std::string const&,
+                     boost::optional<std::string> const&,
+                     boost::optional<std::string> const&,
+                     boost::optional<mqtt::will>,
+                     bool,
+                     std::uint16_t) {
+                        ep->connack(n != 0, mqtt::connect_return_code::accepted);
+                        return true;
+                    });
+                ep->set_disconnect_handler(
+                    [ep] {
+                        ep->force_disconnect();
+                    });
+                if (on_accept) on_accept(ep, n);
+                ep->start_session();
+                accept();
+            });
+    }
+
+    boost::asio::io_service& ios;
+    boost::asio::ip::tcp::acceptor acceptor;
+    std::vector<std::shared_ptr<server_endpoint>> sessions;
+    std::function<void(std::shared_ptr<server_endpoint> const&, std::size_t)> on_accept;
+};
+
+#endif // MQTT_TEST_BROKER_HPP
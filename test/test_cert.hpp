@@ -0,0 +1,68 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_TEST_CERT_HPP)
+#define MQTT_TEST_CERT_HPP
+
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/x509.h>
+#include <openssl/pem.h>
+
+// Self signed certificate for 127.0.0.1. It is also written to ca_file.
+struct test_cert {
+    explicit test_cert(char const* ca_file)
+        :ca_file(ca_file) {
+        EVP_PKEY_CTX* kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+        EVP_PKEY_keygen_init(kctx);
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1);
+        EVP_PKEY* pkey = nullptr;
+        EVP_PKEY_keygen(kctx, &pkey);
+        EVP_PKEY_CTX_free(kctx);
+
+        X509* x = X509_new();
+        X509_set_version(x, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(x), 1);
+        X509_gmtime_adj(X509_getm_notBefore(x), -60);
+        X509_gmtime_adj(X509_getm_notAfter(x), 3600);
+        X509_set_pubkey(x, pkey);
+        X509_NAME* name = X509_get_subject_name(x);
+        X509_NAME_add_entry_by_txt(
+            name, "CN", MBSTRING_ASC, reinterpret_cast<unsigned char const*>("127.0.0.1"), -1, -1, 0);
+        X509_set_issuer_name(x, name);
+        X509_sign(x, pkey, EVP_sha256());
+
+        BIO* b = BIO_new(BIO_s_mem());
+        PEM_write_bio_X509(b, x);
+        cert = read_all(b);
+        PEM_write_bio_PrivateKey(b, pkey, nullptr, nullptr, 0, nullptr, nullptr);
+        key = read_all(b);
+        BIO_free(b);
+        X509_free(x);
+        EVP_PKEY_free(pkey);
+
+        std::ofstream ofs(ca_file);
+        ofs << cert;
+    }
+    ~test_cert() {
+        std::remove(ca_file);
+    }
+    static std::string read_all(BIO* b) {
+        char* p = nullptr;
+        auto size = BIO_get_mem_data(b, &p);
+        std::string s(p, static_cast<std::size_t>(size));
+        BIO_reset(b);
+        return s;
+    }
+    char const* ca_file;
+    std::string cert;
+    std::string key;
+};
+
+#endif // MQTT_TEST_CERT_HPP
@@ -0,0 +1,155 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include <mqtt/client.hpp>
+
+#if !defined(MQTT_NO_TLS)
+
+#include "test_cert.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_tls_session)
+
+namespace {
+
+namespace as = boost::asio;
+
+using tls_socket = as::ssl::stream<as::ip::tcp::socket>;
+using tls_server_endpoint = mqtt::endpoint<tls_socket, as::io_service::strand>;
+
+struct tls_broker {
+    tls_broker(as::io_service& ios, test_cert const& c)
+        :ios(ios),
+         ctx(as::ssl::context::tlsv12),
+         acceptor(ios, as::ip::tcp::endpoint(as::ip::address_v4::loopback(), 0)) {
+        ctx.use_certificate(as::buffer(c.cert), as::ssl::context::pem);
+        ctx.use_private_key(as::buffer(c.key), as::ssl::context::pem);
+        accept();
+    }
+
+    std::uint16_t port() const {
+        return acceptor.local_endpoint().port();
+    }
+
+    void close() {
+        acceptor.close();
+    }
+
+    void accept() {
+        auto s = std::make_shared<std::unique_ptr<tls_socket>>(new tls_socket(ios, ctx));
+        acceptor.async_accept(
+            (*s)->lowest_layer(),
+            [this, s]
+            (boost::system::error_code const& ec) {
+                if (ec) return;
+                accept();
+                (*s)->async_handshake(
+                    as::ssl::stream_base::server,
+                    [this, s]
+                    (boost::system::error_code const& ec) {
+                        if (ec) return;
+                        auto ep = std::make_shared<tls_server_endpoint>(std::move(*s));
+                        sessions.push_back(ep);
+                        ep->set_connect_handler(
+                            [ep]
+                            (std::string const&,
+                             boost::optional<std::string> const&,
+                             boost::optional<std::string> const&,
+                             boost::optional<mqtt::will>,
+                             bool,
+                             std::uint16_t) {
+                                ep->connack(false, mqtt::connect_return_code::accepted);
+                                return true;
+                            });
+                        ep->set_disconnect_handler(
+                            [ep] {
+                                ep->force_disconnect();
+                            });
+                        ep->start_session();
+                    });
+            });
+    }
+
+    as::io_service& ios;
+    as::ssl::context ctx;
+    as::ip::tcp::acceptor acceptor;
+    std::vector<std::shared_ptr<tls_server_endpoint>> sessions;
+};
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( resume ) {
+    test_cert cert("test_tls_session_ca.pem");
+    as::io_service ios;
+    tls_broker b(ios, cert);
+    auto cache = std::make_shared<mqtt::tls_session_cache>();
+
+    auto c1 = mqtt::make_tls_client(ios, "127.0.0.1", b.port());
+    auto c2 = mqtt::make_tls_client(ios, "127.0.0.1", b.port());
+    std::vector<bool> reused;
+    std::size_t closed = 0;
+    for (auto& c : { c1, c2 }) {
+        c->set_ca_cert_file(cert.ca_file);
+        c->set_clean_session(true);
+        c->set_tls_session_cache(cache);
+        c->set_connack_handler(
+            [&, c]
+            (bool, std::uint8_t) {
+                reused.push_back(c->tls_session_reused());
+                c->disconnect();
+                return true;
+            });
+    }
+    c1->set_close_handler(
+        [&] {
+            // Reconnect of the same client, then another client that shares the cache.
+            if (++closed == 1) c1->connect();
+            else c2->connect();
+        });
+    c2->set_close_handler(
+        [&] {
+            b.close();
+        });
+    c1->connect();
+    ios.run();
+    BOOST_TEST(reused.size() == 3U);
+    BOOST_TEST(!reused[0]);
+    BOOST_TEST(reused[1]);
+    BOOST_TEST(reused[2]);
+    BOOST_TEST(cache->size() == 1U);
+}
+
+BOOST_AUTO_TEST_CASE( no_cache ) {
+    test_cert cert("test_tls_session_ca.pem");
+    as::io_service ios;
+    tls_broker b(ios, cert);
+
+    auto c = mqtt::make_tls_client(ios, "127.0.0.1", b.port());
+    c->set_ca_cert_file(cert.ca_file);
+    c->set_clean_session(true);
+    std::vector<bool> reused;
+    c->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            reused.push_back(c->tls_session_reused());
+            c->disconnect();
+            return true;
+        });
+    c->set_close_handler(
+        [&] {
+            if (reused.size() == 1) c->connect();
+            else b.close();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(reused.size() == 2U);
+    BOOST_TEST(!reused[0]);
+    BOOST_TEST(!reused[1]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif // !defined(MQTT_NO_TLS)
@@ -0,0 +1,178 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include "test_broker.hpp"
+#include <mqtt/client.hpp>
+#include <mqtt/topic_filter_map.hpp>
+#include <mqtt/topic_dispatcher.hpp>
+
+#include <algorithm>
+
+BOOST_AUTO_TEST_SUITE(test_topic_filter)
+
+namespace {
+
+std::vector<std::string> matched(mqtt::topic_filter_map<std::string> const& m, std::string const& topic_name) {
+    std::vector<std::string> ret;
+    m.match(topic_name, [&](std::string const& v) { ret.push_back(v); });
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+mqtt::topic_filter_map<std::string> make_map(std::vector<std::string> const& filters) {
+    mqtt::topic_filter_map<std::string> m;
+    for (auto const& f : filters) m.insert_or_assign(f, f);
+    return m;
+}
+
+using strs = std::vector<std::string>;
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( match ) {
+    auto m = make_map(
+        {
+            "sport/tennis/player1",
+            "sport/tennis/player1/#",
+            "sport/#",
+            "sport/+",
+            "sport/+/player1",
+            "+/+",
+            "/+",
+            "+",
+            "#",
+            "a//b",
+        });
+    BOOST_TEST(m.size() == 10U);
+    BOOST_TEST(matched(m, "sport/tennis/player1") ==
+               (strs{ "#", "sport/#", "sport/+/player1", "sport/tennis/player1", "sport/tennis/player1/#" }));
+    BOOST_TEST(matched(m, "sport/tennis/player1/ranking") ==
+               (strs{ "#", "sport/#", "sport/tennis/player1/#" }));
+    BOOST_TEST(matched(m, "sport") ==
+               (strs{ "#", "+", "sport/#" }));
+    BOOST_TEST(matched(m, "sport/") ==
+               (strs{ "#", "+/+", "sport/#", "sport/+" }));
+    BOOST_TEST(matched(m, "/finance") ==
+               (strs{ "#", "+/+", "/+" }));
+    BOOST_TEST(matched(m, "a//b") ==
+               (strs{ "#", "a//b" }));
+    BOOST_TEST(matched(m, "a/b") ==
+               (strs{ "#", "+/+" }));
+}
+
+BOOST_AUTO_TEST_CASE( dollar_topics ) {
+    auto m = make_map({ "#", "+/monitor/Clients", "$SYS/#", "$SYS/monitor/+" });
+    BOOST_TEST(matched(m, "$SYS/monitor/Clients") == (strs{ "$SYS/#", "$SYS/monitor/+" }));
+    BOOST_TEST(matched(m, "monitor/Clients") == (strs{ "#" }));
+}
+
+BOOST_AUTO_TEST_CASE( find_erase ) {
+    auto m = make_map({ "a/b/c", "a/+/c", "a/#", "a" });
+    BOOST_TEST(m.insert_or_assign("a/b/c", "replaced") == false);
+    BOOST_TEST(m.size() == 4U);
+    BOOST_TEST(*m.find("a/b/c") == "replaced");
+    BOOST_TEST(*m.find("a/+/c") == "a/+/c");
+    BOOST_TEST(m.find("a/b") == nullptr);
+    BOOST_TEST(m.find("a/x/c") == nullptr);
+
+    BOOST_TEST(m.erase("a/b/c"));
+    BOOST_TEST(!m.erase("a/b/c"));
+    BOOST_TEST(!m.erase("a/b"));
+    BOOST_TEST(m.size() == 3U);
+    BOOST_TEST(matched(m, "a/b/c") == (strs{ "a/#", "a/+/c" }));
+    BOOST_TEST(m.erase("a/+/c"));
+    BOOST_TEST(m.erase("a/#"));
+    BOOST_TEST(matched(m, "a/b/c") == (strs{}));
+    BOOST_TEST(matched(m, "a") == (strs{ "a" }));
+    BOOST_TEST(m.erase("a"));
+    BOOST_TEST(m.empty());
+
+    m.insert_or_assign("x", "x");
+    m.clear();
+    BOOST_TEST(m.empty());
+    BOOST_TEST(matched(m, "x") == (strs{}));
+}
+
+BOOST_AUTO_TEST_CASE( invalid_filter ) {
+    mqtt::topic_filter_map<int> m;
+    BOOST_CHECK_THROW(m.insert_or_assign("", 1), mqtt::topic_filter_error);
+    BOOST_CHECK_THROW(m.insert_or_assign("a/#/b", 1), mqtt::topic_filter_error);
+    BOOST_CHECK_THROW(m.insert_or_assign("a#", 1), mqtt::topic_filter_error);
+    BOOST_CHECK_THROW(m.insert_or_assign("a/b+", 1), mqtt::topic_filter_error);
+    BOOST_CHECK_THROW(m.insert_or_assign("a/+/b/#/c", 1), mqtt::topic_filter_error);
+    BOOST_TEST(m.empty());
+    // The levels before the invalid one are not left in the map.
+    BOOST_TEST(m.insert_or_assign("a/+/b", 1));
+    BOOST_TEST(m.erase("a/+/b"));
+    BOOST_TEST(m.empty());
+}
+
+BOOST_AUTO_TEST_CASE( many_filters ) {
+    mqtt::topic_filter_map<std::size_t> m;
+    std::size_t const num = 20000;
+    for (std::size_t i = 0; i != num; ++i) {
+        m.insert_or_assign("devices/" + std::to_string(i) + "/state", i);
+    }
+    m.insert_or_assign("devices/+/state", num);
+    std::vector<std::size_t> ret;
+    m.match("devices/12345/state", [&](std::size_t v) { ret.push_back(v); });
+    std::sort(ret.begin(), ret.end());
+    BOOST_TEST(ret == (std::vector<std::size_t>{ 12345, num }));
+}
+
+BOOST_AUTO_TEST_CASE( dispatch_received_publish ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    mqtt::topic_dispatcher d;
+    std::vector<std::string> temperature;
+    std::size_t all = 0;
+    d.set_handler(
+        "sensors/+/temperature",
+        [&]
+        (std::uint8_t, boost::optional<std::uint16_t>, boost::string_ref topic_name, boost::string_ref contents) {
+            temperature.push_back(std::string(topic_name) + "=" + std::string(contents));
+        });
+    d.set_handler(
+        "sensors/#",
+        [&]
+        (std::uint8_t, boost::optional<std::uint16_t>, boost::string_ref, boost::string_ref) {
+            ++all;
+        });
+    BOOST_TEST(d.size() == 2U);
+    b.on_accept =
+        [&]
+        (std::shared_ptr<server_endpoint> const& ep, std::size_t) {
+            ep->set_publish_ref_handler(std::ref(d));
+        };
+
+    auto c = mqtt::make_client(ios, "127.0.0.1", b.port());
+    c->set_client_id("cid1");
+    c->set_clean_session(true);
+    c->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            c->publish_at_most_once("sensors/a/temperature", "20");
+            c->publish_at_most_once("sensors/a/humidity", "40");
+            c->publish_at_least_once("sensors/b/temperature", "21");
+            return true;
+        });
+    c->set_puback_handler(
+        [&]
+        (std::uint16_t) {
+            c->disconnect();
+            b.close();
+            return true;
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(temperature == (strs{ "sensors/a/temperature=20", "sensors/b/temperature=21" }));
+    BOOST_TEST(all == 3U);
+    BOOST_TEST(d.erase_handler("sensors/#"));
+    BOOST_TEST(d.dispatch(0, boost::none, "sensors/c/temperature", "22") == 1U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,74 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_settings.hpp"
+#include "loopback.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_write_coalescing)
+
+// A tcp socket that counts the write operations started on it.
+struct counting_socket : boost::asio::ip::tcp::socket {
+    using boost::asio::ip::tcp::socket::basic_stream_socket;
+    template <typename ConstBufferSequence, typename WriteHandler>
+    void async_write_some(ConstBufferSequence const& buffers, WriteHandler&& h) {
+        ++writes;
+        boost::asio::ip::tcp::socket::async_write_some(buffers, std::forward<WriteHandler>(h));
+    }
+    static std::size_t writes;
+};
+
+std::size_t counting_socket::writes = 0;
+
+BOOST_AUTO_TEST_CASE( burst ) {
+    boost::asio::io_service ios;
+    using endpoint_t = mqtt::endpoint<counting_socket, boost::asio::io_service::strand>;
+    loopback<endpoint_t, counting_socket> lb(ios);
+    counting_socket::writes = 0;
+    std::size_t const num = 1000;
+    std::size_t completed = 0;
+    std::size_t received = 0;
+    std::vector<std::size_t> order;
+    lb.client->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            for (std::size_t i = 0; i != num; ++i) {
+                lb.client->async_publish_at_most_once(
+                    "topic1",
+                    std::to_string(i),
+                    false,
+                    [&, i]
+                    (boost::system::error_code const& ec) {
+                        BOOST_TEST(!ec);
+                        order.push_back(i);
+                        ++completed;
+                    });
+            }
+            return true;
+        });
+    lb.server->set_publish_handler(
+        [&]
+        (std::uint8_t,
+         boost::optional<std::uint16_t>,
+         std::string topic,
+         std::string contents) {
+            BOOST_TEST(topic == "topic1");
+            BOOST_TEST(contents == std::to_string(received));
+            if (++received == num) lb.client->disconnect();
+            return true;
+        });
+    lb.start();
+    ios.run();
+    BOOST_TEST(completed == num);
+    BOOST_TEST(received == num);
+    // The publishes queued together go out in a few gathered writes.
+    // Both endpoints are counted, so the bound includes CONNECT, CONNACK and DISCONNECT.
+    BOOST_TEST(counting_socket::writes <= num / 10);
+    for (std::size_t i = 0; i != order.size(); ++i) {
+        BOOST_TEST(order[i] == i);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
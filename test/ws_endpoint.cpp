@@ -0,0 +1,170 @@
+// Copyright Takatoshi Kondo 2016
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if defined(MQTT_USE_WS)
+
+#include "test_settings.hpp"
+#include <mqtt/ws_endpoint.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_ws_endpoint)
+
+namespace {
+
+using ws_t = mqtt::ws_endpoint<boost::asio::ip::tcp::socket>;
+
+// Connect a pair of ws_endpoints via the loopback interface, and finish the WebSocket handshake.
+void connect_pair(boost::asio::io_service& ios, ws_t& client, ws_t& server) {
+    namespace as = boost::asio;
+    as::ip::tcp::acceptor ac(
+        ios,
+        as::ip::tcp::endpoint(as::ip::address_v4::loopback(), 0));
+    client.lowest_layer().connect(ac.local_endpoint());
+    ac.accept(server.lowest_layer());
+    server.async_accept(
+        []
+        (boost::system::error_code const& ec) {
+            BOOST_TEST(!ec);
+        });
+    client.async_handshake(
+        "127.0.0.1",
+        "/",
+        []
+        (boost::system::error_code const& ec) {
+            BOOST_TEST(!ec);
+        });
+    ios.run();
+    ios.reset();
+}
+
+// Publish a large compressible message from the client endpoint to the server endpoint.
+void publish_over_ws(bool client_deflate, bool server_deflate) {
+    using ep_t = mqtt::endpoint<ws_t, boost::asio::io_service::strand>;
+    boost::asio::io_service ios;
+    std::unique_ptr<ws_t> cs(new ws_t(ios));
+    std::unique_ptr<ws_t> ss(new ws_t(ios));
+    if (client_deflate) cs->enable_permessage_deflate(mqtt::permessage_deflate_options());
+    if (server_deflate) ss->enable_permessage_deflate(mqtt::permessage_deflate_options());
+    connect_pair(ios, *cs, *ss);
+    auto server = std::make_shared<ep_t>(std::move(ss));
+    auto client = std::make_shared<ep_t>(std::move(cs));
+    server->set_connect_handler(
+        [&]
+        (std::string const&,
+         boost::optional<std::string> const&,
+         boost::optional<std::string> const&,
+         boost::optional<mqtt::will>,
+         bool,
+         std::uint16_t) {
+            server->connack(false, mqtt::connect_return_code::accepted);
+            return true;
+        });
+    server->set_disconnect_handler(
+        [&] {
+            server->force_disconnect();
+        });
+    std::string const contents(100000, 'a');
+    std::size_t received = 0;
+    server->set_publish_handler(
+        [&]
+        (std::uint8_t,
+         boost::optional<std::uint16_t>,
+         std::string topic,
+         std::string c) {
+            BOOST_TEST(topic == "topic1");
+            BOOST_TEST(c == contents);
+            ++received;
+            return true;
+        });
+    client->set_connack_handler(
+        [&]
+        (bool, std::uint8_t) {
+            client->publish_at_least_once("topic1", contents);
+            return true;
+        });
+    client->set_puback_handler(
+        [&]
+        (std::uint16_t) {
+            client->disconnect();
+            return true;
+        });
+    server->start_session();
+    client->start_session();
+    client->connect(0);
+    ios.run();
+    BOOST_TEST(received == 1U);
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( read_into ) {
+    boost::asio::io_service ios;
+    ws_t client(ios);
+    ws_t server(ios);
+    connect_pair(ios, client, server);
+
+    // Read a part of the message. The rest stays in the internal buffer.
+    server.write(boost::asio::buffer(std::string("abcdef")));
+    std::vector<char> some(2);
+    client.async_read_some(
+        boost::asio::buffer(some),
+        [&]
+        (boost::system::error_code const& ec, std::size_t size) {
+            BOOST_TEST(!ec);
+            BOOST_TEST(size == 2U);
+        });
+    ios.run();
+    ios.reset();
+    BOOST_TEST(std::string(some.begin(), some.end()) == "ab");
+
+    // The buffered data is read into buf. The handler is not called from async_read_into().
+    std::vector<char> buf(1, 'x');
+    bool returned = false;
+    std::size_t called = 0;
+    client.async_read_into(
+        buf,
+        buf.size(),
+        [&]
+        (boost::system::error_code const& ec, std::size_t size) {
+            BOOST_TEST(returned);
+            BOOST_TEST(!ec);
+            BOOST_TEST(size == 4U);
+            ++called;
+        });
+    returned = true;
+    BOOST_TEST(called == 0U);
+    ios.run();
+    ios.reset();
+    BOOST_TEST(called == 1U);
+    BOOST_TEST(std::string(buf.begin(), buf.end()) == "xcdef");
+
+    // The next message is read directly into buf.
+    server.write(boost::asio::buffer(std::string("ghi")));
+    client.async_read_into(
+        buf,
+        buf.size(),
+        [&]
+        (boost::system::error_code const& ec, std::size_t size) {
+            BOOST_TEST(!ec);
+            BOOST_TEST(size == 3U);
+            ++called;
+        });
+    ios.run();
+    BOOST_TEST(called == 2U);
+    BOOST_TEST(std::string(buf.begin(), buf.end()) == "xcdefghi");
+}
+
+BOOST_AUTO_TEST_CASE( permessage_deflate ) {
+    // Negotiated.
+    publish_over_ws(true, true);
+    // Offered by the client, but the server doesn't accept it.
+    publish_over_ws(true, false);
+    // Enabled only on the server, so the client doesn't offer it.
+    publish_over_ws(false, true);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif // defined(MQTT_USE_WS)